@@ -0,0 +1,19 @@
+# Check a CSIM simulation output (.so) file for errors. CSIM's exit status can't
+# be relied on to report vectors that don't match the simulated outputs, but
+# each mismatch gets a line in the output, e.g.
+#   [0004sa] user expected (L) for Q0
+# and other problems are reported as errors.
+#
+# Usage: cmake -DSO_FILE=<stem>.so -P checksim.cmake
+
+if(NOT EXISTS ${SO_FILE})
+    message(FATAL_ERROR "${SO_FILE}: CSIM produced no output")
+endif()
+
+file(STRINGS ${SO_FILE} problems REGEX "user expected|[Ee][Rr][Rr][Oo][Rr]")
+# Don't trip over a summary saying that there weren't any
+list(FILTER problems EXCLUDE REGEX "(^|[^0-9])0 [Ee][Rr][Rr][Oo][Rr][Ss]?")
+if(problems)
+    list(JOIN problems "\n" text)
+    message(FATAL_ERROR "Simulation failed, see ${SO_FILE}:\n${text}")
+endif()
@@ -0,0 +1,56 @@
+/*
+SEthernet and SEthernet/30 MacsBug dcmd
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Minimal definitions for writing MacsBug debugger commands (dcmds), from the
+MacsBug Reference and Debugging Guide. Retro68 doesn't ship the dcmd.h and
+dcmdGlue library from the MacsBug dcmd kit, so we provide our own. The callback
+glue lives in dcmdglue.S.
+*/
+
+#pragma once
+
+#include <MacTypes.h>
+
+/* dcmd request codes */
+enum {
+  dcmdInit = 0, /* dcmd has been loaded */
+  dcmdHelp = 1, /* Display help text */
+  dcmdDoIt = 2, /* Run the command */
+  dcmdEnd = 3   /* MacsBug is about to return to the system */
+};
+
+/* Parameter block passed to dcmd entrypoint */
+struct dcmdBlock {
+  long *registerFile; /* Saved registers (D0-D7, A0-A7) */
+  short request;      /* Request code */
+  Boolean aborted;    /* Set if the user hit Cmd-. during output */
+};
+typedef struct dcmdBlock dcmdBlock;
+
+/* Callbacks into MacsBug */
+
+/* Draw a line of text in the MacsBug output area */
+pascal void dcmdDrawLine(ConstStr255Param str);
+/* Read the next whitespace-delimited parameter from the command line. Returns
+the character that terminated the parameter. */
+pascal char dcmdGetNextParameter(Str255 str);
+/* Evaluate the next expression on the command line */
+pascal void dcmdGetNextExpression(long *value, Boolean *ok);
+/* Peek at the next character on the command line without consuming it */
+pascal char dcmdPeekAtNextChar(void);
@@ -0,0 +1,563 @@
+/*
+SEthernet and SEthernet/30 MacsBug dcmd
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+'sethernet' MacsBug dcmd
+
+Finds the globals of any loaded SEthernet drivers through the unit table and
+pretty-prints them, so that we don't have to pick apart raw memory dumps while
+the machine is stopped.
+
+Usage:
+  sethernet [info|ph|mc|ring|traffic|txlat|log [count]]
+
+With no arguments, prints everything except the event log.
+
+The dcmd is built against the driver's own headers, so it's always in sync
+with the layout of driverGlobals. The layout is the same for SE and SE/30
+builds, and for release and debug builds up to the event log (which only exists
+in debug builds, and is flagged by hasEventLog).
+*/
+
+#include <Devices.h>
+#include <MacTypes.h>
+#include <Retro68Runtime.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dcmd.h"
+#include "driver.h"
+#include "enc624j600.h"
+#include "enc624j600_registers.h"
+#include "txstats.h"
+
+/* Low-memory globals */
+#define UTableBase (*(DCtlHandle **)0x011c) /* Unit table */
+#define UnitNtryCnt (*(short *)0x01d2)      /* Number of unit table entries */
+
+/* Offset of driver name in DRVR header */
+#define drvrNameOffset 18
+
+/* Draw a printf-formatted line in the MacsBug output area */
+static void drawLine(const char *format, ...) {
+  static char strbuf[256];
+  va_list args;
+  int length;
+  va_start(args, format);
+  /* vsnprintf returns the length the whole line would have had, which may be
+  more than fits (or negative on error) */
+  length = vsnprintf(strbuf + 1, sizeof(strbuf) - 1, format, args);
+  va_end(args);
+  if (length < 0) {
+    length = 0;
+  } else if (length > 254) {
+    length = 254;
+  }
+  strbuf[0] = length;
+  dcmdDrawLine((unsigned char *)strbuf);
+}
+
+/* Compare a Pascal string against a C string */
+static Boolean pstrEqual(const unsigned char *pstr, const char *cstr) {
+  unsigned char i;
+  for (i = 0; i < pstr[0]; i++) {
+    if (cstr[i] == '\0' || pstr[i + 1] != (unsigned char)cstr[i]) {
+      return false;
+    }
+  }
+  return cstr[i] == '\0';
+}
+
+/* Check whether a unit table entry is one of our drivers, and return its
+globals if so */
+static driverGlobalsPtr findGlobals(DCtlHandle dceHandle) {
+  DCtlPtr dce;
+  unsigned char *driver;
+  driverGlobalsPtr theGlobals;
+
+  if (dceHandle == nil || *dceHandle == nil) {
+    return nil;
+  }
+  dce = *dceHandle;
+
+  /* dCtlDriver is a handle for RAM-based drivers, a pointer otherwise */
+  driver = (unsigned char *)dce->dCtlDriver;
+  if (driver == nil) {
+    return nil;
+  }
+  if (dce->dCtlFlags & dRAMBasedMask) {
+    driver = *(unsigned char **)driver;
+    if (driver == nil) {
+      return nil;
+    }
+  }
+
+  if (!pstrEqual(driver + drvrNameOffset, ".ENET") &&
+      !pstrEqual(driver + drvrNameOffset, ".ENET0")) {
+    return nil;
+  }
+
+  /* Other cards use the .ENET name too, check that these are our globals */
+  theGlobals = (driverGlobalsPtr)dce->dCtlStorage;
+  if (theGlobals == nil ||
+      theGlobals->signature != driverGlobalsSignature ||
+      (DCtlPtr)theGlobals->driverDCE != dce) {
+    return nil;
+  }
+  return theGlobals;
+}
+
+static const char *linkStateName(unsigned char state) {
+  switch (state) {
+    case LINK_DOWN:
+      return "down";
+    case LINK_10M:
+      return "10M half duplex";
+    case LINK_100M:
+      return "100M half duplex";
+    case LINK_10M_FULLDPX:
+      return "10M full duplex";
+    case LINK_100M_FULLDPX:
+      return "100M full duplex";
+    default:
+      return "?";
+  }
+}
+
+/* driverInfo counters, in display order */
+static const struct {
+  const char *name;
+  unsigned short offset;
+} infoFields[] = {
+  {"txFrameCount", offsetof(driverInfo, txFrameCount)},
+  {"singleCollisionFrames", offsetof(driverInfo, singleCollisionFrames)},
+  {"multiCollisionFrames", offsetof(driverInfo, multiCollisionFrames)},
+  {"collisionFrames", offsetof(driverInfo, collisionFrames)},
+  {"deferredFrames", offsetof(driverInfo, deferredFrames)},
+  {"lateCollisions", offsetof(driverInfo, lateCollisions)},
+  {"excessiveCollisions", offsetof(driverInfo, excessiveCollisions)},
+  {"excessiveDeferrals", offsetof(driverInfo, excessiveDeferrals)},
+  {"internalTxErrors", offsetof(driverInfo, internalTxErrors)},
+  {"rxFrameCount", offsetof(driverInfo, rxFrameCount)},
+  {"multicastRxFrameCount", offsetof(driverInfo, multicastRxFrameCount)},
+  {"broadcastRxFrameCount", offsetof(driverInfo, broadcastRxFrameCount)},
+  {"fcsErrors", offsetof(driverInfo, fcsErrors)},
+  {"alignmentErrors", offsetof(driverInfo, alignmentErrors)},
+  {"internalRxErrors", offsetof(driverInfo, internalRxErrors)},
+  {"rxPendingBytesHWM", offsetof(driverInfo, rxPendingBytesHWM)},
+  {"rxPendingPacketsHWM", offsetof(driverInfo, rxPendingPacketsHWM)},
+  {"rxBadLength", offsetof(driverInfo, rxBadLength)},
+  {"rxRunt", offsetof(driverInfo, rxRunt)},
+  {"rxTooLong", offsetof(driverInfo, rxTooLong)},
+  {"rxUnwanted", offsetof(driverInfo, rxUnwanted)},
+  {"rxUnknownProto", offsetof(driverInfo, rxUnknownProto)},
+  {"statsQueries", offsetof(driverInfo, statsQueries)},
+  {"statsReplies", offsetof(driverInfo, statsReplies)},
+  {"statsRejected", offsetof(driverInfo, statsRejected)},
+  {"statsDropped", offsetof(driverInfo, statsDropped)},
+  {"bridgeForwarded", offsetof(driverInfo, bridgeForwarded)},
+  {"bridgeFlooded", offsetof(driverInfo, bridgeFlooded)},
+  {"bridgeFiltered", offsetof(driverInfo, bridgeFiltered)},
+  {"bridgeDropped", offsetof(driverInfo, bridgeDropped)},
+  {"bridgeStalls", offsetof(driverInfo, bridgeStalls)},
+  {"bridgeTxFrames", offsetof(driverInfo, bridgeTxFrames)},
+  {"rxSelfDropped", offsetof(driverInfo, rxSelfDropped)},
+  {"txLoopback", offsetof(driverInfo, txLoopback)},
+  {"copyReadKernel", offsetof(driverInfo, copyReadKernel)},
+  {"copyWriteKernel", offsetof(driverInfo, copyWriteKernel)},
+  {"copyReadTimeBlockMove", offsetof(driverInfo, copyReadTime[0])},
+  {"copyReadTimeBytes", offsetof(driverInfo, copyReadTime[1])},
+  {"copyReadTimeWords", offsetof(driverInfo, copyReadTime[2])},
+  {"copyReadTimeLongs", offsetof(driverInfo, copyReadTime[3])},
+  {"copyReadTimeMovem", offsetof(driverInfo, copyReadTime[4])},
+  {"copyWriteTimeBlockMove", offsetof(driverInfo, copyWriteTime[0])},
+  {"copyWriteTimeBytes", offsetof(driverInfo, copyWriteTime[1])},
+  {"copyWriteTimeWords", offsetof(driverInfo, copyWriteTime[2])},
+  {"copyWriteTimeLongs", offsetof(driverInfo, copyWriteTime[3])},
+  {"copyWriteTimeMovem", offsetof(driverInfo, copyWriteTime[4])},
+  {"duplexMismatch", offsetof(driverInfo, duplexMismatch)},
+  {"duplexMismatchEvents", offsetof(driverInfo, duplexMismatchEvents)},
+  {"duplexRemediations", offsetof(driverInfo, duplexRemediations)},
+  {"pauseRxFrames", offsetof(driverInfo, pauseRxFrames)},
+  {"pauseTxAsserts", offsetof(driverInfo, pauseTxAsserts)},
+  {"rxBufferSize", offsetof(driverInfo, rxBufferSize)},
+  {"tapFiltered", offsetof(driverInfo, tapFiltered)},
+  {"tapAccepted", offsetof(driverInfo, tapAccepted)},
+  {"scsiDeferrals", offsetof(driverInfo, scsiDeferrals)},
+  {"scsiDeferTimeouts", offsetof(driverInfo, scsiDeferTimeouts)},
+  {"housekeepingRuns", offsetof(driverInfo, housekeepingRuns)},
+  {"housekeepingTimerRuns", offsetof(driverInfo, housekeepingTimerRuns)},
+  {"missedLinkChanges", offsetof(driverInfo, missedLinkChanges)},
+  {"sramBytesTested", offsetof(driverInfo, sramBytesTested)},
+  {"sramErrors", offsetof(driverInfo, sramErrors)},
+  {"immediateWrites", offsetof(driverInfo, immediateWrites)},
+  {"immediateWritesRejected", offsetof(driverInfo, immediateWritesRejected)},
+  {"txCompletedInDrain", offsetof(driverInfo, txCompletedInDrain)},
+};
+
+static void showInfo(const driverGlobalsPtr theGlobals) {
+  const Byte *addr = theGlobals->info.ethernetAddress;
+  driverInfo infoCopy = theGlobals->info;
+  unsigned long folded[numTxOutcomes];
+  const Byte *info = (const Byte *)&infoCopy;
+  const unsigned short numFields = sizeof(infoFields) / sizeof(infoFields[0]);
+  unsigned short i;
+
+  /* Transmit counters are only brought up to date when read. Do it on a copy,
+  so that we don't modify the driver's state from the debugger. */
+  memcpy(folded, theGlobals->txOutcomesFolded, sizeof(folded));
+  foldTxOutcomes(theGlobals->txOutcomes, folded, &infoCopy);
+
+  drawLine("  Address %02x:%02x:%02x:%02x:%02x:%02x  Link %s", addr[0],
+           addr[1], addr[2], addr[3], addr[4], addr[5],
+           linkStateName(theGlobals->chip.link_state));
+  /* Two counters per line */
+  for (i = 0; i < numFields; i += 2) {
+    unsigned long value1 = *(const unsigned long *)(info + infoFields[i].offset);
+    if (i + 1 < numFields) {
+      unsigned long value2 =
+          *(const unsigned long *)(info + infoFields[i + 1].offset);
+      drawLine("  %-22s %10lu  %-22s %10lu", infoFields[i].name, value1,
+               infoFields[i + 1].name, value2);
+    } else {
+      drawLine("  %-22s %10lu", infoFields[i].name, value1);
+    }
+  }
+}
+
+static void showProtocolHandlers(const driverGlobalsPtr theGlobals) {
+  unsigned short i;
+  drawLine("  Protocol handlers:");
+  for (i = 0; i < numberOfPhs; i++) {
+    const protocolHandlerEntry *ph = &theGlobals->protocolHandlers[i];
+    if (ph->ethertype == phProtocolFree) {
+      continue;
+    }
+    if (ph->ethertype == phProtocolPhaseII) {
+      drawLine("    [%2u] 802.2    handler %08lx", i,
+               (unsigned long)ph->handler);
+    } else {
+      drawLine("    [%2u] %04x     handler %08lx", i, ph->ethertype,
+               (unsigned long)ph->handler);
+    }
+  }
+}
+
+static void showMulticasts(const driverGlobalsPtr theGlobals) {
+  unsigned short i;
+  drawLine("  Multicast addresses:");
+  for (i = 0; i < numberofMulticasts; i++) {
+    const multicastEntry *mc = &theGlobals->multicasts[i];
+    if (mc->refCount == 0) {
+      continue;
+    }
+    drawLine("    [%u] %02x:%02x:%02x:%02x:%02x:%02x  refs %u", i,
+             mc->address.bytes[0], mc->address.bytes[1], mc->address.bytes[2],
+             mc->address.bytes[3], mc->address.bytes[4], mc->address.bytes[5],
+             mc->refCount);
+  }
+}
+
+static void showDMA(const enc624j600_dma_queue *dma) {
+  static const char * const opNames[DMA_NUM_OPS] = {
+    "copy", "checksum", "copy+checksum"
+  };
+  const enc624j600_dma_stats *stats = &dma->stats;
+  unsigned short i;
+
+  drawLine("  DMA: depth %u (max %u)  busy %lu us%s", stats->depth,
+           stats->max_depth, stats->busy_time,
+           dma->clock ? "" : " (not timed)");
+  for (i = 0; i < DMA_NUM_OPS; i++) {
+    if (stats->ops[i] == 0) {
+      continue;
+    }
+    drawLine("    %-14s %10lu ops  avg %lu us  max %lu us", opNames[i],
+             stats->ops[i], stats->latency[i] / stats->ops[i],
+             stats->max_latency[i]);
+  }
+}
+
+static void showRing(const driverGlobalsPtr theGlobals) {
+  const enc624j600 *chip = &theGlobals->chip;
+  unsigned short start = enc624j600_ptr_to_addr(chip, chip->rxbuf_start);
+  unsigned short end = enc624j600_ptr_to_addr(chip, chip->rxbuf_end);
+  unsigned short rxptr = enc624j600_ptr_to_addr(chip, chip->rxptr);
+  unsigned short tail =
+      SWAPBYTES(ENC624J600_READ_REG(chip->base_address, ERXTAIL));
+  unsigned short head =
+      SWAPBYTES(ENC624J600_READ_REG(chip->base_address, ERXHEAD));
+  unsigned short size = end - start;
+  unsigned short unread = (head + size - rxptr) % size;
+
+  drawLine("  Receive ring %04x-%04x (%u bytes)", start, end, size);
+  drawLine("    rxptr %04x  ERXTAIL %04x  ERXHEAD %04x  unread %u bytes",
+           rxptr, tail, head, unread);
+  /* ERXTAIL should always sit just behind our read pointer */
+  if (tail != (rxptr == start ? end : rxptr) - 2) {
+    drawLine("    ERXTAIL is not 2 bytes behind rxptr!");
+  }
+  drawLine("  Transmit: active %u  host queued %u (%u bytes)"
+           "  driver queued %u (%u bytes)",
+           theGlobals->txActive, theGlobals->txHostQueued,
+           theGlobals->txHostLength, theGlobals->txDriverQueued,
+           theGlobals->txDriverLength);
+  showDMA(&chip->dma);
+}
+
+static void showTraffic(const driverGlobalsPtr theGlobals) {
+  static const char * const bucketNames[numSizeBuckets] = {
+    "64", "65-127", "128-255", "256-511", "512-1023", "1024-1518"
+  };
+  const trafficStats *traffic = &theGlobals->traffic;
+  const linkRates *rates = &theGlobals->link.rates;
+  unsigned short i;
+
+  if (rates->linkSpeed) {
+    drawLine("  Link %u Mb/s %s duplex, %u.%02u%% utilised", rates->linkSpeed,
+             rates->fullDuplex ? "full" : "half", rates->utilisation / 100,
+             rates->utilisation % 100);
+  } else {
+    drawLine("  Link down");
+  }
+  drawLine("  Rates              rx         tx");
+  drawLine("    %-10s %10lu %10lu", "frames/s", rates->rxPacketRate,
+           rates->txPacketRate);
+  drawLine("    %-10s %10lu %10lu", "bytes/s", rates->rxByteRate,
+           rates->txByteRate);
+  drawLine("    %-10s %7u.%02u %7u.%02u", "% of link",
+           rates->rxUtilisation / 100, rates->rxUtilisation % 100,
+           rates->txUtilisation / 100, rates->txUtilisation % 100);
+
+  drawLine("  Frame sizes        rx         tx");
+  for (i = 0; i < numSizeBuckets; i++) {
+    drawLine("    %-10s %10lu %10lu", bucketNames[i], traffic->rxSizes[i],
+             traffic->txSizes[i]);
+  }
+
+  drawLine("  Top broadcast/multicast senders:");
+  for (i = 0; i < numTopTalkers; i++) {
+    const topTalker *talker = &traffic->talkers[i];
+    if (talker->frames == 0) {
+      continue;
+    }
+    drawLine("    %02x:%02x:%02x:%02x:%02x:%02x  %10lu", talker->address[0],
+             talker->address[1], talker->address[2], talker->address[3],
+             talker->address[4], talker->address[5], talker->frames);
+  }
+}
+
+static void showTxLatency(const driverGlobalsPtr theGlobals) {
+  const txLatencyStats *latency = &theGlobals->txLatency;
+  unsigned short i;
+
+  if (!theGlobals->hasTxLatency) {
+    drawLine("  Transmit latency not measured (needs a TX_LATENCY build)");
+    return;
+  }
+
+  drawLine("  Transmit latency (us) %9s %9s %9s %9s", "copy", "queue", "wire",
+           "total");
+  for (i = 0; i < numTxLatencyBuckets; i++) {
+    const unsigned long from = i ? 1UL << i : 0;
+    drawLine("    %7lu and up      %9lu %9lu %9lu %9lu", from,
+             latency->buckets[txLatencyCopy][i],
+             latency->buckets[txLatencyQueue][i],
+             latency->buckets[txLatencyWire][i],
+             latency->buckets[txLatencyTotal][i]);
+  }
+}
+
+static const char *eventName(unsigned short eventType) {
+  switch (eventType) {
+    case txEvent:
+      return "tx";
+    case txCompleteEvent:
+      return "txComplete";
+    case txCallIODoneEvent:
+      return "txCallIODone";
+    case txReturnIODoneEvent:
+      return "txReturnIODone";
+    case txTaskAlreadyDeferred:
+      return "txTaskAlreadyDeferred";
+    case txTaskAlreadyDeferredReturn:
+      return "txTaskAlreadyDeferredReturn";
+    case txDriverEvent:
+      return "txDriver";
+    case txLoopbackEvent:
+      return "txLoopback";
+    case txReplyEvent:
+      return "txReply";
+    case rxEvent:
+      return "rx";
+    case rxDoneEvent:
+      return "rxDone";
+    case readRxBufEvent:
+      return "readRxBuf";
+    default:
+      return "?";
+  }
+}
+
+/* Decode the most recent count entries of the event log, oldest first */
+static void showLog(const driverGlobalsPtr theGlobals, unsigned long count,
+                    const dcmdBlock *pb) {
+  const eventLog *log = &theGlobals->log;
+  unsigned long i;
+  unsigned long index;
+  unsigned long lastTicks = 0;
+  Boolean first = true;
+
+  if (!theGlobals->hasEventLog) {
+    drawLine("  No event log (not a debug build)");
+    return;
+  }
+
+  if (count > LOG_LEN - 1) {
+    count = LOG_LEN - 1;
+  }
+
+  drawLine("  Event log (head %lu):", log->head);
+  drawLine("       ticks   delta  event                        data");
+  /* The head entry is the end-of-log marker, start count entries behind it */
+  index = (log->head + LOG_LEN - count) % LOG_LEN;
+  for (i = 0; i < count && !pb->aborted; i++) {
+    const logEntry *entry = &log->entries[index];
+    index = (index + 1) % LOG_LEN;
+
+    /* Skip entries that haven't been written yet */
+    if (entry->eventType == 0) {
+      continue;
+    }
+
+    drawLine("  %10lu %7ld  %-28s %04x", entry->ticks,
+             first ? 0 : (long)(entry->ticks - lastTicks),
+             eventName(entry->eventType), entry->eventData);
+    lastTicks = entry->ticks;
+    first = false;
+  }
+}
+
+enum {
+  showInfoFlag = 1,
+  showPHFlag = 2,
+  showMCFlag = 4,
+  showRingFlag = 8,
+  showLogFlag = 16,
+  showTrafficFlag = 32,
+  showTxLatencyFlag = 64
+};
+
+static void doIt(const dcmdBlock *pb) {
+  Str255 param;
+  unsigned short what;
+  unsigned long logCount = 32;
+  short unit;
+  Boolean found = false;
+
+  dcmdGetNextParameter(param);
+  if (param[0] == 0) {
+    what = showInfoFlag | showPHFlag | showMCFlag | showRingFlag |
+           showTrafficFlag;
+  } else if (pstrEqual(param, "info")) {
+    what = showInfoFlag;
+  } else if (pstrEqual(param, "ph")) {
+    what = showPHFlag;
+  } else if (pstrEqual(param, "mc")) {
+    what = showMCFlag;
+  } else if (pstrEqual(param, "ring")) {
+    what = showRingFlag;
+  } else if (pstrEqual(param, "traffic")) {
+    what = showTrafficFlag;
+  } else if (pstrEqual(param, "txlat")) {
+    what = showTxLatencyFlag;
+  } else if (pstrEqual(param, "log")) {
+    what = showLogFlag;
+    if (dcmdPeekAtNextChar() != '\r') {
+      long value;
+      Boolean ok;
+      dcmdGetNextExpression(&value, &ok);
+      if (ok && value > 0) {
+        logCount = value;
+      }
+    }
+  } else {
+    drawLine("Unknown option. Type 'help sethernet' for usage.");
+    return;
+  }
+
+  for (unit = 0; unit < UnitNtryCnt && !pb->aborted; unit++) {
+    driverGlobalsPtr theGlobals = findGlobals(UTableBase[unit]);
+    if (theGlobals == nil) {
+      continue;
+    }
+    found = true;
+
+    drawLine("SEthernet unit %d (refnum %d) slot %d, globals at %08lx", unit,
+             ~unit, theGlobals->driverDCE->dCtlSlot,
+             (unsigned long)theGlobals);
+    if (what & showInfoFlag) {
+      showInfo(theGlobals);
+    }
+    if (what & showPHFlag) {
+      showProtocolHandlers(theGlobals);
+    }
+    if (what & showMCFlag) {
+      showMulticasts(theGlobals);
+    }
+    if (what & showRingFlag) {
+      showRing(theGlobals);
+    }
+    if (what & showTrafficFlag) {
+      showTraffic(theGlobals);
+    }
+    if (what & showTxLatencyFlag) {
+      showTxLatency(theGlobals);
+    }
+    if (what & showLogFlag) {
+      showLog(theGlobals, logCount, pb);
+    }
+  }
+
+  if (!found) {
+    drawLine("No SEthernet driver found");
+  }
+}
+
+/* dcmd entrypoint, see dcmdglue.S */
+pascal void dcmdEntry(dcmdBlock *pb) {
+  RETRO68_RELOCATE();
+
+  switch (pb->request) {
+    case dcmdInit:
+    case dcmdEnd:
+      break;
+    case dcmdHelp:
+      drawLine("sethernet [info|ph|mc|ring|traffic|txlat|log [n]]");
+      drawLine("  Display SEthernet driver state. With no arguments, shows"
+               " everything except");
+      drawLine("  the event log. 'log' shows the last n (default 32) events"
+               " (debug builds only).");
+      break;
+    case dcmdDoIt:
+      doIt(pb);
+      break;
+  }
+}
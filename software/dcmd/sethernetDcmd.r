@@ -0,0 +1,35 @@
+/*
+SEthernet and SEthernet/30 MacsBug dcmd
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Retro68.r"
+#include "Types.r"
+#include "version.h"
+
+/* Install by copying the dcmd resource into the 'Debugger Prefs' file in the
+System Folder */
+data 'dcmd' (128, "sethernet") {
+    $$read("sethernetDcmd.resource")
+};
+
+resource 'vers' (1, purgeable) {
+    VERSION_MAJOR, VERSION_MINOR;
+    VERSION_DEVSTAGE, VERSION_INTERNAL_ID;
+    0;
+    VERSION_SHORT;
+    VERSION_LONG;
+};
@@ -0,0 +1,453 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Errors.h>
+#include <MacTypes.h>
+#include <Memory.h>
+
+#include "bpf.h"
+#include "util.h"
+
+#include <string.h>
+
+#define likely(x)    __builtin_expect (!!(x), 1)
+#define unlikely(x)  __builtin_expect (!!(x), 0)
+
+/*
+Classic BPF filter programs for monitoring taps (see tap.c)
+
+Programs are checked when they are attached, so that neither the interpreter
+nor the compiled code has to check anything but packet bounds at run time:
+every instruction must be valid, jumps must stay within the program (they can
+only go forwards, so every program terminates), and the last instruction must
+be a return. Division by a constant zero, and shifts by a constant of 32 or
+more, are rejected too.
+*/
+
+/* Check that a program is valid, and find which scratch memory words it loads
+from */
+static OSErr bpfValidate(const bpfInsn *prog, unsigned short length,
+                         unsigned short *memLoaded) {
+  unsigned short i;
+  unsigned short remaining;
+  const bpfInsn *insn;
+
+  *memLoaded = 0;
+  if (length == 0 || length > bpfMaxInsns) {
+    return paramErr;
+  }
+
+  for (i = 0; i < length; i++) {
+    insn = &prog[i];
+    /* Instructions after this one, i.e. the furthest a jump can go */
+    remaining = length - i - 1;
+
+    switch (BPF_CLASS(insn->code)) {
+      case BPF_LD:
+      case BPF_LDX:
+        switch (BPF_MODE(insn->code)) {
+          case BPF_IMM:
+          case BPF_LEN:
+            if (BPF_SIZE(insn->code) != BPF_W) {
+              return paramErr;
+            }
+            break;
+          case BPF_MEM:
+            if (BPF_SIZE(insn->code) != BPF_W || insn->k >= bpfMemWords) {
+              return paramErr;
+            }
+            *memLoaded |= 1 << insn->k;
+            break;
+          case BPF_ABS:
+          case BPF_IND:
+            if (BPF_CLASS(insn->code) != BPF_LD ||
+                BPF_SIZE(insn->code) == 0x18) {
+              return paramErr;
+            }
+            break;
+          case BPF_MSH:
+            if (insn->code != (BPF_LDX | BPF_B | BPF_MSH)) {
+              return paramErr;
+            }
+            break;
+          default:
+            return paramErr;
+        }
+        break;
+
+      case BPF_ST:
+      case BPF_STX:
+        if (insn->code & 0xf8 || insn->k >= bpfMemWords) {
+          return paramErr;
+        }
+        break;
+
+      case BPF_ALU:
+        switch (BPF_OP(insn->code)) {
+          case BPF_ADD:
+          case BPF_SUB:
+          case BPF_MUL:
+          case BPF_OR:
+          case BPF_AND:
+          case BPF_XOR:
+            break;
+          case BPF_DIV:
+          case BPF_MOD:
+            if (BPF_SRC(insn->code) == BPF_K && insn->k == 0) {
+              return paramErr;
+            }
+            break;
+          case BPF_LSH:
+          case BPF_RSH:
+            if (BPF_SRC(insn->code) == BPF_K && insn->k >= 32) {
+              return paramErr;
+            }
+            break;
+          case BPF_NEG:
+            if (BPF_SRC(insn->code) != BPF_K) {
+              return paramErr;
+            }
+            break;
+          default:
+            return paramErr;
+        }
+        break;
+
+      case BPF_JMP:
+        switch (BPF_OP(insn->code)) {
+          case BPF_JA:
+            if (BPF_SRC(insn->code) != BPF_K || insn->k >= remaining) {
+              return paramErr;
+            }
+            break;
+          case BPF_JEQ:
+          case BPF_JGT:
+          case BPF_JGE:
+          case BPF_JSET:
+            if (insn->jt >= remaining || insn->jf >= remaining) {
+              return paramErr;
+            }
+            break;
+          default:
+            return paramErr;
+        }
+        break;
+
+      case BPF_RET:
+        if (insn->code != (BPF_RET | BPF_K) &&
+            insn->code != (BPF_RET | BPF_A)) {
+          return paramErr;
+        }
+        break;
+
+      case BPF_MISC:
+        if (insn->code != (BPF_MISC | BPF_TAX) &&
+            insn->code != (BPF_MISC | BPF_TXA)) {
+          return paramErr;
+        }
+        break;
+    }
+  }
+
+  if (BPF_CLASS(prog[length - 1].code) != BPF_RET) {
+    return paramErr;
+  }
+  return noErr;
+}
+
+/* Validate a filter program and make a copy of it for the driver to use,
+compiling it if asked to. If compilation fails, the filter is interpreted. */
+bpfFilter *bpfCreate(const bpfInsn *prog, unsigned short length,
+                     Boolean compile, Boolean vmEnabled, OSErr *error) {
+  bpfFilter *filter;
+  unsigned short memLoaded;
+  unsigned long size;
+
+  *error = bpfValidate(prog, length, &memLoaded);
+  if (*error != noErr) {
+    return nil;
+  }
+
+  size = sizeof(bpfFilter) + length * sizeof(bpfInsn);
+  filter = (bpfFilter *)NewPtrSysClear(size);
+  if (filter == nil) {
+    *error = MemError();
+    return nil;
+  }
+  BlockMoveData(prog, filter->prog, length * sizeof(bpfInsn));
+  filter->length = length;
+  filter->memLoaded = memLoaded;
+
+  if (compile) {
+    filter->jit = bpfCompile(filter, &filter->codeSize);
+  }
+
+  if (vmEnabled) {
+    /* Used at interrupt time, keep it resident */
+    HoldMemory(filter, size);
+    if (filter->jit != nil) {
+      HoldMemory((Ptr)filter->jit, filter->codeSize);
+    }
+  }
+  return filter;
+}
+
+/* Dispose of a filter made by bpfCreate() */
+void bpfDispose(bpfFilter *filter, Boolean vmEnabled) {
+  if (vmEnabled) {
+    UnholdMemory(filter, sizeof(bpfFilter) + filter->length * sizeof(bpfInsn));
+    if (filter->jit != nil) {
+      UnholdMemory((Ptr)filter->jit, filter->codeSize);
+    }
+  }
+  if (filter->jit != nil) {
+    DisposePtr((Ptr)filter->jit);
+  }
+  DisposePtr((Ptr)filter);
+}
+
+/* Load a big-endian value from a packet. The packet may be in chip memory, so
+read it a byte at a time rather than risk a misaligned access. */
+static inline unsigned long loadWord(const Byte *p) {
+  return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+         ((unsigned short)p[2] << 8) | p[3];
+}
+
+static inline unsigned long loadHalf(const Byte *p) {
+  return ((unsigned short)p[0] << 8) | p[1];
+}
+
+/*
+Run a filter program, for filters that aren't compiled
+
+Loads check that they are within the first bufLen bytes of the packet, and
+return 0 if not. k and X are unsigned, so a single comparison against bufLen
+minus the load size covers offsets that would wrap around too.
+*/
+unsigned long bpfInterpret(bpfFilter *filter, const Byte *packet,
+                           unsigned long wireLen, unsigned long bufLen) {
+  const bpfInsn *insn = filter->prog;
+  unsigned long a = 0;
+  unsigned long x = 0;
+  unsigned long k;
+  unsigned long *mem = filter->mem;
+  unsigned short i;
+
+  if (unlikely(filter->memLoaded)) {
+    for (i = 0; i < bpfMemWords; i++) {
+      if (filter->memLoaded & (1 << i)) {
+        mem[i] = 0;
+      }
+    }
+  }
+
+  for (;; insn++) {
+    switch (insn->code) {
+      case BPF_RET | BPF_K:
+        return insn->k;
+      case BPF_RET | BPF_A:
+        return a;
+
+      case BPF_LD | BPF_W | BPF_ABS:
+        k = insn->k;
+        if (k + 4 < k || k + 4 > bufLen) {
+          return 0;
+        }
+        a = loadWord(packet + k);
+        break;
+      case BPF_LD | BPF_H | BPF_ABS:
+        k = insn->k;
+        if (k + 2 < k || k + 2 > bufLen) {
+          return 0;
+        }
+        a = loadHalf(packet + k);
+        break;
+      case BPF_LD | BPF_B | BPF_ABS:
+        k = insn->k;
+        if (k >= bufLen) {
+          return 0;
+        }
+        a = packet[k];
+        break;
+
+      case BPF_LD | BPF_W | BPF_IND:
+        k = x + insn->k;
+        if (k < x || k + 4 < k || k + 4 > bufLen) {
+          return 0;
+        }
+        a = loadWord(packet + k);
+        break;
+      case BPF_LD | BPF_H | BPF_IND:
+        k = x + insn->k;
+        if (k < x || k + 2 < k || k + 2 > bufLen) {
+          return 0;
+        }
+        a = loadHalf(packet + k);
+        break;
+      case BPF_LD | BPF_B | BPF_IND:
+        k = x + insn->k;
+        if (k < x || k >= bufLen) {
+          return 0;
+        }
+        a = packet[k];
+        break;
+
+      case BPF_LD | BPF_W | BPF_LEN:
+        a = wireLen;
+        break;
+      case BPF_LDX | BPF_W | BPF_LEN:
+        x = wireLen;
+        break;
+      case BPF_LD | BPF_IMM:
+        a = insn->k;
+        break;
+      case BPF_LDX | BPF_IMM:
+        x = insn->k;
+        break;
+      case BPF_LD | BPF_MEM:
+        a = mem[insn->k];
+        break;
+      case BPF_LDX | BPF_MEM:
+        x = mem[insn->k];
+        break;
+      case BPF_LDX | BPF_B | BPF_MSH:
+        k = insn->k;
+        if (k >= bufLen) {
+          return 0;
+        }
+        x = (packet[k] & 0x0f) << 2;
+        break;
+
+      case BPF_ST:
+        mem[insn->k] = a;
+        break;
+      case BPF_STX:
+        mem[insn->k] = x;
+        break;
+
+      case BPF_JMP | BPF_JA:
+        insn += insn->k;
+        break;
+      case BPF_JMP | BPF_JEQ | BPF_K:
+        insn += (a == insn->k) ? insn->jt : insn->jf;
+        break;
+      case BPF_JMP | BPF_JGT | BPF_K:
+        insn += (a > insn->k) ? insn->jt : insn->jf;
+        break;
+      case BPF_JMP | BPF_JGE | BPF_K:
+        insn += (a >= insn->k) ? insn->jt : insn->jf;
+        break;
+      case BPF_JMP | BPF_JSET | BPF_K:
+        insn += (a & insn->k) ? insn->jt : insn->jf;
+        break;
+      case BPF_JMP | BPF_JEQ | BPF_X:
+        insn += (a == x) ? insn->jt : insn->jf;
+        break;
+      case BPF_JMP | BPF_JGT | BPF_X:
+        insn += (a > x) ? insn->jt : insn->jf;
+        break;
+      case BPF_JMP | BPF_JGE | BPF_X:
+        insn += (a >= x) ? insn->jt : insn->jf;
+        break;
+      case BPF_JMP | BPF_JSET | BPF_X:
+        insn += (a & x) ? insn->jt : insn->jf;
+        break;
+
+      case BPF_ALU | BPF_ADD | BPF_K:
+        a += insn->k;
+        break;
+      case BPF_ALU | BPF_SUB | BPF_K:
+        a -= insn->k;
+        break;
+      case BPF_ALU | BPF_MUL | BPF_K:
+        a *= insn->k;
+        break;
+      case BPF_ALU | BPF_DIV | BPF_K:
+        a /= insn->k;
+        break;
+      case BPF_ALU | BPF_MOD | BPF_K:
+        a %= insn->k;
+        break;
+      case BPF_ALU | BPF_OR | BPF_K:
+        a |= insn->k;
+        break;
+      case BPF_ALU | BPF_AND | BPF_K:
+        a &= insn->k;
+        break;
+      case BPF_ALU | BPF_XOR | BPF_K:
+        a ^= insn->k;
+        break;
+      case BPF_ALU | BPF_LSH | BPF_K:
+        a <<= insn->k;
+        break;
+      case BPF_ALU | BPF_RSH | BPF_K:
+        a >>= insn->k;
+        break;
+      case BPF_ALU | BPF_ADD | BPF_X:
+        a += x;
+        break;
+      case BPF_ALU | BPF_SUB | BPF_X:
+        a -= x;
+        break;
+      case BPF_ALU | BPF_MUL | BPF_X:
+        a *= x;
+        break;
+      case BPF_ALU | BPF_DIV | BPF_X:
+        if (x == 0) {
+          return 0;
+        }
+        a /= x;
+        break;
+      case BPF_ALU | BPF_MOD | BPF_X:
+        if (x == 0) {
+          return 0;
+        }
+        a %= x;
+        break;
+      case BPF_ALU | BPF_OR | BPF_X:
+        a |= x;
+        break;
+      case BPF_ALU | BPF_AND | BPF_X:
+        a &= x;
+        break;
+      case BPF_ALU | BPF_XOR | BPF_X:
+        a ^= x;
+        break;
+      case BPF_ALU | BPF_LSH | BPF_X:
+        a = (x < 32) ? a << x : 0;
+        break;
+      case BPF_ALU | BPF_RSH | BPF_X:
+        a = (x < 32) ? a >> x : 0;
+        break;
+      case BPF_ALU | BPF_NEG:
+        a = -a;
+        break;
+
+      case BPF_MISC | BPF_TAX:
+        x = a;
+        break;
+      case BPF_MISC | BPF_TXA:
+        a = x;
+        break;
+
+      default:
+        /* Can't happen, the program has been validated */
+        return 0;
+    }
+  }
+}
@@ -0,0 +1,60 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <MacTypes.h>
+
+#include "sethernet.h"
+
+/* Compiled filter. Called from C with the usual stack-based calling
+convention. */
+typedef unsigned long (*bpfJitProc)(const Byte *packet, unsigned long wireLen,
+                                    unsigned long bufLen, unsigned long *mem);
+
+/* A validated filter program, and its compiled form if any */
+struct bpfFilter {
+  bpfJitProc jit;                 /* Compiled code, nil to interpret */
+  unsigned long codeSize;         /* Size of compiled code */
+  unsigned short length;          /* Number of instructions */
+  unsigned short memLoaded;       /* Bitmap of scratch memory words that are
+                                     loaded from (and so must be cleared) */
+  unsigned long mem[bpfMemWords]; /* Scratch memory */
+  bpfInsn prog[];                 /* Program */
+};
+typedef struct bpfFilter bpfFilter;
+
+bpfFilter *bpfCreate(const bpfInsn *prog, unsigned short length,
+                     Boolean compile, Boolean vmEnabled, OSErr *error);
+void bpfDispose(bpfFilter *filter, Boolean vmEnabled);
+unsigned long bpfInterpret(bpfFilter *filter, const Byte *packet,
+                           unsigned long wireLen, unsigned long bufLen);
+
+/* JIT compiler, see bpfjit.c */
+bpfJitProc bpfCompile(const bpfFilter *filter, unsigned long *codeSize);
+
+/* Run a filter over a packet. Only the first bufLen bytes of the packet (which
+is wireLen bytes long) are available. */
+static inline unsigned long bpfRun(bpfFilter *filter, const Byte *packet,
+                                   unsigned long wireLen,
+                                   unsigned long bufLen) {
+  if (filter->jit != nil) {
+    return filter->jit(packet, wireLen, bufLen, filter->mem);
+  }
+  return bpfInterpret(filter, packet, wireLen, bufLen);
+}
@@ -0,0 +1,601 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <MacTypes.h>
+#include <Memory.h>
+#include <OSUtils.h>
+#include <Traps.h>
+
+#include "bpf.h"
+#include "util.h"
+
+/*
+Filter compiler
+
+Translates a validated filter program into 68000 code (using the 68020+ 32-bit
+multiply and divide instructions in SE/30 builds), called as a bpfJitProc.
+Registers are allocated as:
+
+  D0: A (accumulator)           A0: packet
+  D1: X (index register)        A1: scratch memory
+  D2: number of bytes of packet available
+  D3: length of packet on the wire
+  D4: temporary
+
+Code is generated in two passes. The first pass just measures the code, to find
+where each instruction starts; the second generates it. All branches are
+16-bit, so their size doesn't depend on how far they go.
+
+Every packet load is checked against the number of bytes available, branching
+to a common exit that returns 0 if it is out of bounds. Packets are word-aligned
+in chip memory, so halfword and word loads from even offsets can be done
+directly. Anything else is loaded a byte at a time, since the 68000 can't do
+misaligned accesses.
+*/
+
+/* Registers */
+enum { regA = 0, regX = 1, regBufLen = 2, regWireLen = 3, regTmp = 4 };
+
+/* Condition codes for Bcc */
+enum {
+  ccT = 0x0,  /* BRA */
+  ccHI = 0x2,
+  ccLS = 0x3,
+  ccCC = 0x4,
+  ccCS = 0x5,
+  ccNE = 0x6,
+  ccEQ = 0x7
+};
+
+/* Largest packet offset that can be addressed with a 16-bit displacement. No
+packet is anywhere near this long, so loads beyond it always fail. */
+#define maxDisplacement 0x7ff0
+
+/* Limit on code size, so that branches can reach anywhere in it */
+#define maxCodeSize 0x7f00
+
+typedef struct {
+  unsigned short *code;     /* Code buffer, nil when measuring */
+  unsigned short pos;       /* Current position (words) */
+  unsigned short *offsets;  /* Start of each instruction (words); the entry
+                               after the last instruction is the return-0
+                               exit */
+  unsigned short exit;      /* Index of return-0 exit in offsets */
+} jitState;
+
+/* Helpers for 32-bit multiply and divide on the 68000, called from compiled
+code */
+#if !defined(TARGET_SE30)
+static unsigned long bpfMultiply(unsigned long a, unsigned long b) {
+  return a * b;
+}
+
+static unsigned long bpfDivide(unsigned long a, unsigned long b) {
+  return a / b;
+}
+
+static unsigned long bpfModulo(unsigned long a, unsigned long b) {
+  return a % b;
+}
+#endif
+
+static void emit(jitState *s, unsigned short word) {
+  if (s->code != nil) {
+    s->code[s->pos] = word;
+  }
+  s->pos++;
+}
+
+static void emit32(jitState *s, unsigned long value) {
+  emit(s, value >> 16);
+  emit(s, value & 0xffff);
+}
+
+/* Bcc.W to the start of a program instruction (or the exit) */
+static void emitBranch(jitState *s, unsigned short cc, unsigned short target) {
+  unsigned short from = s->pos + 1;
+  emit(s, 0x6000 | (cc << 8));
+  /* Displacement is relative to the extension word. Offsets aren't known yet
+  when measuring. */
+  emit(s, s->code != nil ? (s->offsets[target] - from) * 2 : 0);
+}
+
+/* Load a constant into a data register */
+static void emitLoadImm(jitState *s, unsigned short reg, unsigned long value) {
+  if ((long)value >= -128 && (long)value <= 127) {
+    emit(s, 0x7000 | (reg << 9) | (value & 0xff)); /* MOVEQ #value,Dn */
+  } else {
+    emit(s, 0x203c | (reg << 9));                  /* MOVE.L #value,Dn */
+    emit32(s, value);
+  }
+}
+
+/* MOVE.L Dsrc,Ddest */
+static void emitMove(jitState *s, unsigned short src, unsigned short dest) {
+  emit(s, 0x2000 | (dest << 9) | src);
+}
+
+/* Return from compiled code */
+static void emitReturn(jitState *s) {
+  emit(s, 0x4cdf); /* MOVEM.L (SP)+,D2-D4 */
+  emit(s, 0x001c);
+  emit(s, 0x4e75); /* RTS */
+}
+
+/* Check that size bytes at offset k are available */
+static Boolean emitCheckAbs(jitState *s, unsigned long k, unsigned short size) {
+  if (k > (unsigned long)(maxDisplacement - size)) {
+    emitBranch(s, ccT, s->exit);
+    return false;
+  }
+  emit(s, 0x0c80 | regBufLen); /* CMPI.L #k+size,D2 */
+  emit32(s, k + size);
+  emitBranch(s, ccCS, s->exit);
+  return true;
+}
+
+/* Load from packet at constant offset k */
+static void emitLoadAbs(jitState *s, unsigned short reg, unsigned short size,
+                        unsigned long k) {
+  unsigned short i;
+
+  if (!emitCheckAbs(s, k, size)) {
+    return;
+  }
+  if (size != 4) {
+    emitLoadImm(s, reg, 0);
+  }
+  if (size == 1) {
+    emit(s, 0x1028 | (reg << 9)); /* MOVE.B k(A0),Dn */
+    emit(s, k);
+  } else if (!(k & 1)) {
+    emit(s, (size == 4 ? 0x2028 : 0x3028) | (reg << 9)); /* MOVE.x k(A0),Dn */
+    emit(s, k);
+  } else {
+    for (i = 0; i < size; i++) {
+      if (i > 0) {
+        emit(s, (size == 4 ? 0xe188 : 0xe148) | reg); /* LSL.x #8,Dn */
+      }
+      emit(s, 0x1028 | (reg << 9)); /* MOVE.B k+i(A0),Dn */
+      emit(s, k + i);
+    }
+  }
+}
+
+/* Load from packet at offset X+k */
+static void emitLoadInd(jitState *s, unsigned short size, unsigned long k) {
+  unsigned short i;
+
+  emitMove(s, regX, regTmp);
+  if (k != 0) {
+    emit(s, 0x0680 | regTmp); /* ADDI.L #k,D4 */
+    emit32(s, k);
+    emitBranch(s, ccCS, s->exit);
+  }
+  emit(s, 0x5080 | ((size & 7) << 9) | regTmp); /* ADDQ.L #size,D4 */
+  emitBranch(s, ccCS, s->exit);
+  emit(s, 0xb080 | (regTmp << 9) | regBufLen);  /* CMP.L D2,D4 */
+  emitBranch(s, ccHI, s->exit);
+  emit(s, 0x5180 | ((size & 7) << 9) | regTmp); /* SUBQ.L #size,D4 */
+
+  if (size != 4) {
+    emitLoadImm(s, regA, 0);
+  }
+  for (i = 0; i < size; i++) {
+    if (i > 0) {
+      emit(s, (size == 4 ? 0xe188 : 0xe148) | regA); /* LSL.x #8,D0 */
+    }
+    emit(s, 0x1030 | (regA << 9));  /* MOVE.B i(A0,D4.L),D0 */
+    emit(s, (regTmp << 12) | 0x0800 | i);
+  }
+}
+
+/* Shift A by a constant */
+static void emitShiftImm(jitState *s, unsigned short opcode, unsigned long k) {
+  if (k == 0) {
+    return;
+  }
+  if (k <= 8) {
+    emit(s, opcode | ((k & 7) << 9) | regA);          /* LSx.L #k,D0 */
+  } else {
+    emitLoadImm(s, regTmp, k);
+    emit(s, opcode | 0x0020 | (regTmp << 9) | regA);  /* LSx.L D4,D0 */
+  }
+}
+
+/* Shift A by X, giving 0 for shifts of 32 or more like the interpreter */
+static void emitShiftX(jitState *s, unsigned short opcode) {
+  emit(s, 0x0c80 | regX);   /* CMPI.L #32,D1 */
+  emit32(s, 32);
+  emit(s, 0x6504);          /* BCS.S shift */
+  emit(s, 0x7000);          /* MOVEQ #0,D0 */
+  emit(s, 0x6002);          /* BRA.S done */
+  emit(s, opcode | 0x0020 | (regX << 9) | regA); /* shift: LSx.L D1,D0 */
+}
+
+/* Multiply, divide or take the remainder of A by X or a constant */
+static void emitMulDiv(jitState *s, unsigned short op, Boolean useX,
+                       unsigned long k) {
+#if defined(TARGET_SE30)
+  unsigned short ea = useX ? regX : 0x3c; /* D1 or immediate */
+
+  switch (op) {
+    case BPF_MUL:
+      emit(s, 0x4c00 | ea); /* MULU.L ea,D0 */
+      emit(s, regA << 12);
+      break;
+    case BPF_DIV:
+      emit(s, 0x4c40 | ea); /* DIVU.L ea,D0 */
+      emit(s, (regA << 12) | regA);
+      break;
+    case BPF_MOD:
+      emit(s, 0x4c40 | ea); /* DIVUL.L ea,D4:D0 */
+      emit(s, (regA << 12) | regTmp);
+      break;
+  }
+  if (!useX) {
+    emit32(s, k);
+  }
+  if (op == BPF_MOD) {
+    emitMove(s, regTmp, regA);
+  }
+#else
+  unsigned long helper;
+
+  switch (op) {
+    case BPF_MUL:
+      helper = (unsigned long)bpfMultiply;
+      break;
+    case BPF_DIV:
+      helper = (unsigned long)bpfDivide;
+      break;
+    default:
+      helper = (unsigned long)bpfModulo;
+      break;
+  }
+
+  emit(s, 0x48e7); /* MOVEM.L D1/A0-A1,-(SP) */
+  emit(s, 0x40c0);
+  if (useX) {
+    emit(s, 0x2f00 | regX); /* MOVE.L D1,-(SP) */
+  } else {
+    emit(s, 0x2f3c);        /* MOVE.L #k,-(SP) */
+    emit32(s, k);
+  }
+  emit(s, 0x2f00 | regA);   /* MOVE.L D0,-(SP) */
+  emit(s, 0x4eb9);          /* JSR helper */
+  emit32(s, helper);
+  emit(s, 0x508f);          /* ADDQ.L #8,SP */
+  emit(s, 0x4cdf);          /* MOVEM.L (SP)+,D1/A0-A1 */
+  emit(s, 0x0302);
+#endif
+}
+
+/* ALU operation on A */
+static void emitAlu(jitState *s, const bpfInsn *insn) {
+  unsigned short op = BPF_OP(insn->code);
+  unsigned long k = insn->k;
+
+  if (op == BPF_NEG) {
+    emit(s, 0x4480 | regA); /* NEG.L D0 */
+    return;
+  }
+
+  if (BPF_SRC(insn->code) == BPF_X) {
+    switch (op) {
+      case BPF_ADD:
+        emit(s, 0xd080 | (regA << 9) | regX); /* ADD.L D1,D0 */
+        break;
+      case BPF_SUB:
+        emit(s, 0x9080 | (regA << 9) | regX); /* SUB.L D1,D0 */
+        break;
+      case BPF_OR:
+        emit(s, 0x8080 | (regA << 9) | regX); /* OR.L D1,D0 */
+        break;
+      case BPF_AND:
+        emit(s, 0xc080 | (regA << 9) | regX); /* AND.L D1,D0 */
+        break;
+      case BPF_XOR:
+        emit(s, 0xb180 | (regX << 9) | regA); /* EOR.L D1,D0 */
+        break;
+      case BPF_LSH:
+        emitShiftX(s, 0xe188);
+        break;
+      case BPF_RSH:
+        emitShiftX(s, 0xe088);
+        break;
+      case BPF_DIV:
+      case BPF_MOD:
+        emit(s, 0x4a80 | regX); /* TST.L D1 */
+        emitBranch(s, ccEQ, s->exit);
+        /* fall through */
+      case BPF_MUL:
+        emitMulDiv(s, op, true, 0);
+        break;
+    }
+    return;
+  }
+
+  switch (op) {
+    case BPF_ADD:
+    case BPF_SUB:
+      if (k == 0) {
+        break;
+      }
+      if (k <= 8) {
+        /* ADDQ.L/SUBQ.L #k,D0 */
+        emit(s, (op == BPF_ADD ? 0x5080 : 0x5180) | ((k & 7) << 9) | regA);
+      } else {
+        /* ADDI.L/SUBI.L #k,D0 */
+        emit(s, (op == BPF_ADD ? 0x0680 : 0x0480) | regA);
+        emit32(s, k);
+      }
+      break;
+    case BPF_OR:
+    case BPF_XOR:
+      if (k != 0) {
+        emit(s, (op == BPF_OR ? 0x0080 : 0x0a80) | regA); /* ORI/EORI.L */
+        emit32(s, k);
+      }
+      break;
+    case BPF_AND:
+      if (k == 0) {
+        emitLoadImm(s, regA, 0);
+      } else if (k != 0xffffffff) {
+        emit(s, 0x0280 | regA); /* ANDI.L #k,D0 */
+        emit32(s, k);
+      }
+      break;
+    case BPF_LSH:
+      emitShiftImm(s, 0xe188, k);
+      break;
+    case BPF_RSH:
+      emitShiftImm(s, 0xe088, k);
+      break;
+    case BPF_MUL:
+    case BPF_DIV:
+    case BPF_MOD:
+      emitMulDiv(s, op, false, k);
+      break;
+  }
+}
+
+/* Conditional jump */
+static void emitJump(jitState *s, const bpfInsn *insn, unsigned short i) {
+  unsigned short op = BPF_OP(insn->code);
+  unsigned short trueTarget = i + 1 + insn->jt;
+  unsigned short falseTarget = i + 1 + insn->jf;
+  unsigned short cc, notCC;
+
+  if (insn->jt == insn->jf) {
+    /* Goes the same way regardless */
+    if (insn->jt != 0) {
+      emitBranch(s, ccT, trueTarget);
+    }
+    return;
+  }
+
+  /* Set the condition codes */
+  if (op == BPF_JSET) {
+    emitMove(s, regA, regTmp);
+    if (BPF_SRC(insn->code) == BPF_X) {
+      emit(s, 0xc080 | (regTmp << 9) | regX); /* AND.L D1,D4 */
+    } else {
+      emit(s, 0x0280 | regTmp);               /* ANDI.L #k,D4 */
+      emit32(s, insn->k);
+    }
+  } else if (BPF_SRC(insn->code) == BPF_X) {
+    emit(s, 0xb080 | (regA << 9) | regX);     /* CMP.L D1,D0 */
+  } else if (insn->k == 0 && op == BPF_JEQ) {
+    emit(s, 0x4a80 | regA);                   /* TST.L D0 */
+  } else {
+    emit(s, 0x0c80 | regA);                   /* CMPI.L #k,D0 */
+    emit32(s, insn->k);
+  }
+
+  switch (op) {
+    case BPF_JEQ:
+      cc = ccEQ;
+      notCC = ccNE;
+      break;
+    case BPF_JGT:
+      cc = ccHI;
+      notCC = ccLS;
+      break;
+    case BPF_JGE:
+      cc = ccCC;
+      notCC = ccCS;
+      break;
+    default: /* BPF_JSET */
+      cc = ccNE;
+      notCC = ccEQ;
+      break;
+  }
+
+  if (insn->jf == 0) {
+    emitBranch(s, cc, trueTarget);
+  } else if (insn->jt == 0) {
+    emitBranch(s, notCC, falseTarget);
+  } else {
+    emitBranch(s, cc, trueTarget);
+    emitBranch(s, ccT, falseTarget);
+  }
+}
+
+/* Generate code for a whole program */
+static void generate(jitState *s, const bpfFilter *filter) {
+  const bpfInsn *insn;
+  unsigned short i;
+
+  /* Prologue: save registers and load arguments */
+  emit(s, 0x48e7); /* MOVEM.L D2-D4,-(SP) */
+  emit(s, 0x3800);
+  emit(s, 0x206f); /* MOVEA.L 16(SP),A0 */
+  emit(s, 16);
+  emit(s, 0x262f); /* MOVE.L 20(SP),D3 */
+  emit(s, 20);
+  emit(s, 0x242f); /* MOVE.L 24(SP),D2 */
+  emit(s, 24);
+  emit(s, 0x226f); /* MOVEA.L 28(SP),A1 */
+  emit(s, 28);
+  emitLoadImm(s, regA, 0);
+  emitLoadImm(s, regX, 0);
+  for (i = 0; i < bpfMemWords; i++) {
+    if (filter->memLoaded & (1 << i)) {
+      emit(s, 0x42a9); /* CLR.L 4i(A1) */
+      emit(s, i * 4);
+    }
+  }
+
+  for (i = 0; i < filter->length; i++) {
+    insn = &filter->prog[i];
+    if (s->code == nil) {
+      s->offsets[i] = s->pos;
+    }
+
+    switch (BPF_CLASS(insn->code)) {
+      case BPF_LD:
+        switch (BPF_MODE(insn->code)) {
+          case BPF_ABS:
+            emitLoadAbs(s, regA,
+                        BPF_SIZE(insn->code) == BPF_W   ? 4
+                        : BPF_SIZE(insn->code) == BPF_H ? 2
+                                                        : 1,
+                        insn->k);
+            break;
+          case BPF_IND:
+            emitLoadInd(s,
+                        BPF_SIZE(insn->code) == BPF_W   ? 4
+                        : BPF_SIZE(insn->code) == BPF_H ? 2
+                                                        : 1,
+                        insn->k);
+            break;
+          case BPF_IMM:
+            emitLoadImm(s, regA, insn->k);
+            break;
+          case BPF_LEN:
+            emitMove(s, regWireLen, regA);
+            break;
+          case BPF_MEM:
+            emit(s, 0x2029 | (regA << 9)); /* MOVE.L 4k(A1),D0 */
+            emit(s, insn->k * 4);
+            break;
+        }
+        break;
+
+      case BPF_LDX:
+        switch (BPF_MODE(insn->code)) {
+          case BPF_IMM:
+            emitLoadImm(s, regX, insn->k);
+            break;
+          case BPF_LEN:
+            emitMove(s, regWireLen, regX);
+            break;
+          case BPF_MEM:
+            emit(s, 0x2029 | (regX << 9)); /* MOVE.L 4k(A1),D1 */
+            emit(s, insn->k * 4);
+            break;
+          case BPF_MSH:
+            emitLoadAbs(s, regX, 1, insn->k);
+            emit(s, 0x0200 | regX); /* ANDI.B #$0F,D1 */
+            emit(s, 0x000f);
+            emit(s, 0xe588 | regX); /* LSL.L #2,D1 */
+            break;
+        }
+        break;
+
+      case BPF_ST:
+        emit(s, 0x2340 | regA); /* MOVE.L D0,4k(A1) */
+        emit(s, insn->k * 4);
+        break;
+      case BPF_STX:
+        emit(s, 0x2340 | regX); /* MOVE.L D1,4k(A1) */
+        emit(s, insn->k * 4);
+        break;
+
+      case BPF_ALU:
+        emitAlu(s, insn);
+        break;
+
+      case BPF_JMP:
+        if (BPF_OP(insn->code) == BPF_JA) {
+          if (insn->k != 0) {
+            emitBranch(s, ccT, i + 1 + insn->k);
+          }
+        } else {
+          emitJump(s, insn, i);
+        }
+        break;
+
+      case BPF_RET:
+        if (BPF_RVAL(insn->code) == BPF_K) {
+          emitLoadImm(s, regA, insn->k);
+        }
+        emitReturn(s);
+        break;
+
+      case BPF_MISC:
+        if (BPF_MISCOP(insn->code) == BPF_TAX) {
+          emitMove(s, regA, regX);
+        } else {
+          emitMove(s, regX, regA);
+        }
+        break;
+    }
+  }
+
+  /* Exit for out-of-bounds loads and division by zero */
+  if (s->code == nil) {
+    s->offsets[filter->length] = s->pos;
+  }
+  emitLoadImm(s, regA, 0);
+  emitReturn(s);
+}
+
+/* Compile a validated filter. Returns nil if it can't be compiled (too big, or
+no memory), in which case it will be interpreted. */
+bpfJitProc bpfCompile(const bpfFilter *filter, unsigned long *codeSize) {
+  unsigned short offsets[bpfMaxInsns + 1];
+  jitState s;
+
+  s.offsets = offsets;
+  s.exit = filter->length;
+
+  /* Measure */
+  s.code = nil;
+  s.pos = 0;
+  generate(&s, filter);
+  if (s.pos * 2UL > maxCodeSize) {
+    return nil;
+  }
+
+  /* Generate */
+  *codeSize = s.pos * 2UL;
+  s.code = (unsigned short *)NewPtrSys(*codeSize);
+  if (s.code == nil) {
+    return nil;
+  }
+  s.pos = 0;
+  generate(&s, filter);
+
+  /* Don't run stale instructions on machines with an instruction cache */
+  if (trapAvailable(_CacheFlush)) {
+    FlushCodeCache();
+  }
+  return (bpfJitProc)s.code;
+}
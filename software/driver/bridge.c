@@ -0,0 +1,270 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Devices.h>
+#include <Errors.h>
+#include <Events.h>
+#include <Memory.h>
+#include <MacTypes.h>
+
+#include "bridge.h"
+#include "buffers.h"
+#include "driver.h"
+#include "enc624j600.h"
+#include "readpacket.h"
+#include "transmit.h"
+#include "util.h"
+
+#define likely(x)    __builtin_expect (!!(x), 1)
+#define unlikely(x)  __builtin_expect (!!(x), 0)
+
+/* Hash an ethernet address into the address table. The low-order bytes vary
+the most between cards from the same vendor, so just fold those together. */
+static inline bridgeEntry *bridgeLookup(bridgeTable *table,
+                                        const hwAddr *address) {
+  return &table->entries[(address->bytes[3] ^ address->bytes[4] ^
+                          address->bytes[5]) & (bridgeTableSize - 1)];
+}
+
+/*
+Bridge a received frame. Called from handlePacket() with the ethernet header
+already in the RHA; pktLen is the length of the whole frame (excluding FCS).
+
+Records which side the frame's source is on, and if the frame needs to go to the
+other side, copies it straight from our receive ring into the other card's
+driver transmit buffer and sends it. The frame is left unread in our receive
+ring, so handlePacket() can go on to deliver it locally as well.
+
+Returns false if the frame needs forwarding but the other card's driver
+transmit buffer is still busy. In that case, receive is stalled: the frame must
+be left in the ring, and packet interrupts stay disabled until the other card
+finishes transmitting and calls bridgeResumePeer().
+*/
+Boolean bridgeFrame(driverGlobalsPtr theGlobals, unsigned short pktLen) {
+  driverGlobalsPtr peer = theGlobals->bridgePeer;
+  bridgeTable *table = theGlobals->bridgeTable;
+  const ethernetHeader *header = &theGlobals->rha.header.pktHeader;
+  const unsigned char *packetData;
+  unsigned long now = TickCount();
+  bridgeEntry *entry;
+  Boolean flooded;
+  unsigned short srSave;
+  Byte *dest;
+
+  /* Learn where the source is (group addresses are never valid sources) */
+  if (likely(!(header->source.bytes[0] & 0x01))) {
+    entry = bridgeLookup(table, &header->source);
+    copyEthAddrs(&entry->address, &header->source);
+    entry->port = theGlobals;
+    entry->lastSeen = now;
+  }
+
+  /* Frames for us are delivered locally only */
+  if (RSV_BIT(theGlobals->rha.header.rsv, RSV_BIT_UNICAST)) {
+    return true;
+  }
+
+  /* Frames for the other card would never be received by it if we sent them
+  out its side, so don't bother */
+  if (ethAddrsEqual(&header->dest, (hwAddr *)peer->info.ethernetAddress)) {
+    theGlobals->info.bridgeFiltered++;
+    return true;
+  }
+
+  if (header->dest.bytes[0] & 0x01) {
+    /* Broadcast or multicast, always goes to the other side */
+    flooded = true;
+  } else {
+    entry = bridgeLookup(table, &header->dest);
+    if (ethAddrsEqual(&entry->address, &header->dest) &&
+        now - entry->lastSeen < table->ageTicks) {
+      if (entry->port == theGlobals) {
+        /* Destination is on this side, nothing to do */
+        theGlobals->info.bridgeFiltered++;
+        return true;
+      }
+      flooded = false;
+    } else {
+      /* Don't know where the destination is. With only one other side to
+      send it to, 'flooding' is easy */
+      flooded = true;
+    }
+  }
+
+  if (unlikely(peer->chip.link_state == LINK_DOWN)) {
+    theGlobals->info.bridgeDropped++;
+    return true;
+  }
+
+  /* Claim the other card's driver transmit buffer, or stall if it's busy. Mask
+  interrupts so that the other card can't finish transmitting between us
+  finding the buffer busy and marking ourselves as stalled. */
+  srSave = maskInterrupts();
+  dest = claimDriverTx(peer);
+  if (unlikely(dest == nil)) {
+    theGlobals->bridgeRxStalled = 1;
+    enc624j600_disable_irq(&theGlobals->chip, IRQ_PKT);
+  }
+  restoreInterrupts(srSave);
+  if (unlikely(dest == nil)) {
+    theGlobals->info.bridgeStalls++;
+    return false;
+  }
+
+  /* Copy the frame across, header from the RHA, everything else straight out
+  of the ring, then rewind the ring for local delivery */
+  copyToChip(peer, dest, (Byte *)header, sizeof(ethernetHeader));
+  packetData = theGlobals->chip.rxptr;
+  readBuf(&theGlobals->chip, dest + sizeof(ethernetHeader),
+          pktLen - sizeof(ethernetHeader));
+  theGlobals->chip.rxptr = packetData;
+
+  queueDriverFrame(peer, pktLen);
+
+  if (flooded) {
+    theGlobals->info.bridgeFlooded++;
+  } else {
+    theGlobals->info.bridgeForwarded++;
+  }
+  peer->info.bridgeTxFrames++;
+  return true;
+}
+
+/* Our driver transmit buffer has become free; if the other card stalled
+waiting for it, let it carry on receiving */
+void bridgeResumePeer(driverGlobalsPtr theGlobals) {
+  driverGlobalsPtr peer = theGlobals->bridgePeer;
+  unsigned short srSave = maskInterrupts();
+  if (peer->bridgeRxStalled) {
+    peer->bridgeRxStalled = 0;
+    enc624j600_enable_irq(&peer->chip, IRQ_PKT);
+  }
+  restoreInterrupts(srSave);
+}
+
+/* Look up another SEthernet card's globals by driver refnum */
+static driverGlobalsPtr findPeer(short refNum) {
+  DCtlHandle dceHandle = GetDCtlEntry(refNum);
+  driverGlobalsPtr peer;
+
+  if (dceHandle == nil || *dceHandle == nil) {
+    return nil;
+  }
+  peer = (driverGlobalsPtr)(*dceHandle)->dCtlStorage;
+  if (peer == nil || peer->signature != driverGlobalsSignature) {
+    return nil;
+  }
+  return peer;
+}
+
+/* Control call handler for ENCAttachBridge */
+OSErr doAttachBridge(driverGlobalsPtr theGlobals, const bridgeConfig *config) {
+#if defined(REV0_SUPPORT)
+  /* Forwarding copies frames into the other card's memory with BlockMoveData,
+  which rev0 boards can't cope with (see issue #3) */
+  (void)theGlobals;
+  (void)config;
+  return controlErr;
+#else
+  driverGlobalsPtr peer;
+  bridgeTable *table;
+  unsigned short srSave;
+  OSErr error;
+
+  if (config == nil) {
+    return paramErr;
+  }
+
+  peer = findPeer(config->peerRefNum);
+  if (peer == nil || peer == theGlobals) {
+    DBGP("Can't bridge to refnum %d", config->peerRefNum);
+    return paramErr;
+  }
+
+  if (theGlobals->bridgePeer != nil || peer->bridgePeer != nil) {
+    /* Already bridging */
+    return controlErr;
+  }
+
+  /* Each card forwards frames into the other's driver transmit buffer */
+  error = reserveDriverTx(theGlobals);
+  if (error == noErr) {
+    error = reserveDriverTx(peer);
+  }
+  if (error != noErr) {
+    return error;
+  }
+
+  table = (bridgeTable *)NewPtrSysClear(sizeof(bridgeTable));
+  if (table == nil) {
+    return MemError();
+  }
+  if (theGlobals->vmEnabled) {
+    /* Table is used at interrupt time, keep it resident */
+    HoldMemory(table, sizeof(bridgeTable));
+  }
+  table->ageTicks = config->ageTicks ? config->ageTicks : bridgeDefaultAgeTicks;
+
+  srSave = maskInterrupts();
+  theGlobals->bridgeTable = table;
+  peer->bridgeTable = table;
+  theGlobals->bridgePeer = peer;
+  peer->bridgePeer = theGlobals;
+  enc624j600_enable_promiscuous(&theGlobals->chip);
+  enc624j600_enable_promiscuous(&peer->chip);
+  restoreInterrupts(srSave);
+
+  return noErr;
+#endif
+}
+
+/* Control call handler for ENCDetachBridge. Also called when closing. */
+OSErr doDetachBridge(driverGlobalsPtr theGlobals) {
+  driverGlobalsPtr peer = theGlobals->bridgePeer;
+  bridgeTable *table = theGlobals->bridgeTable;
+  unsigned short srSave;
+
+  if (peer == nil) {
+    return noErr;
+  }
+
+  srSave = maskInterrupts();
+  theGlobals->bridgePeer = nil;
+  peer->bridgePeer = nil;
+  theGlobals->bridgeTable = nil;
+  peer->bridgeTable = nil;
+  /* A monitoring tap may still want promiscuous mode */
+  if (!theGlobals->tap.promiscuous) {
+    enc624j600_disable_promiscuous(&theGlobals->chip);
+  }
+  if (!peer->tap.promiscuous) {
+    enc624j600_disable_promiscuous(&peer->chip);
+  }
+  /* Make sure neither side is left stalled */
+  theGlobals->bridgeRxStalled = 0;
+  peer->bridgeRxStalled = 0;
+  enc624j600_enable_irq(&theGlobals->chip, IRQ_PKT);
+  enc624j600_enable_irq(&peer->chip, IRQ_PKT);
+  restoreInterrupts(srSave);
+
+  if (theGlobals->vmEnabled) {
+    UnholdMemory(table, sizeof(bridgeTable));
+  }
+  DisposePtr((Ptr)table);
+  return noErr;
+}
@@ -0,0 +1,48 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "driver.h"
+
+/* Number of entries in the bridge address table, must be a power of 2 no
+larger than 256 */
+#define bridgeTableSize 256
+
+/* Default time after which unseen addresses are forgotten */
+#define bridgeDefaultAgeTicks (5 * 60 * 60)
+
+/* Entry in the bridge address table */
+struct bridgeEntry {
+  hwAddr address;           /* Ethernet address */
+  driverGlobalsPtr port;    /* Card that the address was last seen on */
+  unsigned long lastSeen;   /* Tick count when address was last seen */
+} __attribute__((aligned (2)));
+typedef struct bridgeEntry bridgeEntry;
+
+/* Bridge address table, shared by both cards */
+struct bridgeTable {
+  unsigned short ageTicks;  /* Entries older than this are ignored */
+  bridgeEntry entries[bridgeTableSize];
+};
+typedef struct bridgeTable bridgeTable;
+
+Boolean bridgeFrame(driverGlobalsPtr theGlobals, unsigned short pktLen);
+void bridgeResumePeer(driverGlobalsPtr theGlobals);
+OSErr doAttachBridge(driverGlobalsPtr theGlobals, const bridgeConfig *config);
+OSErr doDetachBridge(driverGlobalsPtr theGlobals);
@@ -0,0 +1,206 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Errors.h>
+#include <MacTypes.h>
+
+#include "buffers.h"
+#include "driver.h"
+#include "enc624j600.h"
+#include "util.h"
+
+/*
+Chip buffer layout
+
+Frames sent by AppleTalk-only clients are never longer than 768 bytes, so the
+driver starts out with a half-size transmit buffer and gives the other half to
+the receive buffer, where it helps absorb bursts of incoming frames.
+ENetSetGeneral, which clients call before writing anything longer, grows the
+transmit buffer to a full frame. Frames longer than appleTalkMaxFrame are
+refused by doEWrite() until then.
+
+The driver transmit buffer and the reply buffer are reserved on demand, one
+after the other above a full-size transmit buffer, by moving the start of the
+receive buffer up. They stay reserved until the driver is closed, since frames
+may still be waiting in them. Each layout change only ever moves the receive
+buffer up, so nothing below it moves, and frames already in the transmit
+buffers can carry on transmitting.
+*/
+
+/* Where the receive buffer starts in the current layout */
+static unsigned short rxBufferStart(const driverGlobalsPtr theGlobals) {
+  if (theGlobals->reservedEnd) {
+    return theGlobals->reservedEnd;
+  }
+  return theGlobals->generalMode ? ENC_TX_BUF_SIZE_GENERAL
+                                 : ENC_TX_BUF_SIZE_APPLETALK;
+}
+
+/* Set up the AppleTalk-only layout. Called from driverOpen() in place of
+enc624j600_init(). */
+OSErr bufferLayoutInit(driverGlobalsPtr theGlobals) {
+  theGlobals->generalMode = 0;
+  theGlobals->driverTxStart = 0;
+  theGlobals->replyTxStart = 0;
+  theGlobals->reservedEnd = 0;
+  if (enc624j600_init(&theGlobals->chip, rxBufferStart(theGlobals)) != 0) {
+    return openErr;
+  }
+  theGlobals->info.rxBufferSize =
+      ENC624J600_MEM_END - rxBufferStart(theGlobals);
+  return noErr;
+}
+
+/* Move the receive buffer to where the current layout puts it, if it isn't
+there already. Called with chip interrupts disabled, so the receive path is
+idle. Any frames waiting in the receive buffer are lost (and counted as
+internalRxErrors). */
+static void moveRxBuffer(driverGlobalsPtr theGlobals) {
+  unsigned short start = rxBufferStart(theGlobals);
+  short dropped;
+  unsigned short srSave;
+
+  if (theGlobals->chip.rxbuf_start ==
+      enc624j600_addr_to_ptr(&theGlobals->chip, start)) {
+    return;
+  }
+
+  dropped = enc624j600_resize_rx_buffer(&theGlobals->chip, start);
+  theGlobals->info.internalRxErrors += dropped;
+  theGlobals->info.rxBufferSize = ENC624J600_MEM_END - start;
+
+  /* If receive was stalled waiting to forward a frame to the other card, that
+  frame is gone now */
+  srSave = maskInterrupts();
+  if (theGlobals->bridgeRxStalled) {
+    theGlobals->bridgeRxStalled = 0;
+    enc624j600_enable_irq(&theGlobals->chip, IRQ_PKT);
+  }
+  restoreInterrupts(srSave);
+}
+
+/* Grow the transmit buffer to take full-size frames. Called with chip
+interrupts disabled.
+
+No ENetWrite can be in progress, since the Device Manager doesn't issue another
+control call until the last one completes, so the transmit buffer is free. */
+static void enterGeneralMode(driverGlobalsPtr theGlobals) {
+  theGlobals->generalMode = 1;
+  moveRxBuffer(theGlobals);
+}
+
+/* Reserve size bytes for a transmit buffer, storing its start in *start once
+it's ready for use, unless that's been done already. Fails with controlErr if
+our ISR is running (we've been called from one of our own protocol handlers)
+or about to run, since the receive buffer can't be moved under it. */
+static OSErr reserveTxBuffer(driverGlobalsPtr theGlobals,
+                             unsigned short *start, unsigned short size) {
+  unsigned short srSave;
+  unsigned short oldeie;
+  unsigned short where;
+
+  if (*start != 0) {
+    return noErr;
+  }
+
+  srSave = maskInterrupts();
+  oldeie = enc624j600_disable_irq(&theGlobals->chip, IRQ_ENABLE);
+  restoreInterrupts(srSave);
+  if (!(oldeie & IRQ_ENABLE)) {
+    return controlErr;
+  }
+
+  if (theGlobals->reservedEnd == 0) {
+    /* Leave room for a full-size transmit buffer, so that a later switch to
+    general mode doesn't have to move anything */
+    theGlobals->reservedEnd = ENC_TX_BUF_SIZE_GENERAL;
+  }
+  where = theGlobals->reservedEnd;
+  theGlobals->reservedEnd += size;
+  moveRxBuffer(theGlobals);
+
+  /* The other card may be looking for our driver transmit buffer when
+  bridging, so only publish it once the receive buffer is out of the way */
+  *start = where;
+
+  enc624j600_enable_irq(&theGlobals->chip, IRQ_ENABLE);
+  return noErr;
+}
+
+/* Reserve the driver transmit buffer. Needed by the stats-query responder, and
+by both cards when bridging. */
+OSErr reserveDriverTx(driverGlobalsPtr theGlobals) {
+  return reserveTxBuffer(theGlobals, &theGlobals->driverTxStart,
+                         ENC_DRIVER_TX_BUF_SIZE);
+}
+
+/* Reserve the reply buffer, without which immediate ENetWrite calls fail */
+OSErr reserveReplyTx(driverGlobalsPtr theGlobals) {
+  return reserveTxBuffer(theGlobals, &theGlobals->replyTxStart,
+                         ENC_REPLY_TX_BUF_SIZE);
+}
+
+/*
+ESetGeneral (a.k.a.) Control called with csCode=ENetSetGeneral
+
+Switch to the general-mode buffer layout. Unless a driver or reply transmit
+buffer has already made room, the receive buffer moves up and any frames
+waiting in it are lost (and counted as internalRxErrors), as Inside Macintosh
+warns they may be.
+
+If our ISR is running (we've been called from one of our own protocol handlers)
+or about to run, the switch is left for userISR() to make by calling
+finishSetGeneral(), which completes the call. An immediate call can't be
+completed later, so in that case it fails with controlErr instead.
+*/
+OSErr doSetGeneral(driverGlobalsPtr theGlobals, const EParamBlkPtr pb) {
+  unsigned short srSave;
+  unsigned short oldeie;
+
+  if (theGlobals->generalMode) {
+    return noErr;
+  }
+
+  srSave = maskInterrupts();
+  oldeie = enc624j600_disable_irq(&theGlobals->chip, IRQ_ENABLE);
+  if (!(oldeie & IRQ_ENABLE)) {
+    /* Chip interrupts were already off, so userISR() is running or pending and
+    will re-enable them when it's done */
+    if (pb->ioTrap & ioTrapNoQueue) {
+      restoreInterrupts(srSave);
+      return controlErr;
+    }
+    theGlobals->generalModePending = 1;
+    restoreInterrupts(srSave);
+    return 1;
+  }
+  restoreInterrupts(srSave);
+
+  enterGeneralMode(theGlobals);
+
+  enc624j600_enable_irq(&theGlobals->chip, IRQ_ENABLE);
+  return noErr;
+}
+
+/* Make a switch to general mode deferred by doSetGeneral(), and complete the
+ENetSetGeneral call. Called from userISR(). */
+void finishSetGeneral(driverGlobalsPtr theGlobals) {
+  theGlobals->generalModePending = 0;
+  enterGeneralMode(theGlobals);
+  SafeIODone((DCtlPtr) theGlobals->driverDCE, noErr);
+}
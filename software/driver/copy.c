@@ -0,0 +1,130 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Memory.h>
+#include <MacTypes.h>
+#include <Timer.h>
+#include <Traps.h>
+#include <stddef.h>
+
+#include "copy.h"
+#include "driver.h"
+#include "enc624j600.h"
+#include "util.h"
+
+/* Number of timing runs per kernel; we take the fastest, since anything slower
+was most likely held up by an interrupt */
+#define calibrationRuns 4
+
+/* Kernels, indexed by copyKernelXXX */
+static copyKernelProc * const copyKernels[numCopyKernels] = {
+  copyBlockMove,
+  copyBytes,
+  copyWords,
+  copyLongs,
+  copyMovem
+};
+
+/* readpacket.S finds chipReadCopy at this offset from the chip structure */
+_Static_assert(offsetof(driverGlobals, chipReadCopy) == 80,
+               "Update driverGlobals_chipReadCopy in readpacket.S");
+
+/* Time a copy kernel, returning the best time in microseconds */
+static unsigned long timeKernel(copyKernelProc *kernel, const void *source,
+                                void *dest) {
+  UnsignedWide start;
+  UnsignedWide end;
+  unsigned long best = 0xffffffff;
+  unsigned short run;
+
+  for (run = 0; run < calibrationRuns; run++) {
+    Microseconds(&start);
+    chipCopy(kernel, source, dest, copyCalibrationSize);
+    Microseconds(&end);
+    if (end.lo - start.lo < best) {
+      best = end.lo - start.lo;
+    }
+  }
+  return best;
+}
+
+/* Find the fastest kernel from a list of times */
+static unsigned short fastestKernel(const unsigned long times[]) {
+  unsigned short best = copyKernelBlockMove;
+  unsigned short i;
+
+  for (i = 0; i < numCopyKernels; i++) {
+    if (times[i] < times[best]) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+/*
+Time each copy kernel reading from and writing to this card's memory, and use
+the fastest ones for it from now on. Each card has its own choice, since cards
+in different slots (or behind different glue logic) needn't be equally fast.
+Results are recorded in driverInfo so that machines can be compared.
+
+Must be called before the chip starts transmitting or receiving, as the bottom
+of chip memory (the transmit buffer and the start of the receive buffer) is used
+as scratch space. Leaves BlockMoveData in place if we can't get a microsecond
+timer or a buffer to copy to.
+*/
+void calibrateCopy(driverGlobalsPtr theGlobals) {
+  Byte *chipBuffer;
+  Ptr hostBuffer;
+  unsigned short i;
+
+  /* BlockMoveData is a safe default */
+  theGlobals->chipReadCopy = copyBlockMove;
+  theGlobals->chipWriteCopy = copyBlockMove;
+
+  if (!trapAvailable(_Microseconds)) {
+    return;
+  }
+
+  hostBuffer = NewPtrSys(copyCalibrationSize);
+  if (hostBuffer == nil) {
+    return;
+  }
+  chipBuffer = enc624j600_addr_to_ptr(&theGlobals->chip, ENC_TX_BUF_START);
+
+  for (i = 0; i < numCopyKernels; i++) {
+    theGlobals->info.copyReadTime[i] =
+        timeKernel(copyKernels[i], chipBuffer, hostBuffer);
+  }
+  theGlobals->info.copyReadKernel =
+      fastestKernel(theGlobals->info.copyReadTime);
+  theGlobals->chipReadCopy = copyKernels[theGlobals->info.copyReadKernel];
+
+#if !defined(REV0_SUPPORT)
+  /* Rev0 boards need all writes to chip memory done a byte at a time (see
+  issue #3), so there's nothing to choose between there */
+  for (i = 0; i < numCopyKernels; i++) {
+    theGlobals->info.copyWriteTime[i] =
+        timeKernel(copyKernels[i], hostBuffer, chipBuffer);
+  }
+  theGlobals->info.copyWriteKernel =
+      fastestKernel(theGlobals->info.copyWriteTime);
+  theGlobals->chipWriteCopy = copyKernels[theGlobals->info.copyWriteKernel];
+#endif
+
+  DisposePtr(hostBuffer);
+}
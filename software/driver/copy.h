@@ -0,0 +1,50 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <MacTypes.h>
+
+#include "driver.h"
+
+/* Copy kernels, see copy.S. These take their arguments in registers, so must be
+called through chipCopy() (or from assembly language). */
+typedef void copyKernelProc(void);
+
+copyKernelProc copyBlockMove;
+copyKernelProc copyBytes;
+copyKernelProc copyWords;
+copyKernelProc copyLongs;
+copyKernelProc copyMovem;
+
+/* Call a copy kernel */
+static inline void chipCopy(copyKernelProc *kernel, const void *source,
+                            void *dest, unsigned short len) {
+  register const void *a0 asm("a0") = source;
+  register void *a1 asm("a1") = dest;
+  register unsigned long d0 asm("d0") = len;
+
+  asm volatile(
+    "JSR     (%[kernel])"
+    : "+a" (a0), "+a" (a1), "+d" (d0)
+    : [kernel] "a" (kernel)
+    : "d1", "d2", "memory"
+  );
+}
+
+void calibrateCopy(driverGlobalsPtr theGlobals);
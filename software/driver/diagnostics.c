@@ -0,0 +1,183 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Errors.h>
+#include <MacTypes.h>
+#include <Memory.h>
+
+#include "diagnostics.h"
+#include "driver.h"
+#include "enc624j600.h"
+#include "enc624j600_registers.h"
+
+/* End of the register file */
+#define ENC_SFR_END (EUDAWRPT + 2)
+
+/* Highest PHY register address */
+#define ENC_PHY_REG_MAX 0x1f
+
+/* Check that an ENCRegisterBatch operation makes sense */
+static Boolean validRegisterOp(const encRegisterOp *op) {
+  switch (op->op) {
+    case encOpRead:
+    case encOpWrite:
+      return op->reg >= ETXST && op->reg < ENC_SFR_END && !(op->reg & 1);
+    case encOpSetBits:
+    case encOpClearBits:
+      /* Only the first half of the register file has bit set/clear registers */
+      return op->reg >= ETXST && op->reg < EGPDATA && !(op->reg & 1);
+    case encOpReadPhy:
+    case encOpWritePhy:
+      return op->reg <= ENC_PHY_REG_MAX;
+    default:
+      return false;
+  }
+}
+
+/* Execute a single register operation. Values in the API are in datasheet bit
+order, so swap them on their way to and from the chip. */
+static void doRegisterOp(const enc624j600 *chip, encRegisterOp *op) {
+  switch (op->op) {
+    case encOpRead:
+      op->value = SWAPBYTES(ENC624J600_READ_REG(chip->base_address, op->reg));
+      break;
+    case encOpWrite:
+      ENC624J600_WRITE_REG(chip->base_address, op->reg, SWAPBYTES(op->value));
+      break;
+    case encOpSetBits:
+      ENC624J600_SET_BITS(chip->base_address, op->reg, SWAPBYTES(op->value));
+      break;
+    case encOpClearBits:
+      ENC624J600_CLEAR_BITS(chip->base_address, op->reg, SWAPBYTES(op->value));
+      break;
+    case encOpReadPhy:
+      op->value = SWAPBYTES(enc624j600_read_phy_reg(chip, op->reg));
+      break;
+    case encOpWritePhy:
+      enc624j600_write_phy_reg(chip, op->reg, SWAPBYTES(op->value));
+      break;
+  }
+}
+
+/* Control call handler for ENCReadReg, ENCWriteReg, ENCReadPhy and
+ENCWritePhy */
+OSErr doReadWriteReg(driverGlobalsPtr theGlobals, short csCode,
+                     encRegister *reg) {
+  encRegisterOp op;
+
+  if (reg == nil) {
+    return paramErr;
+  }
+
+  switch (csCode) {
+    case ENCReadReg:
+      op.op = encOpRead;
+      break;
+    case ENCWriteReg:
+      op.op = encOpWrite;
+      break;
+    case ENCReadPhy:
+      op.op = encOpReadPhy;
+      break;
+    default:
+      op.op = encOpWritePhy;
+      break;
+  }
+  op.reg = reg->reg;
+  op.value = reg->value;
+
+  if (!validRegisterOp(&op)) {
+    return paramErr;
+  }
+  doRegisterOp(&theGlobals->chip, &op);
+  reg->value = op.value;
+  return noErr;
+}
+
+/*
+Control call handler for ENCRegisterBatch
+
+A diagnostic tool reading the register file one Control call at a time makes
+hundreds of trips through the Device Manager, and the driver's ISR can change
+things in between them. Do the lot in one call instead, with interrupts masked
+only while actually touching the chip.
+*/
+OSErr doRegisterBatch(driverGlobalsPtr theGlobals, encRegisterBatch *batch) {
+  unsigned short old_eie;
+  unsigned short i;
+
+  if (batch == nil || batch->count > encMaxBatchOps) {
+    return paramErr;
+  }
+
+  /* Check everything up front, so a bad operation can't leave the chip
+  half-configured */
+  for (i = 0; i < batch->count; i++) {
+    if (!validRegisterOp(&batch->ops[i])) {
+      return paramErr;
+    }
+  }
+
+  old_eie = enc624j600_disable_irq(&theGlobals->chip, IRQ_ENABLE);
+  for (i = 0; i < batch->count; i++) {
+    doRegisterOp(&theGlobals->chip, &batch->ops[i]);
+  }
+  enc624j600_enable_irq(&theGlobals->chip, old_eie);
+
+  return noErr;
+}
+
+/* Control call handler for ENCReadSRAM */
+OSErr doReadSRAM(driverGlobalsPtr theGlobals, encSRAMRange *range) {
+  enc624j600 *chip = &theGlobals->chip;
+  unsigned short old_eie;
+
+  if (range == nil || range->buffer == nil ||
+      range->start >= ENC624J600_MEM_END ||
+      range->length > ENC624J600_MEM_END - range->start) {
+    return paramErr;
+  }
+
+  old_eie = enc624j600_disable_irq(chip, IRQ_ENABLE);
+  BlockMoveData(enc624j600_addr_to_ptr(chip, range->start), range->buffer,
+                range->length);
+  range->rxHead = SWAPBYTES(ENC624J600_READ_REG(chip->base_address, ERXHEAD));
+  range->rxTail = SWAPBYTES(ENC624J600_READ_REG(chip->base_address, ERXTAIL));
+  range->rxRead = enc624j600_ptr_to_addr(chip, chip->rxptr);
+  enc624j600_enable_irq(chip, old_eie);
+
+  return noErr;
+}
+
+/* Control call handler for ENCEnableLoopback and ENCDisableLoopback. Frames
+that we send come straight back to us with the PHY in loopback, and we
+deliver them rather than dropping them as echoes, so that a test program can
+see them. */
+void doSetPhyLoopback(driverGlobalsPtr theGlobals, Boolean enable) {
+  unsigned short old_eie;
+
+  old_eie = enc624j600_disable_irq(&theGlobals->chip, IRQ_ENABLE);
+  if (enable) {
+    enc624j600_enable_phy_loopback(&theGlobals->chip);
+    theGlobals->phyLoopback = 1;
+  } else {
+    enc624j600_disable_phy_loopback(&theGlobals->chip);
+    theGlobals->phyLoopback = 0;
+  }
+  enc624j600_enable_irq(&theGlobals->chip, old_eie);
+}
@@ -31,11 +31,27 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <Slots.h>
 #include <Traps.h>
 
+#include "bridge.h"
+#include "buffers.h"
+#include "copy.h"
+#include "diagnostics.h"
+#include "duplex.h"
 #include "enc624j600.h"
 #include "enc624j600_registers.h"
+#include "flowcontrol.h"
+#include "housekeeping.h"
 #include "isr.h"
+#include "linkrate.h"
 #include "multicast.h"
 #include "protocolhandler.h"
+#include "rxsnapshot.h"
+#include "scsidefer.h"
+#include "statsquery.h"
+#include "tap.h"
+#include "traffic.h"
+#include "transmit.h"
+#include "txlatency.h"
+#include "txstats.h"
 #include "util.h"
 
 #if defined(TARGET_SE30)
@@ -51,86 +67,6 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #define likely(x)    __builtin_expect (!!(x), 1)
 #define unlikely(x)  __builtin_expect (!!(x), 0)
 
-/*
-EWrite (a.k.a.) Control called with csCode=ENetWrite
-
-Initiate transmission of an ethernet frame. This function is asynchronous and
-returns as soon as the frame has been copied into the transmit buffer and
-transmission has been started. Completion is signaled through a
-transmit-complete or transmit-aborted interrupt.
-
-The Device Manager handles the queueing of writes for us and won't issue another
-ENetWrite until the last one has signaled completion.
-
-The frame data is given as a Write Data Structure (WDS) - a list of
-address-length pairs like an iovec, we need to read from each one in sequence,
-the end of the WDS is signaled by an entry with a zero length. The ethernet
-header is already prepared for us, we just have to write our hardware address
-into the source field.
-*/
-static OSErr doEWrite(const driverGlobalsPtr theGlobals, const EParamBlkPtr pb) {
-  WDSElement *wds; /* a WDS is a list of address-length pairs like an iovec */
-  unsigned long totalLength; /* total length of frame */
-  Byte *dest;
-
-  /* Shouldn't ever happen unless something has gone very wrong */
-  if (ENC624J600_READ_REG(theGlobals->chip.base_address, ECON1) & ECON1_TXRTS) {
-    DBGS("\pTransmit while already transmitting!");
-  }
-
-  /* Scan through WDS list entries to compute total length */
-  wds = (WDSElement *)pb->u.EParms1.ePointer;
-  totalLength = 0;
-  do {
-    totalLength += wds->entryLength;
-    wds++;
-  } while (wds->entryLength);
-
-  /* Block transmission of oversized or unreasonably short frames. (Add 4 bytes
-  to calculated length to account for FCS field generated by ethernet
-  controller) */
-  if (unlikely(totalLength + 4 > 1518 || totalLength < 14)) {
-    DBGP("TX: bogus length %lu bytes!", totalLength);
-    return eLenErr;
-  }
-
-  /* Restore WDS pointer to start of list */
-  wds = (WDSElement *)pb->u.EParms1.ePointer;
-  dest = enc624j600_addr_to_ptr(&theGlobals->chip, ENC_TX_BUF_START);
-
-  /* Copy data from WDS into transmit buffer */
-  do {
-#if defined(REV0_SUPPORT)
-    enc624j600_memcpy(dest, (Byte *)wds->entryPtr, wds->entryLength);
-#else
-    BlockMoveData((Byte *)wds->entryPtr, dest, wds->entryLength);
-#endif
-    dest += wds->entryLength;
-    wds++;
-  } while (wds->entryLength > 0);
-
-  /* Go back and copy our address into the source field */
-  dest = enc624j600_addr_to_ptr(&theGlobals->chip, ENC_TX_BUF_START + 6);
-#if defined(REV0_SUPPORT)
-  enc624j600_memcpy(dest, theGlobals->info.ethernetAddress, 6);
-#else
-  BlockMoveData(theGlobals->info.ethernetAddress, dest, 6);
-#endif
-
-  if (unlikely(theGlobals->chip.link_state == LINK_DOWN)) {
-    /* don't bother trying to send packets on a down link */
-    return excessCollsns;
-  }
-
-  debug_log(theGlobals, txEvent, totalLength);
-  /* Send it! */
-  enc624j600_transmit(&theGlobals->chip, theGlobals->chip.base_address,
-                      totalLength);
-
-  /* Return >0 to indicate operation in progress */
-  return 1;
-}
-
 /*
 Shutdown procedure
 
@@ -232,6 +168,13 @@ OSErr driverOpen(__attribute__((unused)) EParamBlkPtr pb, AuxDCEPtr dce) {
       /* dCtlStorage is technically a Handle, but since its use is entirely
       user-defined we can just treat it as a pointer */
       dce->dCtlStorage = (Handle)theGlobals;
+      theGlobals->signature = driverGlobalsSignature;
+#if defined(DEBUG)
+      theGlobals->hasEventLog = 1;
+#endif
+#if defined(TX_LATENCY)
+      theGlobals->hasTxLatency = trapAvailable(_Microseconds);
+#endif
 
       /* Define some macros pointing at interesting parts of our globals */
       DBGP(";MC driverGlobals '%08x'"
@@ -368,12 +311,21 @@ OSErr driverOpen(__attribute__((unused)) EParamBlkPtr pb, AuxDCEPtr dce) {
       }
 
       /* Initialize the ethernet controller. */
-      if (enc624j600_init(&theGlobals->chip, ENC_RX_BUF_START) != 0) {
+      if (bufferLayoutInit(theGlobals) != noErr) {
         DBGS("\pENC624J600 initialisation failed");
         error = openErr;
         goto done;
       }
 
+      /* Find the fastest way to copy data to and from the chip on this
+      machine */
+      calibrateCopy(theGlobals);
+
+      /* Time DMA requests if we can */
+      if (trapAvailable(_Microseconds)) {
+        theGlobals->chip.dma.clock = microsecondClock;
+      }
+
       /* Install a shutdown procedure to reset the ENC624J600 as mitigation for
       issue #4 (rev0 hardware produces spurious interrupts on warm restart) */
       ShutDwnInstall(doShutdown, sdRestartOrPower);
@@ -394,6 +346,10 @@ OSErr driverOpen(__attribute__((unused)) EParamBlkPtr pb, AuxDCEPtr dce) {
                                theGlobals->info.ethernetAddress);
       }
 
+      /* Load the stats-query key, if there is one */
+      theGlobals->statsMinInterval = 6;
+      loadStatsKey(theGlobals, dce->dCtlSlot);
+
 #if defined(TARGET_SE30)
       /* Install our interrupt handler using the Slot Manager */
       theGlobals->theSInt.sqType = sIQType;
@@ -431,10 +387,20 @@ OSErr driverOpen(__attribute__((unused)) EParamBlkPtr pb, AuxDCEPtr dce) {
       );
 #endif
       /* Let's go! */
+      flowControlInit(theGlobals);
+      scsiDeferInit(theGlobals);
+      housekeepingInit(theGlobals);
       enc624j600_start(&theGlobals->chip);
       enc624j600_enable_irq(&theGlobals->chip,
                             IRQ_ENABLE | IRQ_LINK | IRQ_PKT | IRQ_RX_ABORT |
-                                IRQ_PCNT_FULL | IRQ_TX | IRQ_TX_ABORT);
+                                IRQ_PCNT_FULL | IRQ_TX | IRQ_TX_ABORT |
+                                IRQ_DMA | IRQ_SOFT);
+
+      /* A stats-query key turns the responder on, and it needs somewhere to
+      build its replies. That can only be set up with interrupts running. */
+      if (theGlobals->statsEnabled && reserveDriverTx(theGlobals) != noErr) {
+        theGlobals->statsEnabled = 0;
+      }
     }
   } else {
     /* Driver was already open, nothing to do */
@@ -468,10 +434,23 @@ do it properly so that the card is in a sane state for A/UX to take over.
 OSErr driverClose(__attribute__((unused)) EParamBlkPtr pb, AuxDCEPtr dce) {
   driverGlobalsPtr theGlobals = (driverGlobalsPtr)dce->dCtlStorage;
 
+  /* Stop bridging, the other card must not keep a pointer to us */
+  doDetachBridge(theGlobals);
+
+  /* The tap's handler may belong to an application that's going away */
+  doDetachTap(theGlobals);
+
+  /* The ISR must stop writing to the overflow snapshot before it is freed */
+  doSetRxSnapshot(theGlobals, false);
+
   /* Reset the chip; this is just a 'big hammer' to stop transmitting, disable
   receive, disable interrupts etc. */
   enc624j600_reset(&theGlobals->chip);
 
+  /* Our Time Manager tasks live in the globals we're about to free */
+  scsiDeferRemove(theGlobals);
+  housekeepingRemove(theGlobals);
+
 #if defined(TARGET_SE30)
   /* Uninstall our slot interrupt handler */
   SIntRemove(&theGlobals->theSInt, dce->dCtlSlot);
@@ -497,6 +476,7 @@ OSErr driverClose(__attribute__((unused)) EParamBlkPtr pb, AuxDCEPtr dce) {
   /* Uninstall our shutdown procedure */
   ShutDwnRemove(doShutdown);
 
+  theGlobals->signature = 0;
   DisposePtr((Ptr)theGlobals);
   dce->dCtlStorage = nil;
 
@@ -517,6 +497,8 @@ be completed by a later IODone call.
 #pragma parameter __D0 driverControl(__A0, __A1)
 OSErr driverControl(EParamBlkPtr pb, AuxDCEPtr dce) {
   driverGlobalsPtr theGlobals = (driverGlobalsPtr)dce->dCtlStorage;
+  unsigned short srSave;
+
   switch (pb->csCode) {
     case ENetDelMulti: /* Delete address from multicast table */
       return doEDelMulti(theGlobals, pb);
@@ -542,16 +524,115 @@ OSErr driverControl(EParamBlkPtr pb, AuxDCEPtr dce) {
         pb->u.EParms1.eBuffSize = sizeof(theGlobals->info);
       }
 
+      /* The ISR and housekeeping fold transmit statistics too */
+      srSave = maskInterrupts();
+      foldTxStats(theGlobals);
+      restoreInterrupts(srSave);
+
       BlockMoveData(&theGlobals->info, pb->u.EParms1.ePointer,
                     pb->u.EParms1.eBuffSize);
       return noErr;
 
     case ENetSetGeneral: /* Enter 'general mode' */
       /* ENEtSetGeneral tells the driver to prepare to transmit general Ethernet
-      packets rather than only AppleTalk packets. Drivers can use this to
-      rearrange TX/RX buffer boundaries for the longer maximum frame length
-      (1536 vs. 768 bytes). We have enough buffer to always operate in general
-      mode, so this is a no-op. */
+      packets rather than only AppleTalk packets. Until then we give some of
+      the transmit buffer to the receive buffer (see buffers.c). */
+      return doSetGeneral(theGlobals, pb);
+
+    case ENCEnableImmediateWrites: /* Reserve the reply buffer */
+      return reserveReplyTx(theGlobals);
+
+    case ENCSetStatsConfig: /* Configure stats-query responder */
+      return doSetStatsConfig(theGlobals,
+                              (statsConfig *)pb->u.EParms1.ePointer);
+
+    case ENCAttachBridge: /* Start bridging to another card */
+      return doAttachBridge(theGlobals,
+                            (bridgeConfig *)pb->u.EParms1.ePointer);
+
+    case ENCDetachBridge: /* Stop bridging */
+      return doDetachBridge(theGlobals);
+
+    case ENCReadReg: /* Read register */
+    case ENCWriteReg: /* Write register */
+    case ENCReadPhy: /* Read PHY register */
+    case ENCWritePhy: /* Write PHY register */
+      /* csParam holds a pointer to the encRegister, not the encRegister
+      itself (see sethernet.h) */
+      return doReadWriteReg(theGlobals, pb->csCode,
+                            *(encRegister **)((CntrlParam *)pb)->csParam);
+
+    case ENCRegisterBatch: /* Execute a list of register operations */
+      return doRegisterBatch(theGlobals,
+                             (encRegisterBatch *)pb->u.EParms1.ePointer);
+
+    case ENCReadSRAM: /* Snapshot chip memory */
+      return doReadSRAM(theGlobals, (encSRAMRange *)pb->u.EParms1.ePointer);
+
+    case ENCEnableLoopback: /* Put PHY into loopback */
+      doSetPhyLoopback(theGlobals, true);
+      return noErr;
+
+    case ENCDisableLoopback: /* Take PHY out of loopback */
+      doSetPhyLoopback(theGlobals, false);
+      return noErr;
+
+    case ENCGetTrafficStats: /* Read frame size histograms and top talkers */
+      return doGetTrafficStats(theGlobals, pb);
+
+    case ENCClearTrafficStats: /* Reset traffic statistics */
+      doClearTrafficStats(theGlobals);
+      return noErr;
+
+    case ENCSetDuplexPolicy: /* Set duplex mismatch remedy */
+      doSetDuplexPolicy(theGlobals, ((CntrlParam *)pb)->csParam[0]);
+      return noErr;
+
+    case ENCSetFlowControl: /* Configure flow control */
+      return doSetFlowControl(theGlobals,
+                              (flowControlConfig *)pb->u.EParms1.ePointer);
+
+    case ENCAssertFlowControl: /* Manually assert or release flow control */
+      return doAssertFlowControl(theGlobals, ((CntrlParam *)pb)->csParam[0]);
+
+    case ENCGetTxLatency: /* Read transmit latency histograms */
+      return doGetTxLatency(theGlobals, pb);
+
+    case ENCClearTxLatency: /* Reset transmit latency histograms */
+      return doClearTxLatency(theGlobals);
+
+    case ENCSetInternalLoopback: /* Loop back frames to our own address */
+      theGlobals->internalLoopback = ((CntrlParam *)pb)->csParam[0] ? 1 : 0;
+      return noErr;
+
+    case ENCAttachTap: /* Attach a monitoring tap */
+      return doAttachTap(theGlobals, (tapConfig *)pb->u.EParms1.ePointer);
+
+    case ENCDetachTap: /* Detach monitoring tap */
+      return doDetachTap(theGlobals);
+
+    case ENCTestFilter: /* Time a tap filter */
+      return doTestFilter(theGlobals, (filterTest *)pb->u.EParms1.ePointer);
+
+    case ENCSetSCSIDefer: /* Configure deferral of receive during SCSI */
+      return doSetSCSIDefer(theGlobals,
+                            (scsiDeferConfig *)pb->u.EParms1.ePointer);
+
+    case ENCGetLinkRates: /* Read packet, byte and utilisation rates */
+      return doGetLinkRates(theGlobals, pb);
+
+    case ENCSetHousekeeping: /* Configure periodic housekeeping */
+      return doSetHousekeeping(theGlobals,
+                               (housekeepingConfig *)pb->u.EParms1.ePointer);
+
+    case ENCSetRxSnapshot: /* Snapshot the receive buffer on overflow */
+      return doSetRxSnapshot(theGlobals, ((CntrlParam *)pb)->csParam[0] != 0);
+
+    case ENCGetRxSnapshot: /* Read receive overflow snapshot */
+      return doGetRxSnapshot(theGlobals, pb);
+
+    case accRun: /* Periodic call from SystemTask (see housekeeping.c) */
+      housekeepingAccRun(theGlobals);
       return noErr;
 
 #if 0
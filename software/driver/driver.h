@@ -22,6 +22,7 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <MacTypes.h>
 #include <OSUtils.h>
 #include <Slots.h>
+#include <Timer.h>
 #include <stddef.h>
 
 #include "enc624j600.h"
@@ -41,11 +42,55 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 /* Number of multicast addresses to support */
 #define numberofMulticasts 8
 
-/* ENC624J600 buffer configuration. Allocate 1536 bytes for a transmit buffer
-(just enough for one frame), leaving the remainder (23040 bytes) as a receive
-buffer. */
+/* Number of distinct transmit outcomes counted by the ISR (see txstats.h) */
+#define numTxOutcomes 32
+
+/* Number of bytes of a frame that wraps around the end of the receive ring
+that a tap filter gets to look at (see tap.c) */
+#define tapBufferSize 128
+
+/* ioTrap bit that marks an immediate call (see IOReturn in header.S). The
+Device Manager has already returned from these by the time they could be
+completed asynchronously, so they must never be passed to IODone. */
+#define ioTrapNoQueue (1 << 9)
+
+/* Interrupt flag we raise ourselves to make the chip interrupt (see
+loopbackHostFrame()). The AES engine it belongs to is never used. */
+#define IRQ_SOFT IRQ_AES
+
+/* ENC624J600 buffer configuration. The transmit buffer for ENetWrite frames
+comes first, followed by the receive buffer, which runs to the end of memory.
+
+Until ENetSetGeneral is called, only AppleTalk frames (at most 768 bytes) can be
+written, so the transmit buffer is only 768 bytes and the receive buffer gets
+the rest (23808 bytes). In general mode the transmit buffer is 1536 bytes (just
+enough for one frame), leaving 23040 bytes to receive into.
+
+The driver transmit buffer (for frames generated by the driver itself, such as
+replies to stats queries, or frames forwarded when bridging) and the reply
+buffer (for immediate ENetWrite frames) are only reserved once something needs
+them, and are then carved out of the bottom of the receive buffer, above a
+full-size transmit buffer (see buffers.c). */
 #define ENC_TX_BUF_START 0x0000
-#define ENC_RX_BUF_START 0x0600
+#define ENC_TX_BUF_SIZE_APPLETALK 0x0300
+#define ENC_TX_BUF_SIZE_GENERAL 0x0600
+#define ENC_DRIVER_TX_BUF_SIZE 0x0600
+#define ENC_REPLY_TX_BUF_SIZE 0x0600
+
+/* Number of immediate ENetWrite frames that can wait in the reply buffer */
+#define txReplyQueueSize 4
+
+/* Longest frame that can be written before ENetSetGeneral */
+#define appleTalkMaxFrame ENC_TX_BUF_SIZE_APPLETALK
+
+/* Transmitter state */
+enum {
+  txIdle = 0,   /* Transmitter is idle */
+  txHost = 1,   /* Transmitting a frame from the transmit buffer (ENetWrite) */
+  txDriver = 2, /* Transmitting a frame from the driver transmit buffer */
+  txReply = 3   /* Transmitting a frame from the reply buffer (immediate
+                   ENetWrite) */
+};
 
 /* Protocol-handler protocol numbers are usually Ethernet II ethertypes except
 for: */
@@ -127,6 +172,9 @@ typedef enum logEvent {
   txReturnIODoneEvent = 0x8003,
   txTaskAlreadyDeferred = 0x8004,
   txTaskAlreadyDeferredReturn = 0x8005,
+  txDriverEvent = 0x8006,
+  txLoopbackEvent = 0x8007,
+  txReplyEvent = 0x8008,
   rxEvent = 0x8010,
   rxDoneEvent = 0x8011,
   readRxBufEvent = 0x8020
@@ -144,18 +192,32 @@ typedef struct eventLog {
 } eventLog;
 #endif
 
+/* Value of the signature field in driverGlobals, used by the dcmd to make sure
+that it's looking at our globals and not some other .ENET driver's */
+#define driverGlobalsSignature 0x53456472 /* 'SEdr' */
+
 /* Global state used by the driver */
 typedef struct driverGlobals {
   enc624j600 chip; /* Ethernet chip state */
 
+  /* Copy kernels chosen for this card's memory (see copy.c). readpacket.S
+  expects chipReadCopy to come straight after chip. */
+  void (*chipReadCopy)(void);
+  void (*chipWriteCopy)(void);
+
   SlotIntQElement theSInt;      /* Our slot interrupt queue entry */
   AuxDCEPtr driverDCE;          /* Our device control entry */
+  unsigned long signature;      /* driverGlobalsSignature */
   
   /* Flags */
   unsigned short hasGestalt : 1;  /* Gestalt Manager is available */
   unsigned short hasSlotMgr : 1;  /* Slot Manager is available */
   unsigned short vmEnabled : 1;   /* Virtual Memory is enabled */
   unsigned short macSE : 1;       /* Running on a Macintosh SE */
+  unsigned short hasEventLog : 1; /* Event log is present (debug build) */
+  unsigned short phyLoopback : 1; /* PHY is in loopback mode */
+  unsigned short hasTxLatency : 1; /* Transmit latency is being measured
+                                      (TX_LATENCY build, see txlatency.h) */
 
   protocolHandlerEntry
       protocolHandlers[numberOfPhs];             /* Protocol handler table */
@@ -163,6 +225,141 @@ typedef struct driverGlobals {
 
   receiveHeaderArea rha;        /* Buffer for receved packet headers */
 
+  /* Transmit state. The transmit buffer and driver transmit buffer can each
+  hold one frame, and the reply buffer a few; whichever ones are not on the
+  wire wait here for the transmitter to become available. */
+  unsigned char txActive;         /* Which buffer is being transmitted */
+  unsigned char txHostQueued;     /* ENetWrite frame waiting to be sent */
+  unsigned char txDriverQueued;   /* Driver-generated frame waiting to be sent */
+  unsigned char txDriverClaimed;  /* Driver transmit buffer is being filled */
+  unsigned short txHostLength;    /* Length of queued ENetWrite frame */
+  unsigned short txDriverLength;  /* Length of queued driver-generated frame */
+  unsigned short txActiveLength;  /* Length of frame being transmitted */
+
+  /* Immediate ENetWrite frames in the reply buffer, oldest first. The buffer
+  is used as a ring, but frames never wrap round its end (see transmit.c). */
+  struct {
+    unsigned short offset[txReplyQueueSize]; /* Where each frame starts */
+    unsigned short length[txReplyQueueSize]; /* Its length */
+    unsigned char ready[txReplyQueueSize];   /* Copied in, ready to send */
+    unsigned char head;                      /* Oldest frame */
+    unsigned char count;                     /* Number of frames */
+    unsigned short tail;                     /* Where the next frame goes */
+  } reply;
+
+  /* Buffer layout (see buffers.c) */
+  unsigned short generalMode : 1;        /* ENetSetGeneral has been called */
+  unsigned short generalModePending : 1; /* Switch to general mode waiting for
+                                            userISR() */
+  unsigned short driverTxStart; /* Driver transmit buffer, 0 if not reserved */
+  unsigned short replyTxStart;  /* Reply buffer, 0 if not reserved */
+  unsigned short reservedEnd;   /* End of the buffers reserved so far, 0 if
+                                   none */
+
+  /* Internal loopback of frames sent to our own address (see transmit.c) */
+  unsigned short internalLoopback : 1; /* Loop back frames to our own address */
+  unsigned short loopbackPending : 1;  /* Looped-back ENetWrite frame waiting to
+                                          be delivered by userISR() */
+  unsigned short loopbackLength;       /* Length of pending looped-back frame */
+
+  /* Stats-query responder configuration (see statsquery.c) */
+  unsigned short statsEnabled : 1;  /* Respond to stats queries */
+  Byte statsKey[statsKeyLength];    /* Key that queries must present */
+  unsigned short statsMinInterval;  /* Minimum ticks between queries */
+  unsigned long statsLastQuery;     /* Tick count at last query let through */
+
+  trafficStats traffic;             /* Frame size and top-talker stats */
+
+  /* Transmit latency (see txlatency.h). Always present so that the layout of
+  driverGlobals doesn't depend on build options. */
+  txLatencyStats txLatency;         /* Latency histograms */
+  struct {
+    unsigned long entry;            /* Microseconds at doEWrite() entry */
+    unsigned long copied;           /* ... after copy into transmit buffer */
+    unsigned long started;          /* ... when transmit was started */
+  } txStamps;
+
+  /* Transmit outcome counts, indexed by txOutcome(ETXSTAT), and the counts
+  already folded into info (see txstats.h) */
+  unsigned long txOutcomes[numTxOutcomes];
+  unsigned long txOutcomesFolded[numTxOutcomes];
+
+  /* Duplex mismatch detection (see duplex.c) */
+  struct {
+    unsigned long windowStart;      /* Tick count at start of window */
+    unsigned long txFrames;         /* Counter values at start of window */
+    unsigned long lateCollisions;
+    unsigned long rxFrames;
+    unsigned long rxErrors;
+    unsigned char badWindows;       /* Consecutive windows with symptoms */
+    unsigned char policy;           /* duplexPolicyXXX */
+    unsigned char forced;           /* Autonegotiation turned off by us */
+    unsigned char renegotiated;     /* Already tried renegotiating */
+    unsigned char badFramesAccepted; /* Chip passes up bad-CRC and runt
+                                        frames */
+    unsigned long rxGoodFrames;     /* Good frames received, before address
+                                       filtering. Unlike the traffic
+                                       histograms, never cleared. */
+  } duplex;
+
+  unsigned short flowControlAsserted : 1; /* Flow control was asserted last
+                                             time we looked (see
+                                             flowcontrol.c) */
+
+  /* Bridge state (see bridge.c) */
+  struct driverGlobals *bridgePeer; /* Globals of the card we're bridging to,
+                                       nil if not bridging */
+  struct bridgeTable *bridgeTable;  /* MAC address table, shared with peer */
+  unsigned short bridgeRxStalled : 1; /* Receive stalled waiting for peer's
+                                         driver transmit buffer */
+
+  /* Monitoring tap (see tap.c) */
+  struct {
+    void *handler;                  /* Tap's receive routine, nil if no tap */
+    struct bpfFilter *filter;       /* Tap's filter, nil to accept everything */
+    unsigned short promiscuous : 1; /* Tap turned on promiscuous mode */
+    Byte buffer[tapBufferSize] __attribute__((aligned (2))); /* Start of
+                                       frames that wrap around the end of the
+                                       receive ring, for filtering */
+  } tap;
+
+  /* SCSI co-scheduling (see scsidefer.c) */
+  struct {
+    TMTask timer;                   /* Polls for the end of a SCSI
+                                       transaction */
+    unsigned short enabled : 1;     /* Defer receive during SCSI transactions */
+    unsigned short deferred : 1;    /* Receive is deferred, IRQ_PKT disabled */
+    unsigned short maxDeferMs;      /* Longest to defer receive for */
+    unsigned short deferredMs;      /* How long receive has been deferred */
+  } scsi;
+
+  /* Link utilisation metering (see linkrate.c) */
+  struct {
+    unsigned long lastUpdate;       /* TickCount() at the last update */
+    linkRates rates;                /* Totals and rates, as reported */
+    unsigned long lastTxPackets;    /* Totals at the last update */
+    unsigned long lastRxPackets;
+    unsigned long lastTxBytes;
+    unsigned long lastRxBytes;
+    long txPacketAvg;               /* Moving averages, scaled (see
+                                       linkrate.c) */
+    long rxPacketAvg;
+    long txByteAvg;
+    long rxByteAvg;
+  } link;
+
+  /* Periodic housekeeping (see housekeeping.c) */
+  struct {
+    TMTask timer;                   /* Stands in for accRun if it stops */
+    unsigned long lastRun;          /* Tick count at the last run */
+    unsigned short periodTicks;     /* Ticks between runs */
+    unsigned short sramBytesPerRun; /* SRAM test budget, 0 if off */
+    unsigned short sramOffset;      /* Where the SRAM test got up to */
+  } housekeeping;
+
+  /* Receive overflow snapshot (see rxsnapshot.c), nil unless turned on */
+  rxSnapshot *rxSnapshot;
+
   /* The driverInfo struct is packed (dictated by the Ethernet driver API).
   Align its start point to avoid awkwardness in accessing its longword counter
   fields. */
@@ -0,0 +1,181 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Events.h>
+#include <MacTypes.h>
+
+#include "driver.h"
+#include "duplex.h"
+#include "enc624j600.h"
+#include "util.h"
+
+#define likely(x)    __builtin_expect (!!(x), 1)
+#define unlikely(x)  __builtin_expect (!!(x), 0)
+
+/* Length of a monitoring window */
+#define duplexWindowTicks (5 * 60)
+
+/* Consecutive bad windows before we call it a mismatch */
+#define duplexBadWindows 2
+
+/* A window is bad if it has at least duplexMinErrors errors, and at least one
+error per duplexErrorRatio good frames. A healthy link should have none at all,
+but an occasional glitch isn't worth acting on. */
+#define duplexMinErrors 3
+#define duplexErrorRatio 64
+
+/* Have the chip pass frames with bad CRCs and runts up to us only while
+they're evidence we're looking for: at full duplex, with monitoring turned on.
+The chip has no receive error counters of its own, so at other times they go
+uncounted. */
+static void duplexUpdateFilter(driverGlobalsPtr theGlobals) {
+  Boolean wanted = theGlobals->duplex.policy != duplexPolicyOff &&
+                   (theGlobals->chip.link_state & LINK_FULLDPX) != 0;
+
+  if (wanted != theGlobals->duplex.badFramesAccepted) {
+    enc624j600_accept_bad_frames(&theGlobals->chip, wanted);
+    theGlobals->duplex.badFramesAccepted = wanted;
+  }
+}
+
+/* Start a new monitoring window */
+static void duplexNewWindow(driverGlobalsPtr theGlobals, unsigned long now,
+                            unsigned long rxFrames) {
+  theGlobals->duplex.windowStart = now;
+  theGlobals->duplex.txFrames = theGlobals->info.txFrameCount;
+  theGlobals->duplex.lateCollisions = theGlobals->info.lateCollisions;
+  theGlobals->duplex.rxFrames = rxFrames;
+  theGlobals->duplex.rxErrors =
+      theGlobals->info.fcsErrors + theGlobals->info.rxRunt;
+}
+
+/* Do something about a detected mismatch, according to policy. halfDuplex is
+the duplex mode that we're currently in. Each remedy is only tried once per
+ENCSetDuplexPolicy call, so that we don't bounce the link up and down
+forever. */
+static void duplexRemediate(driverGlobalsPtr theGlobals, Boolean halfDuplex) {
+  if (theGlobals->duplex.forced) {
+    /* Nothing more we can do */
+    return;
+  }
+
+  switch (theGlobals->duplex.policy) {
+    case duplexPolicyForce:
+      if (theGlobals->duplex.renegotiated) {
+        /* Renegotiating didn't help, so the other end must be hard-wired to
+        the opposite of what we've got */
+        enc624j600_force_duplex(&theGlobals->chip, halfDuplex);
+        theGlobals->duplex.forced = 1;
+        break;
+      }
+      /* Try renegotiating first */
+      /* fall through */
+    case duplexPolicyRenegotiate:
+      if (theGlobals->duplex.renegotiated) {
+        return;
+      }
+      enc624j600_renegotiate(&theGlobals->chip);
+      theGlobals->duplex.renegotiated = 1;
+      break;
+    default:
+      return;
+  }
+  theGlobals->info.duplexRemediations++;
+}
+
+/*
+Check for the signature of a duplex mismatch. Called from housekeeping(), which
+has just brought the transmit counters in info up to date.
+
+At half duplex, late collisions mean that the other end is transmitting without
+regard for us, i.e. it thinks the link is full duplex. At full duplex, CRC
+errors and runts mean that the other end is aborting frames when it sees our
+transmissions as collisions, i.e. it thinks the link is half duplex.
+*/
+void duplexCheck(driverGlobalsPtr theGlobals) {
+  unsigned long now = TickCount();
+  unsigned long rxFrames;
+  unsigned long good;
+  unsigned long errors;
+  Boolean halfDuplex;
+
+  duplexUpdateFilter(theGlobals);
+
+  if (unlikely(theGlobals->duplex.policy == duplexPolicyOff) ||
+      likely(now - theGlobals->duplex.windowStart < duplexWindowTicks)) {
+    return;
+  }
+
+  rxFrames = theGlobals->duplex.rxGoodFrames;
+
+  if (theGlobals->chip.link_state == LINK_DOWN) {
+    /* Nothing to measure */
+    theGlobals->duplex.badWindows = 0;
+    duplexNewWindow(theGlobals, now, rxFrames);
+    return;
+  }
+
+  halfDuplex = !(theGlobals->chip.link_state & LINK_FULLDPX);
+  if (halfDuplex) {
+    good = theGlobals->info.txFrameCount - theGlobals->duplex.txFrames;
+    errors = theGlobals->info.lateCollisions -
+             theGlobals->duplex.lateCollisions;
+  } else {
+    good = rxFrames - theGlobals->duplex.rxFrames;
+    errors = theGlobals->info.fcsErrors + theGlobals->info.rxRunt -
+             theGlobals->duplex.rxErrors;
+  }
+
+  if (errors >= duplexMinErrors && errors * duplexErrorRatio >= good) {
+    theGlobals->duplex.badWindows++;
+    if (theGlobals->duplex.badWindows == duplexBadWindows) {
+      DBGP("Duplex mismatch suspected (%lu errors, %lu frames)", errors, good);
+      theGlobals->info.duplexMismatch = 1;
+      theGlobals->info.duplexMismatchEvents++;
+      duplexRemediate(theGlobals, halfDuplex);
+      theGlobals->duplex.badWindows = 0;
+    }
+  } else if (good > 0) {
+    /* Clean window with traffic, all's well */
+    theGlobals->duplex.badWindows = 0;
+    theGlobals->info.duplexMismatch = 0;
+  }
+
+  duplexNewWindow(theGlobals, now, rxFrames);
+}
+
+/* Control call handler for ENCSetDuplexPolicy */
+void doSetDuplexPolicy(driverGlobalsPtr theGlobals, unsigned short policy) {
+  unsigned short old_eie;
+
+  old_eie = enc624j600_disable_irq(&theGlobals->chip, IRQ_ENABLE);
+  theGlobals->duplex.policy = policy;
+  theGlobals->duplex.renegotiated = 0;
+  if (policy == duplexPolicyOff) {
+    /* Forget anything seen so far, it won't be followed up */
+    theGlobals->duplex.badWindows = 0;
+    theGlobals->info.duplexMismatch = 0;
+  }
+  duplexUpdateFilter(theGlobals);
+  if (theGlobals->duplex.forced) {
+    /* Give autonegotiation another chance */
+    theGlobals->duplex.forced = 0;
+    enc624j600_renegotiate(&theGlobals->chip);
+  }
+  enc624j600_enable_irq(&theGlobals->chip, old_eie);
+}
@@ -0,0 +1,112 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Errors.h>
+#include <MacTypes.h>
+
+#include "driver.h"
+#include "enc624j600.h"
+#include "enc624j600_registers.h"
+#include "flowcontrol.h"
+#include "multicast.h"
+
+#define likely(x)    __builtin_expect (!!(x), 1)
+#define unlikely(x)  __builtin_expect (!!(x), 0)
+
+/* Pause time used if the caller doesn't specify one. This is the chip's reset
+value for EPAUS. */
+#define defaultPauseQuanta 0x1000
+
+/* Set up flow control before the chip is started. Called from driverOpen(). */
+void flowControlInit(driverGlobalsPtr theGlobals) {
+  /* Pass MAC control frames up to the receive filters rather than eating them
+  in the MAC, so that we can count received PAUSE frames. They are still acted
+  on by the MAC either way. */
+  ENC624J600_SET_BITS(theGlobals->chip.base_address, MACON1, MACON1_PASSALL);
+  updateMulticastHashTable(theGlobals);
+
+  /* Automatic full-duplex flow control, no backpressure. Applied by
+  enc624j600_start() when it syncs duplex settings. */
+  theGlobals->chip.flow_control = FLOW_CONTROL_AUTO;
+  theGlobals->chip.backpressure = 0;
+  ENC624J600_WRITE_REG(theGlobals->chip.base_address, EPAUS,
+                       SWAPBYTES(defaultPauseQuanta));
+}
+
+/*
+Count the times that the chip starts asserting flow control. The chip doesn't
+tell us when it sends a PAUSE frame, so this counts flow control episodes rather
+than frames. Called from userISR(), which runs after every batch of received
+frames, i.e. exactly when the receive buffer may have crossed a watermark.
+*/
+void flowControlPoll(driverGlobalsPtr theGlobals) {
+  Boolean asserted;
+
+  if (likely(theGlobals->chip.flow_control != FLOW_CONTROL_AUTO)) {
+    /* Off, or counted by doAssertFlowControl() */
+    return;
+  }
+  if (!(theGlobals->chip.link_state & LINK_FULLDPX) &&
+      !theGlobals->chip.backpressure) {
+    /* Automatic flow control is disabled at half duplex */
+    return;
+  }
+
+  asserted = enc624j600_flow_control_asserted(&theGlobals->chip);
+  if (unlikely(asserted && !theGlobals->flowControlAsserted)) {
+    theGlobals->info.pauseTxAsserts++;
+  }
+  theGlobals->flowControlAsserted = asserted;
+}
+
+/* Control call handler for ENCSetFlowControl */
+OSStatus doSetFlowControl(driverGlobalsPtr theGlobals,
+                          const flowControlConfig *config) {
+  unsigned short old_eie;
+  unsigned short quanta;
+
+  if (config == nil || config->mode > flowControlManual) {
+    return paramErr;
+  }
+  quanta = config->pauseQuanta ? config->pauseQuanta : defaultPauseQuanta;
+
+  /* enc624j600_duplex_sync() is also called from the ISR on link changes */
+  old_eie = enc624j600_disable_irq(&theGlobals->chip, IRQ_ENABLE);
+  /* flowControlXXX values match FLOW_CONTROL_XXX */
+  enc624j600_set_flow_control(&theGlobals->chip, config->mode,
+                              config->halfDuplexBackpressure != 0, quanta);
+  theGlobals->flowControlAsserted = 0;
+  enc624j600_enable_irq(&theGlobals->chip, old_eie);
+  return noErr;
+}
+
+/* Control call handler for ENCAssertFlowControl */
+OSStatus doAssertFlowControl(driverGlobalsPtr theGlobals, Boolean on) {
+  unsigned short old_eie;
+
+  if (theGlobals->chip.flow_control != FLOW_CONTROL_MANUAL) {
+    return controlErr;
+  }
+
+  old_eie = enc624j600_disable_irq(&theGlobals->chip, IRQ_ENABLE);
+  if (enc624j600_assert_flow_control(&theGlobals->chip, on) && on) {
+    theGlobals->info.pauseTxAsserts++;
+  }
+  enc624j600_enable_irq(&theGlobals->chip, old_eie);
+  return noErr;
+}
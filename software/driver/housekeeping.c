@@ -0,0 +1,254 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Periodic housekeeping
+
+Some of the driver's work isn't urgent, but needs doing every so often: folding
+transmit outcome counts into driverInfo, updating the link rate averages once a
+second, checking for a duplex mismatch, noticing a link change whose interrupt
+never arrived, and testing the chip's SRAM for faults. Rather than tacking it
+onto the end of every interrupt, it is done here, a couple of times a second.
+
+The driver asks for periodic time (dNeedTime), so the Device Manager calls
+driverControl() with csCode accRun from SystemTask every dCtlDelay ticks. That's
+at task level, but only while applications are calling SystemTask or
+WaitNextEvent, and under the SE/30's .ENET shim the flags in our own header may
+not be the ones in effect. So a Time Manager task keeps an eye on things and
+runs housekeeping itself if accRun hasn't done so for two periods. The SRAM test
+is left out of those runs, since they happen at interrupt time.
+
+While housekeeping runs, the chip's interrupts are disabled, so the ISR sees the
+results all at once.
+*/
+
+#include <Devices.h>
+#include <Errors.h>
+#include <Events.h>
+#include <MacTypes.h>
+#include <OSUtils.h>
+#include <Timer.h>
+#include <stddef.h>
+
+#include "driver.h"
+#include "duplex.h"
+#include "enc624j600.h"
+#include "enc624j600_registers.h"
+#include "housekeeping.h"
+#include "linkrate.h"
+#include "txstats.h"
+#include "util.h"
+
+#define likely(x)    __builtin_expect (!!(x), 1)
+#define unlikely(x)  __builtin_expect (!!(x), 0)
+
+/* Ticks between runs, if ENCSetHousekeeping doesn't say */
+#define housekeepingDefaultTicks 30
+
+/* Bytes of SRAM to test per run by default */
+#define housekeepingDefaultSRAMBytes 64
+
+/* Words of SRAM tested with interrupts masked. Each word takes five accesses
+to the chip, so this keeps the masked time well under what the serial ports can
+put up with. */
+#define sramChunkWords 8
+
+/* Milliseconds in a number of ticks */
+static inline unsigned long ticksToMs(unsigned short ticks) {
+  return ((unsigned long)ticks * 50) / 3;
+}
+
+/* If the chip says that the link is up or down and we think otherwise, we
+missed an IRQ_LINK. Catch up the way the ISR would have. */
+static void pollLink(driverGlobalsPtr theGlobals) {
+  Boolean up;
+
+  if (enc624j600_read_irqstate(&theGlobals->chip) & IRQ_LINK) {
+    /* Pending, the ISR will see to it */
+    return;
+  }
+  up = (ENC624J600_READ_REG(theGlobals->chip.base_address, ESTAT) &
+        ESTAT_PHYLNK) != 0;
+  if (unlikely(up != (theGlobals->chip.link_state != LINK_DOWN))) {
+    DBGP("Missed link change, link now %s", up ? "up" : "down");
+    enc624j600_duplex_sync(&theGlobals->chip);
+    theGlobals->info.missedLinkChanges++;
+  }
+}
+
+/* Nothing may touch the transmit buffers while they're being tested: the
+transmitter must be idle, no frames may be waiting to go (or being copied into
+the reply buffer), and the DMA engine (which copies between buffers) must be
+quiet. Call with interrupts masked. */
+static Boolean txBuffersIdle(const driverGlobalsPtr theGlobals) {
+  return theGlobals->txActive == txIdle && !theGlobals->txHostQueued &&
+         !theGlobals->txDriverQueued && !theGlobals->txDriverClaimed &&
+         theGlobals->reply.count == 0 && theGlobals->chip.dma.head == nil;
+}
+
+/*
+Test up to the per-run budget of the transmit buffers (everything below the
+receive buffer), carrying on from where the last run left off. Each word is
+complemented, read back, restored and read back again, with interrupts masked,
+so that nothing else ever sees the test pattern. Returns without testing
+anything if the transmit buffers are in use.
+
+The receive buffer is written by the chip itself, so it can't be tested behind
+its back like this.
+*/
+static void testSRAM(driverGlobalsPtr theGlobals) {
+  volatile unsigned short *word;
+  unsigned short limit;
+  unsigned short remaining;
+  unsigned short chunk;
+  unsigned short i;
+  unsigned short saved;
+  unsigned short errors = 0;
+  unsigned short srSave;
+
+  limit = theGlobals->chip.rxbuf_start - theGlobals->chip.base_address;
+  remaining = theGlobals->housekeeping.sramBytesPerRun / 2;
+
+  while (remaining > 0) {
+    if (theGlobals->housekeeping.sramOffset >= limit) {
+      theGlobals->housekeeping.sramOffset = 0;
+    }
+    chunk = (limit - theGlobals->housekeeping.sramOffset) / 2;
+    if (chunk > sramChunkWords) {
+      chunk = sramChunkWords;
+    }
+    if (chunk > remaining) {
+      chunk = remaining;
+    }
+
+    srSave = maskInterrupts();
+    if (!txBuffersIdle(theGlobals)) {
+      restoreInterrupts(srSave);
+      break;
+    }
+    word = (volatile unsigned short *)enc624j600_addr_to_ptr(
+        &theGlobals->chip, theGlobals->housekeeping.sramOffset);
+    for (i = 0; i < chunk; i++, word++) {
+      saved = *word;
+      *word = ~saved;
+      if (*word != (unsigned short)~saved) {
+        errors++;
+      }
+      *word = saved;
+      if (*word != saved) {
+        errors++;
+      }
+    }
+    restoreInterrupts(srSave);
+
+    theGlobals->housekeeping.sramOffset += chunk * 2;
+    theGlobals->info.sramBytesTested += chunk * 2;
+    remaining -= chunk;
+  }
+
+  if (unlikely(errors)) {
+    DBGP("SRAM test: %u errors", errors);
+    theGlobals->info.sramErrors += errors;
+  }
+}
+
+/* Do a round of housekeeping. testMemory is false when called at interrupt
+time. */
+static void housekeeping(driverGlobalsPtr theGlobals, Boolean testMemory) {
+  unsigned short old_eie;
+  unsigned short srSave;
+
+  theGlobals->housekeeping.lastRun = TickCount();
+  old_eie = enc624j600_disable_irq(&theGlobals->chip, IRQ_ENABLE);
+
+  /* ENetGetInfo and stats queries fold transmit statistics too */
+  srSave = maskInterrupts();
+  foldTxStats(theGlobals);
+  restoreInterrupts(srSave);
+
+  linkRateUpdate(theGlobals);
+  duplexCheck(theGlobals);
+  pollLink(theGlobals);
+
+  if (testMemory && theGlobals->housekeeping.sramBytesPerRun) {
+    testSRAM(theGlobals);
+  }
+
+  enc624j600_enable_irq(&theGlobals->chip, old_eie);
+}
+
+/* Time Manager task, called with A1 pointing at our TMTask. Runs housekeeping
+if accRun has let it lapse. */
+#pragma parameter housekeepingTask(__A1)
+static void housekeepingTask(TMTask *task) {
+  driverGlobalsPtr theGlobals = (driverGlobalsPtr)(
+      (Byte *)task - offsetof(driverGlobals, housekeeping.timer));
+  unsigned short period = theGlobals->housekeeping.periodTicks;
+
+  if (TickCount() - theGlobals->housekeeping.lastRun >= 2UL * period) {
+    theGlobals->info.housekeepingTimerRuns++;
+    housekeeping(theGlobals, false);
+  }
+  PrimeTime((QElemPtr)task, ticksToMs(period));
+}
+
+/* Tell the Device Manager how often to call us */
+static void setPeriod(driverGlobalsPtr theGlobals, unsigned short ticks) {
+  theGlobals->housekeeping.periodTicks = ticks;
+  theGlobals->driverDCE->dCtlDelay = ticks;
+  theGlobals->driverDCE->dCtlFlags |= dNeedTimeMask;
+}
+
+/* Start periodic housekeeping. Called from driverOpen(). */
+void housekeepingInit(driverGlobalsPtr theGlobals) {
+  setPeriod(theGlobals, housekeepingDefaultTicks);
+  theGlobals->housekeeping.sramBytesPerRun = housekeepingDefaultSRAMBytes;
+  theGlobals->housekeeping.sramOffset = 0;
+  theGlobals->housekeeping.lastRun = TickCount();
+  theGlobals->link.lastUpdate = theGlobals->housekeeping.lastRun;
+  theGlobals->housekeeping.timer.tmAddr = (TimerUPP)housekeepingTask;
+  InsTime((QElemPtr)&theGlobals->housekeeping.timer);
+  PrimeTime((QElemPtr)&theGlobals->housekeeping.timer,
+            ticksToMs(housekeepingDefaultTicks));
+}
+
+/* Stop periodic housekeeping. Called from driverClose(). */
+void housekeepingRemove(driverGlobalsPtr theGlobals) {
+  theGlobals->driverDCE->dCtlFlags &= ~dNeedTimeMask;
+  RmvTime((QElemPtr)&theGlobals->housekeeping.timer);
+}
+
+/* Control call handler for accRun */
+void housekeepingAccRun(driverGlobalsPtr theGlobals) {
+  theGlobals->info.housekeepingRuns++;
+  housekeeping(theGlobals, true);
+}
+
+/* Control call handler for ENCSetHousekeeping. The Time Manager task picks up
+the new period next time it runs. */
+OSStatus doSetHousekeeping(driverGlobalsPtr theGlobals,
+                           const housekeepingConfig *config) {
+  if (config == nil || config->sramBytesPerRun & 1) {
+    return paramErr;
+  }
+
+  setPeriod(theGlobals, config->periodTicks ? config->periodTicks
+                                            : housekeepingDefaultTicks);
+  theGlobals->housekeeping.sramBytesPerRun = config->sramBytesPerRun;
+  return noErr;
+}
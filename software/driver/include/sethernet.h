@@ -27,23 +27,649 @@ enum {
   ENCWritePhy = 0x7003, /* Write PHY register, csParam is encRegister* */
 
   ENCEnableLoopback = 0x7004, /* Set PHY to loopback mode, csParam unused */
-  ENCDisableLoopback = 0x7005 /* Take PHY out of loopback, csParam unused */
+  ENCDisableLoopback = 0x7005, /* Take PHY out of loopback, csParam unused */
+
+  ENCSetStatsConfig = 0x7006, /* Configure stats-query responder, ePointer is
+                                 statsConfig* (nil to disable responder) */
+
+  ENCAttachBridge = 0x7007, /* Bridge frames to another SEthernet card,
+                               ePointer is bridgeConfig* */
+  ENCDetachBridge = 0x7008, /* Stop bridging, csParam unused */
+
+  ENCSetInternalLoopback = 0x7009, /* Deliver frames sent to our own address
+                                      inside the driver rather than over the
+                                      wire, csParam[0] is 1 to enable, 0 to
+                                      disable */
+
+  ENCRegisterBatch = 0x700a, /* Execute a list of register operations
+                                atomically, ePointer is encRegisterBatch* */
+  ENCReadSRAM = 0x700b,      /* Snapshot a range of chip memory, ePointer is
+                                encSRAMRange* */
+
+  ENCGetTrafficStats = 0x700c,  /* Read frame size histograms and top talkers,
+                                   ePointer is trafficStats*, eBuffSize its
+                                   size (as for ENetGetInfo) */
+  ENCClearTrafficStats = 0x700d, /* Reset traffic statistics, csParam unused */
+
+  ENCSetDuplexPolicy = 0x700e,   /* Set response to a duplex mismatch,
+                                    csParam[0] is duplexPolicyXXX */
+
+  ENCSetFlowControl = 0x700f,    /* Configure flow control, ePointer is
+                                    flowControlConfig* */
+  ENCAssertFlowControl = 0x7010, /* Assert (csParam[0] = 1) or release
+                                    (csParam[0] = 0) flow control, in
+                                    flowControlManual mode only */
+
+  ENCGetTxLatency = 0x7011,   /* Read transmit latency histograms, ePointer is
+                                 txLatencyStats*, eBuffSize its size. Returns
+                                 controlErr unless the driver was built with
+                                 TX_LATENCY. */
+  ENCClearTxLatency = 0x7012, /* Reset transmit latency histograms, csParam
+                                 unused */
+
+  ENCAttachTap = 0x7013,  /* Attach a monitoring tap, ePointer is tapConfig* */
+  ENCDetachTap = 0x7014,  /* Detach monitoring tap, csParam unused */
+  ENCTestFilter = 0x7015, /* Time a tap filter against a sample frame, ePointer
+                             is filterTest* */
+
+  ENCSetSCSIDefer = 0x7016, /* Configure deferral of receive work during SCSI
+                               transactions, ePointer is scsiDeferConfig* */
+
+  ENCGetLinkRates = 0x7017, /* Read packet, byte and utilisation rates,
+                               ePointer/eBuffSize as for ENetGetInfo, buffer
+                               receives linkRates */
+
+  ENCSetHousekeeping = 0x7018, /* Configure periodic housekeeping, ePointer is
+                                  housekeepingConfig* */
+
+  ENCSetRxSnapshot = 0x7019, /* Take a snapshot of the receive buffer on the
+                                next overflow (csParam[0] = 1, discarding any
+                                snapshot already taken) or stop taking them
+                                (csParam[0] = 0) */
+  ENCGetRxSnapshot = 0x701a, /* Read the receive overflow snapshot,
+                                ePointer/eBuffSize as for ENetGetInfo, buffer
+                                receives rxSnapshot. Returns controlErr unless
+                                snapshots are turned on. */
+
+  ENCEnableImmediateWrites = 0x701b /* Reserve a buffer for immediate ENetWrite
+                                       calls, which fail with memFullErr until
+                                       this is done. csParam unused. */
+};
+
+/*
+Frame size limits
+
+Until ENetSetGeneral is called, the driver only accepts ENetWrite frames of up
+to 768 bytes (enough for any AppleTalk frame), and fails longer ones with
+eLenErr. After ENetSetGeneral, frames of up to 1514 bytes (not counting the
+FCS) are accepted. The driver uses the difference to give the receive buffer
+more room in the meantime.
+
+The stats-query responder, bridging and ENCTestFilter share a driver transmit
+buffer, and immediate ENetWrite calls need a reply buffer. Each is taken from
+the receive buffer when first needed, and kept until the driver is closed.
+Setting one up from inside a protocol handler fails with controlErr; try again
+later.
+*/
+
+/*
+Stats-query protocol
+
+The driver answers stats queries sent to it on a private ethertype, without
+involving any software running on the Mac. A query is an Ethernet frame (unicast
+to us, or broadcast to poll a whole segment) with the ethertype
+statsQueryEthertype, with a statsQuery structure as its payload. The driver
+replies with a statsReply structure, followed by infoLength bytes of driverInfo
+(see below).
+
+Replies are only sent if the key in the query matches the driver's configured
+key. The key is loaded at driver open time from a 'skey' resource with an ID
+corresponding to the card's slot (the same convention as the 'eadr' resource),
+or set with the ENCSetStatsConfig Control call. With no key configured, queries
+are ignored. Note that the key is sent in the clear - it keeps casual observers
+out, but is no defense against anyone who can capture traffic on the segment.
+
+All multi-byte values are big-endian.
+*/
+
+/* IEEE 802 'Local Experimental Ethertype 1' */
+#define statsQueryEthertype 0x88b5
+
+/* Resource type for stats-query key ('skey') */
+#define statsKeyRType 0x736b6579
+
+#define statsMagic 0x53457374 /* 'SEst' */
+#define statsProtocolVersion 2
+#define statsKeyLength 8
+
+enum {
+  statsOpQuery = 1, /* Query, sent to driver */
+  statsOpReply = 2  /* Reply, sent by driver */
+};
+
+/* Stats query payload */
+struct statsQuery {
+  unsigned long magic;       /* statsMagic */
+  unsigned char version;     /* statsProtocolVersion */
+  unsigned char op;          /* statsOpQuery */
+  unsigned short seq;        /* Sequence number, echoed in reply */
+  Byte key[statsKeyLength];  /* Key */
+} __attribute__((packed));
+typedef struct statsQuery statsQuery;
+
+/* Stats reply payload, followed by a driverInfo snapshot */
+struct statsReply {
+  unsigned long magic;       /* statsMagic */
+  unsigned char version;     /* statsProtocolVersion */
+  unsigned char op;          /* statsOpReply */
+  unsigned short seq;        /* Sequence number from query */
+  unsigned long ticks;       /* Value of TickCount() when reply was sent */
+  unsigned short infoVersion; /* driverInfoVersion of the data that follows */
+  unsigned short infoLength; /* Length of driverInfo data that follows */
+} __attribute__((packed));
+typedef struct statsReply statsReply;
+
+/* Parameters for ENCSetStatsConfig */
+struct statsConfig {
+  Byte key[statsKeyLength];     /* Key that queries must present */
+  unsigned short minInterval;   /* Minimum interval between queries, in ticks.
+                                   Queries arriving sooner are dropped unread,
+                                   which limits the time spent on them. */
 };
+typedef struct statsConfig statsConfig;
+
+/*
+Parameters for ENCAttachBridge
+
+Bridging joins the segments that two cards are connected to, with the driver
+forwarding frames between them at interrupt time. Both cards are put into
+promiscuous mode. A table of which side each ethernet address was last seen on
+keeps frames between hosts on the same side from being forwarded. The Mac itself
+stays an ordinary host on each segment, through each card's own address.
+
+The call can be made on either card, and sets up both.
+*/
+struct bridgeConfig {
+  short peerRefNum;         /* Driver reference number of the other card */
+  unsigned short ageTicks;  /* Forget an address if it hasn't been seen for this
+                               many ticks (0 for the default of 5 minutes) */
+};
+typedef struct bridgeConfig bridgeConfig;
+
+/*
+Register address-value pair used for register-access Control calls
 
-/* Register address-value pair used for register-access Control calls */
+Registers are given by their address in the chip's memory map (e.g. 0x7e72 for
+EIE), PHY registers by their PHY address (e.g. 0x01 for PHSTAT1). Values are
+in the datasheet's bit order.
+*/
 struct encRegister {
   unsigned short reg;
   unsigned short value;
 };
 typedef struct encRegister encRegister;
 
+/* Operations for ENCRegisterBatch */
+enum {
+  encOpRead = 0,      /* Read register into value */
+  encOpWrite = 1,     /* Write value to register */
+  encOpSetBits = 2,   /* Set bits given in value (registers below 0x7e80) */
+  encOpClearBits = 3, /* Clear bits given in value (registers below 0x7e80) */
+  encOpReadPhy = 4,   /* Read PHY register into value */
+  encOpWritePhy = 5   /* Write value to PHY register */
+};
+
+/* A single operation in an ENCRegisterBatch call */
+struct encRegisterOp {
+  unsigned short op;    /* encOpXXX */
+  unsigned short reg;   /* Register or PHY register address */
+  unsigned short value; /* Value read or to be written */
+};
+typedef struct encRegisterOp encRegisterOp;
+
+#define encMaxBatchOps 128
+
+/*
+Parameters for ENCRegisterBatch
+
+All operations are checked before any are executed; if any is invalid, the call
+fails with paramErr and nothing is touched. The operations are then executed in
+order with the card's interrupts masked, so that the driver can't change
+anything in between them. Register reads can have side effects (e.g. EGPDATA)
+just as they would from the driver.
+*/
+struct encRegisterBatch {
+  unsigned short count;   /* Number of operations (at most encMaxBatchOps) */
+  encRegisterOp ops[];    /* Operations */
+};
+typedef struct encRegisterBatch encRegisterBatch;
+
+/*
+Parameters for ENCReadSRAM
+
+Copies a range of the chip's memory (e.g. the receive FIFO), along with the
+receive FIFO pointers, with the card's interrupts masked, so that the copy and
+pointers are consistent with each other. Memory addresses run from 0x0000 to
+0x5fff.
+*/
+struct encSRAMRange {
+  unsigned short start;   /* Chip address to start copying from */
+  unsigned short length;  /* Number of bytes to copy */
+  Ptr buffer;             /* Buffer to copy into */
+  unsigned short rxHead;  /* Returned: receive FIFO head (ERXHEAD) */
+  unsigned short rxTail;  /* Returned: receive FIFO tail (ERXTAIL) */
+  unsigned short rxRead;  /* Returned: driver's receive FIFO read pointer */
+};
+typedef struct encSRAMRange encSRAMRange;
+
+/*
+Traffic statistics returned by ENCGetTrafficStats
+
+Frame sizes are counted in the RMON etherStats buckets, including the FCS:
+64, 65-127, 128-255, 256-511, 512-1023 and 1024-1518 bytes. Received frames are
+counted after CRC and length checks, but before address filtering; transmitted
+frames when they complete successfully.
+
+The top-talker table tracks which stations are sending the most broadcast and
+multicast frames. It is a small hash table indexed by source address. When two
+stations share a slot, each frame from the newcomer knocks one off the
+incumbent's count, and the newcomer takes over the slot when the count reaches
+zero. Heavy senders therefore stay in the table, but counts are approximate.
+*/
+enum {
+  sizeBucket64 = 0,
+  sizeBucket65to127 = 1,
+  sizeBucket128to255 = 2,
+  sizeBucket256to511 = 3,
+  sizeBucket512to1023 = 4,
+  sizeBucket1024to1518 = 5,
+  numSizeBuckets
+};
+
+#define numTopTalkers 16
+
+/* Entry in the top-talker table */
+struct topTalker {
+  Byte address[6];      /* Source address (all zeroes if slot unused) */
+  unsigned short unused;
+  unsigned long frames; /* Broadcast/multicast frames seen from address */
+};
+typedef struct topTalker topTalker;
+
+struct trafficStats {
+  unsigned long rxSizes[numSizeBuckets]; /* Received frames by size */
+  unsigned long txSizes[numSizeBuckets]; /* Transmitted frames by size */
+  topTalker talkers[numTopTalkers];      /* Top broadcast/multicast senders */
+};
+typedef struct trafficStats trafficStats;
+
+/*
+Duplex mismatch policies for ENCSetDuplexPolicy
+
+The driver watches for the signature of a duplex mismatch over 5-second windows:
+late collisions on transmit while we're at half duplex (the other end thinks
+the link is full duplex), or CRC errors and runts on receive while we're at full
+duplex (the other end is at half duplex and aborting frames on collisions). Two
+bad windows in a row set the duplexMismatch flag in driverInfo, and a clean
+window clears it again.
+
+The chip normally discards frames with CRC errors and runts without telling
+anyone. While the link is at full duplex and a policy other than duplexPolicyOff
+is set, the driver has it pass them up instead, so that they can be counted (in
+fcsErrors and rxRunt) and then dropped.
+
+Renegotiating fixes a mismatch caused by autonegotiation going wrong. Forcing
+fixes one caused by the other end having its duplex hard-wired: we turn off
+autonegotiation and set our duplex to whatever the symptoms say the other end
+is using.
+*/
+enum {
+  duplexPolicyReport = 0,      /* Only set the flag (default) */
+  duplexPolicyRenegotiate = 1, /* Restart autonegotiation */
+  duplexPolicyForce = 2,       /* Restart autonegotiation, then force duplex to
+                                  match the other end if the mismatch comes
+                                  back. Setting any policy restores
+                                  autonegotiation. */
+  duplexPolicyOff = 3          /* Don't watch for a mismatch at all */
+};
+
+/*
+Transmit latency histograms for ENCGetTxLatency
+
+ENetWrite frames are timestamped with the Microseconds trap on entry to the
+Control call, once copied into chip memory, when handed to the transmitter, and
+at the transmit-complete interrupt. Each stage's latency is counted in a log2
+histogram: bucket n counts latencies of 2^n to 2^(n+1)-1 microseconds (bucket 0
+also counts 0), and the last bucket counts everything longer.
+
+Only available in drivers built with TX_LATENCY defined (cmake
+-DTX_LATENCY=ON), since the timestamps are expensive on slow machines.
+*/
+enum {
+  txLatencyCopy = 0,  /* Control entry to frame copied into chip memory */
+  txLatencyQueue = 1, /* Copied to transmit started (waiting for a
+                         driver-generated frame to finish) */
+  txLatencyWire = 2,  /* Transmit started to transmit complete (deferrals,
+                         collisions, and time on the wire) */
+  txLatencyTotal = 3, /* Control entry to transmit complete */
+  numTxLatencyStages
+};
+
+#define numTxLatencyBuckets 20
+
+struct txLatencyStats {
+  unsigned long buckets[numTxLatencyStages][numTxLatencyBuckets];
+};
+typedef struct txLatencyStats txLatencyStats;
+
+/*
+Flow control configuration for ENCSetFlowControl
+
+At full duplex, flow control sends PAUSE frames asking the link partner to stop
+transmitting for pauseQuanta * 512 bit times (the largest value, 0xffff, is
+about 3.4ms at 10Mbit/s). At half duplex, it jams the medium instead
+("backpressure"), which stops every other station on a shared segment too, so
+it is only done if halfDuplexBackpressure is set. Only set that on a dedicated
+point-to-point link.
+
+In flowControlAuto mode the chip asserts flow control when its receive buffer
+is 3/4 full, and releases it when it drains to 1/2 full. In flowControlManual
+mode it is up to the caller, using ENCAssertFlowControl.
+*/
+enum {
+  flowControlAuto = 0,  /* Chip asserts flow control (default) */
+  flowControlOff = 1,   /* Never assert flow control */
+  flowControlManual = 2 /* Caller asserts flow control */
+};
+
+struct flowControlConfig {
+  unsigned short mode;                   /* flowControlXXX */
+  unsigned short pauseQuanta;            /* Pause time in PAUSE frames, 0 for
+                                            default (0x1000) */
+  unsigned short halfDuplexBackpressure; /* Nonzero to allow flow control at
+                                            half duplex */
+};
+typedef struct flowControlConfig flowControlConfig;
+
+/*
+Tap filter programs
+
+Filters are classic BPF programs, as used by tcpdump and libpcap (the output of
+'tcpdump -dd' can be pasted straight in). The program sees the frame starting
+at its Ethernet header, without the FCS. Its return value is the number of
+bytes of the frame to pass to the tap, with 0 meaning that the tap doesn't want
+the frame at all.
+
+When a tap is attached, the filter is compiled into native code, unless
+tapInterpret is given. Loads from beyond the end of the frame make the filter
+return 0, as usual.
+*/
+struct bpfInsn {
+  unsigned short code;  /* Opcode (BPF_XXX values below, or'ed together) */
+  unsigned char jt;     /* Jump offset if true */
+  unsigned char jf;     /* Jump offset if false */
+  unsigned long k;      /* Generic operand */
+};
+typedef struct bpfInsn bpfInsn;
+
+/* Longest filter program accepted */
+#define bpfMaxInsns 256
+/* Number of words of scratch memory */
+#define bpfMemWords 16
+
+/* Instruction classes */
+#define BPF_CLASS(code) ((code) & 0x07)
+#define BPF_LD 0x00
+#define BPF_LDX 0x01
+#define BPF_ST 0x02
+#define BPF_STX 0x03
+#define BPF_ALU 0x04
+#define BPF_JMP 0x05
+#define BPF_RET 0x06
+#define BPF_MISC 0x07
+
+/* Load sizes */
+#define BPF_SIZE(code) ((code) & 0x18)
+#define BPF_W 0x00
+#define BPF_H 0x08
+#define BPF_B 0x10
+
+/* Load addressing modes */
+#define BPF_MODE(code) ((code) & 0xe0)
+#define BPF_IMM 0x00
+#define BPF_ABS 0x20
+#define BPF_IND 0x40
+#define BPF_MEM 0x60
+#define BPF_LEN 0x80
+#define BPF_MSH 0xa0
+
+/* ALU and jump operations */
+#define BPF_OP(code) ((code) & 0xf0)
+#define BPF_ADD 0x00
+#define BPF_SUB 0x10
+#define BPF_MUL 0x20
+#define BPF_DIV 0x30
+#define BPF_OR 0x40
+#define BPF_AND 0x50
+#define BPF_LSH 0x60
+#define BPF_RSH 0x70
+#define BPF_NEG 0x80
+#define BPF_MOD 0x90
+#define BPF_XOR 0xa0
+
+#define BPF_JA 0x00
+#define BPF_JEQ 0x10
+#define BPF_JGT 0x20
+#define BPF_JGE 0x30
+#define BPF_JSET 0x40
+
+/* Operand source */
+#define BPF_SRC(code) ((code) & 0x08)
+#define BPF_K 0x00
+#define BPF_X 0x08
+
+/* Return value source */
+#define BPF_RVAL(code) ((code) & 0x18)
+#define BPF_A 0x10
+
+/* Miscellaneous operations */
+#define BPF_MISCOP(code) ((code) & 0xf8)
+#define BPF_TAX 0x00
+#define BPF_TXA 0x80
+
+/*
+Parameters for ENCAttachTap
+
+A tap sees received frames before they are delivered to protocol handlers.
+Frames that pass its filter are passed to its handler, which is called exactly
+like a protocol handler (see Inside Macintosh: Networking), with the number of
+bytes returned by the filter as the frame length. The frame is then delivered
+to the protocol handlers as usual.
+
+Only one tap can be attached at a time. The filter program is copied by the
+driver, but the handler must stay in memory (and be held, under Virtual Memory)
+until the tap is detached.
+*/
+enum {
+  tapPromiscuous = 1, /* See frames for other stations too */
+  tapInterpret = 2    /* Interpret the filter rather than compiling it */
+};
+
+struct tapConfig {
+  Ptr handler;                  /* Protocol handler-style receive routine */
+  const bpfInsn *filter;        /* Filter program (nil to accept every frame
+                                   in full) */
+  unsigned short filterLength;  /* Number of instructions in filter */
+  unsigned short flags;         /* tapXXX flags */
+};
+typedef struct tapConfig tapConfig;
+
+/*
+Parameters for ENCTestFilter
+
+Copies frame into chip memory and runs the filter over it iterations times,
+timing it with the Microseconds trap (controlErr if that isn't available). With
+a nil filter, times copying the whole frame out of chip memory instead, which
+is what a consumer without a filter has to do with every frame.
+*/
+struct filterTest {
+  const bpfInsn *filter;        /* Filter program, or nil */
+  unsigned short filterLength;  /* Number of instructions in filter */
+  unsigned short flags;         /* tapInterpret to use the interpreter */
+  const Byte *frame;            /* Frame to test against */
+  unsigned short frameLength;   /* Length of frame (at most 1514) */
+  unsigned short iterations;    /* Number of times to run the filter */
+  unsigned long result;         /* Returned: filter result */
+  unsigned long microseconds;   /* Returned: total time for all iterations */
+  unsigned long codeSize;       /* Returned: size of compiled code, in bytes (0
+                                   if interpreted) */
+};
+typedef struct filterTest filterTest;
+
+/*
+Parameters for ENCSetSCSIDefer
+
+While the SCSI bus is busy, the driver leaves received frames in the chip's
+receive buffer instead of handing them to protocol handlers at interrupt time,
+so that it doesn't hold up the SCSI Manager's data transfers. It catches up once
+the bus goes free, or after maxDeferMs, or when the receive buffer is 3/4 full,
+whichever comes first. Enabled by default.
+*/
+struct scsiDeferConfig {
+  unsigned short enabled;     /* Nonzero to defer receive during SCSI
+                                 transactions */
+  unsigned short maxDeferMs;  /* Longest to defer for, 0 for default (20ms) */
+};
+typedef struct scsiDeferConfig scsiDeferConfig;
+
+/*
+Link utilisation, as returned by ENCGetLinkRates
+
+The totals count every frame that reached the receive buffer or left the
+transmit buffer, in bytes on the wire including padding and FCS (ETXWIRE for
+transmitted frames). Frames dropped by the chip's receive filters aren't seen,
+so on a hub the receive figures only cover traffic addressed to us.
+
+Rates are exponentially weighted moving averages, updated about once every
+intervalMs by the driver, so they settle a few seconds after a change in load.
+Utilisation is in hundredths of a percent of the negotiated link speed, and
+allows for the preamble and inter-frame gap of each frame.
+*/
+struct linkRates {
+  unsigned long txPackets;          /* Totals (wrap around) */
+  unsigned long rxPackets;
+  unsigned long txBytes;
+  unsigned long rxBytes;
+  unsigned long txPacketRate;       /* Frames per second */
+  unsigned long rxPacketRate;
+  unsigned long txByteRate;         /* Bytes per second */
+  unsigned long rxByteRate;
+  unsigned short txUtilisation;     /* Hundredths of a percent */
+  unsigned short rxUtilisation;
+  unsigned short utilisation;       /* Of the link as a whole: transmit plus
+                                       receive on a half-duplex link, the busier
+                                       direction on a full-duplex one */
+  unsigned short linkSpeed;         /* Mb/s, 0 if the link is down */
+  unsigned short fullDuplex;        /* Nonzero if the link is full duplex */
+  unsigned short intervalMs;        /* Time between rate updates */
+};
+typedef struct linkRates linkRates;
+
+/*
+Parameters for ENCSetHousekeeping
+
+Work that doesn't have to happen at interrupt time (folding statistics, duplex
+mismatch checks, catching link changes whose interrupt went missing, and testing
+the chip's SRAM) is done every periodTicks, from the driver's periodic accRun
+call or from a Time Manager task if accRun calls aren't arriving. The SRAM test
+only runs from accRun, only while the transmitter is idle, and checks at most
+sramBytesPerRun bytes of the transmit buffers each time.
+*/
+struct housekeepingConfig {
+  unsigned short periodTicks;     /* Ticks between runs, 0 for default (30) */
+  unsigned short sramBytesPerRun; /* Bytes of SRAM to test per run, 0 to turn
+                                     the test off */
+};
+typedef struct housekeepingConfig housekeepingConfig;
+
+/*
+Receive overflow snapshot, as returned by ENCGetRxSnapshot
+
+When the receive buffer overflows (or the chip's pending-frame counter
+saturates), the driver records the state of the buffer and the metadata of every
+frame waiting in it, without their payloads, so that it's possible to tell
+afterwards what filled it up. Only the first overflow after ENCSetRxSnapshot is
+recorded; later ones are counted in abortsSince until it is called again.
+
+Addresses are in the chip's address space. Each frame entry holds the chip's
+own header for the frame (next-frame pointer and Receive Status Vector, both
+little-endian, see the ENC624J600 datasheet) followed by its Ethernet header.
+*/
+#define rxSnapshotMaxFrames 64
+
+struct rxSnapshotFrame {
+  unsigned short address;     /* Where the frame starts in the buffer */
+  unsigned short nextLE;      /* Address of the following frame */
+  Byte rsv[6];                /* Receive Status Vector */
+  Byte dest[6];               /* Ethernet header */
+  Byte source[6];
+  unsigned short protocol;
+};
+typedef struct rxSnapshotFrame rxSnapshotFrame;
+
+/* Bits in rxSnapshot.flags */
+enum {
+  rxSnapshotSCSIDeferred = 0x0001, /* Receive was deferred for SCSI */
+  rxSnapshotBridgeStalled = 0x0002, /* Bridged receive was waiting for the
+                                       other card */
+  rxSnapshotBadChain = 0x8000 /* A next-frame pointer was out of range, so the
+                                 frame list stops early */
+};
+
+struct rxSnapshot {
+  unsigned short valid;        /* Nonzero once a snapshot has been taken */
+  unsigned short flags;        /* rxSnapshotXXX */
+  unsigned long ticks;         /* Tick count when it was taken */
+  unsigned long abortsSince;   /* Overflows since then */
+  unsigned short irqStatus;    /* EIR at the time */
+  unsigned short rxStart;      /* Start of the receive buffer */
+  unsigned short rxEnd;        /* End of the receive buffer */
+  unsigned short rxHead;       /* ERXHEAD (where the chip writes next) */
+  unsigned short rxTail;       /* ERXTAIL (end of the space it may use) */
+  unsigned short rxRead;       /* Driver's read pointer (first pending frame) */
+  unsigned short pendingFrames; /* Frames waiting, according to the chip */
+  unsigned short pendingBytes;  /* Bytes of the buffer in use */
+  unsigned short frameCount;   /* Entries in frames[] */
+  rxSnapshotFrame frames[rxSnapshotMaxFrames]; /* In buffer order */
+};
+typedef struct rxSnapshot rxSnapshot;
+
+/* Kernels used for copying to and from chip memory, as reported in driverInfo.
+The driver times each of them when it is opened and uses the fastest. */
+enum {
+  copyKernelBlockMove = 0, /* BlockMoveData trap */
+  copyKernelBytes = 1,     /* MOVE.B loop */
+  copyKernelWords = 2,     /* MOVE.W loop */
+  copyKernelLongs = 3,     /* MOVE.L loop */
+  copyKernelMovem = 4,     /* MOVEM.L 32-byte blocks */
+  numCopyKernels
+};
+
+/* Number of bytes copied by each copy kernel timing run */
+#define copyCalibrationSize 1024
+
 /*
 Information returned by EGetInfo
 
 'Standard' EGetInfo responses are defined for EtherTalk NB and SONIC cards. We
 use the more detailed SONIC format, plus some of our own fields tacked on to the
 end.
+
+driverInfoVersion goes up by one whenever fields are added, so that stats-query
+clients can tell whether they know the layout of the driverInfo they get.
 */
+#define driverInfoVersion 1
+
 struct driverInfo {
   Byte ethernetAddress[6]; /* Our ethernet address */
 
@@ -67,8 +693,9 @@ struct driverInfo {
   unsigned long rxFrameCount;     /* Frames received without error */
   unsigned long multicastRxFrameCount; /* Multicast frames received */
   unsigned long broadcastRxFrameCount; /* Broadcast frames received */
-  unsigned long fcsErrors;        /* Receive failure due to checksum errors (not
-                                     reported by default on ENC624J600) */
+  unsigned long fcsErrors;        /* Receive failure due to checksum errors
+                                     (only counted while watching for a duplex
+                                     mismatch, see duplexPolicyXXX) */
   unsigned long alignmentErrors;  /* Receive failures due to alignment errors
                                      (not reported by ENC624J600) */
   unsigned long internalRxErrors; /* Receive failures due to internal errors
@@ -86,5 +713,75 @@ struct driverInfo {
       rxUnwanted; /* Frames received with an 'unwanted' destination address
                      (likely hash collisions in the multicast table) */
   unsigned long rxUnknownProto; /* Packets received with an unknown protocol */
+
+  unsigned long statsQueries;  /* Stats queries received */
+  unsigned long statsReplies;  /* Stats replies sent */
+  unsigned long statsRejected; /* Stats queries rejected (malformed or bad
+                                  key) */
+  unsigned long statsDropped;  /* Stats queries ignored due to rate limit or
+                                  busy transmitter */
+
+  /* Bridge statistics, per card (port) */
+  unsigned long bridgeForwarded; /* Frames received and forwarded to a known
+                                    destination on the other side */
+  unsigned long bridgeFlooded;   /* Frames received and forwarded to an unknown
+                                    or group destination */
+  unsigned long bridgeFiltered;  /* Frames received and not forwarded, as their
+                                    destination is on this side */
+  unsigned long bridgeDropped;   /* Frames that could not be forwarded (other
+                                    side's link down) */
+  unsigned long bridgeStalls;    /* Times receive was paused waiting for the
+                                    other card's transmitter */
+  unsigned long bridgeTxFrames;  /* Frames transmitted on behalf of the other
+                                    card */
+
+  unsigned long rxSelfDropped; /* Frames received with our own source address
+                                  (echoes of our own transmissions) */
+  unsigned long txLoopback;    /* Frames to our own address delivered by
+                                  internal loopback */
+
+  /* Copy kernel calibration results. Times are the best of several runs, in
+  microseconds, or 0 if not measured (no Microseconds trap) */
+  unsigned long copyReadKernel;  /* Kernel used for reads from chip memory */
+  unsigned long copyWriteKernel; /* Kernel used for writes to chip memory */
+  unsigned long copyReadTime[numCopyKernels];  /* Time to read
+                                                  copyCalibrationSize bytes */
+  unsigned long copyWriteTime[numCopyKernels]; /* Time to write
+                                                  copyCalibrationSize bytes */
+
+  unsigned long duplexMismatch;       /* Nonzero while a duplex mismatch is
+                                         suspected */
+  unsigned long duplexMismatchEvents; /* Times a duplex mismatch was detected */
+  unsigned long duplexRemediations;   /* Times the driver renegotiated or
+                                         forced duplex to fix a mismatch */
+
+  unsigned long pauseRxFrames;   /* PAUSE frames received from link partner */
+  unsigned long pauseTxAsserts;  /* Times we asserted flow control (started
+                                    sending PAUSE frames or backpressure) */
+
+  unsigned long rxBufferSize;    /* Size of receive buffer (bytes), larger
+                                    until ENetSetGeneral is called */
+
+  unsigned long tapFiltered;     /* Frames offered to the tap's filter */
+  unsigned long tapAccepted;     /* Frames passed to the tap's handler */
+
+  unsigned long scsiDeferrals;   /* Times receive was deferred for SCSI */
+  unsigned long scsiDeferTimeouts; /* Deferrals that ended before the SCSI
+                                      transaction did */
+
+  unsigned long housekeepingRuns;  /* Housekeeping runs from accRun */
+  unsigned long housekeepingTimerRuns; /* ... from the Time Manager, because
+                                          accRun calls weren't arriving */
+  unsigned long missedLinkChanges; /* Link changes found by polling, without an
+                                      interrupt */
+  unsigned long sramBytesTested;   /* Bytes of SRAM tested in the background */
+  unsigned long sramErrors;        /* Words that failed the SRAM test */
+
+  unsigned long immediateWrites;   /* Immediate ENetWrite frames accepted */
+  unsigned long immediateWritesRejected; /* ... turned away because the reply
+                                            buffer was full (or not
+                                            reserved) */
+  unsigned long txCompletedInDrain; /* Transmit completions handled between
+                                       received frames */
 } __attribute__((packed));
 typedef struct driverInfo driverInfo;
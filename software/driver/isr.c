@@ -22,11 +22,21 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "isr.h"
 #include "driver.h"
+#include "bridge.h"
+#include "buffers.h"
 #include "enc624j600.h"
 #include "enc624j600_registers.h"
+#include "flowcontrol.h"
+#include "linkrate.h"
 #include "multicast.h"
 #include "protocolhandler.h"
 #include "readpacket.h"
+#include "rxsnapshot.h"
+#include "scsidefer.h"
+#include "statsquery.h"
+#include "tap.h"
+#include "traffic.h"
+#include "transmit.h"
 #include "util.h"
 
 #if defined(DEBUG)
@@ -45,26 +55,6 @@ driverGlobalsPtr isrGlobals;
 #define likely(x)    __builtin_expect (!!(x), 1)
 #define unlikely(x)  __builtin_expect (!!(x), 0)
 
-/* IODone may trash D3 and A2-A3, which are normally assumed to be preserved
-across calls. This is not documented anywhere obvious in Inside Macintosh, and
-the IODone() inline function in the Universal Interfaces Devices.h does NOT save
-any registers beyond the standard register spec. This routine provides a 'safe'
-version that shouldn't cause any nasty register-trashing surprises. */
-static inline void SafeIODone(DCtlPtr dce, OSErr result) {
-  asm volatile(
-    "   MOVE.L   %[dce], %%a1\n\t"
-    "   MOVE.W   %[result], %%d0\n\t"
-    "   MOVE.L   0x08fc, %%a0\n\t"  /* 0x08fc = IODone jump vector (JIODone) */
-    "   JSR      (%%a0)\n\t"
-    :
-    : [dce] "g" (dce),
-      [result] "g" (result)
-    : "d0", "d1", "d2", "a0", "a1", /* Registers that we normally expect to be 
-                                       trashed across calls */
-      "d3", "a2", "a3"              /* Extra registers that IODone may change */
-  );
-}
-
 /*
 Wrapper to call protocol handlers from C.
 
@@ -114,15 +104,93 @@ static void callPH(enc624j600 *chip, void *phProc, Byte *payloadPtr,
   );
 }
 
-/* Handle a packet from the receive FIFO */
-static void handlePacket(driverGlobalsPtr theGlobals) {
-  unsigned short pktLen;         /* Length of packet */
+/*
+Pass a frame to the protocol handler for its ethertype. The ethernet header
+must already be in the RHA, with chip.rxptr pointing at the frame's payload.
+pktLen is the length of the whole frame. Returns false if there was no handler
+for the frame.
+*/
+Boolean deliverFrame(driverGlobalsPtr theGlobals, unsigned short pktLen) {
+  protocolHandlerEntry *protocolSlot; /* Protocol handler */
+
+  /* Find a protocol handler for this packet */
+  if (likely(theGlobals->rha.header.pktHeader.protocol < 0x0600)) {
+    /* An ethertype field of < 0x600 indicates an 802.2 Type 1 frame (Ethernet
+    Phase II in Apple parlance). We assign this the protocol number 0. The LAP
+    manager always registers itself as the handler for this protocol. */
+    protocolSlot = findPH(theGlobals, phProtocolPhaseII);
+  } else {
+    /* Otherwise, look up a protocol handler using the ethertype field */
+    protocolSlot = findPH(theGlobals, theGlobals->rha.header.pktHeader.protocol);
+  }
+
+  if (unlikely(protocolSlot == nil)) {
+    /* no handler for this protocol, drop it */
+    theGlobals->info.rxUnknownProto++;
+    return false;
+  }
+
+  if (unlikely(protocolSlot->handler == nil)) {
+    /* Technically, it is legal to register a protocol handler without a
+    callback, indicating that it will use the ERead call to read packets. As far
+    as I'm aware, this is not done by any software except for some Inside
+    Macintosh code examples, and implementing ERead looks to be tricky, so for
+    now it's not supported */
+    DBGP("nil pointer for protocol %04x.", protocolSlot->ethertype);
+    theGlobals->info.rxUnknownProto++;
+    return false;
+  }
+
+  /* Call the protocol handler to read the rest of the packet. We've already
+  read the header into the RHA, so subtract its size from the packet length. */
+  debug_log(theGlobals, rxEvent, pktLen);
+  callPH(&theGlobals->chip, protocolSlot->handler, theGlobals->rha.workspace,
+         pktLen - sizeof(ethernetHeader));
+  debug_log(theGlobals, rxDoneEvent, pktLen);
+  theGlobals->info.rxFrameCount++;
+  return true;
+}
+
+/* Offer a received frame to the monitoring tap, and if its filter wants any of
+the frame, pass that much of it to the tap's handler. Leaves chip.rxptr where it
+was so that the frame can be delivered as usual afterwards. */
+static void tapDeliver(driverGlobalsPtr theGlobals,
+                       const unsigned char *thisPacket, unsigned short pktLen) {
+  const unsigned char *payload = theGlobals->chip.rxptr;
+  unsigned long snapLen;
+
+  theGlobals->info.tapFiltered++;
+  snapLen = tapFilter(theGlobals, thisPacket, pktLen);
+  if (likely(snapLen == 0)) {
+    return;
+  }
+  /* The header is already in the RHA, so the handler always gets that much */
+  if (snapLen > pktLen) {
+    snapLen = pktLen;
+  } else if (snapLen < sizeof(ethernetHeader)) {
+    snapLen = sizeof(ethernetHeader);
+  }
+
+  theGlobals->info.tapAccepted++;
+  callPH(&theGlobals->chip, theGlobals->tap.handler, theGlobals->rha.workspace,
+         snapLen - sizeof(ethernetHeader));
+  theGlobals->chip.rxptr = payload;
+}
+
+/* Check whether a frame was sent from our own address */
+static inline Boolean isOwnFrame(const driverGlobalsPtr theGlobals,
+                                 const ethernetHeader *header) {
+  return ethAddrsEqual(&header->source,
+                       (const hwAddr *)theGlobals->info.ethernetAddress);
+}
+
+/* Record receive FIFO high-water marks. The FIFO is at its fullest when we
+start working through it, so this only needs doing once per interrupt rather
+than once per frame. */
+static void recordFifoLevel(driverGlobalsPtr theGlobals) {
   unsigned short bytesPending;   /* Number of bytes pending in receive FIFO */
   unsigned short packetsPending; /* Number of packets pending in receive FIFO */
-  unsigned char * nextPacket;    /* Pointer to next packet in buffer */
-  protocolHandlerEntry *protocolSlot; /* Protocol handler */
 
-  /* Record some FIFO stats */
   packetsPending = enc624j600_read_rx_pending_count(&theGlobals->chip);
   if (unlikely(packetsPending > theGlobals->info.rxPendingPacketsHWM)) {
     theGlobals->info.rxPendingPacketsHWM = packetsPending;
@@ -131,6 +199,31 @@ static void handlePacket(driverGlobalsPtr theGlobals) {
   if (unlikely(bytesPending > theGlobals->info.rxPendingBytesHWM)) {
     theGlobals->info.rxPendingBytesHWM = bytesPending;
   }
+}
+
+/* Handle a packet from the receive FIFO. Returns false if the packet was left in
+the FIFO because bridged receive is stalled. */
+static Boolean handlePacket(driverGlobalsPtr theGlobals) {
+  unsigned short pktLen;         /* Length of packet */
+  unsigned char * nextPacket;    /* Pointer to next packet in buffer */
+  const unsigned char * thisPacket = theGlobals->chip.rxptr; /* Start of packet */
+  Boolean headerWraps;           /* Packet header wraps around end of FIFO */
+
+  /* Frames from our own address are echoes of our own transmissions (on hub
+  segments) or frames that a stack sent to itself over the wire. Drop them
+  before doing any real work, checking the source address in place in the FIFO
+  unless the header wraps around the end of it (rare, in which case we check it
+  once it's in the RHA). With the PHY in loopback, our own frames are exactly
+  what we want to see. */
+  headerWraps = thisPacket + sizeof(ringbufEntry) > theGlobals->chip.rxbuf_end;
+  if (likely(!headerWraps && !theGlobals->phyLoopback)) {
+    const ringbufEntry *entry = (const ringbufEntry *)thisPacket;
+    if (unlikely(isOwnFrame(theGlobals, &entry->pktHeader))) {
+      nextPacket = enc624j600_addr_to_ptr(&theGlobals->chip,
+                                          SWAPBYTES(entry->nextPkt_le));
+      goto dropOwn;
+    }
+  }
 
   /* Copy the packet header (including ENC624J600 data) into the Receive Header
   Area (RHA) - packet handlers expect this */
@@ -142,30 +235,67 @@ static void handlePacket(driverGlobalsPtr theGlobals) {
   nextPacket = enc624j600_addr_to_ptr(
       &theGlobals->chip, SWAPBYTES(theGlobals->rha.header.nextPkt_le));
 
+  if (unlikely(headerWraps) && !theGlobals->phyLoopback &&
+      unlikely(isOwnFrame(theGlobals, &theGlobals->rha.header.pktHeader))) {
+    goto dropOwn;
+  }
+
   /* Packet length field in Recieve Status Vector is stored little-endian.
   Subtract 4 since this length includes the trailing checksum, which we don't
   care about */
   pktLen = SWAPBYTES(theGlobals->rha.header.rsv.pkt_len_le) - 4;
 
-  /* Check for CRC errors. By default the ENC624J600 drops bad-CRC packets
-  silently in hardware, but collect stats in case we disable that filter. */
+  /* Check for CRC errors. The ENC624J600 drops bad-CRC packets silently in
+  hardware, except while duplex mismatch detection wants to count them (see
+  duplex.c). */
   if (unlikely(RSV_BIT(theGlobals->rha.header.rsv, RSV_BIT_CRC_ERR))) {
     theGlobals->info.fcsErrors++;
-    goto drop;
+    goto dropEarly;
   }
 
-  /* Check for runt frames (typically dropped in hardware, but collect stats in
-  case the filter gets disabled) */
+  /* Check for runt frames (likewise dropped in hardware unless duplex mismatch
+  detection wants them) */
   if (unlikely(pktLen < 60)) {
     theGlobals->info.rxRunt++;
-    goto drop;
+    goto dropEarly;
   }
 
   /* Check for too-long frames (typically dropped in hardware, but collect stats
   in case the filter gets disabled) */
   if (unlikely(pktLen > 1514)) {
     theGlobals->info.rxTooLong++;
-    goto drop;
+    goto dropEarly;
+  }
+
+  /* MAC control frames only reach us because we set MACON1_PASSALL so that we
+  can count PAUSE frames. The MAC has already acted on them, and they must never
+  be bridged. */
+  if (unlikely(RSV_BIT(theGlobals->rha.header.rsv, RSV_BIT_CONTROL_FRAME))) {
+    if (RSV_BIT(theGlobals->rha.header.rsv, RSV_BIT_PAUSE_FRAME)) {
+      theGlobals->info.pauseRxFrames++;
+    }
+    goto dropEarly;
+  }
+
+  /* When bridging, forward the packet to the other card if needed. If we can't
+  do that yet, rewind and leave the packet in the FIFO for later. */
+  if (theGlobals->bridgePeer != nil) {
+    if (unlikely(!bridgeFrame(theGlobals, pktLen))) {
+      theGlobals->chip.rxptr = thisPacket;
+      return false;
+    }
+  }
+
+  /* Count it for link utilisation, FCS and all. Not before here, since a
+  stalled bridge has the frame handled again later. */
+  countRxWire(theGlobals, pktLen + 4);
+  countFrameSize(theGlobals->traffic.rxSizes, pktLen);
+  theGlobals->duplex.rxGoodFrames++;
+
+  /* A monitoring tap sees every frame that we receive, including ones that
+  only got through because it asked for promiscuous mode */
+  if (unlikely(theGlobals->tap.handler != nil)) {
+    tapDeliver(theGlobals, thisPacket, pktLen);
   }
 
   /* Sanity-check our receive filters */
@@ -175,6 +305,7 @@ static void handlePacket(driverGlobalsPtr theGlobals) {
   } else if (RSV_BIT(theGlobals->rha.header.rsv, RSV_BIT_BROADCAST)) {
     /* Destination is broadcast */
     theGlobals->info.broadcastRxFrameCount++;
+    countTalker(theGlobals, &theGlobals->rha.header.pktHeader.source);
     goto accept;
   } else if (RSV_BIT(theGlobals->rha.header.rsv, RSV_BIT_MULTICAST) 
              && RSV_BIT(theGlobals->rha.header.rsv, RSV_BIT_HASH_MATCH)) {
@@ -182,6 +313,10 @@ static void handlePacket(driverGlobalsPtr theGlobals) {
       for there to be a hash collision with another multicast address, but let's
       just ignore that */
       theGlobals->info.multicastRxFrameCount++;
+      countTalker(theGlobals, &theGlobals->rha.header.pktHeader.source);
+  } else if (theGlobals->bridgePeer != nil || theGlobals->tap.promiscuous) {
+    /* Promiscuous while bridging or tapping, frame wasn't for us */
+    goto drop;
   } else {
     /* Hash collision with a non-multicast address */
     theGlobals->info.rxUnwanted++;
@@ -189,41 +324,23 @@ static void handlePacket(driverGlobalsPtr theGlobals) {
   }
 
 accept:
-  /* Find a protocol handler for this packet */
-  if (likely(theGlobals->rha.header.pktHeader.protocol < 0x0600)) {
-    /* An ethertype field of < 0x600 indicates an 802.2 Type 1 frame (Ethernet
-    Phase II in Apple parlance). We assign this the protocol number 0. The LAP
-    manager always registers itself as the handler for this protocol. */
-    protocolSlot = findPH(theGlobals, phProtocolPhaseII);
-  } else {
-    /* Otherwise, look up a protocol handler using the ethertype field */
-    protocolSlot = findPH(theGlobals, theGlobals->rha.header.pktHeader.protocol);
-  }
-
-  if (unlikely(protocolSlot == nil)) {
-    /* no handler for this protocol, drop it */
-    theGlobals->info.rxUnknownProto++;
+  /* Stats queries are answered by the driver itself */
+  if (unlikely(theGlobals->rha.header.pktHeader.protocol == statsQueryEthertype
+               && theGlobals->statsEnabled)) {
+    handleStatsQuery(theGlobals, pktLen - sizeof(ethernetHeader));
     goto drop;
   }
 
-  if (unlikely(protocolSlot->handler == nil)) {
-    /* Technically, it is legal to register a protocol handler without a
-    callback, indicating that it will use the ERead call to read packets. As far
-    as I'm aware, this is not done by any software except for some Inside
-    Macintosh code examples, and implementing ERead looks to be tricky, so for
-    now it's not supported */
-    DBGP("nil pointer for protocol %04x.", protocolSlot->ethertype);
-    theGlobals->info.rxUnknownProto++;
-    goto drop;
-  }
+  deliverFrame(theGlobals, pktLen);
+  goto drop;
 
-  /* Call the protocol handler to read the rest of the packet. We've already
-  read the header into the RHA, so subtract its size from the packet length. */
-  debug_log(theGlobals, rxEvent, pktLen);
-  callPH(&theGlobals->chip, protocolSlot->handler, theGlobals->rha.workspace,
-         pktLen - sizeof(ethernetHeader));
-  debug_log(theGlobals, rxDoneEvent, pktLen);
-  theGlobals->info.rxFrameCount++;
+dropEarly:
+  /* Rejected before the bridge check, but it took up the wire all the same */
+  countRxWire(theGlobals, pktLen + 4);
+  goto drop;
+
+dropOwn:
+  theGlobals->info.rxSelfDropped++;
 
 drop:
   /* finished with packet, discard any remaining data by advancing the FIFO read
@@ -232,6 +349,7 @@ drop:
 
   /* decrement pending-receive counter */
   enc624j600_decrement_rx_pending_count(&theGlobals->chip);
+  return true;
 }
 
 /* User-memory-accessing section of ISR, called through DeferUserFn when running
@@ -241,76 +359,49 @@ exit. */
 static void userISR(driverGlobalsPtr theGlobals) {
   short irq_status = enc624j600_read_irqstate(&theGlobals->chip);
 
-  if (likely(irq_status & IRQ_TX)) {
-    /* Transmit complete; signal successful completion */
+  if (likely(irq_status & (IRQ_TX | IRQ_TX_ABORT))) {
+    handleTxComplete(theGlobals, irq_status);
+  }
 
-    /* Record statistics */
-    unsigned short txstat =
-        ENC624J600_READ_REG(theGlobals->chip.base_address, ETXSTAT);
-    unsigned short collisions =
-        (txstat & ETXSTAT_COLCNT_MASK) >> ETXSTAT_COLCNT_SHIFT;
-    if (txstat & ETXSTAT_DEFER) {
-      theGlobals->info.deferredFrames++;
-    }
-    if (collisions >= 1) {
-      theGlobals->info.collisionFrames++;
-      if (collisions == 1) {
-        theGlobals->info.singleCollisionFrames++;
-      } else {
-        theGlobals->info.multiCollisionFrames++;
-      }
-    }
-    theGlobals->info.txFrameCount++;
-
-    /* Must acknowledge the transmit interrupt *before* calling IODone,
-    otherwise we can accidentally acknowledge the interrupt for a transmit
-    started by a completion routine */
-    enc624j600_clear_irq(&theGlobals->chip, IRQ_TX);
-
-    /* Call IODone to progress IO queue and call async completion routine */
-    debug_log(theGlobals, txCallIODoneEvent, noErr);
-    SafeIODone((DCtlPtr) theGlobals->driverDCE, noErr);
-    debug_log(theGlobals, txReturnIODoneEvent, 0x5555);
-  } else if (irq_status & IRQ_TX_ABORT) {
-    /*
-    Transmit aborted due to one of:
-      - Collision count exceeded MACLCON_MAXRET (count in ETXSTAT_COLCNT)
-      - Collision occurred after 63 bytes transmitted (ETXSTAT_LATECOL set)
-      - Medium was busy, transmission deferred for longer than timeout
-        (ETXSTAT_EXDEFER set)
-      - Transmit aborted in software by clearing ECON1_TXRTS
-    */
+  if (irq_status & IRQ_PKT) {
+    recordFifoLevel(theGlobals);
+  }
 
-   /* Record statistics */
-    unsigned short txstat =
-        ENC624J600_READ_REG(theGlobals->chip.base_address, ETXSTAT);
-    if (txstat & ETXSTAT_EXDEFER) {
-      theGlobals->info.excessiveDeferrals++;
-    } else if (txstat & ETXSTAT_MAXCOL) {
-      theGlobals->info.excessiveCollisions++;
-    } else if (txstat & ETXSTAT_LATECOL) {
-      theGlobals->info.lateCollisions++;
-    } else {
-      theGlobals->info.internalTxErrors++;
+  /* Handle any pending received packets, unless bridged receive is stalled
+  waiting for the other card to transmit, or a SCSI transaction is in progress
+  (in which case they wait in the receive buffer until it's over, see
+  scsidefer.c) */
+  while (!theGlobals->bridgeRxStalled &&
+         ((irq_status = enc624j600_read_irqstate(&theGlobals->chip)) &
+          IRQ_PKT) &&
+         !scsiDeferReceive(theGlobals)) {
+    /* A long drain can outlast a transmission. Pick up the completion between
+    frames rather than at the end, so that the next write gets started and the
+    transmitter isn't left idle while we receive. EIR has just been read, so
+    this costs nothing per frame. */
+    if (unlikely(irq_status & (IRQ_TX | IRQ_TX_ABORT))) {
+      theGlobals->info.txCompletedInDrain++;
+      handleTxComplete(theGlobals, irq_status);
     }
+    if (!handlePacket(theGlobals)) {
+      break;
+    }
+    /* IRQ_PKT flag is not directly clearable - it indicates that the
+    pending-receive count (decremented by handlePacket()) is nonzero */
+  };
 
-    DBGP("TX abort! ETXSTAT=%04x", txstat);
-
-    /* Acknowledge interrupt *before* calling IODone */
-    enc624j600_clear_irq(&theGlobals->chip, IRQ_TX_ABORT);
+  /* A protocol handler may have sent a frame to our own address while we were
+  receiving, deliver it now that the RHA is free */
+  if (unlikely(theGlobals->loopbackPending)) {
+    finishLoopback(theGlobals);
+  }
 
-    /* Call IODone to progress IO queue and call async completion routine */
-    debug_log(theGlobals, txCallIODoneEvent, excessCollsns);
-    SafeIODone((DCtlPtr) theGlobals->driverDCE, excessCollsns);
-    debug_log(theGlobals, txReturnIODoneEvent, 0x5555);
+  /* Likewise for a switch to general mode */
+  if (unlikely(theGlobals->generalModePending)) {
+    finishSetGeneral(theGlobals);
   }
 
-  /* Handle any pending received packets */
-  while (enc624j600_read_irqstate(&theGlobals->chip) & IRQ_PKT) {
-    handlePacket(theGlobals);
-    /* IRQ_PKT flag is not directly clearable - it indicates that the
-    pending-receive count (decremented by handlePacket()) is nonzero */
-  };
+  flowControlPoll(theGlobals);
 
   enc624j600_enable_irq(&theGlobals->chip, IRQ_ENABLE);
 }
@@ -344,11 +435,32 @@ unsigned long driverISR(driverGlobalsPtr theGlobals) {
 
     DBGP("RX abort! EIR=%04x", irq_status);
 
+    if (unlikely(theGlobals->rxSnapshot != nil)) {
+      rxSnapshotTake(theGlobals, irq_status);
+    }
+
     enc624j600_clear_irq(&theGlobals->chip, IRQ_RX_ABORT | IRQ_PCNT_FULL);
     irq_handled = 1;
   }
 
-  if (likely(irq_status & (IRQ_TX | IRQ_TX_ABORT | IRQ_PKT))) {
+  if (unlikely(irq_status & IRQ_DMA)) {
+    /* DMA engine finished a request. Its callback runs here, at interrupt
+    time, so it must not touch user memory. */
+    enc624j600_dma_complete(&theGlobals->chip);
+    irq_handled = 1;
+  }
+
+  if (unlikely(irq_status & IRQ_SOFT)) {
+    /* Raised by loopbackHostFrame() to bring us round; the looped-back frame
+    itself is delivered by userISR() below */
+    enc624j600_clear_irq(&theGlobals->chip, IRQ_SOFT);
+    irq_handled = 1;
+  }
+
+  /* A looped-back frame is delivered by userISR() too (see
+  loopbackHostFrame()) */
+  if (likely(irq_status & (IRQ_TX | IRQ_TX_ABORT | IRQ_PKT)) ||
+      unlikely(theGlobals->loopbackPending)) {
 #if defined(TARGET_SE30)
     /* Transmit and receive handlers touch user memory. When running with
     Virtual Memory enabled, this could cause a double fault (if the ISR runs
@@ -34,3 +34,5 @@ extern driverGlobalsPtr isrGlobals;
 /* Assembly-language wrapper for our ISRs written in C; implementation in 
 isrwrapper.S */
 void isrWrapper(void);
+
+Boolean deliverFrame(driverGlobalsPtr theGlobals, unsigned short pktLen);
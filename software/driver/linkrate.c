@@ -0,0 +1,184 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Link utilisation metering
+
+The ISR keeps running totals of frames and bytes in each direction as they go
+past (see linkrate.h), which costs a couple of additions per frame. About once a
+second, housekeeping (see housekeeping.c) takes the difference from last time
+and folds it into moving averages, from which it works out how busy the link
+is. Monitors read the result with ENCGetLinkRates rather than polling and
+differencing counters themselves.
+*/
+
+#include <ENET.h>
+#include <Events.h>
+#include <MacTypes.h>
+
+#include "driver.h"
+#include "linkrate.h"
+#include "util.h"
+
+/* Ticks between rate updates. Housekeeping doesn't run exactly on time, so
+each sample is scaled to what it would have been over exactly this long, which
+keeps the averages per-second. */
+#define linkRateIntervalTicks 60
+
+/* Each new sample carries a weight of 1/2^linkRateWeightShift in the moving
+averages */
+#define linkRateWeightShift 2
+
+/* The averages are kept scaled up by 2^linkRateScaleShift, so that low rates
+don't get lost to rounding */
+#define linkRateScaleShift 4
+
+/* Preamble, start-of-frame delimiter and inter-frame gap, in byte times */
+#define linkFrameOverhead 20
+
+static long movingAverage(long average, unsigned long sample) {
+  return average +
+         (((long)(sample << linkRateScaleShift) - average) >>
+          linkRateWeightShift);
+}
+
+/* A rising average settles up to 2^linkRateWeightShift - 1 scaled units short
+of its input, so round rather than truncate */
+static unsigned long unscale(long average) {
+  return average > 0 ? ((unsigned long)average +
+                        (1UL << (linkRateScaleShift - 1))) >>
+                           linkRateScaleShift
+                     : 0;
+}
+
+/* Scale a difference in totals over elapsed ticks to one over
+linkRateIntervalTicks, without overflowing */
+static unsigned long perInterval(unsigned long delta, unsigned long elapsed) {
+  if (elapsed == linkRateIntervalTicks) {
+    return delta;
+  }
+  return (delta / elapsed) * linkRateIntervalTicks +
+         ((delta % elapsed) * linkRateIntervalTicks) / elapsed;
+}
+
+/* Hundredths of a percent of a link of the given speed (in Mb/s) */
+static unsigned short utilisation(unsigned long byteRate,
+                                  unsigned long packetRate,
+                                  unsigned short speed) {
+  unsigned long bits;
+  unsigned long hundredths;
+
+  if (speed == 0) {
+    return 0;
+  }
+  bits = (byteRate + packetRate * linkFrameOverhead) * 8;
+  hundredths = bits / (speed * 100UL);
+  return hundredths > 10000 ? 10000 : hundredths;
+}
+
+/* Update the rates if an interval has gone by since the last update. Called
+from housekeeping(). */
+void linkRateUpdate(driverGlobalsPtr theGlobals) {
+  linkRates *rates = &theGlobals->link.rates;
+  unsigned char linkState = theGlobals->chip.link_state;
+  unsigned long now = TickCount();
+  unsigned long elapsed = now - theGlobals->link.lastUpdate;
+  unsigned long txPackets, rxPackets, txBytes, rxBytes;
+  unsigned long txPacketRate, rxPacketRate, txByteRate, rxByteRate;
+  unsigned short txUtil, rxUtil, speed;
+  unsigned short srSave;
+
+  if (elapsed < linkRateIntervalTicks) {
+    return;
+  }
+  theGlobals->link.lastUpdate = now;
+
+  /* Take a consistent snapshot of the totals, in case the ISR is part way
+  through counting a frame */
+  srSave = maskInterrupts();
+  txPackets = rates->txPackets;
+  rxPackets = rates->rxPackets;
+  txBytes = rates->txBytes;
+  rxBytes = rates->rxBytes;
+  restoreInterrupts(srSave);
+
+  theGlobals->link.txPacketAvg = movingAverage(
+      theGlobals->link.txPacketAvg,
+      perInterval(txPackets - theGlobals->link.lastTxPackets, elapsed));
+  theGlobals->link.rxPacketAvg = movingAverage(
+      theGlobals->link.rxPacketAvg,
+      perInterval(rxPackets - theGlobals->link.lastRxPackets, elapsed));
+  theGlobals->link.txByteAvg = movingAverage(
+      theGlobals->link.txByteAvg,
+      perInterval(txBytes - theGlobals->link.lastTxBytes, elapsed));
+  theGlobals->link.rxByteAvg = movingAverage(
+      theGlobals->link.rxByteAvg,
+      perInterval(rxBytes - theGlobals->link.lastRxBytes, elapsed));
+  theGlobals->link.lastTxPackets = txPackets;
+  theGlobals->link.lastRxPackets = rxPackets;
+  theGlobals->link.lastTxBytes = txBytes;
+  theGlobals->link.lastRxBytes = rxBytes;
+
+  txPacketRate = unscale(theGlobals->link.txPacketAvg);
+  rxPacketRate = unscale(theGlobals->link.rxPacketAvg);
+  txByteRate = unscale(theGlobals->link.txByteAvg);
+  rxByteRate = unscale(theGlobals->link.rxByteAvg);
+
+  if (linkState & LINK_100M) {
+    speed = 100;
+  } else if (linkState & LINK_10M) {
+    speed = 10;
+  } else {
+    speed = 0;
+  }
+  txUtil = utilisation(txByteRate, txPacketRate, speed);
+  rxUtil = utilisation(rxByteRate, rxPacketRate, speed);
+
+  /* Publish the new rates all at once, so that doGetLinkRates() never sees a
+  mixture of old and new */
+  srSave = maskInterrupts();
+  rates->txPacketRate = txPacketRate;
+  rates->rxPacketRate = rxPacketRate;
+  rates->txByteRate = txByteRate;
+  rates->rxByteRate = rxByteRate;
+  rates->txUtilisation = txUtil;
+  rates->rxUtilisation = rxUtil;
+  rates->linkSpeed = speed;
+  rates->intervalMs = (linkRateIntervalTicks * 50) / 3;
+  rates->fullDuplex = (linkState & LINK_FULLDPX) ? 1 : 0;
+  if (rates->fullDuplex) {
+    rates->utilisation = txUtil > rxUtil ? txUtil : rxUtil;
+  } else {
+    rates->utilisation = txUtil + rxUtil > 10000 ? 10000 : txUtil + rxUtil;
+  }
+  restoreInterrupts(srSave);
+}
+
+/* Control call handler for ENCGetLinkRates */
+OSErr doGetLinkRates(driverGlobalsPtr theGlobals, EParamBlkPtr pb) {
+  unsigned short srSave;
+
+  if (pb->u.EParms1.eBuffSize > (short) sizeof(theGlobals->link.rates)) {
+    pb->u.EParms1.eBuffSize = sizeof(theGlobals->link.rates);
+  }
+  srSave = maskInterrupts();
+  BlockMoveData(&theGlobals->link.rates, pb->u.EParms1.ePointer,
+                pb->u.EParms1.eBuffSize);
+  restoreInterrupts(srSave);
+  return noErr;
+}
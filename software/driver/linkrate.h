@@ -0,0 +1,41 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <ENET.h>
+#include <MacTypes.h>
+
+#include "driver.h"
+
+/* Count a transmitted frame, bytes is ETXWIRE */
+static inline void countTxWire(driverGlobalsPtr theGlobals,
+                               unsigned short bytes) {
+  theGlobals->link.rates.txPackets++;
+  theGlobals->link.rates.txBytes += bytes;
+}
+
+/* Count a received frame, bytes is the RSV length (including FCS) */
+static inline void countRxWire(driverGlobalsPtr theGlobals,
+                               unsigned short bytes) {
+  theGlobals->link.rates.rxPackets++;
+  theGlobals->link.rates.rxBytes += bytes;
+}
+
+void linkRateUpdate(driverGlobalsPtr theGlobals);
+OSErr doGetLinkRates(driverGlobalsPtr theGlobals, EParamBlkPtr pb);
@@ -58,22 +58,30 @@ static multicastEntry* findFreeMulticastEntry(
   return nil;
 }
 
+/* Set the bit for an address in a multicast hash table */
+static void hashAddress(unsigned short hashTable[4], const Byte *address) {
+  unsigned long hashValue = crc32(address, 6);
+
+  /* Use bits 28:23 of CRC32 as bitwise index into hash table */
+  hashValue = (hashValue >> 23) & 0x3f;
+  hashTable[hashValue >> 4] |= (1 << (hashValue & 0x0f));
+}
+
 /* Generate the 8-byte multicast hash table used by the ENC624J600 and load it
 into the chip. See the data sheet for hash table format. */
-static void updateMulticastHashTable(const driverGlobalsPtr theGlobals) {
+void updateMulticastHashTable(const driverGlobalsPtr theGlobals) {
+  /* 802.3x PAUSE frames are sent to this address. We always listen for it so
+  that received PAUSE frames get to isr.c to be counted. */
+  static const Byte pauseAddress[6] = {0x01, 0x80, 0xc2, 0x00, 0x00, 0x01};
   unsigned short hashTable[4];
-  unsigned long hashValue;
 
   /* Zero out hash table */
   memset(hashTable, 0, 4 * sizeof(unsigned short));
 
+  hashAddress(hashTable, pauseAddress);
   for (unsigned short i = 0; i < numberofMulticasts; i++) {
     if (theGlobals->multicasts[i].refCount > 0) {
-      hashValue = crc32(theGlobals->multicasts[i].address.bytes, 6);
-
-      /* Use bits 28:23 of CRC32 as bitwise index into hash table */
-      hashValue = (hashValue >> 23) & 0x3f;
-      hashTable[hashValue >> 4] |= (1 << (hashValue & 0x0f));
+      hashAddress(hashTable, theGlobals->multicasts[i].address.bytes);
     }
   }
   enc624j600_write_multicast_table(&theGlobals->chip, hashTable);
@@ -22,6 +22,7 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "driver.h"
 
+void updateMulticastHashTable(const driverGlobalsPtr theGlobals);
 multicastEntry* findMulticastEntry(const driverGlobalsPtr theGlobals,
                                    const hwAddr *address);
 OSStatus doEAddMulti(driverGlobalsPtr theGlobals, const EParamBlkPtr pb);
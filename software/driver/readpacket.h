@@ -4,7 +4,8 @@
 readpacket.S. We don't (and shouldn't) call it directly. */
 extern void readPacket();
 
-/* C wrapper to read data from receive buffer */
+/* C wrapper to read data from receive buffer. chip must be the one in our
+driverGlobals, which also holds the copy kernel to use. */
 static inline void readBuf(struct enc624j600 * chip, void * dest,
                               unsigned short len) {
   asm volatile(
@@ -0,0 +1,178 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Receive overflow snapshots
+
+A receive abort only tells us that the buffer filled up, not what filled it. With
+snapshots turned on, the ISR walks the chain of frames waiting in the buffer on
+the first abort and copies out the chip's header and the Ethernet header of
+each one: a few dozen bytes per frame, and none of the payloads. The snapshot is
+then held until someone reads it and asks for another (see rxSnapshot in
+sethernet.h), so that the frames that caused an overflow aren't overwritten by
+the ones that came after.
+*/
+
+#include <Devices.h>
+#include <ENET.h>
+#include <Errors.h>
+#include <Events.h>
+#include <MacTypes.h>
+#include <Memory.h>
+#include <stddef.h>
+
+#include "driver.h"
+#include "enc624j600.h"
+#include "enc624j600_registers.h"
+#include "readpacket.h"
+#include "rxsnapshot.h"
+#include "util.h"
+
+/* Frame entries are read straight out of the buffer */
+_Static_assert(sizeof(rxSnapshotFrame) - offsetof(rxSnapshotFrame, nextLE) ==
+                   sizeof(ringbufEntry),
+               "rxSnapshotFrame doesn't match ringbufEntry");
+
+/*
+Record the state of the receive buffer. Called from driverISR() on a receive
+abort, before any of the waiting frames have been handled.
+
+The walk follows the next-frame pointers from our read pointer, using readBuf()
+so that entries that wrap around the end of the buffer come out whole, and puts
+the read pointer back afterwards.
+*/
+void rxSnapshotTake(driverGlobalsPtr theGlobals, unsigned short irqStatus) {
+  rxSnapshot *snapshot = theGlobals->rxSnapshot;
+  enc624j600 *chip = &theGlobals->chip;
+  const unsigned char *readPtr = chip->rxptr;
+  rxSnapshotFrame *frame;
+  unsigned short next;
+  unsigned short i;
+
+  if (snapshot->valid) {
+    snapshot->abortsSince++;
+    return;
+  }
+
+  snapshot->ticks = TickCount();
+  snapshot->abortsSince = 0;
+  snapshot->irqStatus = irqStatus;
+  snapshot->rxStart = enc624j600_ptr_to_addr(chip, chip->rxbuf_start);
+  snapshot->rxEnd = enc624j600_ptr_to_addr(chip, chip->rxbuf_end);
+  snapshot->rxHead = SWAPBYTES(ENC624J600_READ_REG(chip->base_address, ERXHEAD));
+  snapshot->rxTail = SWAPBYTES(ENC624J600_READ_REG(chip->base_address, ERXTAIL));
+  snapshot->rxRead = enc624j600_ptr_to_addr(chip, readPtr);
+  snapshot->pendingFrames = enc624j600_read_rx_pending_count(chip);
+  snapshot->pendingBytes = enc624j600_read_rx_fifo_level(chip);
+  snapshot->flags = 0;
+  if (theGlobals->scsi.deferred) {
+    snapshot->flags |= rxSnapshotSCSIDeferred;
+  }
+  if (theGlobals->bridgeRxStalled) {
+    snapshot->flags |= rxSnapshotBridgeStalled;
+  }
+
+  for (i = 0; i < snapshot->pendingFrames && i < rxSnapshotMaxFrames; i++) {
+    frame = &snapshot->frames[i];
+    frame->address = enc624j600_ptr_to_addr(chip, chip->rxptr);
+    /* The rest of the entry has the same layout as a ringbufEntry */
+    readBuf(chip, &frame->nextLE, sizeof(ringbufEntry));
+
+    next = SWAPBYTES(frame->nextLE);
+    if (next < snapshot->rxStart || next >= snapshot->rxEnd || (next & 1)) {
+      snapshot->flags |= rxSnapshotBadChain;
+      i++;
+      break;
+    }
+    chip->rxptr = enc624j600_addr_to_ptr(chip, next);
+  }
+  snapshot->frameCount = i;
+
+  chip->rxptr = readPtr;
+  snapshot->valid = 1;
+}
+
+/* Control call handler for ENCSetRxSnapshot */
+OSErr doSetRxSnapshot(driverGlobalsPtr theGlobals, Boolean enable) {
+  rxSnapshot *snapshot = theGlobals->rxSnapshot;
+  unsigned short srSave;
+
+  if (enable) {
+    if (snapshot == nil) {
+      snapshot = (rxSnapshot *)NewPtrSysClear(sizeof(rxSnapshot));
+      if (snapshot == nil) {
+        return MemError();
+      }
+      if (theGlobals->vmEnabled) {
+        /* Written at interrupt time, keep it resident */
+        HoldMemory(snapshot, sizeof(rxSnapshot));
+      }
+    }
+    /* Re-arm */
+    srSave = maskInterrupts();
+    snapshot->valid = 0;
+    snapshot->frameCount = 0;
+    theGlobals->rxSnapshot = snapshot;
+    restoreInterrupts(srSave);
+    return noErr;
+  }
+
+  if (snapshot == nil) {
+    return noErr;
+  }
+  srSave = maskInterrupts();
+  theGlobals->rxSnapshot = nil;
+  restoreInterrupts(srSave);
+  if (theGlobals->vmEnabled) {
+    UnholdMemory(snapshot, sizeof(rxSnapshot));
+  }
+  DisposePtr((Ptr)snapshot);
+  return noErr;
+}
+
+/* Control call handler for ENCGetRxSnapshot. Once a snapshot has been taken the
+ISR only touches abortsSince, so the frame list can be copied without keeping
+interrupts masked for the whole time. */
+OSErr doGetRxSnapshot(driverGlobalsPtr theGlobals, EParamBlkPtr pb) {
+  rxSnapshot *snapshot = theGlobals->rxSnapshot;
+  unsigned short srSave;
+  short length;
+
+  if (snapshot == nil) {
+    return controlErr;
+  }
+  if (pb->u.EParms1.eBuffSize > (short) sizeof(rxSnapshot)) {
+    pb->u.EParms1.eBuffSize = sizeof(rxSnapshot);
+  }
+  length = pb->u.EParms1.eBuffSize;
+
+  srSave = maskInterrupts();
+  if (!snapshot->valid) {
+    /* Nothing to see yet, and it could change under us */
+    if (length > (short) offsetof(rxSnapshot, frames)) {
+      length = offsetof(rxSnapshot, frames);
+    }
+    BlockMoveData(snapshot, pb->u.EParms1.ePointer, length);
+    restoreInterrupts(srSave);
+    return noErr;
+  }
+  restoreInterrupts(srSave);
+
+  BlockMoveData(snapshot, pb->u.EParms1.ePointer, length);
+  return noErr;
+}
@@ -0,0 +1,177 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Co-scheduling with the SCSI Manager
+
+Neither machine has SCSI DMA. The SCSI Manager moves every byte with the CPU,
+and during blind transfers it counts on being able to keep up with the target
+without checking each handshake. Draining a burst of received frames at
+interrupt time stalls it in the middle of a transaction, so disk throughput
+collapses whenever the network is busy (and an AppleShare server is always doing
+both at once).
+
+So while the SCSI bus is busy, the ISR does no more receive work than
+acknowledging the interrupt. Frames queue up in the chip's receive buffer,
+IRQ_PKT is disabled, and a Time Manager task polls for the bus going free. At
+that point it re-enables IRQ_PKT, the chip interrupts again straight away, and
+the ISR catches up. Deferral is limited both in time and by how full the receive
+buffer gets, so that a long transfer (or a hung bus) can't make us drop frames.
+If the buffer does fill up, full-duplex flow control (see flowcontrol.c) asks
+the link partner to hold off.
+
+"Busy" means the BSY line in the 5380's Current SCSI Bus Status register. The
+target holds BSY from selection until bus free, whoever started the transaction,
+and reading the register has no side effects.
+*/
+
+#include <Errors.h>
+#include <MacTypes.h>
+#include <OSUtils.h>
+#include <Timer.h>
+#include <stddef.h>
+
+#include "driver.h"
+#include "enc624j600.h"
+#include "scsidefer.h"
+#include "util.h"
+
+#define likely(x)    __builtin_expect (!!(x), 1)
+#define unlikely(x)  __builtin_expect (!!(x), 0)
+
+/* Low-memory global holding the 5380's base address for reads */
+#define SCSIBase (*(volatile Byte **)0x0c00)
+
+/* 5380 Current SCSI Bus Status register (the Mac spaces the 5380's registers
+16 bytes apart) and its BSY bit */
+#define scsiBusStatus 0x40
+#define scsiBSY 0x40
+
+/* Milliseconds between checks for the end of a SCSI transaction */
+#define scsiPollMs 1
+
+/* Longest to defer receive for, if ENCSetSCSIDefer doesn't say */
+#define scsiDefaultMaxDeferMs 20
+
+static inline Boolean scsiBusy(void) {
+  return (SCSIBase[scsiBusStatus] & scsiBSY) != 0;
+}
+
+/* The receive buffer is too full to keep deferring */
+static inline Boolean rxBufferFilling(driverGlobalsPtr theGlobals) {
+  return enc624j600_read_rx_fifo_level(&theGlobals->chip) >
+         theGlobals->info.rxBufferSize / 4 * 3;
+}
+
+/* Stop deferring receive. If frames arrived in the meantime, the chip
+interrupts as soon as IRQ_PKT is enabled. Call with interrupts masked. */
+static void resumeReceive(driverGlobalsPtr theGlobals) {
+  theGlobals->scsi.deferred = 0;
+  /* If bridged receive is stalled as well, the bridge turns IRQ_PKT back on
+  when the other card is ready */
+  if (!theGlobals->bridgeRxStalled) {
+    enc624j600_enable_irq(&theGlobals->chip, IRQ_PKT);
+  }
+}
+
+/* Time Manager task, called with A1 pointing at our TMTask. On the SE/30 the
+card interrupts at a higher level than the Time Manager, so mask interrupts to
+keep the ISR from deferring again halfway through. */
+#pragma parameter scsiPollTask(__A1)
+static void scsiPollTask(TMTask *task) {
+  driverGlobalsPtr theGlobals =
+      (driverGlobalsPtr)((Byte *)task - offsetof(driverGlobals, scsi.timer));
+  unsigned short srSave = maskInterrupts();
+
+  if (!theGlobals->scsi.deferred) {
+    /* Already resumed by doSetSCSIDefer() */
+  } else if (!scsiBusy()) {
+    resumeReceive(theGlobals);
+  } else if (theGlobals->scsi.deferredMs >= theGlobals->scsi.maxDeferMs ||
+             rxBufferFilling(theGlobals)) {
+    theGlobals->info.scsiDeferTimeouts++;
+    resumeReceive(theGlobals);
+  } else {
+    theGlobals->scsi.deferredMs += scsiPollMs;
+    PrimeTime((QElemPtr)task, scsiPollMs);
+  }
+  restoreInterrupts(srSave);
+}
+
+/* Set up SCSI co-scheduling. Called from driverOpen(). */
+void scsiDeferInit(driverGlobalsPtr theGlobals) {
+  theGlobals->scsi.enabled = 1;
+  theGlobals->scsi.deferred = 0;
+  theGlobals->scsi.maxDeferMs = scsiDefaultMaxDeferMs;
+  theGlobals->scsi.timer.tmAddr = (TimerUPP)scsiPollTask;
+  InsTime((QElemPtr)&theGlobals->scsi.timer);
+}
+
+/* Remove our Time Manager task. Called from driverClose(). */
+void scsiDeferRemove(driverGlobalsPtr theGlobals) {
+  RmvTime((QElemPtr)&theGlobals->scsi.timer);
+  theGlobals->scsi.deferred = 0;
+}
+
+/*
+Called by userISR() before handling each received frame. Returns true if receive
+should be deferred because a SCSI transaction is in progress, in which case
+IRQ_PKT is disabled until the Time Manager task turns it back on.
+*/
+Boolean scsiDeferReceive(driverGlobalsPtr theGlobals) {
+  if (!theGlobals->scsi.enabled) {
+    return false;
+  }
+  if (unlikely(theGlobals->scsi.deferred)) {
+    /* Something else (the bridge, say) turned IRQ_PKT back on while we were
+    waiting. Turn it off again rather than taking interrupts we won't
+    service. */
+    enc624j600_disable_irq(&theGlobals->chip, IRQ_PKT);
+    return true;
+  }
+  if (likely(!scsiBusy()) || rxBufferFilling(theGlobals)) {
+    return false;
+  }
+
+  theGlobals->scsi.deferred = 1;
+  theGlobals->scsi.deferredMs = 0;
+  enc624j600_disable_irq(&theGlobals->chip, IRQ_PKT);
+  PrimeTime((QElemPtr)&theGlobals->scsi.timer, scsiPollMs);
+  theGlobals->info.scsiDeferrals++;
+  return true;
+}
+
+/* Control call handler for ENCSetSCSIDefer */
+OSStatus doSetSCSIDefer(driverGlobalsPtr theGlobals,
+                        const scsiDeferConfig *config) {
+  unsigned short srSave;
+
+  if (config == nil) {
+    return paramErr;
+  }
+
+  srSave = maskInterrupts();
+  theGlobals->scsi.enabled = config->enabled ? 1 : 0;
+  theGlobals->scsi.maxDeferMs =
+      config->maxDeferMs ? config->maxDeferMs : scsiDefaultMaxDeferMs;
+  if (!theGlobals->scsi.enabled && theGlobals->scsi.deferred) {
+    resumeReceive(theGlobals);
+  }
+  restoreInterrupts(srSave);
+  return noErr;
+}
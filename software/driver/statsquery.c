@@ -0,0 +1,175 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Errors.h>
+#include <Events.h>
+#include <MacTypes.h>
+#include <Resources.h>
+#include <stddef.h>
+
+#include "statsquery.h"
+#include "buffers.h"
+#include "driver.h"
+#include "readpacket.h"
+#include "transmit.h"
+#include "txstats.h"
+#include "util.h"
+
+#define likely(x)    __builtin_expect (!!(x), 1)
+#define unlikely(x)  __builtin_expect (!!(x), 0)
+
+/* Reply frame layout in the driver transmit buffer */
+typedef struct statsReplyFrame {
+  ethernetHeader header;
+  statsReply reply;
+  driverInfo info;
+} statsReplyFrame;
+
+_Static_assert(sizeof(statsReplyFrame) <= ENC_DRIVER_TX_BUF_SIZE,
+               "Stats reply doesn't fit in driver transmit buffer");
+
+/*
+Handle a stats query. Called from handlePacket() with the ethernet header
+already in the RHA; length is the number of bytes remaining in the packet.
+
+This runs at interrupt time, so the rate limit is checked before anything else,
+and applies to every query (not just those we answer), to bound the time we can
+be made to spend here by a flood of queries, good or bad. The reply is built
+piece by piece straight into the driver transmit buffer, rather than on the
+stack.
+*/
+void handleStatsQuery(driverGlobalsPtr theGlobals, unsigned short length) {
+  statsQuery query;
+  ethernetHeader header;
+  statsReply reply;
+  unsigned long now = TickCount();
+  unsigned char i;
+  unsigned char keyMismatch;
+  Byte *buffer;
+
+  theGlobals->info.statsQueries++;
+
+  if (unlikely(now - theGlobals->statsLastQuery <
+               theGlobals->statsMinInterval)) {
+    theGlobals->info.statsDropped++;
+    return;
+  }
+  theGlobals->statsLastQuery = now;
+
+  if (unlikely(length < sizeof(statsQuery))) {
+    theGlobals->info.statsRejected++;
+    return;
+  }
+
+  readBuf(&theGlobals->chip, &query, sizeof(statsQuery));
+
+  if (query.magic != statsMagic || query.version != statsProtocolVersion ||
+      query.op != statsOpQuery) {
+    theGlobals->info.statsRejected++;
+    return;
+  }
+
+  /* Compare the whole key regardless of where the first mismatch is */
+  keyMismatch = 0;
+  for (i = 0; i < statsKeyLength; i++) {
+    keyMismatch |= query.key[i] ^ theGlobals->statsKey[i];
+  }
+  if (keyMismatch) {
+    theGlobals->info.statsRejected++;
+    return;
+  }
+
+  /* The previous reply (or some other driver-generated frame) hasn't gone out
+  yet, don't wait around for it */
+  buffer = claimDriverTx(theGlobals);
+  if (unlikely(buffer == nil)) {
+    theGlobals->info.statsDropped++;
+    return;
+  }
+
+  theGlobals->info.statsReplies++;
+
+  /* Reply goes back to whoever asked. Source address is filled in by
+  sendDriverFrame() */
+  copyEthAddrs(&header.dest, &theGlobals->rha.header.pktHeader.source);
+  header.protocol = statsQueryEthertype;
+  copyToChip(theGlobals, buffer + offsetof(statsReplyFrame, header),
+             (Byte *)&header, sizeof(ethernetHeader));
+
+  reply.magic = statsMagic;
+  reply.version = statsProtocolVersion;
+  reply.op = statsOpReply;
+  reply.seq = query.seq;
+  reply.ticks = now;
+  reply.infoVersion = driverInfoVersion;
+  reply.infoLength = sizeof(driverInfo);
+  copyToChip(theGlobals, buffer + offsetof(statsReplyFrame, reply),
+             (Byte *)&reply, sizeof(statsReply));
+
+  foldTxStats(theGlobals);
+  copyToChip(theGlobals, buffer + offsetof(statsReplyFrame, info),
+             (Byte *)&theGlobals->info, sizeof(driverInfo));
+
+  sendDriverFrame(theGlobals, sizeof(statsReplyFrame));
+}
+
+/* Load the stats-query key from a 'skey' resource, if one exists */
+void loadStatsKey(driverGlobalsPtr theGlobals, short slot) {
+  Handle keyResource;
+  Size keyLength;
+
+  theGlobals->statsEnabled = 0;
+  keyResource = GetResource(statsKeyRType, slot);
+  if (keyResource != nil) {
+    /* Keys shorter than statsKeyLength are zero-padded (statsKey starts out
+    zeroed) */
+    keyLength = GetHandleSize(keyResource);
+    if (keyLength > 0 && keyLength <= statsKeyLength) {
+      BlockMoveData(*keyResource, theGlobals->statsKey, keyLength);
+      theGlobals->statsEnabled = 1;
+      DBGP("Stats-query responder enabled");
+    }
+    ReleaseResource(keyResource);
+  }
+}
+
+/* Control call handler for ENCSetStatsConfig */
+OSErr doSetStatsConfig(driverGlobalsPtr theGlobals, const statsConfig *config) {
+  unsigned short old_eie;
+  OSErr error;
+
+  if (config != nil) {
+    /* Replies are sent from the driver transmit buffer */
+    error = reserveDriverTx(theGlobals);
+    if (error != noErr) {
+      return error;
+    }
+  }
+
+  /* Don't let the ISR see a half-updated configuration */
+  old_eie = enc624j600_disable_irq(&theGlobals->chip, IRQ_ENABLE);
+  if (config == nil) {
+    theGlobals->statsEnabled = 0;
+  } else {
+    BlockMoveData(config->key, theGlobals->statsKey, statsKeyLength);
+    theGlobals->statsMinInterval = config->minInterval;
+    theGlobals->statsEnabled = 1;
+  }
+  enc624j600_enable_irq(&theGlobals->chip, old_eie);
+  return noErr;
+}
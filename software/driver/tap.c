@@ -0,0 +1,220 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Errors.h>
+#include <Memory.h>
+#include <MacTypes.h>
+#include <Traps.h>
+#include <stddef.h>
+
+#include "tap.h"
+#include "bpf.h"
+#include "buffers.h"
+#include "copy.h"
+#include "driver.h"
+#include "enc624j600.h"
+#include "readpacket.h"
+#include "transmit.h"
+#include "util.h"
+
+#define likely(x)    __builtin_expect (!!(x), 1)
+#define unlikely(x)  __builtin_expect (!!(x), 0)
+
+/*
+Run the tap's filter over a received frame, returning the number of bytes of
+the frame that the tap wants (0 for none). Called from handlePacket() with the
+frame's header already in the RHA and chip.rxptr pointing at its payload;
+thisPacket is the frame's entry in the receive ring, and pktLen is the length of
+the frame excluding FCS.
+
+The filter normally runs straight out of the receive ring, so that frames it
+rejects are never copied anywhere. The chip keeps ring entries word-aligned, so
+the compiled filter's word and longword loads from even offsets are safe on the
+68000. In the rare case that the frame wraps around the end of the ring, the
+filter gets a copy of the start of it instead.
+*/
+unsigned long tapFilter(driverGlobalsPtr theGlobals, const Byte *thisPacket,
+                        unsigned short pktLen) {
+  bpfFilter *filter = theGlobals->tap.filter;
+  const Byte *frame = thisPacket + offsetof(ringbufEntry, pktHeader);
+  const Byte *payload;
+  unsigned short bufLen;
+
+  if (filter == nil) {
+    return pktLen;
+  }
+
+  if (likely(frame + pktLen <= theGlobals->chip.rxbuf_end)) {
+    return bpfRun(filter, frame, pktLen, pktLen);
+  }
+
+  /* Header from the RHA (it may be the part that wraps), then as much of the
+  payload as fits. Rewind afterwards so that the frame can still be read. */
+  bufLen = pktLen < tapBufferSize ? pktLen : tapBufferSize;
+  *(ethernetHeader *)theGlobals->tap.buffer = theGlobals->rha.header.pktHeader;
+  payload = theGlobals->chip.rxptr;
+  readBuf(&theGlobals->chip, theGlobals->tap.buffer + sizeof(ethernetHeader),
+          bufLen - sizeof(ethernetHeader));
+  theGlobals->chip.rxptr = payload;
+  return bpfRun(filter, theGlobals->tap.buffer, pktLen, bufLen);
+}
+
+/* Control call handler for ENCAttachTap */
+OSErr doAttachTap(driverGlobalsPtr theGlobals, const tapConfig *config) {
+  bpfFilter *filter = nil;
+  OSErr error;
+  unsigned short srSave;
+
+  if (config == nil || config->handler == nil) {
+    return paramErr;
+  }
+
+  if (theGlobals->tap.handler != nil) {
+    /* Only one tap at a time */
+    return controlErr;
+  }
+
+  if (config->filter != nil) {
+    filter = bpfCreate(config->filter, config->filterLength,
+                       !(config->flags & tapInterpret), theGlobals->vmEnabled,
+                       &error);
+    if (filter == nil) {
+      DBGP("Bad tap filter (%d)", error);
+      return error;
+    }
+  }
+
+  srSave = maskInterrupts();
+  theGlobals->tap.filter = filter;
+  theGlobals->tap.handler = config->handler;
+  if (config->flags & tapPromiscuous) {
+    theGlobals->tap.promiscuous = 1;
+    enc624j600_enable_promiscuous(&theGlobals->chip);
+  }
+  restoreInterrupts(srSave);
+
+  return noErr;
+}
+
+/* Control call handler for ENCDetachTap. Also called when closing. */
+OSErr doDetachTap(driverGlobalsPtr theGlobals) {
+  bpfFilter *filter = theGlobals->tap.filter;
+  unsigned short srSave;
+
+  if (theGlobals->tap.handler == nil) {
+    return noErr;
+  }
+
+  srSave = maskInterrupts();
+  theGlobals->tap.handler = nil;
+  theGlobals->tap.filter = nil;
+  if (theGlobals->tap.promiscuous) {
+    theGlobals->tap.promiscuous = 0;
+    /* Bridging needs promiscuous mode too */
+    if (theGlobals->bridgePeer == nil) {
+      enc624j600_disable_promiscuous(&theGlobals->chip);
+    }
+  }
+  restoreInterrupts(srSave);
+
+  if (filter != nil) {
+    bpfDispose(filter, theGlobals->vmEnabled);
+  }
+  return noErr;
+}
+
+/*
+Control call handler for ENCTestFilter. Runs a filter (or, without one, copies
+the whole frame out of chip memory) over a frame in the driver transmit buffer
+(reserving it first if need be), so that it costs what it would on a frame in
+the receive ring.
+*/
+OSErr doTestFilter(driverGlobalsPtr theGlobals, filterTest *test) {
+  bpfFilter *filter = nil;
+  Byte *chipBuffer;
+  Ptr hostBuffer = nil;
+  unsigned long start;
+  unsigned short i;
+  OSErr error = noErr;
+
+  if (test == nil || test->frame == nil || test->frameLength == 0 ||
+      test->frameLength > 1514) {
+    return paramErr;
+  }
+
+  if (!trapAvailable(_Microseconds)) {
+    return controlErr;
+  }
+
+  error = reserveDriverTx(theGlobals);
+  if (error != noErr) {
+    return error;
+  }
+
+  if (test->filter != nil) {
+    filter = bpfCreate(test->filter, test->filterLength,
+                       !(test->flags & tapInterpret), false, &error);
+    if (filter == nil) {
+      return error;
+    }
+  } else {
+    hostBuffer = NewPtrSys(test->frameLength);
+    if (hostBuffer == nil) {
+      return MemError();
+    }
+  }
+
+  chipBuffer = claimDriverTx(theGlobals);
+  if (chipBuffer == nil) {
+    /* Something is waiting to be sent, try again later */
+    error = controlErr;
+    goto done;
+  }
+  copyToChip(theGlobals, chipBuffer, test->frame, test->frameLength);
+
+  test->result = 0;
+  if (filter != nil) {
+    start = microsecondClock();
+    for (i = 0; i < test->iterations; i++) {
+      test->result = bpfRun(filter, chipBuffer, test->frameLength,
+                            test->frameLength);
+    }
+    test->microseconds = microsecondClock() - start;
+    test->codeSize = filter->codeSize;
+  } else {
+    start = microsecondClock();
+    for (i = 0; i < test->iterations; i++) {
+      chipCopy(theGlobals->chipReadCopy, chipBuffer, hostBuffer,
+               test->frameLength);
+    }
+    test->microseconds = microsecondClock() - start;
+    test->result = test->frameLength;
+    test->codeSize = 0;
+  }
+
+  releaseDriverTx(theGlobals);
+
+done:
+  if (filter != nil) {
+    bpfDispose(filter, false);
+  }
+  if (hostBuffer != nil) {
+    DisposePtr(hostBuffer);
+  }
+  return error;
+}
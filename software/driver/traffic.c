@@ -0,0 +1,94 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <ENET.h>
+#include <Errors.h>
+#include <Memory.h>
+#include <MacTypes.h>
+#include <string.h>
+
+#include "driver.h"
+#include "enc624j600.h"
+#include "traffic.h"
+#include "util.h"
+
+#define likely(x)    __builtin_expect (!!(x), 1)
+
+const unsigned char sizeBucketTable[24] = {
+  sizeBucket64,                                   /* 0-63 */
+  sizeBucket65to127,                              /* 64-127 */
+  sizeBucket128to255, sizeBucket128to255,         /* 128-255 */
+  sizeBucket256to511, sizeBucket256to511,         /* 256-511 */
+  sizeBucket256to511, sizeBucket256to511,
+  sizeBucket512to1023, sizeBucket512to1023,       /* 512-1023 */
+  sizeBucket512to1023, sizeBucket512to1023,
+  sizeBucket512to1023, sizeBucket512to1023,
+  sizeBucket512to1023, sizeBucket512to1023,
+  sizeBucket1024to1518, sizeBucket1024to1518,     /* 1024-1535 */
+  sizeBucket1024to1518, sizeBucket1024to1518,
+  sizeBucket1024to1518, sizeBucket1024to1518,
+  sizeBucket1024to1518, sizeBucket1024to1518
+};
+
+/* Count a broadcast or multicast frame against its sender in the top-talker
+table (see sethernet.h) */
+void countTalker(driverGlobalsPtr theGlobals, const hwAddr *source) {
+  unsigned long hash;
+  topTalker *slot;
+
+  /* Fold the address down to a table index */
+  hash = source->first4 ^ source->last2;
+  hash ^= hash >> 16;
+  hash ^= hash >> 8;
+  slot = &theGlobals->traffic.talkers[hash & (numTopTalkers - 1)];
+
+  if (likely(ethAddrsEqual((hwAddr *)slot->address, source))) {
+    slot->frames++;
+  } else if (slot->frames <= 1) {
+    /* Slot is free, or the incumbent has been outsent */
+    copyEthAddrs((hwAddr *)slot->address, source);
+    slot->frames = 1;
+  } else {
+    slot->frames--;
+  }
+}
+
+/* Control call handler for ENCGetTrafficStats */
+OSErr doGetTrafficStats(driverGlobalsPtr theGlobals, EParamBlkPtr pb) {
+  unsigned short srSave;
+
+  if (pb->u.EParms1.eBuffSize > (short) sizeof(theGlobals->traffic)) {
+    pb->u.EParms1.eBuffSize = sizeof(theGlobals->traffic);
+  }
+  /* Don't let the ISR update the counts or the talker table mid-copy */
+  srSave = maskInterrupts();
+  BlockMoveData(&theGlobals->traffic, pb->u.EParms1.ePointer,
+                pb->u.EParms1.eBuffSize);
+  restoreInterrupts(srSave);
+  return noErr;
+}
+
+/* Control call handler for ENCClearTrafficStats */
+void doClearTrafficStats(driverGlobalsPtr theGlobals) {
+  unsigned short old_eie;
+
+  /* Don't let the ISR count anything while we're clearing */
+  old_eie = enc624j600_disable_irq(&theGlobals->chip, IRQ_ENABLE);
+  memset(&theGlobals->traffic, 0, sizeof(theGlobals->traffic));
+  enc624j600_enable_irq(&theGlobals->chip, old_eie);
+}
@@ -0,0 +1,42 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <ENET.h>
+#include <MacTypes.h>
+
+#include "driver.h"
+
+/* Size bucket for each 64-byte band of frame length (including FCS) */
+extern const unsigned char sizeBucketTable[24];
+
+/* Count a frame in a size histogram. length excludes the FCS. */
+static inline void countFrameSize(unsigned long buckets[],
+                                  unsigned short length) {
+  if (length <= 60) {
+    /* Minimum-size (or padded up to it) */
+    buckets[sizeBucket64]++;
+  } else {
+    buckets[sizeBucketTable[(length + 4) >> 6]]++;
+  }
+}
+
+void countTalker(driverGlobalsPtr theGlobals, const hwAddr *source);
+OSErr doGetTrafficStats(driverGlobalsPtr theGlobals, EParamBlkPtr pb);
+void doClearTrafficStats(driverGlobalsPtr theGlobals);
@@ -0,0 +1,504 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Devices.h>
+#include <ENET.h>
+#include <Errors.h>
+#include <MacTypes.h>
+#include <OSUtils.h>
+
+#include "transmit.h"
+#include "bridge.h"
+#include "driver.h"
+#include "enc624j600.h"
+#include "enc624j600_registers.h"
+#include "isr.h"
+#include "linkrate.h"
+#include "readpacket.h"
+#include "traffic.h"
+#include "txlatency.h"
+#include "txstats.h"
+#include "util.h"
+
+#define likely(x)    __builtin_expect (!!(x), 1)
+#define unlikely(x)  __builtin_expect (!!(x), 0)
+
+/* Start transmitting the frame in the transmit buffer */
+static void startHostTx(driverGlobalsPtr theGlobals, unsigned short length) {
+  debug_log(theGlobals, txEvent, length);
+  txLatencyStamp(theGlobals, started);
+  theGlobals->txActive = txHost;
+  theGlobals->txActiveLength = length;
+  theGlobals->txHostQueued = 0;
+  enc624j600_transmit(&theGlobals->chip,
+                      enc624j600_addr_to_ptr(&theGlobals->chip,
+                                             ENC_TX_BUF_START),
+                      length);
+}
+
+/* Start transmitting the frame in the driver transmit buffer */
+static void startDriverTx(driverGlobalsPtr theGlobals, unsigned short length) {
+  debug_log(theGlobals, txDriverEvent, length);
+  theGlobals->txActive = txDriver;
+  theGlobals->txActiveLength = length;
+  theGlobals->txDriverQueued = 0;
+  enc624j600_transmit(&theGlobals->chip,
+                      enc624j600_addr_to_ptr(&theGlobals->chip,
+                                             theGlobals->driverTxStart),
+                      length);
+}
+
+/* Start transmitting the oldest frame in the reply buffer */
+static void startReplyTx(driverGlobalsPtr theGlobals) {
+  unsigned char slot = theGlobals->reply.head;
+  unsigned short start =
+      theGlobals->replyTxStart + theGlobals->reply.offset[slot];
+  unsigned short length = theGlobals->reply.length[slot];
+
+  debug_log(theGlobals, txReplyEvent, length);
+  theGlobals->txActive = txReply;
+  theGlobals->txActiveLength = length;
+  enc624j600_transmit(&theGlobals->chip,
+                      enc624j600_addr_to_ptr(&theGlobals->chip, start), length);
+}
+
+/* The oldest frame in the reply buffer can be sent */
+static inline Boolean replyReady(const driverGlobalsPtr theGlobals) {
+  return theGlobals->reply.count &&
+         theGlobals->reply.ready[theGlobals->reply.head];
+}
+
+/* Total length of the frame in a WDS */
+static unsigned long wdsLength(const WDSElement *wds) {
+  unsigned long totalLength = 0;
+
+  do {
+    totalLength += wds->entryLength;
+    wds++;
+  } while (wds->entryLength);
+  return totalLength;
+}
+
+/* Copy the frame in a WDS into chip memory */
+static void copyWDS(const driverGlobalsPtr theGlobals, Byte *dest,
+                    const WDSElement *wds) {
+  do {
+    copyToChip(theGlobals, dest, (Byte *)wds->entryPtr, wds->entryLength);
+    dest += wds->entryLength;
+    wds++;
+  } while (wds->entryLength > 0);
+}
+
+/* Pass a frame in the transmit buffer to our own protocol handlers, as if it
+had just been received. Caller must have our chip's interrupts disabled, so that
+the receive path isn't using the RHA. */
+static void deliverLoopback(driverGlobalsPtr theGlobals, unsigned short length) {
+  const unsigned char *savedRxptr = theGlobals->chip.rxptr;
+
+  debug_log(theGlobals, txLoopbackEvent, length);
+
+  /* Point the read pointer at the transmit buffer. This lies below the receive
+  FIFO, so readBuf() and the protocol handler's ReadPacket calls never see it
+  wrap. */
+  theGlobals->chip.rxptr =
+      enc624j600_addr_to_ptr(&theGlobals->chip, ENC_TX_BUF_START);
+  readBuf(&theGlobals->chip, (unsigned char *)&theGlobals->rha.header.pktHeader,
+          sizeof(ethernetHeader));
+  deliverFrame(theGlobals, length);
+  theGlobals->chip.rxptr = savedRxptr;
+
+  theGlobals->info.txLoopback++;
+}
+
+/*
+Loop back an ENetWrite frame addressed to ourselves without sending it over the
+wire. Protocol handlers expect to be called at interrupt time, so the frame is
+always left in the transmit buffer for userISR() to deliver by calling
+finishLoopback(), which completes the write.
+
+If our ISR is running (most likely we've been called from one of our own
+protocol handlers) it may already be past the point where it looks for a
+looped-back frame, and otherwise there may be nothing to make it run at all. So
+we raise IRQ_SOFT, which makes the chip interrupt as soon as the ISR (if any)
+re-enables interrupts.
+*/
+static OSErr loopbackHostFrame(driverGlobalsPtr theGlobals,
+                               unsigned short length) {
+  theGlobals->loopbackLength = length;
+  theGlobals->loopbackPending = 1;
+  enc624j600_raise_irq(&theGlobals->chip, IRQ_SOFT);
+  return 1;
+}
+
+/* Deliver a looped-back frame deferred by loopbackHostFrame(), and complete
+the ENetWrite call that sent it. Called from userISR(). */
+void finishLoopback(driverGlobalsPtr theGlobals) {
+  theGlobals->loopbackPending = 0;
+  deliverLoopback(theGlobals, theGlobals->loopbackLength);
+  SafeIODone((DCtlPtr) theGlobals->driverDCE, noErr);
+}
+
+/* Find room for a frame of the given (even) size in the reply buffer, or return
+-1 if there isn't any. Frames are sent and freed oldest first, so the frames in
+the buffer always run from the head frame's offset to the tail, possibly
+wrapping round the end of the buffer. A frame has to be contiguous, so if it
+doesn't fit between the tail and the end, it goes at the start instead. Call
+with interrupts masked. */
+static short replyAlloc(const driverGlobalsPtr theGlobals,
+                        unsigned short space) {
+  unsigned short head;
+  unsigned short tail = theGlobals->reply.tail;
+
+  if (theGlobals->reply.count == 0) {
+    return 0;
+  }
+  if (theGlobals->reply.count == txReplyQueueSize) {
+    return -1;
+  }
+  head = theGlobals->reply.offset[theGlobals->reply.head];
+  if (tail > head) {
+    /* Free space is after the tail and before the head */
+    if (tail + space <= ENC_REPLY_TX_BUF_SIZE) {
+      return tail;
+    }
+    return space <= head ? 0 : -1;
+  }
+  /* Wrapped, free space is between the tail and the head */
+  return tail + space <= head ? tail : -1;
+}
+
+/*
+Immediate ENetWrite, typically a protocol handler replying from interrupt time.
+
+The Device Manager doesn't serialize immediate calls with queued ones, so one
+may arrive while a queued write's frame is still in the transmit buffer.
+Immediate frames go in the reply buffer instead, in a queue of their own, and
+are sent when the transmitter next comes free. Nothing is waiting for them to
+finish (the call has already returned by then), so no IODone call is made; the
+write is complete as soon as the frame is copied. If the reply buffer is full,
+the write fails with memFullErr and the caller can try again later. The reply
+buffer is only there once a client has asked for it with
+ENCEnableImmediateWrites (see buffers.c); until then every immediate write
+fails this way.
+
+Space is reserved with interrupts masked, but the frame is copied in with them
+enabled, so a frame isn't sent until it is marked ready. Frames addressed to
+ourselves are not looped back internally, they go out on the wire.
+*/
+static OSErr doEWriteImmediate(const driverGlobalsPtr theGlobals,
+                               const EParamBlkPtr pb) {
+  const WDSElement *wds = (const WDSElement *)pb->u.EParms1.ePointer;
+  unsigned long totalLength;
+  unsigned short space;
+  unsigned short srSave;
+  unsigned char slot;
+  short offset;
+  Byte *dest;
+
+  totalLength = wdsLength(wds);
+  if (unlikely(totalLength + 4 > 1518 || totalLength < 14)) {
+    DBGP("TX: bogus length %lu bytes!", totalLength);
+    return eLenErr;
+  }
+
+  if (unlikely(theGlobals->chip.link_state == LINK_DOWN)) {
+    return excessCollsns;
+  }
+
+  /* Keep frames word-aligned */
+  space = (totalLength + 1) & ~1;
+
+  srSave = maskInterrupts();
+  offset = theGlobals->replyTxStart ? replyAlloc(theGlobals, space) : -1;
+  if (offset < 0) {
+    theGlobals->info.immediateWritesRejected++;
+    restoreInterrupts(srSave);
+    return memFullErr;
+  }
+  slot = (theGlobals->reply.head + theGlobals->reply.count) % txReplyQueueSize;
+  theGlobals->reply.offset[slot] = offset;
+  theGlobals->reply.length[slot] = totalLength;
+  theGlobals->reply.ready[slot] = 0;
+  theGlobals->reply.count++;
+  theGlobals->reply.tail = offset + space;
+  restoreInterrupts(srSave);
+
+  dest = enc624j600_addr_to_ptr(&theGlobals->chip,
+                                theGlobals->replyTxStart + offset);
+  copyWDS(theGlobals, dest, wds);
+  copyToChip(theGlobals, dest + 6, theGlobals->info.ethernetAddress, 6);
+
+  srSave = maskInterrupts();
+  theGlobals->reply.ready[slot] = 1;
+  theGlobals->info.immediateWrites++;
+  if (theGlobals->txActive == txIdle && slot == theGlobals->reply.head) {
+    startReplyTx(theGlobals);
+  }
+  restoreInterrupts(srSave);
+  return noErr;
+}
+
+/*
+EWrite (a.k.a.) Control called with csCode=ENetWrite
+
+Initiate transmission of an ethernet frame. This function is asynchronous and
+returns as soon as the frame has been copied into the transmit buffer and
+transmission has been started. Completion is signaled through a
+transmit-complete or transmit-aborted interrupt.
+
+The Device Manager handles the queueing of writes for us and won't issue another
+ENetWrite until the last one has signaled completion. However, the transmitter
+may still be busy sending a frame generated by the driver itself, in which case
+our frame waits in the transmit buffer and is started by handleTxComplete().
+
+Transmit state is changed by our ISR, and when bridging, by the other card's
+ISR too, so masking our own chip's interrupts isn't enough to keep it
+consistent. Mask CPU interrupts instead while changing it.
+
+The frame data is given as a Write Data Structure (WDS) - a list of
+address-length pairs like an iovec, we need to read from each one in sequence,
+the end of the WDS is signaled by an entry with a zero length. The ethernet
+header is already prepared for us, we just have to write our hardware address
+into the source field.
+
+With internal loopback enabled, frames addressed to ourselves never reach the
+transmitter; see loopbackHostFrame().
+
+Immediate calls are handled separately by doEWriteImmediate().
+*/
+OSErr doEWrite(const driverGlobalsPtr theGlobals, const EParamBlkPtr pb) {
+  WDSElement *wds; /* a WDS is a list of address-length pairs like an iovec */
+  unsigned long totalLength; /* total length of frame */
+  unsigned short srSave;
+  Byte *dest;
+
+  if (unlikely(pb->ioTrap & ioTrapNoQueue)) {
+    return doEWriteImmediate(theGlobals, pb);
+  }
+
+  txLatencyStamp(theGlobals, entry);
+
+  /* Shouldn't ever happen unless something has gone very wrong */
+  if (theGlobals->txActive == txHost || theGlobals->txHostQueued) {
+    DBGS("\pTransmit while already transmitting!");
+  }
+
+  /* Scan through WDS list entries to compute total length */
+  wds = (WDSElement *)pb->u.EParms1.ePointer;
+  totalLength = wdsLength(wds);
+
+  /* Block transmission of oversized or unreasonably short frames. (Add 4 bytes
+  to calculated length to account for FCS field generated by ethernet
+  controller) */
+  if (unlikely(totalLength + 4 > 1518 || totalLength < 14)) {
+    DBGP("TX: bogus length %lu bytes!", totalLength);
+    return eLenErr;
+  }
+
+  /* Until ENetSetGeneral is called, the transmit buffer only has room for
+  AppleTalk frames (see buffers.c) */
+  if (unlikely(totalLength > appleTalkMaxFrame && !theGlobals->generalMode)) {
+    DBGP("TX: %lu bytes before ENetSetGeneral!", totalLength);
+    return eLenErr;
+  }
+
+  /* Copy data from WDS into transmit buffer */
+  dest = enc624j600_addr_to_ptr(&theGlobals->chip, ENC_TX_BUF_START);
+  copyWDS(theGlobals, dest, wds);
+
+  /* Go back and copy our address into the source field */
+  dest = enc624j600_addr_to_ptr(&theGlobals->chip, ENC_TX_BUF_START + 6);
+  copyToChip(theGlobals, dest, theGlobals->info.ethernetAddress, 6);
+  txLatencyStamp(theGlobals, copied);
+
+  if (unlikely(theGlobals->internalLoopback) &&
+      ethAddrsEqual((const hwAddr *)enc624j600_addr_to_ptr(&theGlobals->chip,
+                                                           ENC_TX_BUF_START),
+                    (const hwAddr *)theGlobals->info.ethernetAddress)) {
+    /* Sent to ourselves, no need to involve the wire */
+    return loopbackHostFrame(theGlobals, totalLength);
+  }
+
+  if (unlikely(theGlobals->chip.link_state == LINK_DOWN)) {
+    /* don't bother trying to send packets on a down link */
+    return excessCollsns;
+  }
+
+  srSave = maskInterrupts();
+  if (likely(theGlobals->txActive == txIdle)) {
+    /* Send it! */
+    startHostTx(theGlobals, totalLength);
+  } else {
+    /* Transmitter is busy with a frame of our own, wait our turn */
+    theGlobals->txHostLength = totalLength;
+    theGlobals->txHostQueued = 1;
+  }
+  restoreInterrupts(srSave);
+
+  /* Return >0 to indicate operation in progress */
+  return 1;
+}
+
+/*
+Claim the driver transmit buffer so that a frame can be built in it. Returns a
+pointer to the buffer, or nil if it's still in use or hasn't been reserved. A
+claimed buffer must be released by queueDriverFrame() or sendDriverFrame().
+*/
+Byte *claimDriverTx(driverGlobalsPtr theGlobals) {
+  Byte *buffer = nil;
+  unsigned short srSave = maskInterrupts();
+  if (theGlobals->driverTxStart && theGlobals->txActive != txDriver &&
+      !theGlobals->txDriverQueued && !theGlobals->txDriverClaimed) {
+    theGlobals->txDriverClaimed = 1;
+    buffer = enc624j600_addr_to_ptr(&theGlobals->chip,
+                                    theGlobals->driverTxStart);
+  }
+  restoreInterrupts(srSave);
+  return buffer;
+}
+
+/* Give up a claimed driver transmit buffer without sending anything from it */
+void releaseDriverTx(driverGlobalsPtr theGlobals) {
+  theGlobals->txDriverClaimed = 0;
+  if (theGlobals->bridgePeer != nil) {
+    /* The other card may have stalled while we had the buffer */
+    bridgeResumePeer(theGlobals);
+  }
+}
+
+/*
+Send the frame in the (claimed) driver transmit buffer as-is.
+
+Unlike ENetWrite frames, nobody is waiting on completion of these, so no IODone
+call is made when they are sent.
+*/
+void queueDriverFrame(driverGlobalsPtr theGlobals, unsigned short length) {
+  unsigned short srSave = maskInterrupts();
+  theGlobals->txDriverClaimed = 0;
+  if (theGlobals->txActive == txIdle) {
+    startDriverTx(theGlobals, length);
+  } else {
+    theGlobals->txDriverLength = length;
+    theGlobals->txDriverQueued = 1;
+  }
+  restoreInterrupts(srSave);
+}
+
+/* Send a frame that the driver has built in the (claimed) driver transmit
+buffer, with our address filled in as its source */
+void sendDriverFrame(driverGlobalsPtr theGlobals, unsigned short length) {
+  copyToChip(theGlobals,
+             enc624j600_addr_to_ptr(&theGlobals->chip,
+                                    theGlobals->driverTxStart + 6),
+             theGlobals->info.ethernetAddress, 6);
+  queueDriverFrame(theGlobals, length);
+}
+
+/* Handle a transmit-complete or transmit-abort interrupt */
+void handleTxComplete(driverGlobalsPtr theGlobals, unsigned short irq_status) {
+  unsigned short txstat =
+      ENC624J600_READ_REG(theGlobals->chip.base_address, ETXSTAT);
+  unsigned char completed = theGlobals->txActive;
+  unsigned short srSave;
+  OSErr result;
+
+  /* Aborted frames took up the wire too, as far as they got */
+  countTxWire(theGlobals,
+              ENC624J600_READ_REG(theGlobals->chip.base_address, ETXWIRE));
+
+  if (likely(irq_status & IRQ_TX)) {
+    /* Transmit complete; signal successful completion */
+    if (completed == txHost) {
+      txLatencyComplete(theGlobals);
+    }
+
+    /* Record statistics. Only the raw outcome is counted here, the driverInfo
+    counters are derived from it when read (see txstats.h) */
+    theGlobals->txOutcomes[txOutcome(txstat)]++;
+    countFrameSize(theGlobals->traffic.txSizes, theGlobals->txActiveLength);
+
+    /* Must acknowledge the transmit interrupt *before* calling IODone,
+    otherwise we can accidentally acknowledge the interrupt for a transmit
+    started by a completion routine */
+    enc624j600_clear_irq(&theGlobals->chip, IRQ_TX);
+    result = noErr;
+  } else {
+    /*
+    Transmit aborted due to one of:
+      - Collision count exceeded MACLCON_MAXRET (count in ETXSTAT_COLCNT)
+      - Collision occurred after 63 bytes transmitted (ETXSTAT_LATECOL set)
+      - Medium was busy, transmission deferred for longer than timeout
+        (ETXSTAT_EXDEFER set)
+      - Transmit aborted in software by clearing ECON1_TXRTS
+    */
+
+   /* Record statistics */
+    if (txstat & ETXSTAT_EXDEFER) {
+      theGlobals->info.excessiveDeferrals++;
+    } else if (txstat & ETXSTAT_MAXCOL) {
+      theGlobals->info.excessiveCollisions++;
+    } else if (txstat & ETXSTAT_LATECOL) {
+      theGlobals->info.lateCollisions++;
+    } else {
+      theGlobals->info.internalTxErrors++;
+    }
+
+    DBGP("TX abort! ETXSTAT=%04x", txstat);
+
+    /* Acknowledge interrupt *before* calling IODone */
+    enc624j600_clear_irq(&theGlobals->chip, IRQ_TX_ABORT);
+    result = excessCollsns;
+  }
+
+  /* Get the next frame going, if there is one. Replies go first, since
+  someone is waiting on them, but alternate between buffers so that none can
+  starve the others. */
+  srSave = maskInterrupts();
+  theGlobals->txActive = txIdle;
+  if (completed == txReply) {
+    /* Nobody is waiting on completion of these. Its space is free as soon as
+    it has gone. */
+    theGlobals->reply.head = (theGlobals->reply.head + 1) % txReplyQueueSize;
+    theGlobals->reply.count--;
+  }
+  if (completed != txReply && replyReady(theGlobals)) {
+    startReplyTx(theGlobals);
+  } else if (completed != txDriver && theGlobals->txDriverQueued) {
+    startDriverTx(theGlobals, theGlobals->txDriverLength);
+  } else if (theGlobals->txHostQueued) {
+    startHostTx(theGlobals, theGlobals->txHostLength);
+  } else if (theGlobals->txDriverQueued) {
+    startDriverTx(theGlobals, theGlobals->txDriverLength);
+  } else if (replyReady(theGlobals)) {
+    startReplyTx(theGlobals);
+  }
+  restoreInterrupts(srSave);
+
+  if (completed == txDriver && theGlobals->bridgePeer != nil) {
+    /* The driver transmit buffer is free again, let the other card forward
+    the frame it was waiting to send */
+    bridgeResumePeer(theGlobals);
+  }
+
+  if (completed == txHost) {
+    /* Call IODone to progress IO queue and call async completion routine */
+    debug_log(theGlobals, txCallIODoneEvent, result);
+    SafeIODone((DCtlPtr) theGlobals->driverDCE, result);
+    debug_log(theGlobals, txReturnIODoneEvent, 0x5555);
+  }
+}
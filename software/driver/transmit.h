@@ -0,0 +1,44 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <ENET.h>
+#include <MacTypes.h>
+
+#include "copy.h"
+#include "driver.h"
+
+/* Copy data into the given card's chip memory */
+static inline void copyToChip(const driverGlobalsPtr theGlobals, Byte *dest,
+                              const Byte *source, unsigned short len) {
+#if defined(REV0_SUPPORT)
+  (void)theGlobals;
+  enc624j600_memcpy(dest, source, len);
+#else
+  chipCopy(theGlobals->chipWriteCopy, source, dest, len);
+#endif
+}
+
+OSErr doEWrite(const driverGlobalsPtr theGlobals, const EParamBlkPtr pb);
+Byte *claimDriverTx(driverGlobalsPtr theGlobals);
+void releaseDriverTx(driverGlobalsPtr theGlobals);
+void queueDriverFrame(driverGlobalsPtr theGlobals, unsigned short length);
+void sendDriverFrame(driverGlobalsPtr theGlobals, unsigned short length);
+void handleTxComplete(driverGlobalsPtr theGlobals, unsigned short irq_status);
+void finishLoopback(driverGlobalsPtr theGlobals);
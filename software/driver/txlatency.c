@@ -0,0 +1,90 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Errors.h>
+#include <MacTypes.h>
+#include <Memory.h>
+
+#include "driver.h"
+#include "enc624j600.h"
+#include "txlatency.h"
+
+#include <string.h>
+
+#if defined(TX_LATENCY)
+/* Count a latency in a log2 histogram */
+static void countLatency(unsigned long buckets[], unsigned long micros) {
+  unsigned short bucket = 0;
+
+  /* No bit-scan instruction on the 68000, but this is at most a few shifts for
+  any reasonable latency */
+  while (micros > 1 && bucket < numTxLatencyBuckets - 1) {
+    micros >>= 1;
+    bucket++;
+  }
+  buckets[bucket]++;
+}
+
+/* An ENetWrite frame has been transmitted, record how long each stage took.
+Called from handleTxComplete(). */
+void txLatencyComplete(driverGlobalsPtr theGlobals) {
+  unsigned long (*buckets)[numTxLatencyBuckets] = theGlobals->txLatency.buckets;
+  UnsignedWide now;
+
+  if (!theGlobals->hasTxLatency) {
+    return;
+  }
+  Microseconds(&now);
+
+  countLatency(buckets[txLatencyCopy],
+               theGlobals->txStamps.copied - theGlobals->txStamps.entry);
+  countLatency(buckets[txLatencyQueue],
+               theGlobals->txStamps.started - theGlobals->txStamps.copied);
+  countLatency(buckets[txLatencyWire],
+               now.lo - theGlobals->txStamps.started);
+  countLatency(buckets[txLatencyTotal],
+               now.lo - theGlobals->txStamps.entry);
+}
+#endif
+
+/* Control call handler for ENCGetTxLatency */
+OSErr doGetTxLatency(driverGlobalsPtr theGlobals, EParamBlkPtr pb) {
+  if (!theGlobals->hasTxLatency) {
+    return controlErr;
+  }
+  if (pb->u.EParms1.eBuffSize > (short) sizeof(theGlobals->txLatency)) {
+    pb->u.EParms1.eBuffSize = sizeof(theGlobals->txLatency);
+  }
+  BlockMoveData(&theGlobals->txLatency, pb->u.EParms1.ePointer,
+                pb->u.EParms1.eBuffSize);
+  return noErr;
+}
+
+/* Control call handler for ENCClearTxLatency */
+OSErr doClearTxLatency(driverGlobalsPtr theGlobals) {
+  unsigned short old_eie;
+
+  if (!theGlobals->hasTxLatency) {
+    return controlErr;
+  }
+  /* Don't let the ISR count anything while we're clearing */
+  old_eie = enc624j600_disable_irq(&theGlobals->chip, IRQ_ENABLE);
+  memset(&theGlobals->txLatency, 0, sizeof(theGlobals->txLatency));
+  enc624j600_enable_irq(&theGlobals->chip, old_eie);
+  return noErr;
+}
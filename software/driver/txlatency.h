@@ -0,0 +1,52 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <ENET.h>
+#include <MacTypes.h>
+
+#include "driver.h"
+
+/*
+Transmit latency instrumentation. A Microseconds trap call at each stage is a
+noticeable cost on a 68000, so unless the driver is built with TX_LATENCY the
+hooks below compile to nothing.
+*/
+#if defined(TX_LATENCY)
+#include <Timer.h>
+
+/* Record the time at which an ENetWrite frame reached a stage (a field of
+driverGlobals.txStamps) */
+#define txLatencyStamp(theGlobals, stage)                                      \
+  do {                                                                         \
+    if ((theGlobals)->hasTxLatency) {                                          \
+      UnsignedWide txLatencyNow;                                               \
+      Microseconds(&txLatencyNow);                                             \
+      (theGlobals)->txStamps.stage = txLatencyNow.lo;                          \
+    }                                                                          \
+  } while (0)
+
+void txLatencyComplete(driverGlobalsPtr theGlobals);
+#else
+#define txLatencyStamp(theGlobals, stage) do {} while (0)
+#define txLatencyComplete(theGlobals) do {} while (0)
+#endif
+
+OSErr doGetTxLatency(driverGlobalsPtr theGlobals, EParamBlkPtr pb);
+OSErr doClearTxLatency(driverGlobalsPtr theGlobals);
@@ -0,0 +1,79 @@
+/*
+SEthernet and SEthernet/30 Driver
+
+Copyright (C) 2023-2024 Richard Halkyard
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <MacTypes.h>
+
+#include "driver.h"
+#include "enc624j600_registers.h"
+
+/*
+Lazily-computed transmit statistics
+
+The transmit-complete interrupt only counts each frame against its raw outcome,
+i.e. the DEFER and COLCNT fields of ETXSTAT. The derived driverInfo counters
+(txFrameCount, deferredFrames, and the collision counters) are brought up to
+date by foldTxOutcomes() whenever someone is about to read them.
+*/
+
+/* Index into txOutcomes[] for an ETXSTAT value: DEFER in bit 4, COLCNT in bits
+3-0 */
+static inline unsigned short txOutcome(unsigned short txstat) {
+  return ((txstat & ETXSTAT_DEFER) >> 11) |
+         ((txstat & ETXSTAT_COLCNT_MASK) >> ETXSTAT_COLCNT_SHIFT);
+}
+
+/* Add transmits counted in outcomes[] since the last fold to info. folded[]
+holds the outcome counts already added, and is updated. Must not be interrupted
+by the ISR when working on the driver's own counters. */
+static inline void foldTxOutcomes(const unsigned long outcomes[],
+                                  unsigned long folded[], driverInfo *info) {
+  unsigned short i;
+  unsigned long count, delta;
+  unsigned short collisions;
+
+  for (i = 0; i < numTxOutcomes; i++) {
+    count = outcomes[i];
+    delta = count - folded[i];
+    if (delta == 0) {
+      continue;
+    }
+    folded[i] = count;
+
+    info->txFrameCount += delta;
+    if (i & 0x10) {
+      info->deferredFrames += delta;
+    }
+    collisions = i & 0x0f;
+    if (collisions >= 1) {
+      info->collisionFrames += delta;
+      if (collisions == 1) {
+        info->singleCollisionFrames += delta;
+      } else {
+        info->multiCollisionFrames += delta;
+      }
+    }
+  }
+}
+
+/* Bring our own driverInfo up to date */
+static inline void foldTxStats(driverGlobalsPtr theGlobals) {
+  foldTxOutcomes(theGlobals->txOutcomes, theGlobals->txOutcomesFolded,
+                 &theGlobals->info);
+}
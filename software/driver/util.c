@@ -39,11 +39,12 @@ void DebugPrintf(const char * format, ...) {
    8-1 */
 Boolean trapAvailable(const unsigned short trap) {
   TrapType type;
-  /* First determine whether it is an OS or Toolbox routine */
+  /* First determine whether it is an OS or Toolbox routine (Toolbox traps
+  have bit 11 set) */
   if (trap & 0x800) {
-    type = OSTrap;
-  } else {
     type = ToolTrap;
+  } else {
+    type = OSTrap;
   }
 
   /* filter cases where older systems mask with 0x1ff rather than 0x3ff */
@@ -55,17 +56,21 @@ Boolean trapAvailable(const unsigned short trap) {
   }
 }
 
+/* Low 32 bits of the Microseconds trap, for timing statistics. Caller must
+check that the trap is available. */
+unsigned long microsecondClock(void) {
+  UnsignedWide now;
+  Microseconds(&now);
+  return now.lo;
+}
+
 #if defined(DEBUG)
 void debug_log(driverGlobals *theGlobals, unsigned short eventType,
                unsigned short eventData) {
   eventLog *log = &theGlobals->log;
 
   /* Disable interrupts so that log operations are atomic */
-  unsigned short srSave;
-  asm("MOVE.W  %%sr, %[srSave] \n\t"
-      "ORI.W   %[srMaskInterrupts], %%sr  \n\t"
-      : [srSave] "=dm"(srSave)
-      : [srMaskInterrupts] "i"(0x700));
+  unsigned short srSave = maskInterrupts();
 
   log->entries[log->head].ticks = TickCount();
   log->entries[log->head].eventType = eventType;
@@ -78,6 +83,6 @@ void debug_log(driverGlobals *theGlobals, unsigned short eventType,
   log->entries[log->head].eventData = 0xffff;
 
   /* Restore processor state */
-  asm volatile("MOVE.W  %[srSave], %%sr \n\t" : : [srSave] "dm"(srSave));
+  restoreInterrupts(srSave);
 }
 #endif
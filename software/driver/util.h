@@ -18,6 +18,7 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include <Devices.h>
 #include <MacTypes.h>
 
 #if defined(DEBUG)
@@ -29,6 +30,7 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "driver.h"
 
 Boolean trapAvailable(const unsigned short trap);
+unsigned long microsecondClock(void);
 
 #if defined(DEBUG)
 /* Write an event to the debugging event log */
@@ -48,6 +50,47 @@ void DebugPrintf(const char * format, ...);
 #define DBG()
 #endif
 
+/* Mask all interrupts, returning the previous status register value */
+static inline unsigned short maskInterrupts(void) {
+  unsigned short srSave;
+  asm volatile("MOVE.W  %%sr, %[srSave] \n\t"
+               "ORI.W   %[srMaskInterrupts], %%sr  \n\t"
+               : [srSave] "=dm"(srSave)
+               : [srMaskInterrupts] "i"(0x700)
+               /* Keep the compiler from moving memory accesses out of the
+               masked region */
+               : "memory");
+  return srSave;
+}
+
+/* Restore the status register value returned by maskInterrupts() */
+static inline void restoreInterrupts(unsigned short srSave) {
+  asm volatile("MOVE.W  %[srSave], %%sr \n\t"
+               :
+               : [srSave] "dm"(srSave)
+               : "memory");
+}
+
+/* IODone may trash D3 and A2-A3, which are normally assumed to be preserved
+across calls. This is not documented anywhere obvious in Inside Macintosh, and
+the IODone() inline function in the Universal Interfaces Devices.h does NOT save
+any registers beyond the standard register spec. This routine provides a 'safe'
+version that shouldn't cause any nasty register-trashing surprises. */
+static inline void SafeIODone(DCtlPtr dce, OSErr result) {
+  asm volatile(
+    "   MOVE.L   %[dce], %%a1\n\t"
+    "   MOVE.W   %[result], %%d0\n\t"
+    "   MOVE.L   0x08fc, %%a0\n\t"  /* 0x08fc = IODone jump vector (JIODone) */
+    "   JSR      (%%a0)\n\t"
+    :
+    : [dce] "g" (dce),
+      [result] "g" (result)
+    : "d0", "d1", "d2", "a0", "a1", /* Registers that we normally expect to be 
+                                       trashed across calls */
+      "d3", "a2", "a3"              /* Extra registers that IODone may change */
+  );
+}
+
 /* Compare two ethernet addresses for equality */
 static inline Boolean ethAddrsEqual(const hwAddr *addr1, const hwAddr *addr2) {
   /* Compare first 4 bytes */
@@ -33,28 +33,25 @@ extern char strbuf[255];
 #define unlikely(x)  __builtin_expect (!!(x), 0)
 
 /*
-Promiscuous-mode receive configuration:
-    CRCEN:    discard frames with invalid CRC
-    RUNTEN:   discard runt frames
-    UCEN:     accept unicast frames addressed to us
-    NOTMEEN:  accept unicast frames addressed to destinations other than us
-    BCEN:     accept broadcast frames
-    MCEN:     accept all multicast frames
-*/
-#define RXFCON_PROMISCUOUS                                          \
-  ERXFCON_CRCEN | ERXFCON_RUNTEN | ERXFCON_UCEN | ERXFCON_NOTMEEN | \
-      ERXFCON_BCEN | ERXFCON_MCEN
-
-/* Default receive configuration:
+Default receive configuration:
     CRCEN:    discard frames with invalid CRC
     RUNTEN:   discard runt frames
     UCEN:     accept unicast frames addressed to us
     BCEN:     accept broadcast frames
     HTEN:     accept frames with destination address in our hash table
               (used for multicast)
+
+Promiscuous mode swaps HTEN for NOTMEEN (accept unicast frames addressed to
+destinations other than us) and MCEN (accept all multicast frames), and
+enc624j600_accept_bad_frames() swaps CRCEN and RUNTEN for CRCEEN and RUNTEEN.
+Each only changes its own bits, so they can be combined.
 */
 #define RXFCON_DEFAULT \
   ERXFCON_CRCEN | ERXFCON_RUNTEN | ERXFCON_UCEN | ERXFCON_BCEN | ERXFCON_HTEN
+#define RXFCON_PROMISCUOUS_ON ERXFCON_NOTMEEN | ERXFCON_MCEN
+#define RXFCON_PROMISCUOUS_OFF ERXFCON_HTEN
+#define RXFCON_BAD_FRAMES_ON ERXFCON_CRCEEN | ERXFCON_RUNTEEN
+#define RXFCON_BAD_FRAMES_OFF ERXFCON_CRCEN | ERXFCON_RUNTEN
 
 /* Reset chip */
 short enc624j600_reset(const enc624j600 *chip) {
@@ -75,16 +72,14 @@ short enc624j600_reset(const enc624j600 *chip) {
   return 0;
 }
 
-/* Initialize chip */
-short enc624j600_init(enc624j600 *chip, const unsigned short txbuf_size) {
+/* Set up the receive buffer between the end of the transmit buffer and the
+end of RAM, along with the flow control watermarks that depend on its size.
+Writing ERXST also resets the hardware write pointer (ERXHEAD) to the start of
+the buffer. Must only be called with reception disabled. */
+static void set_rx_buffer(enc624j600 *chip, const unsigned short txbuf_size) {
   unsigned short tmp;
   unsigned short rxbuf_size, rx_tail, flow_hwm, flow_lwm;
-  if (txbuf_size % 2) {
-    /* Buffer boundary must be word-aligned */
-    return -1;
-  }
 
-  /* Set up receive buffer between end of transmit buffer and end of RAM */
   ENC624J600_WRITE_REG(chip->base_address, ERXST, SWAPBYTES(txbuf_size));
   rx_tail = ENC624J600_MEM_END - 2;
   ENC624J600_WRITE_REG(chip->base_address, ERXTAIL, SWAPBYTES(rx_tail));
@@ -96,10 +91,11 @@ short enc624j600_init(enc624j600 *chip, const unsigned short txbuf_size) {
   chip->rxbuf_end = enc624j600_addr_to_ptr(chip, ENC624J600_MEM_END);
 
   /*
-  Set up flow control parameters. We only enable flow control for full-duplex
-  links, since  half-duplex flow control operates by jamming the medium, which
-  is an extremely antisocial thing to do on shared-media links (such as if
-  connected to a hub rather than a switch).
+  Set up flow control parameters. By default we only enable flow control for
+  full-duplex links, since  half-duplex flow control operates by jamming the
+  medium, which is an extremely antisocial thing to do on shared-media links
+  (such as if connected to a hub rather than a switch). See
+  enc624j600_set_flow_control() for the opt-in.
 
   The high- and low-water-mark parameters (assert flow control at 3/4 full,
   deassert at 1/2 full) are completely made up based on gut instinct. Should
@@ -114,6 +110,17 @@ short enc624j600_init(enc624j600 *chip, const unsigned short txbuf_size) {
   flow_lwm = (rxbuf_size / 2) / 96;
   tmp = (flow_hwm << ERXWM_RXFWM_SHIFT) | (flow_lwm << ERXWM_RXEWM_SHIFT);
   ENC624J600_WRITE_REG(chip->base_address, ERXWM, tmp);
+}
+
+/* Initialize chip */
+short enc624j600_init(enc624j600 *chip, const unsigned short txbuf_size) {
+  unsigned short tmp;
+  if (txbuf_size % 2) {
+    /* Buffer boundary must be word-aligned */
+    return -1;
+  }
+
+  set_rx_buffer(chip, txbuf_size);
 
   /* Set up 25MHz clock output (used by glue logic for timing generation). */
   tmp = ENC624J600_READ_REG(chip->base_address, ECON2);
@@ -154,20 +161,80 @@ void enc624j600_duplex_sync(enc624j600 *chip) {
     ENC624J600_SET_BITS(chip->base_address, MACON2, MACON2_FULDPX);
     ENC624J600_WRITE_REG(chip->base_address, MABBIPG,
                          0x15 << MABBIPG_BBIPG_SHIFT);
-    /* Enable automtaic flow control */
-    ENC624J600_SET_BITS(chip->base_address, ECON2, ECON2_AUTOFC);
   } else {
     /* Half duplex */
     ENC624J600_CLEAR_BITS(chip->base_address, MACON2, MACON2_FULDPX);
     ENC624J600_WRITE_REG(chip->base_address, MABBIPG,
                          0x12 << MABBIPG_BBIPG_SHIFT);
+  }
+
+  /* Half-duplex flow control jams the medium, so it is only allowed when the
+  user has explicitly opted in (i.e. on a dedicated point-to-point link). */
+  if (chip->flow_control == FLOW_CONTROL_AUTO &&
+      ((estat & ESTAT_PHYDPX) || chip->backpressure)) {
+    /* Enable automatic flow control */
+    ENC624J600_SET_BITS(chip->base_address, ECON2, ECON2_AUTOFC);
+  } else {
     /* Disable automatic flow control */
     ENC624J600_CLEAR_BITS(chip->base_address, ECON2, ECON2_AUTOFC);
     /* Ensure flow control is deasserted */
-    ENC624J600_CLEAR_BITS(chip->base_address, ECON1, ECON1_FCOP1 | ECON1_FCOP1);
+    ENC624J600_CLEAR_BITS(chip->base_address, ECON1, ECON1_FCOP1 | ECON1_FCOP0);
   }
 }
 
+void enc624j600_set_flow_control(enc624j600 *chip, const unsigned char mode,
+                                 const unsigned char backpressure,
+                                 const unsigned short pause_quanta) {
+  chip->flow_control = mode;
+  chip->backpressure = backpressure;
+  ENC624J600_WRITE_REG(chip->base_address, EPAUS, SWAPBYTES(pause_quanta));
+  enc624j600_duplex_sync(chip);
+}
+
+short enc624j600_assert_flow_control(const enc624j600 *chip,
+                                     const unsigned char on) {
+  unsigned short econ1;
+  const unsigned char full = chip->link_state & LINK_FULLDPX;
+
+  if (chip->flow_control != FLOW_CONTROL_MANUAL ||
+      (!full && !chip->backpressure)) {
+    return 0;
+  }
+
+  /* Only the FCOP bits are changed, with the set and clear registers, so that
+  TXRTS and DMAST finishing in the meantime aren't written back */
+  econ1 = ENC624J600_READ_REG(chip->base_address, ECON1);
+  if (on) {
+    if (econ1 & ECON1_FCOP1) {
+      return 0;
+    }
+    /* FCOP=10: send PAUSE frames periodically (full duplex) or jam the medium
+    (half duplex) until released */
+    ENC624J600_CLEAR_BITS(chip->base_address, ECON1, ECON1_FCOP0);
+    ENC624J600_SET_BITS(chip->base_address, ECON1, ECON1_FCOP1);
+  } else {
+    if (!(econ1 & ECON1_FCOP1)) {
+      return 0;
+    }
+    if (full) {
+      /* FCOP=11: send a single zero-quanta PAUSE to release the link partner,
+      hardware then returns FCOP to 00 */
+      ENC624J600_SET_BITS(chip->base_address, ECON1, ECON1_FCOP0);
+    } else {
+      ENC624J600_CLEAR_BITS(chip->base_address, ECON1,
+                            ECON1_FCOP1 | ECON1_FCOP0);
+    }
+  }
+  return 1;
+}
+
+short enc624j600_flow_control_asserted(const enc624j600 *chip) {
+  /* Automatic flow control doesn't reflect its state in FCOP, but the flow
+  control state machine is only busy while pausing the link partner */
+  return (ENC624J600_READ_REG(chip->base_address, ECON1) & ECON1_FCOP1) ||
+         !(ENC624J600_READ_REG(chip->base_address, ESTAT) & ESTAT_FCIDLE);
+}
+
 /* Enable packet reception */
 void enc624j600_start(enc624j600 *chip) {
   /* Sync MAC duplex configuration with autonegotiated values from PHY */
@@ -179,6 +246,39 @@ void enc624j600_start(enc624j600 *chip) {
   ENC624J600_SET_BITS(chip->base_address, ECON1, ECON1_RXEN);
 }
 
+/* Move the start of the receive buffer (i.e. resize the transmit buffer) on a
+running chip. Reception is stopped while the buffer is moved, and any frames
+waiting in it are discarded. Returns the number of frames discarded, or -1 if
+txbuf_size is not word-aligned. Chip interrupts must be disabled. */
+short enc624j600_resize_rx_buffer(enc624j600 *chip,
+                                  const unsigned short txbuf_size) {
+  unsigned short econ1;
+  unsigned char pending, i;
+
+  if (txbuf_size % 2) {
+    return -1;
+  }
+
+  /* Stop reception, and let any frame that's already arriving finish */
+  econ1 = ENC624J600_READ_REG(chip->base_address, ECON1);
+  ENC624J600_CLEAR_BITS(chip->base_address, ECON1, ECON1_RXEN);
+  while (ENC624J600_READ_REG(chip->base_address, ESTAT) & ESTAT_RXBUSY) {
+  };
+
+  /* Throw away whatever is left in the buffer */
+  pending = enc624j600_read_rx_pending_count(chip);
+  for (i = 0; i < pending; i++) {
+    enc624j600_decrement_rx_pending_count(chip);
+  }
+
+  set_rx_buffer(chip, txbuf_size);
+
+  if (econ1 & ECON1_RXEN) {
+    ENC624J600_SET_BITS(chip->base_address, ECON1, ECON1_RXEN);
+  }
+  return pending;
+}
+
 /* Read device ID and silicon revision from chip */
 void enc624j600_read_id(const enc624j600 *chip, unsigned char *device_id,
                         unsigned char *revision) {
@@ -222,12 +322,27 @@ void enc624j600_write_multicast_table(const enc624j600 *chip,
 
 /* Enable promiscuous-mode reception */
 void enc624j600_enable_promiscuous(const enc624j600 *chip) {
-  ENC624J600_WRITE_REG(chip->base_address, ERXFCON, RXFCON_PROMISCUOUS);
+  ENC624J600_CLEAR_BITS(chip->base_address, ERXFCON, RXFCON_PROMISCUOUS_OFF);
+  ENC624J600_SET_BITS(chip->base_address, ERXFCON, RXFCON_PROMISCUOUS_ON);
 }
 
 /* Disable promiscuous-mode reception, return to normal operation */
 void enc624j600_disable_promiscuous(const enc624j600 *chip) {
-  ENC624J600_WRITE_REG(chip->base_address, ERXFCON, RXFCON_DEFAULT);
+  ENC624J600_CLEAR_BITS(chip->base_address, ERXFCON, RXFCON_PROMISCUOUS_ON);
+  ENC624J600_SET_BITS(chip->base_address, ERXFCON, RXFCON_PROMISCUOUS_OFF);
+}
+
+/* Accept frames with invalid CRCs and runt frames (flagged as such in their
+receive status vectors), or go back to discarding them in hardware */
+void enc624j600_accept_bad_frames(const enc624j600 *chip,
+                                  const unsigned char accept) {
+  if (accept) {
+    ENC624J600_CLEAR_BITS(chip->base_address, ERXFCON, RXFCON_BAD_FRAMES_OFF);
+    ENC624J600_SET_BITS(chip->base_address, ERXFCON, RXFCON_BAD_FRAMES_ON);
+  } else {
+    ENC624J600_CLEAR_BITS(chip->base_address, ERXFCON, RXFCON_BAD_FRAMES_ON);
+    ENC624J600_SET_BITS(chip->base_address, ERXFCON, RXFCON_BAD_FRAMES_OFF);
+  }
 }
 
 /* Begin transmitting data from the transmit buffer. start_addr must point to
@@ -298,7 +413,9 @@ void enc624j600_write_phy_reg(const enc624j600 *chip,
   }
   /* only write low half of MIREGADR, the high half is reserved */
   ENC624J600_WRITE_REG8(chip->base_address, MIREGADR, phyreg);
-  ENC624J600_WRITE_REG(chip->base_address, MIWR, SWAPBYTES(value));
+  /* value is in the same (byte-swapped) order that enc624j600_read_phy_reg
+  returns and the PHY register bit definitions use */
+  ENC624J600_WRITE_REG(chip->base_address, MIWR, value);
 }
 
 /* Read a value from a PHY register */
@@ -329,6 +446,159 @@ void enc624j600_disable_phy_loopback(const enc624j600 *chip) {
   enc624j600_write_phy_reg(chip, PHCON1, old_phcon1 & ~PHCON1_PLOOPBK);
 }
 
+/* Restart autonegotiation */
+void enc624j600_renegotiate(const enc624j600 *chip) {
+  unsigned short phcon1 = enc624j600_read_phy_reg(chip, PHCON1);
+  enc624j600_write_phy_reg(chip, PHCON1, phcon1 | PHCON1_ANEN | PHCON1_RENEG);
+}
+
+/* Turn off autonegotiation and force the PHY to full or half duplex, keeping
+the current link speed. The resulting link change interrupt will bring the MAC
+into line through enc624j600_duplex_sync. */
+void enc624j600_force_duplex(const enc624j600 *chip, const unsigned char full) {
+  unsigned short phcon1 = enc624j600_read_phy_reg(chip, PHCON1);
+  phcon1 &= ~(PHCON1_ANEN | PHCON1_SPD100 | PHCON1_PFULDPX);
+  if (chip->link_state & LINK_100M) {
+    phcon1 |= PHCON1_SPD100;
+  }
+  if (full) {
+    phcon1 |= PHCON1_PFULDPX;
+  }
+  enc624j600_write_phy_reg(chip, PHCON1, phcon1);
+}
+
+/* Read the clock used for DMA statistics */
+static inline unsigned long dma_clock(const enc624j600 *chip) {
+  return chip->dma.clock ? chip->dma.clock() : 0;
+}
+
+/* Start a request on the DMA engine. Engine must be idle. */
+static void dma_start(enc624j600 *chip, const enc624j600_dma_req *req) {
+  unsigned short op;
+
+  ENC624J600_WRITE_REG(chip->base_address, EDMAST, SWAPBYTES(req->src));
+  ENC624J600_WRITE_REG(chip->base_address, EDMALEN, SWAPBYTES(req->len));
+
+  switch (req->op) {
+    case DMA_COPY:
+      op = ECON1_DMACPY | ECON1_DMANOCS;
+      break;
+    case DMA_COPY_CHECKSUM:
+      op = ECON1_DMACPY;
+      break;
+    default:
+      /* DMA_CHECKSUM: DMACPY and DMANOCS both clear */
+      op = 0;
+      break;
+  }
+  if (op & ECON1_DMACPY) {
+    ENC624J600_WRITE_REG(chip->base_address, EDMADST, SWAPBYTES(req->dst));
+  }
+  /* Set and clear registers only, so that a transmit finishing in the meantime
+  can't have a stale TXRTS written back over it. Checksum seed is always zero
+  (DMACSSD clear). */
+  ENC624J600_CLEAR_BITS(chip->base_address, ECON1,
+                        ECON1_DMACPY | ECON1_DMANOCS | ECON1_DMACSSD);
+  if (op) {
+    ENC624J600_SET_BITS(chip->base_address, ECON1, op);
+  }
+  ENC624J600_SET_BITS(chip->base_address, ECON1, ECON1_DMAST);
+  chip->dma.started = dma_clock(chip);
+}
+
+/* Record the result of the request at the head of the queue, remove it, and
+start the next one. Engine must have finished. Returns the finished request. */
+static enc624j600_dma_req *dma_finish(enc624j600 *chip) {
+  enc624j600_dma_req *req = chip->dma.head;
+  enc624j600_dma_stats *stats = &chip->dma.stats;
+  unsigned long now = dma_clock(chip);
+  unsigned long latency = now - req->submitted;
+
+  if (req->op != DMA_COPY) {
+    req->checksum =
+        SWAPBYTES(ENC624J600_READ_REG(chip->base_address, EDMACS));
+  }
+
+  stats->ops[req->op]++;
+  stats->latency[req->op] += latency;
+  if (latency > stats->max_latency[req->op]) {
+    stats->max_latency[req->op] = latency;
+  }
+  stats->busy_time += now - chip->dma.started;
+  stats->depth--;
+
+  chip->dma.head = req->next;
+  if (chip->dma.head == NULL) {
+    chip->dma.tail = NULL;
+  } else {
+    dma_start(chip, chip->dma.head);
+  }
+  return req;
+}
+
+/* Add a request to the end of the queue, starting it if the engine is idle.
+Chip interrupts must be masked. */
+static void dma_enqueue(enc624j600 *chip, enc624j600_dma_req *req) {
+  req->next = NULL;
+  req->submitted = dma_clock(chip);
+  if (++chip->dma.stats.depth > chip->dma.stats.max_depth) {
+    chip->dma.stats.max_depth = chip->dma.stats.depth;
+  }
+
+  if (chip->dma.head == NULL) {
+    chip->dma.head = chip->dma.tail = req;
+    dma_start(chip, req);
+  } else {
+    chip->dma.tail->next = req;
+    chip->dma.tail = req;
+  }
+}
+
+void enc624j600_dma_submit(enc624j600 *chip, enc624j600_dma_req *req) {
+  unsigned short old_eie = enc624j600_disable_irq(chip, IRQ_ENABLE);
+  dma_enqueue(chip, req);
+  enc624j600_enable_irq(chip, old_eie);
+}
+
+/* Handle a DMA interrupt. Call from the interrupt handler when IRQ_DMA is
+set. */
+void enc624j600_dma_complete(enc624j600 *chip) {
+  enc624j600_dma_req *req;
+
+  enc624j600_clear_irq(chip, IRQ_DMA);
+  if (unlikely(chip->dma.head == NULL ||
+               (ENC624J600_READ_REG(chip->base_address, ECON1) &
+                ECON1_DMAST))) {
+    /* Spurious, or the engine is still busy */
+    return;
+  }
+
+  req = dma_finish(chip);
+  if (req->callback) {
+    req->callback(chip, req);
+  }
+}
+
+void enc624j600_dma_run(enc624j600 *chip, enc624j600_dma_req *req) {
+  unsigned short old_eie = enc624j600_disable_irq(chip, IRQ_ENABLE);
+  enc624j600_dma_req *done;
+
+  /* Queue it behind anything already submitted, then run the engine by hand
+  until our request comes out */
+  dma_enqueue(chip, req);
+
+  do {
+    while (ENC624J600_READ_REG(chip->base_address, ECON1) & ECON1_DMAST) {};
+    enc624j600_clear_irq(chip, IRQ_DMA);
+    done = dma_finish(chip);
+    if (done->callback) {
+      done->callback(chip, done);
+    }
+  } while (done != req);
+
+  enc624j600_enable_irq(chip, old_eie);
+}
+
 #if defined(REV0_SUPPORT)
 /*
 Copy data byte-by-byte
@@ -36,6 +36,68 @@ enum enc624j600_link_state {
   LINK_100M_FULLDPX = 0x6 /* LINK_100M | LINK_FULLDPX */
 };
 
+/* Flow control modes, applied by enc624j600_duplex_sync. FLOW_CONTROL_AUTO is
+zero so that a freshly-cleared chip struct keeps the original behaviour. */
+enum enc624j600_flow_control {
+  FLOW_CONTROL_AUTO = 0,   /* Hardware asserts flow control at the receive
+                              watermarks (full duplex only, unless
+                              backpressure is enabled) */
+  FLOW_CONTROL_OFF = 1,    /* Never assert flow control */
+  FLOW_CONTROL_MANUAL = 2  /* Caller asserts and releases flow control with
+                              enc624j600_assert_flow_control */
+};
+
+/* DMA engine operations */
+enum enc624j600_dma_op {
+  DMA_COPY = 0,          /* Copy len bytes from src to dst */
+  DMA_CHECKSUM = 1,      /* Compute IP checksum of len bytes at src */
+  DMA_COPY_CHECKSUM = 2, /* Copy and compute checksum in one pass */
+  DMA_NUM_OPS
+};
+
+struct enc624j600;
+
+/* A DMA request. Requests are owned by the caller and linked into the queue by
+enc624j600_dma_submit; they must not be touched until completed. */
+struct enc624j600_dma_req {
+  struct enc624j600_dma_req *next; /* Queue link (private) */
+  unsigned char op;         /* enc624j600_dma_op */
+  unsigned short src;       /* Source address in chip memory */
+  unsigned short dst;       /* Destination address (copy operations) */
+  unsigned short len;       /* Length in bytes */
+  unsigned short checksum;  /* Result (checksum operations), in datasheet byte
+                               order */
+  unsigned long submitted;  /* Clock value at submission (private) */
+  /* Completion callback, or NULL. Called from enc624j600_dma_complete (i.e.
+  from the interrupt handler), or from enc624j600_dma_run. */
+  void (*callback)(struct enc624j600 *chip, struct enc624j600_dma_req *req);
+  void *context;            /* For the caller's use */
+};
+typedef struct enc624j600_dma_req enc624j600_dma_req;
+
+/* DMA statistics. Times are in units of the queue's clock, if one is set. */
+struct enc624j600_dma_stats {
+  unsigned long ops[DMA_NUM_OPS];          /* Completed operations by type */
+  unsigned long latency[DMA_NUM_OPS];      /* Total submit-to-complete time */
+  unsigned long max_latency[DMA_NUM_OPS];  /* Longest submit-to-complete time */
+  unsigned long busy_time;                 /* Total time engine was busy */
+  unsigned short depth;                    /* Requests currently queued
+                                              (including the active one) */
+  unsigned short max_depth;                /* Highest queue depth seen */
+};
+typedef struct enc624j600_dma_stats enc624j600_dma_stats;
+
+/* DMA request queue. The head of the queue is the request running on the
+engine. */
+struct enc624j600_dma_queue {
+  enc624j600_dma_req *head;
+  enc624j600_dma_req *tail;
+  unsigned long started;         /* Clock value when head was started */
+  unsigned long (*clock)(void);  /* Clock for statistics, or NULL for none */
+  enc624j600_dma_stats stats;
+};
+typedef struct enc624j600_dma_queue enc624j600_dma_queue;
+
 struct enc624j600 {
   unsigned char *base_address; /* Base address of chip (also start of transmit
                                   buffer) */
@@ -44,6 +106,10 @@ struct enc624j600 {
   const unsigned char *rxptr;   /* Receive buffer read pointer */
   unsigned char link_state;     /* Current link state (updated by calls to 
                                    enc624j600_duplex_sync) */
+  unsigned char flow_control;   /* Flow control mode (enc624j600_flow_control) */
+  unsigned char backpressure;   /* Nonzero to allow flow control (i.e. jamming)
+                                   on half-duplex links */
+  enc624j600_dma_queue dma;     /* DMA request queue */
 };
 typedef struct enc624j600 enc624j600;
 
@@ -78,6 +144,13 @@ begins immediately after thee transmit buffer and continues to end of memory.
 Transmit buffer size must be an even number of bytes. */
 short enc624j600_init(enc624j600 *chip, const unsigned short txbuf_size);
 
+/* Change the transmit buffer size of a running chip, moving the start of the
+receive buffer. Frames waiting in the receive buffer are discarded; returns the
+number discarded, or -1 if the size is odd. Call with chip interrupts
+disabled. */
+short enc624j600_resize_rx_buffer(enc624j600 *chip,
+                                  const unsigned short txbuf_size);
+
 /* Start accepting packets */
 void enc624j600_start(enc624j600 *chip);
 
@@ -101,6 +174,11 @@ void enc624j600_enable_promiscuous(const enc624j600 *chip);
 /* Disable promiscuous mode */
 void enc624j600_disable_promiscuous(const enc624j600 *chip);
 
+/* Accept (accept nonzero) or discard frames with invalid CRCs and runt
+frames */
+void enc624j600_accept_bad_frames(const enc624j600 *chip,
+                                  const unsigned char accept);
+
 /* Update the multicast hash table */
 void enc624j600_write_multicast_table(const enc624j600 *chip,
                                       const unsigned short table[4]);
@@ -133,6 +211,13 @@ static inline void enc624j600_clear_irq(const enc624j600 *chip,
   ENC624J600_CLEAR_BITS(chip->base_address, EIR, irqmask & (~EIR_CRYPTEN));
 }
 
+/* Raise interrupts from software, e.g. to get the interrupt handler to run.
+Bits of irqmask are defined below */
+static inline void enc624j600_raise_irq(const enc624j600 *chip,
+                                        const unsigned short irqmask) {
+  ENC624J600_SET_BITS(chip->base_address, EIR, irqmask & (~EIR_CRYPTEN));
+}
+
 /* Read count of pending frames in receive buffer */
 static inline unsigned char enc624j600_read_rx_pending_count(const enc624j600 *chip) {
   return (ENC624J600_READ_REG(chip->base_address, ESTAT) &
@@ -183,6 +268,46 @@ void enc624j600_enable_phy_loopback(const enc624j600 *chip);
 /* Disable PHY loopback */
 void enc624j600_disable_phy_loopback(const enc624j600 *chip);
 
+/* Restart autonegotiation */
+void enc624j600_renegotiate(const enc624j600 *chip);
+
+/* Disable autonegotiation and force full (full != 0) or half duplex */
+void enc624j600_force_duplex(const enc624j600 *chip, const unsigned char full);
+
+/* Set flow control mode, half-duplex backpressure opt-in, and the pause time
+(in 512-bit-time quanta) sent in full-duplex PAUSE frames. Applies the new
+settings immediately. */
+void enc624j600_set_flow_control(enc624j600 *chip, const unsigned char mode,
+                                 const unsigned char backpressure,
+                                 const unsigned short pause_quanta);
+
+/* Assert (on != 0) or release flow control. Only has an effect in
+FLOW_CONTROL_MANUAL mode, and on half-duplex links only if backpressure is
+enabled. Returns nonzero if flow control state was changed. */
+short enc624j600_assert_flow_control(const enc624j600 *chip,
+                                     const unsigned char on);
+
+/* Returns nonzero if flow control is currently being asserted, either by
+hardware (FLOW_CONTROL_AUTO) or by enc624j600_assert_flow_control */
+short enc624j600_flow_control_asserted(const enc624j600 *chip);
+
+/*
+DMA engine. The chip has a single DMA engine, so requests are queued and run
+one at a time. enc624j600_dma_submit starts a request immediately if the engine
+is idle and never waits. The caller must enable IRQ_DMA and call
+enc624j600_dma_complete when it fires, which finishes the running request,
+starts the next, and calls the finished request's callback.
+
+Before interrupts are available (e.g. during startup), enc624j600_dma_run runs
+a request synchronously instead, after draining anything already queued.
+
+The queue is protected by masking chip interrupts, so submission is safe from
+anywhere except the callback of a request on a different chip.
+*/
+void enc624j600_dma_submit(enc624j600 *chip, enc624j600_dma_req *req);
+void enc624j600_dma_complete(enc624j600 *chip);
+void enc624j600_dma_run(enc624j600 *chip, enc624j600_dma_req *req);
+
 /* Our own memcpy implementation that avoids longword writes */
 #if defined(REV0_SUPPORT)
 void enc624j600_memcpy(volatile unsigned char *dest,
@@ -244,6 +369,10 @@ short enc624j600_memtest(const enc624j600 * chip);
 #define RSV_BIT_MULTICAST (24)
 /* Destination is broadcast */
 #define RSV_BIT_BROADCAST (25)
+/* Packet was a MAC control frame (only received when MACON1_PASSALL is set) */
+#define RSV_BIT_CONTROL_FRAME (27)
+/* Packet was a PAUSE control frame */
+#define RSV_BIT_PAUSE_FRAME (28)
 /* Destination matched a hash table entry */
 #define RSV_BIT_HASH_MATCH (33)
 /* Destination is unicast to us */
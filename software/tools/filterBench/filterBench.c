@@ -0,0 +1,219 @@
+/*
+Tap filter benchmark
+
+Times the driver's tap filters (see ENCAttachTap in sethernet.h) against some
+canned frames, using the ENCTestFilter call. Each filter is timed both compiled
+and interpreted, against the cost of a tap with no filter at all, which has to
+copy every frame out of the card.
+*/
+
+#include <Devices.h>
+#include <ENET.h>
+#include <MacTypes.h>
+#include <Memory.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sethernet.h"
+
+/* Number of times each filter is run per measurement */
+#define defaultIterations 1000
+
+typedef struct cannedFilter {
+  const char *name;
+  const bpfInsn *prog;
+  unsigned short length;
+} cannedFilter;
+
+typedef struct cannedFrame {
+  const char *name;
+  const Byte *header;
+  unsigned short headerLength;
+  unsigned short length;
+} cannedFrame;
+
+/* Filter programs, as output by 'tcpdump -dd' */
+
+/* ip */
+static const bpfInsn filterIP[] = {
+  {0x28, 0, 0, 0x0000000c},
+  {0x15, 0, 1, 0x00000800},
+  {0x06, 0, 0, 0x00040000},
+  {0x06, 0, 0, 0x00000000},
+};
+
+/* arp */
+static const bpfInsn filterARP[] = {
+  {0x28, 0, 0, 0x0000000c},
+  {0x15, 0, 1, 0x00000806},
+  {0x06, 0, 0, 0x00040000},
+  {0x06, 0, 0, 0x00000000},
+};
+
+/* tcp port 80 */
+static const bpfInsn filterHTTP[] = {
+  {0x28, 0, 0, 0x0000000c},
+  {0x15, 0, 6, 0x000086dd},
+  {0x30, 0, 0, 0x00000014},
+  {0x15, 0, 15, 0x00000006},
+  {0x28, 0, 0, 0x00000036},
+  {0x15, 12, 0, 0x00000050},
+  {0x28, 0, 0, 0x00000038},
+  {0x15, 10, 11, 0x00000050},
+  {0x15, 0, 10, 0x00000800},
+  {0x30, 0, 0, 0x00000017},
+  {0x15, 0, 8, 0x00000006},
+  {0x28, 0, 0, 0x00000014},
+  {0x45, 6, 0, 0x00001fff},
+  {0xb1, 0, 0, 0x0000000e},
+  {0x48, 0, 0, 0x0000000e},
+  {0x15, 2, 0, 0x00000050},
+  {0x48, 0, 0, 0x00000010},
+  {0x15, 0, 1, 0x00000050},
+  {0x06, 0, 0, 0x00040000},
+  {0x06, 0, 0, 0x00000000},
+};
+
+/* AppleTalk (802.2 SNAP, OUI 08-00-07, type 809b), first 64 bytes only */
+static const bpfInsn filterAppleTalk[] = {
+  {0x28, 0, 0, 0x0000000c},  /* ldh [12] */
+  {0x25, 5, 0, 0x000005dc},  /* jgt #1500, reject */
+  {0x20, 0, 0, 0x00000010},  /* ld [16] */
+  {0x15, 0, 3, 0x03080007},  /* jeq #0x03080007, ..., reject */
+  {0x28, 0, 0, 0x00000014},  /* ldh [20] */
+  {0x15, 0, 1, 0x0000809b},  /* jeq #0x809b, ..., reject */
+  {0x06, 0, 0, 0x00000040},  /* ret #64 */
+  {0x06, 0, 0, 0x00000000},  /* reject: ret #0 */
+};
+
+static const cannedFilter filters[] = {
+  {"ip", filterIP, sizeof(filterIP) / sizeof(bpfInsn)},
+  {"arp", filterARP, sizeof(filterARP) / sizeof(bpfInsn)},
+  {"tcp port 80", filterHTTP, sizeof(filterHTTP) / sizeof(bpfInsn)},
+  {"appletalk", filterAppleTalk, sizeof(filterAppleTalk) / sizeof(bpfInsn)},
+};
+#define numFilters (sizeof(filters) / sizeof(filters[0]))
+
+/* Frames, headers only; the rest of each frame is zeroes */
+
+/* TCP segment from port 1024 to port 80 */
+static const Byte frameTCP[] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+  0x08, 0x00,
+  /* IPv4, 20-byte header, TCP */
+  0x45, 0x00, 0x05, 0xdc, 0x00, 0x01, 0x40, 0x00, 0x40, 0x06, 0x00, 0x00,
+  0x0a, 0x58, 0x00, 0x02, 0x0a, 0x58, 0x00, 0x01,
+  /* Ports 1024 -> 80 */
+  0x04, 0x00, 0x00, 0x50,
+};
+
+/* ARP request */
+static const Byte frameARP[] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+  0x08, 0x06,
+  0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x01,
+};
+
+/* AppleTalk DDP datagram over EtherTalk Phase 2 */
+static const Byte frameAppleTalk[] = {
+  0x09, 0x00, 0x07, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+  0x02, 0x4a,
+  /* 802.2 SNAP */
+  0xaa, 0xaa, 0x03, 0x08, 0x00, 0x07, 0x80, 0x9b,
+};
+
+static const cannedFrame frames[] = {
+  {"TCP/80, 1514 bytes", frameTCP, sizeof(frameTCP), 1514},
+  {"ARP, 60 bytes", frameARP, sizeof(frameARP), 60},
+  {"DDP, 600 bytes", frameAppleTalk, sizeof(frameAppleTalk), 600},
+};
+#define numFrames (sizeof(frames) / sizeof(frames[0]))
+
+static short enetRefNum;
+
+static OSErr testFilter(filterTest *test) {
+  EParamBlock pb;
+
+  memset(&pb, 0, sizeof(pb));
+  pb.ioRefNum = enetRefNum;
+  pb.csCode = ENCTestFilter;
+  pb.u.EParms1.ePointer = (Ptr)test;
+  return PBControlSync((ParmBlkPtr)&pb);
+}
+
+/* Run one test and print the time per frame in microseconds. Returns false if
+the test failed. */
+static Boolean runTest(filterTest *test, Boolean showCodeSize) {
+  OSErr err = testFilter(test);
+
+  if (err != noErr) {
+    printf("  error %d\n", err);
+    return false;
+  }
+  printf("%9.2f us", (double)test->microseconds / test->iterations);
+  if (showCodeSize) {
+    printf(" (%lu bytes)", test->codeSize);
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  filterTest test;
+  Byte *frame;
+  unsigned short f, p;
+  OSErr err;
+
+  printf("**** SEthernet tap filter benchmark ****\n\n");
+
+  err = OpenDriver("\p.ENET", &enetRefNum);
+  if (err != noErr) {
+    printf("Couldn't open .ENET: %d\n", err);
+    return 1;
+  }
+
+  frame = (Byte *)NewPtrClear(1514);
+  if (frame == nil) {
+    printf("Out of memory\n");
+    return 1;
+  }
+
+  printf("Time per frame, %d iterations\n", defaultIterations);
+  for (f = 0; f < numFrames; f++) {
+    memset(frame, 0, frames[f].length);
+    memcpy(frame, frames[f].header, frames[f].headerLength);
+
+    printf("\n%s\n", frames[f].name);
+
+    memset(&test, 0, sizeof(test));
+    test.frame = frame;
+    test.frameLength = frames[f].length;
+    test.iterations = defaultIterations;
+    printf("  %-12s  no filter:   ", "(copy)");
+    if (!runTest(&test, false)) {
+      return 1;
+    }
+    printf("\n");
+
+    for (p = 0; p < numFilters; p++) {
+      test.filter = filters[p].prog;
+      test.filterLength = filters[p].length;
+
+      test.flags = tapInterpret;
+      printf("  %-12s  interpreted: ", filters[p].name);
+      if (!runTest(&test, false)) {
+        continue;
+      }
+      printf("  compiled: ");
+      test.flags = 0;
+      if (!runTest(&test, true)) {
+        continue;
+      }
+      printf("  -> %lu\n", test.result);
+    }
+  }
+
+  return 0;
+}
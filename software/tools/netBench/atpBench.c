@@ -0,0 +1,268 @@
+/*
+AppleTalk (ATP) throughput and latency tester
+
+Sends ATP requests to atpPeer.py running on another machine (see README.md),
+which answers each with up to 8 response packets. Over EtherTalk this exercises
+the driver's phProtocolPhaseII path (802.2 SNAP frames) rather than the
+ethertype path used by MacTCP. Reports throughput, the fraction of the CPU left
+idle, retransmitted requests, and round-trip latency.
+*/
+
+#include <AppleTalk.h>
+#include <Events.h>
+#include <MacTypes.h>
+#include <Memory.h>
+#include <Timer.h>
+#include <Traps.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "idle.h"
+
+/* Largest ATP response packet */
+#define maxRespSize 578
+
+/* ATP allows up to 8 responses per request */
+#define maxResps 8
+
+/* Seconds to wait for a response before retransmitting */
+#define requestTimeout 1
+
+/* Give up on a transaction after this many retransmits */
+#define maxRetries 10
+
+/* Request payload */
+typedef struct atpRequest {
+  unsigned char op;        /* opXXX */
+  unsigned char pad;
+  unsigned short respSize; /* Size of each response packet */
+} atpRequest;
+
+enum {
+  opThroughput = 'T', /* Peer answers with a full set of respSize responses */
+  opPing = 'P'        /* Peer answers with a single respSize response */
+};
+
+static BDSType bds;
+static unsigned long spins;       /* Idle loop count for the current test */
+static unsigned long retransmits; /* Requests that had to be sent again */
+
+/* Run one transaction, retransmitting on timeout. Returns the number of
+response bytes received, or -1 on failure. */
+static long transact(const AddrBlock *peer, atpRequest *request,
+                     unsigned char bitmap) {
+  ATPParamBlock pb;
+  unsigned short retries;
+  long received;
+  short i;
+
+  for (retries = 0; retries <= maxRetries; retries++) {
+    memset(&pb, 0, sizeof(pb));
+    pb.addrBlock = *peer;
+    pb.reqLength = sizeof(*request);
+    pb.reqPointer = (Ptr)request;
+    pb.bdsPointer = (Ptr)bds;
+    pb.u0.bitMap = bitmap;
+    pb.timeOutVal = requestTimeout;
+    /* Retransmit ourselves, so that we can count it */
+    pb.retryCount = 0;
+
+    PSendRequest(&pb, true);
+    spins += idleWait(&pb.ioResult);
+
+    if (pb.ioResult == noErr) {
+      received = 0;
+      for (i = 0; i < pb.numOfResps; i++) {
+        received += bds[i].dataSize;
+      }
+      return received;
+    }
+    if (pb.ioResult != reqFailed) {
+      printf("PSendRequest failed: %d\n", pb.ioResult);
+      return -1;
+    }
+    retransmits++;
+  }
+  printf("No response from peer\n");
+  return -1;
+}
+
+/* Throughput test: count transactions of 8 x respSize bytes */
+static void throughputTest(const AddrBlock *peer, unsigned short respSize,
+                           unsigned long count) {
+  atpRequest request = {opThroughput, 0, respSize};
+  unsigned long total = 0;
+  unsigned long start, ticks;
+  unsigned long i;
+  long received;
+  double seconds;
+
+  spins = 0;
+  retransmits = 0;
+  start = TickCount();
+  for (i = 0; i < count; i++) {
+    received = transact(peer, &request, 0xff);
+    if (received < 0) {
+      break;
+    }
+    total += received;
+  }
+  ticks = TickCount() - start;
+  if (ticks == 0) {
+    ticks = 1;
+  }
+  seconds = ticks / 60.0;
+
+  printf("  %lu transactions, %lu bytes in %.2f s = %.1f kB/s\n", i, total,
+         seconds, total / seconds / 1024);
+  printf("  CPU idle: %.0f%%\n", idleFraction(spins, ticks) * 100);
+  printf("  Retransmitted requests: %lu\n", retransmits);
+}
+
+/* Current time in microseconds, or ticks converted to microseconds if there's
+no Microseconds trap */
+static unsigned long now(Boolean haveMicroseconds) {
+  UnsignedWide us;
+  if (haveMicroseconds) {
+    Microseconds(&us);
+    return us.lo;
+  }
+  return TickCount() * 16667;
+}
+
+/* Latency test: time single-response transactions */
+static void pingTest(const AddrBlock *peer, unsigned short respSize,
+                     unsigned long count, Boolean haveMicroseconds) {
+  atpRequest request = {opPing, 0, respSize};
+  unsigned long rtt, minRtt = 0xffffffff, maxRtt = 0, totalRtt = 0;
+  unsigned long replies = 0;
+  unsigned long start, ticks, sent;
+  unsigned long i;
+
+  spins = 0;
+  retransmits = 0;
+  start = TickCount();
+  for (i = 0; i < count; i++) {
+    sent = now(haveMicroseconds);
+    if (transact(peer, &request, 0x01) < 0) {
+      break;
+    }
+    rtt = now(haveMicroseconds) - sent;
+    totalRtt += rtt;
+    minRtt = rtt < minRtt ? rtt : minRtt;
+    maxRtt = rtt > maxRtt ? rtt : maxRtt;
+    replies++;
+  }
+  ticks = TickCount() - start;
+
+  printf("  %lu transactions, %lu retransmitted requests\n", replies,
+         retransmits);
+  if (replies > 0) {
+    /* Retransmitted transactions include the timeout, which swamps everything
+    else in max and avg */
+    printf("  Round trip min/avg/max %lu/%lu/%lu us%s\n", minRtt,
+           totalRtt / replies, maxRtt,
+           haveMicroseconds ? "" : " (tick resolution)");
+  }
+  printf("  CPU idle: %.0f%%\n", idleFraction(spins, ticks) * 100);
+}
+
+static unsigned long readNumber(const char *prompt, unsigned long dflt) {
+  char line[64];
+  unsigned long value;
+
+  printf("%s [%lu]: ", prompt, dflt);
+  fflush(stdout);
+  if (fgets(line, sizeof(line), stdin) == NULL ||
+      sscanf(line, "%lu", &value) != 1) {
+    return dflt;
+  }
+  return value;
+}
+
+static void help(void) {
+  printf("\n[T]hroughput, [P]ing, [Q]uit?\n");
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  char line[64];
+  unsigned int net, node, socket;
+  AddrBlock peer;
+  unsigned long respSize, count;
+  Boolean haveMicroseconds;
+  OSErr err;
+  int choice;
+  short i;
+
+  printf("**** SEthernet AppleTalk (ATP) benchmark ****\n\n");
+
+  err = MPPOpen();
+  if (err != noErr) {
+    printf("Couldn't open AppleTalk: %d\n", err);
+    return 1;
+  }
+  haveMicroseconds = NGetTrapAddress(_Microseconds, OSTrap) !=
+                     GetToolboxTrapAddress(_Unimplemented);
+
+  for (i = 0; i < maxResps; i++) {
+    bds[i].buffSize = maxRespSize;
+    bds[i].buffPtr = NewPtr(maxRespSize);
+    if (bds[i].buffPtr == nil) {
+      printf("Out of memory\n");
+      return 1;
+    }
+  }
+
+  printf("Calibrating idle loop...\n");
+  idleCalibrate();
+
+  do {
+    printf("Peer address (net.node.socket, as printed by atpPeer.py): ");
+    fflush(stdout);
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+      return 0;
+    }
+  } while (sscanf(line, "%u.%u.%u", &net, &node, &socket) != 3 ||
+           net > 0xffff || node > 0xfe || socket > 0xfe);
+  peer.aNet = net;
+  peer.aNode = node;
+  peer.aSocket = socket;
+
+  help();
+  while (1) {
+    choice = toupper(getchar());
+    if (choice == '\r' || choice == '\n') {
+      continue;
+    }
+    if (choice == 'Q') {
+      return 0;
+    }
+    if (choice != 'T' && choice != 'P') {
+      help();
+      continue;
+    }
+    /* Eat the rest of the line */
+    while (getchar() != '\n') {}
+
+    respSize = readNumber("Response size", choice == 'P' ? 16 : maxRespSize);
+    if (respSize > maxRespSize) {
+      printf("Too big\n");
+      help();
+      continue;
+    }
+    count = readNumber("Count", choice == 'P' ? 100 : 200);
+
+    if (choice == 'T') {
+      printf("ATP throughput, %lu x 8 x %lu bytes\n", count, respSize);
+      throughputTest(&peer, respSize, count);
+    } else {
+      printf("ATP ping, %lu x %lu bytes\n", count, respSize);
+      pingTest(&peer, respSize, count, haveMicroseconds);
+    }
+    help();
+  }
+}
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+
+# Peer for the atpBench AppleTalk benchmark: an ATP responder on a DDP socket.
+# Linux only, and needs the kernel AppleTalk stack configured on the interface
+# facing the Mac (e.g. by netatalk's atalkd). See README.md.
+#
+# Python's socket module can create AppleTalk sockets but doesn't understand
+# their addresses, so bind/sendto/recvfrom go through libc directly.
+
+import argparse
+import ctypes
+import ctypes.util
+import os
+import struct
+import sys
+
+AF_APPLETALK = 5
+SOCK_DGRAM = 2
+ATADDR_ANYNET = 0
+ATADDR_ANYNODE = 0
+
+DEFAULT_SOCKET = 100  # In the "experimental" static socket range
+
+DDP_TYPE_ATP = 3
+
+# ATP header: DDP type, control, bitmap/sequence, TID, user bytes
+ATP_HEADER_FORMAT = '>BBBHL'
+ATP_FUNC_MASK = 0xc0
+ATP_TREQ = 0x40
+ATP_TRESP = 0x80
+ATP_EOM = 0x10
+
+# Request payload: op, pad, response size
+REQUEST_FORMAT = '>BBH'
+OP_THROUGHPUT = ord('T')
+OP_PING = ord('P')
+
+MAX_RESP_SIZE = 578
+
+
+class AtalkAddr(ctypes.Structure):
+    _fields_ = [('s_net', ctypes.c_uint16), ('s_node', ctypes.c_uint8)]
+
+
+class SockaddrAt(ctypes.Structure):
+    _fields_ = [('sat_family', ctypes.c_uint16), ('sat_port', ctypes.c_uint8),
+                ('sat_addr', AtalkAddr), ('sat_zero', ctypes.c_char * 8)]
+
+
+libc = ctypes.CDLL(ctypes.util.find_library('c'), use_errno=True)
+
+
+def check(result):
+    if result < 0:
+        errno = ctypes.get_errno()
+        raise OSError(errno, os.strerror(errno))
+    return result
+
+
+def ntohs(value):
+    return struct.unpack('>H', struct.pack('=H', value))[0]
+
+
+def format_addr(sat):
+    return '%d.%d.%d' % (ntohs(sat.sat_addr.s_net), sat.sat_addr.s_node, sat.sat_port)
+
+
+def serve(fd):
+    buf = ctypes.create_string_buffer(1024)
+    sender = SockaddrAt()
+    sender_len = ctypes.c_uint32(ctypes.sizeof(sender))
+    header_size = struct.calcsize(ATP_HEADER_FORMAT)
+    pattern = bytes(i & 0xff for i in range(MAX_RESP_SIZE))
+    transactions = 0
+
+    while True:
+        sender_len.value = ctypes.sizeof(sender)
+        length = check(libc.recvfrom(fd, buf, len(buf), 0, ctypes.byref(sender),
+                                     ctypes.byref(sender_len)))
+        data = buf.raw[:length]
+        if length < header_size + struct.calcsize(REQUEST_FORMAT):
+            continue
+        ddp_type, control, bitmap, tid, _ = struct.unpack_from(ATP_HEADER_FORMAT, data)
+        if ddp_type != DDP_TYPE_ATP or control & ATP_FUNC_MASK != ATP_TREQ:
+            continue
+        op, _, resp_size = struct.unpack_from(REQUEST_FORMAT, data, header_size)
+        resp_size = min(resp_size, MAX_RESP_SIZE)
+        if op == OP_PING:
+            bitmap &= 0x01
+
+        # At-least-once transactions: just answer every request, including
+        # retransmitted ones
+        sequences = [seq for seq in range(8) if bitmap & (1 << seq)]
+        for seq in sequences:
+            resp_control = ATP_TRESP
+            if seq == sequences[-1]:
+                resp_control |= ATP_EOM
+            packet = struct.pack(ATP_HEADER_FORMAT, DDP_TYPE_ATP, resp_control, seq,
+                                 tid, 0) + pattern[:resp_size]
+            check(libc.sendto(fd, packet, len(packet), 0, ctypes.byref(sender),
+                              ctypes.sizeof(sender)))
+
+        transactions += 1
+        if transactions % 1000 == 0:
+            print('%d transactions, last from %s' % (transactions, format_addr(sender)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Peer for the atpBench AppleTalk benchmark.')
+    parser.add_argument('--socket', '-s', type=int, default=DEFAULT_SOCKET,
+                        help='DDP socket number to listen on (default %d)' % DEFAULT_SOCKET)
+    args = parser.parse_args()
+
+    fd = check(libc.socket(AF_APPLETALK, SOCK_DGRAM, 0))
+    addr = SockaddrAt(sat_family=AF_APPLETALK, sat_port=args.socket,
+                      sat_addr=AtalkAddr(ATADDR_ANYNET, ATADDR_ANYNODE))
+    check(libc.bind(fd, ctypes.byref(addr), ctypes.sizeof(addr)))
+
+    addr_len = ctypes.c_uint32(ctypes.sizeof(addr))
+    check(libc.getsockname(fd, ctypes.byref(addr), ctypes.byref(addr_len)))
+    print('Listening on %s (net.node.socket)' % format_addr(addr))
+
+    try:
+        serve(fd)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        os.close(fd)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
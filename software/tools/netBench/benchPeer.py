@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+
+# Peer for the tcpBench MacTCP benchmark: a TCP source/sink and a UDP
+# sink/echoer on one port. See README.md for the protocol.
+
+import argparse
+import socket
+import struct
+import sys
+import threading
+
+BENCH_PORT = 5001
+
+# TCP command header: op, pad, bufLen, count
+TCP_HEADER_FORMAT = '>BBHL'
+# UDP datagram header: op, pad, pad, seq, time
+UDP_HEADER_FORMAT = '>BBHLL'
+# UDP stats reply: header, datagrams, bytes
+UDP_STATS_FORMAT = UDP_HEADER_FORMAT + 'LL'
+
+OP_TCP_SINK = ord('T')
+OP_TCP_SOURCE = ord('R')
+OP_UDP_DATA = ord('D')
+OP_UDP_END = ord('E')
+OP_UDP_STATS = ord('S')
+OP_UDP_PING = ord('P')
+
+
+def recv_exactly(conn, length):
+    data = b''
+    while len(data) < length:
+        chunk = conn.recv(length - len(data))
+        if not chunk:
+            raise ConnectionError('connection closed')
+        data += chunk
+    return data
+
+
+def handle_tcp(conn, addr):
+    with conn:
+        op, _, buf_len, count = struct.unpack(
+            TCP_HEADER_FORMAT,
+            recv_exactly(conn, struct.calcsize(TCP_HEADER_FORMAT)))
+        total = buf_len * count
+        if op == OP_TCP_SINK:
+            received = 0
+            while received < total:
+                chunk = conn.recv(65536)
+                if not chunk:
+                    break
+                received += len(chunk)
+            conn.sendall(struct.pack('>L', received))
+            print('%s: TCP sink, received %d of %d bytes' % (addr[0], received, total))
+        elif op == OP_TCP_SOURCE:
+            buf = bytes(i & 0xff for i in range(buf_len))
+            for _ in range(count):
+                conn.sendall(buf)
+            print('%s: TCP source, sent %d bytes' % (addr[0], total))
+        else:
+            print('%s: unknown TCP op %d' % (addr[0], op))
+
+
+def tcp_server(port):
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as sock:
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        sock.bind(('', port))
+        sock.listen()
+        while True:
+            conn, addr = sock.accept()
+            threading.Thread(target=handle_tcp, args=(conn, addr), daemon=True).start()
+
+
+def udp_server(port):
+    # Counts of data datagrams and bytes from each sender since its last
+    # end-of-test request
+    counts = {}
+    header_size = struct.calcsize(UDP_HEADER_FORMAT)
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as sock:
+        sock.bind(('', port))
+        while True:
+            data, addr = sock.recvfrom(65536)
+            if len(data) < header_size:
+                continue
+            op = data[0]
+            if op == OP_UDP_DATA:
+                datagrams, total = counts.get(addr, (0, 0))
+                counts[addr] = (datagrams + 1, total + len(data))
+            elif op == OP_UDP_END:
+                datagrams, total = counts.pop(addr, (0, 0))
+                sock.sendto(struct.pack(UDP_STATS_FORMAT, OP_UDP_STATS, 0, 0, 0, 0,
+                                        datagrams, total), addr)
+                if datagrams:
+                    print('%s: UDP test, received %d datagrams, %d bytes' %
+                          (addr[0], datagrams, total))
+            elif op == OP_UDP_PING:
+                sock.sendto(data, addr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Peer for the tcpBench MacTCP benchmark.')
+    parser.add_argument('--port', '-p', type=int, default=BENCH_PORT,
+                        help='TCP and UDP port to listen on (default %d)' % BENCH_PORT)
+    args = parser.parse_args()
+
+    threading.Thread(target=tcp_server, args=(args.port,), daemon=True).start()
+    print('Listening on TCP and UDP port %d' % args.port)
+    try:
+        udp_server(args.port)
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,41 @@
+/*
+CPU idle measurement for the network benchmarks (see idle.h)
+*/
+
+#include <MacTypes.h>
+
+#include "idle.h"
+
+/* Ticks to calibrate over */
+#define calibrationTicks 120
+
+/* Ticks low-memory global. Read directly, rather than with TickCount(), so that
+the calibration loop has the same shape as idleWait() */
+#define Ticks (*(volatile unsigned long *)0x016a)
+
+static double spinsPerTick;
+
+void idleCalibrate(void) {
+  unsigned long spins = 0;
+  unsigned long end;
+
+  /* Start on a tick boundary */
+  end = Ticks + 1;
+  while (Ticks < end) {}
+
+  end += calibrationTicks;
+  while (Ticks < end) {
+    spins++;
+  }
+  spinsPerTick = (double)spins / calibrationTicks;
+}
+
+double idleFraction(unsigned long spins, unsigned long ticks) {
+  double fraction;
+
+  if (ticks == 0 || spinsPerTick == 0) {
+    return 0;
+  }
+  fraction = spins / (spinsPerTick * ticks);
+  return fraction > 1 ? 1 : fraction;
+}
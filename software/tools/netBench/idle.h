@@ -0,0 +1,30 @@
+/*
+CPU idle measurement for the network benchmarks
+
+The benchmarks issue every network call asynchronously and spin on the
+parameter block's ioResult until it completes, counting loop iterations. Time
+spent in interrupt handlers and deferred tasks (i.e. the network stack and the
+driver) is stolen from that loop, so comparing the count against the count for
+an otherwise idle machine over the same time gives the fraction of the CPU that
+was left over.
+*/
+
+#pragma once
+
+#include <MacTypes.h>
+
+/* Count the idle loop rate. Call once, before starting a test. */
+void idleCalibrate(void);
+
+/* Spin until an asynchronous call completes, counting iterations */
+static inline unsigned long idleWait(volatile OSErr *ioResult) {
+  unsigned long spins = 0;
+  while (*ioResult > 0) {
+    spins++;
+  }
+  return spins;
+}
+
+/* Fraction of the CPU that was idle, given the total idleWait() count over a
+test and the test duration in ticks */
+double idleFraction(unsigned long spins, unsigned long ticks);
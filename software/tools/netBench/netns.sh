@@ -0,0 +1,52 @@
+#!/bin/sh
+
+# Set up a network namespace for the benchmark peers, bridged to a tap device
+# that an emulator (or a real Mac, via a spare ethernet port added to the
+# bridge) can use, and start benchPeer.py in it. Needs root.
+#
+#   sudo ./netns.sh up [tap]    # default tap device: tap0
+#   sudo ./netns.sh down
+#
+# The peer's address is 10.88.0.1/24; give the Mac an address on the same
+# subnet in the MacTCP control panel. For AppleTalk, run atalkd (configured for
+# the sebench0 interface) and atpPeer.py inside the namespace:
+#
+#   sudo ip netns exec sebench atalkd
+#   sudo ip netns exec sebench ./atpPeer.py
+
+set -e
+
+NS=sebench
+BRIDGE=sebr0
+TAP=${2:-tap0}
+HERE=$(dirname "$0")
+
+case "$1" in
+  up)
+    ip netns add $NS
+    ip link add $BRIDGE type bridge
+    ip link add sebench-host type veth peer name sebench0
+    ip link set sebench0 netns $NS
+    ip link set sebench-host master $BRIDGE
+    ip tuntap add dev "$TAP" mode tap 2>/dev/null || true
+    ip link set "$TAP" master $BRIDGE
+    ip link set $BRIDGE up
+    ip link set sebench-host up
+    ip link set "$TAP" up
+    ip netns exec $NS ip link set lo up
+    ip netns exec $NS ip addr add 10.88.0.1/24 dev sebench0
+    ip netns exec $NS ip link set sebench0 up
+    ip netns exec $NS "$HERE/benchPeer.py" &
+    echo "Namespace $NS up, benchPeer.py running (pid $!)"
+    ;;
+  down)
+    ip netns pids $NS 2>/dev/null | xargs -r kill
+    ip netns del $NS 2>/dev/null || true
+    ip link del $BRIDGE 2>/dev/null || true
+    ip link del sebench-host 2>/dev/null || true
+    ;;
+  *)
+    echo "usage: $0 up [tap] | down" >&2
+    exit 1
+    ;;
+esac
@@ -0,0 +1,878 @@
+/*
+ttcp-style TCP and UDP throughput and latency tester for MacTCP
+
+Measures what applications actually get out of the network, including MacTCP's
+own overheads, against benchPeer.py running on another machine (see README.md
+for the protocol). Reports throughput, the fraction of the CPU left idle, and
+retransmitted (TCP) or lost (UDP) packets.
+
+The full duplex test sends and receives over TCP at the same time, to measure
+how well both directions of the link are kept busy.
+
+The disk test reads a file from the startup disk while receiving over TCP, to
+measure how much network and disk traffic get in each other's way.
+*/
+
+#include <Devices.h>
+#include <ENET.h>
+#include <Events.h>
+#include <Files.h>
+#include <MacTCP.h>
+#include <MacTypes.h>
+#include <Memory.h>
+#include <Timer.h>
+#include <Traps.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "idle.h"
+#include "sethernet.h"
+
+#define benchPort 5001
+
+/* MacTCP wants at least 4kB of receive buffer for TCP and 2kB for UDP; more
+lets it advertise a bigger window */
+#define tcpRcvBufSize 16384
+#define udpRcvBufSize 8192
+
+/* Largest buffer we'll send in one call */
+#define maxBufLen 8192
+
+/* Disk test file, its size, and the size of each read */
+#define diskFileName "\ptcpBench disk test"
+#define diskFileSize (1024L * 1024)
+#define diskChunk 32768
+
+/* Ticks to measure disk throughput on its own for */
+#define diskAloneTicks (5 * 60)
+
+/* Command sent by us at the start of a TCP connection. All fields are in
+network byte order, which is our native order. */
+typedef struct benchHeader {
+  unsigned char op;      /* opXXX */
+  unsigned char pad;
+  unsigned short bufLen; /* Size of each write */
+  unsigned long count;   /* Number of writes */
+} benchHeader;
+
+/* UDP datagrams start with this */
+typedef struct udpHeader {
+  unsigned char op;      /* opXXX */
+  unsigned char pad;
+  unsigned short pad2;
+  unsigned long seq;     /* Sequence number */
+  unsigned long time;    /* Sender's timestamp, echoed back in pings */
+} udpHeader;
+
+/* UDP test results returned by the peer in an opUdpStats datagram */
+typedef struct udpStats {
+  udpHeader header;
+  unsigned long datagrams; /* Data datagrams received */
+  unsigned long bytes;     /* Data bytes received (including headers) */
+} udpStats;
+
+enum {
+  opTcpSink = 'T',   /* We send count x bufLen bytes, peer replies with the
+                        total it received (4 bytes) */
+  opTcpSource = 'R', /* Peer sends count x bufLen bytes */
+  opUdpData = 'D',   /* Throughput test datagram */
+  opUdpEnd = 'E',    /* End of throughput test, peer replies with opUdpStats */
+  opUdpStats = 'S',
+  opUdpPing = 'P'    /* Peer echoes it back unchanged */
+};
+
+/* Disk reader for the disk test. Keeps an asynchronous read going, working
+through the file and starting again at the end. */
+typedef struct diskReader {
+  ParamBlockRec pb;
+  short refNum;
+  Ptr buffer;
+  long position;        /* Offset of the read in progress */
+  unsigned long bytes;  /* Bytes read so far */
+  OSErr err;            /* First error, if any */
+} diskReader;
+
+static short ipRefNum;
+static short enetRefNum;
+static unsigned long sendBuf[maxBufLen / sizeof(unsigned long)];
+static unsigned long spins; /* Idle loop count for the current test */
+static diskReader *activeDisk; /* Reading alongside network calls, or nil */
+
+/* Start the next disk read, bypassing the disk cache so that every read goes
+to the disk */
+static void diskStart(diskReader *disk) {
+  memset(&disk->pb, 0, sizeof(disk->pb));
+  disk->pb.ioParam.ioRefNum = disk->refNum;
+  disk->pb.ioParam.ioBuffer = disk->buffer;
+  disk->pb.ioParam.ioReqCount = diskChunk;
+  disk->pb.ioParam.ioPosMode = fsFromStart | noCacheMask;
+  disk->pb.ioParam.ioPosOffset = disk->position;
+  PBReadAsync(&disk->pb);
+}
+
+/* If the last disk read has finished, count it and start another. Returns
+false once a read has failed. */
+static Boolean diskPoll(diskReader *disk) {
+  if (disk->pb.ioParam.ioResult > 0) {
+    return true;
+  }
+  if (disk->pb.ioParam.ioResult != noErr) {
+    disk->err = disk->pb.ioParam.ioResult;
+    return false;
+  }
+  disk->bytes += disk->pb.ioParam.ioActCount;
+  disk->position += diskChunk;
+  if (disk->position >= diskFileSize) {
+    disk->position = 0;
+  }
+  diskStart(disk);
+  return true;
+}
+
+/* Wait for the disk read in progress to finish */
+static void diskStop(diskReader *disk) {
+  while (disk->pb.ioParam.ioResult > 0) {}
+}
+
+/* Wait for an asynchronous network call, counting idle time or keeping the
+disk busy */
+static void waitFor(volatile OSErr *ioResult) {
+  if (activeDisk == nil) {
+    spins += idleWait(ioResult);
+    return;
+  }
+  while (*ioResult > 0) {
+    diskPoll(activeDisk);
+  }
+}
+
+/* Start a MacTCP call without waiting for it */
+static void tcpStart(TCPiopb *pb, short csCode) {
+  pb->ioCompletion = nil;
+  pb->ioCRefNum = ipRefNum;
+  pb->csCode = csCode;
+  PBControlAsync((ParmBlkPtr)pb);
+}
+
+/* Make a MacTCP call and wait for it to finish, counting idle time */
+static OSErr tcpCall(TCPiopb *pb, short csCode) {
+  tcpStart(pb, csCode);
+  waitFor(&pb->ioResult);
+  return pb->ioResult;
+}
+
+static OSErr udpCall(UDPiopb *pb, short csCode) {
+  pb->ioCompletion = nil;
+  pb->ioCRefNum = ipRefNum;
+  pb->csCode = csCode;
+  PBControlAsync((ParmBlkPtr)pb);
+  waitFor(&pb->ioResult);
+  return pb->ioResult;
+}
+
+/* Parse a dotted-quad IP address */
+static Boolean parseAddr(const char *str, ip_addr *addr) {
+  unsigned int a, b, c, d;
+  if (sscanf(str, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 || a > 255 || b > 255 ||
+      c > 255 || d > 255) {
+    return false;
+  }
+  *addr = ((unsigned long)a << 24) | ((unsigned long)b << 16) | (c << 8) | d;
+  return true;
+}
+
+static unsigned long readNumber(const char *prompt, unsigned long dflt) {
+  char line[64];
+  unsigned long value;
+
+  printf("%s [%lu]: ", prompt, dflt);
+  fflush(stdout);
+  if (fgets(line, sizeof(line), stdin) == NULL ||
+      sscanf(line, "%lu", &value) != 1) {
+    return dflt;
+  }
+  return value;
+}
+
+static void report(unsigned long bytes, unsigned long ticks) {
+  double seconds;
+
+  if (ticks == 0) {
+    ticks = 1;
+  }
+  seconds = ticks / 60.0;
+  printf("  %lu bytes in %.2f s = %.1f kB/s\n", bytes, seconds,
+         bytes / seconds / 1024);
+  /* Idle time isn't counted while the disk test keeps the disk busy */
+  if (activeDisk == nil) {
+    printf("  CPU idle: %.0f%%\n", idleFraction(spins, ticks) * 100);
+  }
+}
+
+/* Create a TCP stream and connect it to the peer. Returns the stream's
+receive buffer, or nil on failure. */
+static Ptr tcpOpen(TCPiopb *pb, ip_addr host) {
+  Ptr rcvBuf;
+  OSErr err;
+
+  rcvBuf = NewPtr(tcpRcvBufSize);
+  if (rcvBuf == nil) {
+    printf("Out of memory\n");
+    return nil;
+  }
+
+  memset(pb, 0, sizeof(*pb));
+  pb->csParam.create.rcvBuff = rcvBuf;
+  pb->csParam.create.rcvBuffLen = tcpRcvBufSize;
+  err = tcpCall(pb, TCPCreate);
+  if (err != noErr) {
+    printf("TCPCreate failed: %d\n", err);
+    DisposePtr(rcvBuf);
+    return nil;
+  }
+
+  memset(&pb->csParam, 0, sizeof(pb->csParam));
+  pb->csParam.open.remoteHost = host;
+  pb->csParam.open.remotePort = benchPort;
+  pb->csParam.open.commandTimeoutValue = 30;
+  err = tcpCall(pb, TCPActiveOpen);
+  if (err != noErr) {
+    printf("TCPActiveOpen failed: %d\n", err);
+    memset(&pb->csParam, 0, sizeof(pb->csParam));
+    tcpCall(pb, TCPRelease);
+    DisposePtr(rcvBuf);
+    return nil;
+  }
+  return rcvBuf;
+}
+
+/* Close and release a stream opened by tcpOpen() */
+static void tcpClose(TCPiopb *pb, Ptr rcvBuf) {
+  memset(&pb->csParam, 0, sizeof(pb->csParam));
+  tcpCall(pb, TCPClose);
+  memset(&pb->csParam, 0, sizeof(pb->csParam));
+  tcpCall(pb, TCPRelease);
+  DisposePtr(rcvBuf);
+}
+
+/* Tell the peer what to do with the connection */
+static OSErr tcpSendHeader(TCPiopb *pb, unsigned char op,
+                           unsigned short bufLen, unsigned long count) {
+  benchHeader header;
+  wdsEntry wds[2];
+
+  header.op = op;
+  header.pad = 0;
+  header.bufLen = bufLen;
+  header.count = count;
+  wds[0].length = sizeof(header);
+  wds[0].ptr = (Ptr)&header;
+  wds[1].length = 0;
+  wds[1].ptr = nil;
+  memset(&pb->csParam, 0, sizeof(pb->csParam));
+  pb->csParam.send.wdsPtr = (Ptr)wds;
+  pb->csParam.send.pushFlag = true;
+  return tcpCall(pb, TCPSend);
+}
+
+/* Start sending a buffer */
+static void tcpSendStart(TCPiopb *pb, wdsEntry *wds, Boolean push) {
+  memset(&pb->csParam, 0, sizeof(pb->csParam));
+  pb->csParam.send.wdsPtr = (Ptr)wds;
+  pb->csParam.send.pushFlag = push;
+  tcpStart(pb, TCPSend);
+}
+
+/* Start receiving into a buffer */
+static void tcpRcvStart(TCPiopb *pb, Ptr buf, unsigned short bufLen) {
+  memset(&pb->csParam, 0, sizeof(pb->csParam));
+  pb->csParam.receive.commandTimeoutValue = 30;
+  pb->csParam.receive.rcvBuff = buf;
+  pb->csParam.receive.rcvBuffLen = bufLen;
+  tcpStart(pb, TCPRcv);
+}
+
+static void tcpShowStats(TCPiopb *pb) {
+  TCPConnectionStats stats;
+
+  memset(&pb->csParam, 0, sizeof(pb->csParam));
+  memset(&stats, 0, sizeof(stats));
+  pb->csParam.status.connStatPtr = &stats;
+  if (tcpCall(pb, TCPStatus) == noErr) {
+    printf("  Data packets sent %lu, retransmitted %lu (%lu bytes)\n",
+           stats.dataPktsSent, stats.dataPktsResent, stats.bytesResent);
+    printf("  Data packets received %lu, duplicate bytes %lu\n",
+           stats.dataPktsRcvd, stats.bytesRcvdDup);
+  }
+}
+
+/* TCP throughput test, in either direction */
+static void tcpTest(ip_addr host, Boolean transmit, unsigned short bufLen,
+                    unsigned long count) {
+  TCPiopb pb;
+  Ptr rcvBuf;
+  wdsEntry wds[2];
+  unsigned long total = 0;
+  unsigned long start, ticks;
+  unsigned long i;
+  OSErr err;
+
+  rcvBuf = tcpOpen(&pb, host);
+  if (rcvBuf == nil) {
+    return;
+  }
+
+  spins = 0;
+  start = TickCount();
+
+  err = tcpSendHeader(&pb, transmit ? opTcpSink : opTcpSource, bufLen, count);
+
+  if (transmit) {
+    wds[0].length = bufLen;
+    wds[0].ptr = (Ptr)sendBuf;
+    wds[1].length = 0;
+    wds[1].ptr = nil;
+    for (i = 0; i < count && err == noErr; i++) {
+      tcpSendStart(&pb, wds, i == count - 1);
+      waitFor(&pb.ioResult);
+      err = pb.ioResult;
+    }
+    /* Wait for the peer to tell us it has everything */
+    if (err == noErr) {
+      tcpRcvStart(&pb, (Ptr)&total, sizeof(total));
+      waitFor(&pb.ioResult);
+      err = pb.ioResult;
+    }
+  } else {
+    while (total < (unsigned long)bufLen * count && err == noErr) {
+      tcpRcvStart(&pb, (Ptr)sendBuf, maxBufLen);
+      waitFor(&pb.ioResult);
+      err = pb.ioResult;
+      total += pb.csParam.receive.rcvBuffLen;
+    }
+  }
+
+  ticks = TickCount() - start;
+  if (err != noErr) {
+    printf("Transfer failed: %d\n", err);
+  }
+  report(total, ticks);
+  tcpShowStats(&pb);
+  tcpClose(&pb, rcvBuf);
+}
+
+static void reportDirection(const char *name, unsigned long bytes,
+                            unsigned long ticks, OSErr err) {
+  double seconds;
+
+  if (err != noErr) {
+    printf("  %s failed: %d\n", name, err);
+  }
+  if (ticks == 0) {
+    ticks = 1;
+  }
+  seconds = ticks / 60.0;
+  printf("  %s: %lu bytes in %.2f s = %.1f kB/s\n", name, bytes, seconds,
+         bytes / seconds / 1024);
+}
+
+/*
+Full duplex: send and receive at the same time, over two connections, so that
+both directions of the link are busy at once. Each connection keeps one
+asynchronous call going, started again as soon as the last one finishes.
+Compared with separate send and receive tests, this shows whether the driver
+keeps the transmitter busy while it is draining received frames.
+*/
+static void duplexTest(ip_addr host, unsigned short bufLen,
+                       unsigned long count) {
+  TCPiopb txPb, rxPb;
+  Ptr txRcvBuf, rxRcvBuf, rcvData;
+  wdsEntry wds[2];
+  unsigned long wanted = (unsigned long)bufLen * count;
+  unsigned long sent = 0, confirmed = 0, received = 0;
+  unsigned long start, txTicks = 0, rxTicks = 0;
+  enum { sending, confirming, done } txState;
+  Boolean receiving;
+  OSErr txErr, rxErr;
+
+  rcvData = NewPtr(maxBufLen);
+  if (rcvData == nil) {
+    printf("Out of memory\n");
+    return;
+  }
+  txRcvBuf = tcpOpen(&txPb, host);
+  if (txRcvBuf == nil) {
+    DisposePtr(rcvData);
+    return;
+  }
+  rxRcvBuf = tcpOpen(&rxPb, host);
+  if (rxRcvBuf == nil) {
+    tcpClose(&txPb, txRcvBuf);
+    DisposePtr(rcvData);
+    return;
+  }
+
+  start = TickCount();
+  txErr = tcpSendHeader(&txPb, opTcpSink, bufLen, count);
+  rxErr = tcpSendHeader(&rxPb, opTcpSource, bufLen, count);
+
+  wds[0].length = bufLen;
+  wds[0].ptr = (Ptr)sendBuf;
+  wds[1].length = 0;
+  wds[1].ptr = nil;
+  txState = done;
+  receiving = false;
+  if (txErr == noErr) {
+    tcpSendStart(&txPb, wds, count == 1);
+    txState = sending;
+  }
+  if (rxErr == noErr) {
+    tcpRcvStart(&rxPb, rcvData, maxBufLen);
+    receiving = true;
+  }
+
+  /* No idle time to count here, we're always polling one or the other */
+  while (txState != done || receiving) {
+    if (txState != done && txPb.ioResult <= 0) {
+      txErr = txPb.ioResult;
+      if (txErr != noErr) {
+        txState = done;
+      } else if (txState == sending && ++sent < count) {
+        tcpSendStart(&txPb, wds, sent == count - 1);
+      } else if (txState == sending) {
+        /* Wait for the peer to tell us it has everything */
+        tcpRcvStart(&txPb, (Ptr)&confirmed, sizeof(confirmed));
+        txState = confirming;
+      } else {
+        txState = done;
+      }
+      if (txState == done) {
+        txTicks = TickCount() - start;
+      }
+    }
+    if (receiving && rxPb.ioResult <= 0) {
+      rxErr = rxPb.ioResult;
+      if (rxErr == noErr) {
+        received += rxPb.csParam.receive.rcvBuffLen;
+      }
+      if (rxErr == noErr && received < wanted) {
+        tcpRcvStart(&rxPb, rcvData, maxBufLen);
+      } else {
+        receiving = false;
+        rxTicks = TickCount() - start;
+      }
+    }
+  }
+
+  reportDirection("Send", confirmed, txTicks, txErr);
+  reportDirection("Receive", received, rxTicks, rxErr);
+  reportDirection("Both", confirmed + received,
+                  txTicks > rxTicks ? txTicks : rxTicks, noErr);
+  printf(" Sending connection:\n");
+  tcpShowStats(&txPb);
+  printf(" Receiving connection:\n");
+  tcpShowStats(&rxPb);
+
+  tcpClose(&rxPb, rxRcvBuf);
+  tcpClose(&txPb, txRcvBuf);
+  DisposePtr(rcvData);
+}
+
+/* Create a UDP stream, returning nil on failure */
+static StreamPtr udpCreate(UDPiopb *pb, Ptr rcvBuf) {
+  memset(pb, 0, sizeof(*pb));
+  pb->csParam.create.rcvBuff = rcvBuf;
+  pb->csParam.create.rcvBuffLen = udpRcvBufSize;
+  if (udpCall(pb, UDPCreate) != noErr) {
+    printf("UDPCreate failed: %d\n", pb->ioResult);
+    return 0;
+  }
+  return pb->udpStream;
+}
+
+static OSErr udpSend(UDPiopb *pb, ip_addr host, Ptr data,
+                     unsigned short length) {
+  wdsEntry wds[2];
+
+  wds[0].length = length;
+  wds[0].ptr = data;
+  wds[1].length = 0;
+  wds[1].ptr = nil;
+  memset(&pb->csParam, 0, sizeof(pb->csParam));
+  pb->csParam.send.remoteHost = host;
+  pb->csParam.send.remotePort = benchPort;
+  pb->csParam.send.wdsPtr = (Ptr)wds;
+  pb->csParam.send.checkSum = true;
+  return udpCall(pb, UDPWrite);
+}
+
+/* Wait up to timeout seconds for a datagram. On success the caller must copy
+what it needs out of pb->csParam.receive.rcvBuff and call udpReturn(). */
+static OSErr udpReceive(UDPiopb *pb, unsigned short timeout) {
+  memset(&pb->csParam, 0, sizeof(pb->csParam));
+  pb->csParam.receive.timeOut = timeout;
+  return udpCall(pb, UDPRead);
+}
+
+static void udpReturn(UDPiopb *pb) {
+  udpCall(pb, UDPBfrReturn);
+}
+
+/* UDP throughput test. We only transmit, since there's no flow control and
+MacTCP would just drop whatever it couldn't keep up with. */
+static void udpTest(ip_addr host, unsigned short bufLen, unsigned long count) {
+  UDPiopb pb;
+  Ptr rcvBuf;
+  udpHeader *header = (udpHeader *)sendBuf;
+  udpStats stats;
+  unsigned long start, ticks;
+  unsigned long i;
+  OSErr err = noErr;
+  short tries;
+
+  if (bufLen < sizeof(udpStats)) {
+    bufLen = sizeof(udpStats);
+  }
+  rcvBuf = NewPtr(udpRcvBufSize);
+  if (rcvBuf == nil) {
+    printf("Out of memory\n");
+    return;
+  }
+  if (udpCreate(&pb, rcvBuf) == 0) {
+    DisposePtr(rcvBuf);
+    return;
+  }
+
+  spins = 0;
+  start = TickCount();
+  header->op = opUdpData;
+  for (i = 0; i < count && err == noErr; i++) {
+    header->seq = i;
+    err = udpSend(&pb, host, (Ptr)sendBuf, bufLen);
+  }
+  ticks = TickCount() - start;
+
+  /* Ask for the peer's count, a few times in case the request gets lost */
+  memset(&stats, 0, sizeof(stats));
+  header->op = opUdpEnd;
+  for (tries = 0; tries < 3; tries++) {
+    udpSend(&pb, host, (Ptr)sendBuf, sizeof(udpHeader));
+    if (udpReceive(&pb, 2) == noErr) {
+      if (pb.csParam.receive.rcvBuffLen >= sizeof(stats) &&
+          pb.csParam.receive.rcvBuff[0] == opUdpStats) {
+        memcpy(&stats, pb.csParam.receive.rcvBuff, sizeof(stats));
+        udpReturn(&pb);
+        break;
+      }
+      udpReturn(&pb);
+    }
+  }
+
+  if (err != noErr) {
+    printf("UDPWrite failed: %d\n", err);
+  }
+  printf("  Sent %lu datagrams of %u bytes\n", i, bufLen);
+  report(stats.bytes, ticks);
+  if (tries == 3) {
+    printf("  No reply from peer, received count unknown\n");
+  } else {
+    printf("  Peer received %lu, lost %lu\n", stats.datagrams,
+           i - stats.datagrams);
+  }
+
+  memset(&pb.csParam, 0, sizeof(pb.csParam));
+  udpCall(&pb, UDPRelease);
+  DisposePtr(rcvBuf);
+}
+
+/* Current time in microseconds, or ticks converted to microseconds if there's
+no Microseconds trap */
+static unsigned long now(Boolean haveMicroseconds) {
+  UnsignedWide us;
+  if (haveMicroseconds) {
+    Microseconds(&us);
+    return us.lo;
+  }
+  return TickCount() * 16667;
+}
+
+/* UDP round-trip latency test */
+static void pingTest(ip_addr host, unsigned short bufLen, unsigned long count,
+                     Boolean haveMicroseconds) {
+  UDPiopb pb;
+  Ptr rcvBuf;
+  udpHeader *header = (udpHeader *)sendBuf;
+  unsigned long rtt, minRtt = 0xffffffff, maxRtt = 0, totalRtt = 0;
+  unsigned long replies = 0;
+  unsigned long start, ticks;
+  unsigned long i;
+
+  if (bufLen < sizeof(udpHeader)) {
+    bufLen = sizeof(udpHeader);
+  }
+  rcvBuf = NewPtr(udpRcvBufSize);
+  if (rcvBuf == nil) {
+    printf("Out of memory\n");
+    return;
+  }
+  if (udpCreate(&pb, rcvBuf) == 0) {
+    DisposePtr(rcvBuf);
+    return;
+  }
+
+  spins = 0;
+  start = TickCount();
+  header->op = opUdpPing;
+  for (i = 0; i < count; i++) {
+    header->seq = i;
+    header->time = now(haveMicroseconds);
+    if (udpSend(&pb, host, (Ptr)sendBuf, bufLen) != noErr) {
+      break;
+    }
+    /* Skip any stale replies to earlier pings that timed out */
+    while (udpReceive(&pb, 1) == noErr) {
+      udpHeader reply;
+      /* Datagrams in MacTCP's buffer aren't necessarily word-aligned */
+      memcpy(&reply, pb.csParam.receive.rcvBuff, sizeof(reply));
+      udpReturn(&pb);
+      if (reply.op == opUdpPing && reply.seq == i) {
+        rtt = now(haveMicroseconds) - header->time;
+        totalRtt += rtt;
+        minRtt = rtt < minRtt ? rtt : minRtt;
+        maxRtt = rtt > maxRtt ? rtt : maxRtt;
+        replies++;
+        break;
+      }
+    }
+  }
+  ticks = TickCount() - start;
+
+  printf("  %lu pings of %u bytes, %lu replies, %lu lost\n", i, bufLen,
+         replies, i - replies);
+  if (replies > 0) {
+    printf("  Round trip min/avg/max %lu/%lu/%lu us%s\n", minRtt,
+           totalRtt / replies, maxRtt,
+           haveMicroseconds ? "" : " (tick resolution)");
+  }
+  printf("  CPU idle: %.0f%%\n", idleFraction(spins, ticks) * 100);
+
+  memset(&pb.csParam, 0, sizeof(pb.csParam));
+  udpCall(&pb, UDPRelease);
+  DisposePtr(rcvBuf);
+}
+
+/* Open the disk test file, creating it if it isn't there or is too short */
+static OSErr diskOpen(diskReader *disk) {
+  long count;
+  long eof;
+  OSErr err;
+
+  err = Create(diskFileName, 0, 'SEnb', 'BINA');
+  if (err != noErr && err != dupFNErr) {
+    return err;
+  }
+  err = FSOpen(diskFileName, 0, &disk->refNum);
+  if (err != noErr) {
+    return err;
+  }
+  if (GetEOF(disk->refNum, &eof) == noErr && eof >= diskFileSize) {
+    return noErr;
+  }
+
+  printf("Creating %ld kB test file...\n", diskFileSize / 1024);
+  memset(disk->buffer, 0xa5, diskChunk);
+  SetFPos(disk->refNum, fsFromStart, 0);
+  for (eof = 0; eof < diskFileSize && err == noErr; eof += diskChunk) {
+    count = diskChunk;
+    err = FSWrite(disk->refNum, &count, disk->buffer);
+  }
+  if (err != noErr) {
+    FSClose(disk->refNum);
+  }
+  return err;
+}
+
+static void reportDisk(const char *what, diskReader *disk,
+                       unsigned long ticks) {
+  if (disk->err != noErr) {
+    printf("  Disk read failed: %d\n", disk->err);
+  }
+  if (ticks == 0) {
+    ticks = 1;
+  }
+  printf("  Disk, %s: %lu bytes in %.2f s = %.1f kB/s\n", what, disk->bytes,
+         ticks / 60.0, disk->bytes / (ticks / 60.0) / 1024);
+}
+
+/*
+Disk and network together: measure how fast a file can be read from the disk on
+its own, then read it again while receiving over TCP. Optionally turns the
+driver's deferral of receive work during SCSI transactions (ENCSetSCSIDefer) on
+or off first, so the two can be compared.
+*/
+static void diskTest(ip_addr host, unsigned short bufLen, unsigned long count,
+                     short deferral) {
+  diskReader disk;
+  EParamBlock enetPB;
+  scsiDeferConfig config;
+  unsigned long start;
+  OSErr err;
+
+  if (deferral >= 0) {
+    if (enetRefNum == 0) {
+      printf("No SEthernet driver, can't change SCSI deferral\n");
+    } else {
+      config.enabled = deferral;
+      config.maxDeferMs = 0;
+      memset(&enetPB, 0, sizeof(enetPB));
+      enetPB.ioRefNum = enetRefNum;
+      enetPB.csCode = ENCSetSCSIDefer;
+      enetPB.u.EParms1.ePointer = (Ptr)&config;
+      err = PBControlSync((ParmBlkPtr)&enetPB);
+      if (err != noErr) {
+        printf("ENCSetSCSIDefer failed: %d\n", err);
+      }
+    }
+  }
+
+  memset(&disk, 0, sizeof(disk));
+  disk.buffer = NewPtr(diskChunk);
+  if (disk.buffer == nil) {
+    printf("Out of memory\n");
+    return;
+  }
+  err = diskOpen(&disk);
+  if (err != noErr) {
+    printf("Couldn't open test file: %d\n", err);
+    DisposePtr(disk.buffer);
+    return;
+  }
+
+  /* Disk on its own */
+  start = TickCount();
+  diskStart(&disk);
+  while (TickCount() - start < diskAloneTicks && diskPoll(&disk)) {}
+  diskStop(&disk);
+  reportDisk("alone", &disk, TickCount() - start);
+
+  /* Disk while receiving */
+  disk.bytes = 0;
+  disk.err = noErr;
+  printf("  Network, alongside disk:\n");
+  start = TickCount();
+  activeDisk = &disk;
+  diskStart(&disk);
+  tcpTest(host, false, bufLen, count);
+  activeDisk = nil;
+  diskStop(&disk);
+  reportDisk("alongside network", &disk, TickCount() - start);
+
+  FSClose(disk.refNum);
+  DisposePtr(disk.buffer);
+}
+
+static void help(void) {
+  printf("\n[T]CP send, TCP [R]eceive, TCP [F]ull duplex, [U]DP send, "
+         "UDP [P]ing,\n[D]isk + TCP receive, [Q]uit?\n");
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  char line[64];
+  ip_addr host;
+  unsigned long bufLen, count;
+  Boolean haveMicroseconds;
+  OSErr err;
+  int choice;
+  unsigned long deferral = 2;
+  unsigned short i;
+
+  printf("**** SEthernet MacTCP benchmark ****\n\n");
+
+  err = OpenDriver("\p.IPP", &ipRefNum);
+  if (err != noErr) {
+    printf("Couldn't open MacTCP: %d\n", err);
+    return 1;
+  }
+  /* Only needed to change driver settings for the disk test */
+  if (OpenDriver("\p.ENET", &enetRefNum) != noErr) {
+    enetRefNum = 0;
+  }
+  haveMicroseconds = NGetTrapAddress(_Microseconds, OSTrap) !=
+                     GetToolboxTrapAddress(_Unimplemented);
+
+  for (i = 0; i < maxBufLen; i++) {
+    ((Byte *)sendBuf)[i] = i;
+  }
+
+  printf("Calibrating idle loop...\n");
+  idleCalibrate();
+
+  do {
+    printf("Peer IP address: ");
+    fflush(stdout);
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+      return 0;
+    }
+  } while (!parseAddr(line, &host));
+
+  help();
+  while (1) {
+    choice = toupper(getchar());
+    if (choice == '\r' || choice == '\n') {
+      continue;
+    }
+    if (choice == 'Q') {
+      return 0;
+    }
+    if (strchr("TRFUPD", choice) == NULL) {
+      help();
+      continue;
+    }
+    /* Eat the rest of the line */
+    while (getchar() != '\n') {}
+
+    bufLen = readNumber("Buffer size", choice == 'P' ? 64 : 1460);
+    if (bufLen > maxBufLen || (choice == 'U' && bufLen > 1472)) {
+      printf("Too big\n");
+      help();
+      continue;
+    }
+    count = readNumber("Count", choice == 'P' ? 100 : 1000);
+    if (choice == 'D') {
+      /* 0 = off, 1 = on, 2 = leave as it is */
+      deferral = readNumber("SCSI deferral (0 off, 1 on, 2 unchanged)", 2);
+    }
+
+    switch (choice) {
+      case 'T':
+        printf("TCP send, %lu x %lu bytes\n", count, bufLen);
+        tcpTest(host, true, bufLen, count);
+        break;
+      case 'R':
+        printf("TCP receive, %lu x %lu bytes\n", count, bufLen);
+        tcpTest(host, false, bufLen, count);
+        break;
+      case 'F':
+        printf("TCP full duplex, %lu x %lu bytes each way\n", count, bufLen);
+        duplexTest(host, bufLen, count);
+        break;
+      case 'U':
+        printf("UDP send, %lu x %lu bytes\n", count, bufLen);
+        udpTest(host, bufLen, count);
+        break;
+      case 'P':
+        printf("UDP ping, %lu x %lu bytes\n", count, bufLen);
+        pingTest(host, bufLen, count, haveMicroseconds);
+        break;
+      case 'D':
+        printf("Disk + TCP receive, %lu x %lu bytes\n", count, bufLen);
+        diskTest(host, bufLen, count, deferral < 2 ? (short)deferral : -1);
+        break;
+    }
+    help();
+  }
+}
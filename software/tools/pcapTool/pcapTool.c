@@ -0,0 +1,626 @@
+/*
+Packet capture and replay
+
+Capture mode attaches a monitoring tap to the driver (see ENCAttachTap in
+sethernet.h) and writes every frame it receives to a pcap file. Frames are
+appended to one of a pair of buffers at interrupt time; when a buffer fills up,
+the tap moves on to the other one while the main loop writes the full one to
+disk with an asynchronous PBWrite, so that disk and network activity overlap.
+If both buffers are full, frames are dropped and counted.
+
+Replay mode reads a pcap file and sends each frame with ENetWrite, either with
+the gaps between frames that they were captured with, or as fast as possible.
+*/
+
+#include <Devices.h>
+#include <ENET.h>
+#include <Events.h>
+#include <Files.h>
+#include <Gestalt.h>
+#include <MacTypes.h>
+#include <Memory.h>
+#include <OSUtils.h>
+#include <Timer.h>
+#include <Traps.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "phHandler.h"
+#include "sethernet.h"
+
+/* Size of each capture buffer, and of the replay read buffer */
+#define bufferSize 32768
+
+/* Number of capture buffers */
+#define numBuffers 2
+
+/* Ethernet header and largest frame (excluding FCS) */
+#define ethHeaderSize 14
+#define maxFrameSize 1514
+
+/* Seconds between 1904 (Mac epoch) and 1970 (Unix epoch) */
+#define unixEpochOffset 2082844800UL
+
+/* pcap file header */
+typedef struct pcapFileHeader {
+  unsigned long magic;          /* pcapMagic */
+  unsigned short versionMajor;
+  unsigned short versionMinor;
+  long thisZone;                /* Timestamp offset from UTC, always 0 */
+  unsigned long sigFigs;        /* Timestamp accuracy, always 0 */
+  unsigned long snapLen;        /* Longest frame that was captured in full */
+  unsigned long linkType;       /* linkTypeEthernet */
+} pcapFileHeader;
+
+/* pcap record header, precedes each frame */
+typedef struct pcapRecordHeader {
+  unsigned long seconds;        /* Timestamp */
+  unsigned long microseconds;
+  unsigned long inclLen;        /* Number of bytes of frame in the file */
+  unsigned long origLen;        /* Length of frame on the wire */
+} pcapRecordHeader;
+
+#define pcapMagic 0xa1b2c3d4UL
+#define pcapMagicSwapped 0xd4c3b2a1UL
+#define linkTypeEthernet 1
+
+/* Capture buffer states */
+enum {
+  bufFree = 0,   /* Empty */
+  bufFilling,    /* Frames being added by the tap */
+  bufReady,      /* Full, waiting to be written */
+  bufWriting     /* Being written to disk */
+};
+
+typedef struct captureBuffer {
+  volatile unsigned short state;  /* bufXXX */
+  unsigned long used;             /* Bytes in buffer */
+  Byte *data;
+} captureBuffer;
+
+static short enetRefNum;
+static Boolean haveMicroseconds;
+
+/* Capture state, shared with the tap at interrupt time */
+static captureBuffer buffers[numBuffers];
+static volatile unsigned short filling;  /* Buffer the tap is adding to */
+static unsigned short nextWrite;         /* Next buffer to write to disk */
+static unsigned long snapLength;         /* Longest frame to save in full */
+static unsigned long lastClock;          /* now() at last timestamp */
+static pcapRecordHeader lastStamp;       /* Timestamp of last frame */
+static volatile unsigned long capturedFrames;
+static volatile unsigned long capturedBytes;
+static volatile unsigned long droppedFrames;
+
+/* Current time in microseconds, or ticks converted to microseconds if there's
+no Microseconds trap */
+static unsigned long now(void) {
+  UnsignedWide us;
+  if (haveMicroseconds) {
+    Microseconds(&us);
+    return us.lo;
+  }
+  return TickCount() * 16667;
+}
+
+static Boolean trapAvailable(unsigned short trap, TrapType type) {
+  return NGetTrapAddress(trap, type) != GetToolboxTrapAddress(_Unimplemented);
+}
+
+/*
+Called through phHandler at interrupt time with the frame's ethernet header and
+the number of bytes following it. Starts a record for the frame in the capture
+buffer and returns where the rest of the frame should go, with *readLength set
+to how much of it to read, or nil if there's no room for it.
+*/
+static Byte *captureFrame(const Byte *header, unsigned long length,
+                          unsigned short *readLength) {
+  captureBuffer *buf = &buffers[filling];
+  unsigned long frameLength = length + ethHeaderSize;
+  unsigned long clock;
+  unsigned long delta;
+  pcapRecordHeader record;
+  Byte *dest;
+
+  *readLength = 0;
+
+  record.origLen = frameLength;
+  record.inclLen = frameLength < snapLength ? frameLength : snapLength;
+
+  if (buf->state == bufFilling &&
+      buf->used + sizeof(record) + record.inclLen > bufferSize) {
+    /* This one's full, hand it over to be written and move on to the next */
+    buf->state = bufReady;
+    filling = (filling + 1) % numBuffers;
+    buf = &buffers[filling];
+  }
+  if (buf->state == bufFree) {
+    buf->used = 0;
+    buf->state = bufFilling;
+  } else if (buf->state != bufFilling) {
+    /* Still waiting to be written out */
+    droppedFrames++;
+    return nil;
+  }
+
+  /* Advance the timestamp by the time since the last frame */
+  clock = now();
+  delta = clock - lastClock;
+  lastClock = clock;
+  lastStamp.seconds += delta / 1000000;
+  lastStamp.microseconds += delta % 1000000;
+  if (lastStamp.microseconds >= 1000000) {
+    lastStamp.seconds++;
+    lastStamp.microseconds -= 1000000;
+  }
+  record.seconds = lastStamp.seconds;
+  record.microseconds = lastStamp.microseconds;
+
+  /* Records aren't padded, so they can be at odd addresses */
+  dest = buf->data + buf->used;
+  memcpy(dest, &record, sizeof(record));
+  dest += sizeof(record);
+  memcpy(dest, header, ethHeaderSize);
+  dest += ethHeaderSize;
+  buf->used += sizeof(record) + record.inclLen;
+
+  capturedFrames++;
+  capturedBytes += frameLength;
+  *readLength = record.inclLen - ethHeaderSize;
+  return dest;
+}
+
+static OSErr enetControl(short csCode, Ptr param) {
+  EParamBlock pb;
+
+  memset(&pb, 0, sizeof(pb));
+  pb.ioRefNum = enetRefNum;
+  pb.csCode = csCode;
+  pb.u.EParms1.ePointer = param;
+  return PBControlSync((ParmBlkPtr)&pb);
+}
+
+/* Start writing a buffer to the file */
+static void startWrite(ParamBlockRec *pb, short fileRef, captureBuffer *buf) {
+  memset(pb, 0, sizeof(*pb));
+  pb->ioParam.ioRefNum = fileRef;
+  pb->ioParam.ioBuffer = (Ptr)buf->data;
+  pb->ioParam.ioReqCount = buf->used;
+  pb->ioParam.ioPosMode = fsAtMark;
+  buf->state = bufWriting;
+  PBWriteAsync(pb);
+}
+
+/*
+Write out any full buffers, one at a time. writing is the buffer being written,
+or -1 if none. Returns the new value of writing, or -2 if a write failed.
+*/
+static short pumpWrites(ParamBlockRec *pb, short fileRef, short writing,
+                        unsigned long *written) {
+  if (writing >= 0) {
+    if (pb->ioParam.ioResult > 0) {
+      return writing;
+    }
+    if (pb->ioParam.ioResult != noErr) {
+      printf("Write failed: %d\n", pb->ioParam.ioResult);
+      return -2;
+    }
+    *written += pb->ioParam.ioActCount;
+    buffers[writing].state = bufFree;
+    writing = -1;
+  }
+
+  /* Buffers fill up in order, so they're written in order too */
+  if (buffers[nextWrite].state == bufReady) {
+    writing = nextWrite;
+    startWrite(pb, fileRef, &buffers[writing]);
+    nextWrite = (nextWrite + 1) % numBuffers;
+  }
+  return writing;
+}
+
+static unsigned long readNumber(const char *prompt, unsigned long dflt) {
+  char line[64];
+  unsigned long value;
+
+  printf("%s [%lu]: ", prompt, dflt);
+  fflush(stdout);
+  if (fgets(line, sizeof(line), stdin) == NULL ||
+      sscanf(line, "%lu", &value) != 1) {
+    return dflt;
+  }
+  return value;
+}
+
+static Boolean readYesNo(const char *prompt, Boolean dflt) {
+  char line[64];
+
+  printf("%s [%c]: ", prompt, dflt ? 'Y' : 'N');
+  fflush(stdout);
+  if (fgets(line, sizeof(line), stdin) == NULL ||
+      (toupper(line[0]) != 'Y' && toupper(line[0]) != 'N')) {
+    return dflt;
+  }
+  return toupper(line[0]) == 'Y';
+}
+
+/* Read a file name into a Pascal string */
+static Boolean readFileName(const char *prompt, Str255 name) {
+  char line[64];
+  size_t len;
+
+  printf("%s: ", prompt);
+  fflush(stdout);
+  if (fgets(line, sizeof(line), stdin) == NULL) {
+    return false;
+  }
+  len = strlen(line);
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+    len--;
+  }
+  if (len == 0 || len > 31) {
+    return false;
+  }
+  name[0] = len;
+  memcpy(&name[1], line, len);
+  return true;
+}
+
+static void capture(void) {
+  Str255 fileName;
+  short fileRef;
+  pcapFileHeader fileHeader;
+  tapConfig tap;
+  ParamBlockRec pb;
+  long count;
+  unsigned long seconds, start, elapsed, written = 0;
+  unsigned long dateTime;
+  Boolean promiscuous, vm;
+  long response;
+  short writing = -1;
+  short i;
+  OSErr err;
+
+  if (!readFileName("Capture to file", fileName)) {
+    return;
+  }
+  snapLength = readNumber("Snap length", maxFrameSize);
+  if (snapLength < ethHeaderSize) {
+    snapLength = ethHeaderSize;
+  }
+  promiscuous = readYesNo("Promiscuous", true);
+  seconds = readNumber("Seconds (0 to stop with the mouse button)", 0);
+
+  vm = trapAvailable(_Gestalt, ToolTrap) &&
+       Gestalt(gestaltVMAttr, &response) == noErr &&
+       (response & (1 << gestaltVMPresent));
+
+  for (i = 0; i < numBuffers; i++) {
+    buffers[i].data = (Byte *)NewPtr(bufferSize);
+    if (buffers[i].data == nil) {
+      printf("Out of memory\n");
+      return;
+    }
+    /* Filled at interrupt time, keep them resident */
+    if (vm) {
+      HoldMemory(buffers[i].data, bufferSize);
+    }
+    buffers[i].state = bufFree;
+    buffers[i].used = 0;
+  }
+  filling = 0;
+  nextWrite = 0;
+  capturedFrames = capturedBytes = droppedFrames = 0;
+
+  err = Create(fileName, 0, 'SEcp', 'pcap');
+  if (err != noErr && err != dupFNErr) {
+    printf("Couldn't create file: %d\n", err);
+    goto freeBuffers;
+  }
+  err = FSOpen(fileName, 0, &fileRef);
+  if (err != noErr) {
+    printf("Couldn't open file: %d\n", err);
+    goto freeBuffers;
+  }
+  SetEOF(fileRef, 0);
+
+  fileHeader.magic = pcapMagic;
+  fileHeader.versionMajor = 2;
+  fileHeader.versionMinor = 4;
+  fileHeader.thisZone = 0;
+  fileHeader.sigFigs = 0;
+  fileHeader.snapLen = snapLength;
+  fileHeader.linkType = linkTypeEthernet;
+  count = sizeof(fileHeader);
+  err = FSWrite(fileRef, &count, &fileHeader);
+  if (err != noErr) {
+    printf("Couldn't write file: %d\n", err);
+    goto closeFile;
+  }
+
+  /* pcap timestamps are UTC seconds since 1970. Local time is close enough. */
+  GetDateTime(&dateTime);
+  lastStamp.seconds = dateTime - unixEpochOffset;
+  lastStamp.microseconds = 0;
+  lastClock = now();
+
+  phFrame = captureFrame;
+  tap.handler = (Ptr)phHandler;
+  tap.filter = nil;
+  tap.filterLength = 0;
+  tap.flags = promiscuous ? tapPromiscuous : 0;
+  err = enetControl(ENCAttachTap, (Ptr)&tap);
+  if (err != noErr) {
+    printf("Couldn't attach tap: %d\n", err);
+    goto closeFile;
+  }
+
+  printf("Capturing, %s to stop...\n",
+         seconds ? "wait or click" : "click the mouse");
+  start = TickCount();
+  while (!Button() && (seconds == 0 || TickCount() - start < seconds * 60)) {
+    writing = pumpWrites(&pb, fileRef, writing, &written);
+    if (writing == -2) {
+      break;
+    }
+  }
+  enetControl(ENCDetachTap, nil);
+  elapsed = TickCount() - start;
+
+  /* Write out whatever's left. The tap is gone, so the buffer it was filling
+  is ours now. */
+  if (buffers[filling].state == bufFilling) {
+    buffers[filling].state = bufReady;
+  }
+  while (writing != -2) {
+    writing = pumpWrites(&pb, fileRef, writing, &written);
+    if (writing == -1) {
+      break;
+    }
+  }
+
+  if (elapsed == 0) {
+    elapsed = 1;
+  }
+  printf("%lu frames, %lu bytes in %.1f s (%.1f frames/s, %.1f kB/s)\n",
+         capturedFrames, capturedBytes, elapsed / 60.0,
+         capturedFrames * 60.0 / elapsed,
+         capturedBytes * 60.0 / elapsed / 1024);
+  printf("%lu frames dropped (buffers full)\n", droppedFrames);
+  printf("%lu bytes written to disk (%.1f kB/s)\n", written,
+         written * 60.0 / elapsed / 1024);
+
+closeFile:
+  FSClose(fileRef);
+  FlushVol(nil, 0);
+
+freeBuffers:
+  for (i = 0; i < numBuffers; i++) {
+    if (buffers[i].data != nil) {
+      if (vm) {
+        UnholdMemory(buffers[i].data, bufferSize);
+      }
+      DisposePtr((Ptr)buffers[i].data);
+      buffers[i].data = nil;
+    }
+  }
+}
+
+/* Buffered reader for replay */
+typedef struct fileReader {
+  short fileRef;
+  Byte *data;
+  long start;   /* Offset of first unread byte in data */
+  long end;     /* Offset past last valid byte in data */
+} fileReader;
+
+/* Read len bytes from the file, returning false at end of file */
+static Boolean readBytes(fileReader *reader, void *dest, long len) {
+  long count;
+
+  if (reader->end - reader->start < len) {
+    /* Move what's left to the front and top up the buffer */
+    memmove(reader->data, reader->data + reader->start,
+            reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+    count = bufferSize - reader->end;
+    FSRead(reader->fileRef, &count, reader->data + reader->end);
+    reader->end += count;
+    if (reader->end < len) {
+      return false;
+    }
+  }
+  memcpy(dest, reader->data + reader->start, len);
+  reader->start += len;
+  return true;
+}
+
+/* Skip len bytes of the file, returning false at end of file */
+static Boolean skipBytes(fileReader *reader, long len) {
+  long buffered = reader->end - reader->start;
+
+  if (len <= buffered) {
+    reader->start += len;
+    return true;
+  }
+  reader->start = reader->end = 0;
+  return SetFPos(reader->fileRef, fsFromMark, len - buffered) == noErr;
+}
+
+static unsigned long swap32(unsigned long value) {
+  return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) |
+         (value << 24);
+}
+
+static void replay(void) {
+  Str255 fileName;
+  fileReader reader;
+  pcapFileHeader fileHeader;
+  pcapRecordHeader record;
+  WDSElement wds[2];
+  Byte *frame;
+  Boolean swapped, timed;
+  Boolean first = true;
+  unsigned long firstSeconds = 0, firstMicroseconds = 0;
+  unsigned long due, late, maxLate = 0;
+  unsigned long start, ticks;
+  unsigned long sent = 0, bytes = 0, skipped = 0, errors = 0;
+  OSErr err;
+
+  if (!readFileName("Replay file", fileName)) {
+    return;
+  }
+  timed = readYesNo("Keep original timing", true);
+
+  err = FSOpen(fileName, 0, &reader.fileRef);
+  if (err != noErr) {
+    printf("Couldn't open file: %d\n", err);
+    return;
+  }
+  reader.data = (Byte *)NewPtr(bufferSize);
+  frame = (Byte *)NewPtr(maxFrameSize);
+  if (reader.data == nil || frame == nil) {
+    printf("Out of memory\n");
+    goto done;
+  }
+  reader.start = reader.end = 0;
+
+  if (!readBytes(&reader, &fileHeader, sizeof(fileHeader))) {
+    printf("Not a pcap file\n");
+    goto done;
+  }
+  if (fileHeader.magic == pcapMagic) {
+    swapped = false;
+  } else if (fileHeader.magic == pcapMagicSwapped) {
+    swapped = true;
+    fileHeader.linkType = swap32(fileHeader.linkType);
+  } else {
+    printf("Not a pcap file (or nanosecond timestamps)\n");
+    goto done;
+  }
+  if (fileHeader.linkType != linkTypeEthernet) {
+    printf("Not an Ethernet capture\n");
+    goto done;
+  }
+
+  /* Frames longer than AppleTalk ones can only be sent in general mode */
+  enetControl(ENetSetGeneral, nil);
+
+  printf("Replaying, click the mouse to stop...\n");
+  start = now();
+  while (!Button() && readBytes(&reader, &record, sizeof(record))) {
+    if (swapped) {
+      record.seconds = swap32(record.seconds);
+      record.microseconds = swap32(record.microseconds);
+      record.inclLen = swap32(record.inclLen);
+      record.origLen = swap32(record.origLen);
+    }
+    if (record.inclLen > maxFrameSize || record.inclLen < ethHeaderSize) {
+      /* Can't send this */
+      if (!skipBytes(&reader, record.inclLen)) {
+        break;
+      }
+      skipped++;
+      continue;
+    }
+    if (!readBytes(&reader, frame, record.inclLen)) {
+      break;
+    }
+
+    if (first) {
+      firstSeconds = record.seconds;
+      firstMicroseconds = record.microseconds;
+      start = now();
+      first = false;
+    }
+    if (timed) {
+      /* Wait until the frame is due, relative to the first one */
+      due = (record.seconds - firstSeconds) * 1000000 +
+            record.microseconds - firstMicroseconds;
+      while (now() - start < due) {
+        if (Button()) {
+          break;
+        }
+      }
+      late = now() - start - due;
+      if (late > maxLate) {
+        maxLate = late;
+      }
+    }
+
+    wds[0].entryLength = record.inclLen;
+    wds[0].entryPtr = (Ptr)frame;
+    wds[1].entryLength = 0;
+    err = enetControl(ENetWrite, (Ptr)wds);
+    if (err != noErr) {
+      errors++;
+      continue;
+    }
+    sent++;
+    bytes += record.inclLen;
+  }
+
+  ticks = (now() - start) / 16667;
+  if (ticks == 0) {
+    ticks = 1;
+  }
+  printf("%lu frames, %lu bytes sent in %.1f s (%.1f frames/s, %.1f kB/s)\n",
+         sent, bytes, ticks / 60.0, sent * 60.0 / ticks,
+         bytes * 60.0 / ticks / 1024);
+  printf("%lu frames skipped, %lu write errors\n", skipped, errors);
+  if (timed) {
+    printf("Latest frame was sent %lu us after it was due\n", maxLate);
+  }
+
+done:
+  FSClose(reader.fileRef);
+  if (reader.data != nil) {
+    DisposePtr((Ptr)reader.data);
+  }
+  if (frame != nil) {
+    DisposePtr((Ptr)frame);
+  }
+}
+
+static void help(void) {
+  printf("\n[C]apture, [R]eplay, [Q]uit?\n");
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  int choice;
+  OSErr err;
+
+  printf("**** SEthernet packet capture ****\n\n");
+
+  err = OpenDriver("\p.ENET", &enetRefNum);
+  if (err != noErr) {
+    printf("Couldn't open .ENET: %d\n", err);
+    return 1;
+  }
+  haveMicroseconds = trapAvailable(_Microseconds, OSTrap);
+
+  help();
+  while (1) {
+    choice = toupper(getchar());
+    if (choice == '\r' || choice == '\n') {
+      continue;
+    }
+    if (choice == 'Q') {
+      return 0;
+    }
+    /* Eat the rest of the line */
+    while (getchar() != '\n') {}
+
+    if (choice == 'C') {
+      capture();
+    } else if (choice == 'R') {
+      replay();
+    }
+    help();
+  }
+}
@@ -0,0 +1,36 @@
+/*
+Protocol handler glue for tools that receive frames from the driver (see
+phHandler.h)
+*/
+
+#include "phHandler.h"
+
+phFrameProc phFrame;
+
+/*
+Called by the driver exactly like a protocol handler, with:
+  A0-A1: the driver's (ReadRest needs them, so they're preserved here)
+  A3: pointer just past the frame's ethernet header, in the driver's RHA
+  A4: ReadPacket routine (ReadRest is at 2(A4))
+  D1: number of bytes following the header
+phFrame is C, so it can change A0-A1 and D0-D2; everything ReadRest relies on
+is saved around the call. phFrame's readLength goes in a word on the stack.
+*/
+asm(
+  "   .global   phHandler             \n"
+  "phHandler:                         \n"
+  "   MOVEM.L   %d1/%a0-%a1/%a3-%a4, -(%sp) \n"
+  "   SUBQ.L    #2, %sp               \n" /* readLength */
+  "   PEA       (%sp)                 \n" /* &readLength */
+  "   MOVEQ     #0, %d0               \n"
+  "   MOVE.W    %d1, %d0              \n"
+  "   MOVE.L    %d0, -(%sp)           \n" /* length */
+  "   PEA       -14(%a3)              \n" /* header */
+  "   MOVE.L    phFrame(%pc), %a0     \n"
+  "   JSR       (%a0)                 \n"
+  "   LEA       12(%sp), %sp          \n"
+  "   MOVE.W    (%sp)+, %d3           \n" /* D3 = bytes to read */
+  "   MOVEM.L   (%sp)+, %d1/%a0-%a1/%a3-%a4 \n"
+  "   MOVE.L    %d0, %a3              \n" /* A3 = where to read them to */
+  "   JMP       2(%a4)                \n" /* ReadRest, returns to the driver */
+);
@@ -0,0 +1,25 @@
+/*
+Protocol handler glue for tools that receive frames from the driver
+
+The driver calls a protocol handler (or a tap, see ENCSetTap) in assembly, with
+the frame's header already read and ReadPacket/ReadRest to read the rest (see
+Inside Macintosh: Networking). phHandler adapts that to a C routine: it passes
+the header to phFrame, then reads as much of the rest of the frame as phFrame
+asked for, and returns to the driver through ReadRest.
+*/
+
+#pragma once
+
+#include <MacTypes.h>
+
+/* Called at interrupt time with the frame's ethernet header and the number of
+bytes following it. Returns where to read the rest of the frame to, with
+*readLength set to how many bytes of it to read (0 to discard it). */
+typedef Byte *(*phFrameProc)(const Byte *header, unsigned long length,
+                             unsigned short *readLength);
+
+/* Routine for phHandler to call. Set it before attaching phHandler. */
+extern phFrameProc phFrame;
+
+/* Protocol handler to pass to ENetAttachPH or ENCSetTap */
+extern void phHandler(void);
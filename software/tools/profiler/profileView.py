@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+
+# Turn a sample dump from the profiler (see profiler.c for the format) into a
+# flat profile and a breakdown of where the samples landed by interrupt level.
+
+import argparse
+import bisect
+import collections
+import struct
+import sys
+
+DUMP_MAGIC = 0x53457066
+DUMP_VERSION = 1
+
+HEADER_FORMAT = '>LHH9L'
+REGION_FORMAT = '>LLB31s'
+SYMBOL_FORMAT = '>LL64s'
+SAMPLE_FORMAT = '>LH'
+
+REGION_KINDS = ['ROM', 'heap', 'driver', 'resource', 'profiler']
+
+CPUS = {0: '68000', 1: '68010', 2: '68020', 3: '68030', 4: '68040'}
+
+# What usually runs at each interrupt level on the SE and SE/30. The sampling
+# interrupt is level 4, so nothing at level 4 or above is ever sampled.
+LEVELS = [
+    'task',
+    'level 1 (VIA1; SE card)',
+    'level 2 (VIA2 and slots; SE/30 card)',
+    'level 3',
+]
+
+Header = collections.namedtuple('Header', [
+    'magic', 'version', 'cpu', 'requested_rate', 'measured_rate',
+    'elapsed_ticks', 'sample_count', 'dropped_samples', 'idle_spins',
+    'sampled_spins', 'region_count', 'symbol_count'])
+Region = collections.namedtuple('Region', ['start', 'length', 'kind', 'name'])
+Symbol = collections.namedtuple('Symbol', ['low', 'end', 'name'])
+
+def cstr(b):
+    return b.split(b'\0', 1)[0].decode('mac_roman')
+
+def read_dump(f):
+    def read(fmt):
+        size = struct.calcsize(fmt)
+        data = f.read(size)
+        if len(data) != size:
+            raise ValueError('dump is truncated')
+        return struct.unpack(fmt, data)
+
+    header = Header(*read(HEADER_FORMAT))
+    if header.magic != DUMP_MAGIC:
+        raise ValueError('not a profiler dump')
+    if header.version != DUMP_VERSION:
+        raise ValueError('unsupported dump version %d' % header.version)
+
+    regions = []
+    for _ in range(header.region_count):
+        start, length, kind, name = read(REGION_FORMAT)
+        regions.append(Region(start, length, kind, cstr(name)))
+    symbols = []
+    for _ in range(header.symbol_count):
+        low, end, name = read(SYMBOL_FORMAT)
+        symbols.append(Symbol(low, end, cstr(name)))
+    samples = [read(SAMPLE_FORMAT) for _ in range(header.sample_count)]
+    return header, regions, symbols, samples
+
+def read_map(f):
+    # Lines of "address name", for code without MacsBug symbols (e.g. ROM
+    # routines). Addresses are hex, and relative to the start of the region
+    # named by --map-region.
+    entries = []
+    for line in f:
+        fields = line.split(None, 1)
+        if len(fields) != 2 or fields[0].startswith('#'):
+            continue
+        entries.append((int(fields[0], 16), fields[1].strip()))
+    entries.sort()
+    return [e[0] for e in entries], [e[1] for e in entries]
+
+class Symbolicator:
+    def __init__(self, regions, symbols, maps):
+        self.regions = regions
+        self.symbols = sorted(symbols)
+        self.lows = [s.low for s in self.symbols]
+        self.maps = maps
+        self.cache = {}
+
+    def region(self, pc):
+        # The smallest region containing pc: resources and drivers are inside
+        # heaps. Regions of unknown length extend to the next region.
+        best = None
+        for r in self.regions:
+            if pc < r.start:
+                continue
+            if r.length:
+                if pc >= r.start + r.length:
+                    continue
+            elif any(r.start < o.start <= pc for o in self.regions):
+                continue
+            if best is None or (r.length and
+                                (not best.length or r.length < best.length)):
+                best = r
+        return best
+
+    def symbol(self, pc):
+        i = bisect.bisect_right(self.lows, pc) - 1
+        if i >= 0 and pc <= self.symbols[i].end:
+            return self.symbols[i]
+        return None
+
+    def name(self, pc):
+        if pc not in self.cache:
+            self.cache[pc] = self.lookup(pc)
+        return self.cache[pc]
+
+    def lookup(self, pc):
+        region = self.region(pc)
+        sym = self.symbol(pc)
+        if sym is not None and sym.name:
+            return sym.name, region
+        if region is not None and region.name in self.maps:
+            offsets, names = self.maps[region.name]
+            i = bisect.bisect_right(offsets, pc - region.start) - 1
+            if i >= 0:
+                return names[i], region
+        where = region.name if region is not None else 'unknown'
+        base = region.start if region is not None else 0
+        if sym is not None:
+            # Unnamed routine, identify it by where it ends
+            return '%s routine ending +0x%x' % (where, sym.end - base), region
+        return '%s +0x%x' % (where, (pc - base) & ~0xff), region
+
+def percent(n, total):
+    return 100.0 * n / total if total else 0.0
+
+def main():
+    parser = argparse.ArgumentParser(description='Show a profile from a '
+                                     'SEthernet profiler sample dump')
+    parser.add_argument('dump', type=argparse.FileType('rb'))
+    parser.add_argument('-n', '--top', type=int, default=30,
+                        help='number of routines to show (default 30)')
+    parser.add_argument('-m', '--map', type=argparse.FileType('r'),
+                        action='append', default=[],
+                        help='symbol map ("hexoffset name" lines) for code '
+                        'without MacsBug symbols')
+    parser.add_argument('--map-region', action='append', default=[],
+                        help='region each --map applies to (default ROM)')
+    parser.add_argument('--regions', action='store_true',
+                        help='list the region table')
+    args = parser.parse_args()
+
+    try:
+        header, regions, symbols, samples = read_dump(args.dump)
+    except ValueError as e:
+        sys.exit('%s: %s' % (args.dump.name, e))
+
+    maps = {}
+    for i, f in enumerate(args.map):
+        region = args.map_region[i] if i < len(args.map_region) else 'ROM'
+        maps[region] = read_map(f)
+
+    seconds = header.elapsed_ticks / 60.0
+    total = len(samples)
+    print('%d samples over %.2f s on a %s, %d per second (asked for %d)' %
+          (total, seconds, CPUS.get(header.cpu, '680x0'),
+           header.measured_rate, header.requested_rate))
+    if header.dropped_samples:
+        print('%d samples dropped (buffer full)' % header.dropped_samples)
+    if header.idle_spins:
+        overhead = max(0, header.idle_spins - header.sampled_spins)
+        print('Sampling overhead: %.1f%% of the CPU' %
+              percent(overhead, header.idle_spins))
+    if args.regions:
+        print('\nRegions:')
+        for r in sorted(regions):
+            kind = REGION_KINDS[r.kind] if r.kind < len(REGION_KINDS) else '?'
+            print('  %08x %8s %-9s %s' % (r.start, r.length and '%x' % r.length
+                                          or '?', kind, r.name))
+    if not total:
+        return
+
+    sym = Symbolicator(regions, symbols, maps)
+    levels = collections.Counter()
+    routines = collections.Counter()
+    routine_interrupt = collections.Counter()
+    by_region = collections.Counter()
+    for pc, sr in samples:
+        level = (sr >> 8) & 7
+        name, region = sym.name(pc)
+        levels[level] += 1
+        routines[name] += 1
+        if level:
+            routine_interrupt[name] += 1
+        by_region[region.name if region is not None else 'unknown'] += 1
+
+    interrupt = total - levels[0]
+    print('\nInterrupt level (IPL of the interrupted code; code that masks '
+          'interrupts counts as the level it masked to):')
+    for level in range(len(LEVELS)):
+        print('  %-40s %7d %6.1f%%' % (LEVELS[level], levels[level],
+                                       percent(levels[level], total)))
+    print('  %-40s %7d %6.1f%%' % ('all interrupt levels', interrupt,
+                                   percent(interrupt, total)))
+
+    print('\nBy region:')
+    for name, count in by_region.most_common():
+        print('  %-40s %7d %6.1f%%' % (name, count, percent(count, total)))
+
+    print('\nFlat profile:')
+    print('  %7s %6s %6s  %s' % ('samples', '%', 'intr%', 'routine'))
+    for name, count in routines.most_common(args.top):
+        print('  %7d %6.1f %6.1f  %s' % (count, percent(count, total),
+                                         percent(routine_interrupt[name],
+                                                 count), name))
+
+if __name__ == '__main__':
+    main()
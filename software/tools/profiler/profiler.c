@@ -0,0 +1,868 @@
+/*
+Statistical PC-sampling profiler
+
+Interrupts the machine at a regular rate, records the program counter and status
+register of whatever it interrupted, and writes the samples to a file for
+profileView.py to turn into a flat profile and an interrupt-versus-task
+breakdown.
+
+The sampling interrupt comes from the SCC rather than a VIA timer. The VIAs
+interrupt at level 1 (and the SE/30's VIA2 at level 2), no higher than the card
+does, so a VIA interrupt can never land inside the driver's interrupt handler.
+Instead, the baud rate generator of SCC channel A (the modem port, which must
+not be in use) is set to interrupt every time it counts down to zero. That's a
+level 4 interrupt; our handler records the sample and passes the interrupt on to
+the ROM's handler, which acknowledges it. Code that runs with interrupts masked
+to level 4 or above can't be sampled.
+
+Samples are symbolicated here, where the code is. Each sampled PC is looked up
+by scanning forward to the end of its routine for a MacsBug symbol (see
+macsbug.inc in the driver). The dump also records where the ROM, the heaps, the
+drivers in the unit table and loaded code resources are, so that samples in code
+without symbols can still be attributed to something.
+*/
+
+#include <Devices.h>
+#include <Events.h>
+#include <Files.h>
+#include <Gestalt.h>
+#include <LowMem.h>
+#include <MacTypes.h>
+#include <Memory.h>
+#include <OSUtils.h>
+#include <Resources.h>
+#include <Traps.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Offset of channel A's control register from SCCRd/SCCWr */
+#define sccACtl 2
+
+/* SCC write registers and the bits we use in them */
+#define sccWR0 0
+#define sccWR12 12
+#define sccWR13 13
+#define sccWR14 14
+#define sccWR15 15
+#define sccResetExtStatus 0x10 /* WR0: reset external/status interrupts */
+#define sccBRGEnable 0x01      /* WR14: baud rate generator enable */
+#define sccBRGFromPCLK 0x02    /* WR14: baud rate generator clocked by PCLK */
+#define sccZeroCountIE 0x02    /* WR15: zero count interrupt enable */
+#define sccDCDIE 0x08          /* WR15: DCD interrupt enable (the mouse) */
+
+/* SCC PCLK on the SE and SE/30 */
+#define sccPCLK 3672000UL
+
+/* Level 4 interrupt autovector, relative to the VBR */
+#define level4Vector 0x70
+
+/* Range of sample rates (per second). The baud rate generator's time constant
+is 16 bits, so it can't count out anything slower than sccPCLK / 65537 (about
+56 Hz). */
+#define minRate 57
+#define maxRate 5000
+
+/* Smallest sample buffer worth running with */
+#define minSamples 1000
+
+/* Sizes of the region and symbol tables */
+#define maxRegions 256
+#define maxSymbols 1024
+
+/* Farthest to scan forward from a PC for the end of its routine */
+#define maxScan 8192
+
+/* Length of each half of the overhead measurement */
+#define calibrationTicks 120
+
+/* Highest address that might be ROM, relative to ROMBase */
+#define romSpan 0x100000
+
+/* A sample, as recorded by profileHandler */
+typedef struct sample {
+  unsigned long pc;
+  unsigned short sr;
+} sample;
+
+/* Sample dump file. All big-endian: a dumpHeader, then regionCount
+dumpRegions, symbolCount dumpSymbols and sampleCount samples. */
+#define dumpMagic 0x53457066 /* 'SEpf' */
+#define dumpVersion 1
+
+typedef struct dumpHeader {
+  unsigned long magic;          /* dumpMagic */
+  unsigned short version;       /* dumpVersion */
+  unsigned short cpu;           /* CPUFlag: 0 for a 68000, 3 for a 68030 */
+  unsigned long requestedRate;  /* Samples per second asked for */
+  unsigned long measuredRate;   /* Samples per second actually taken */
+  unsigned long elapsedTicks;   /* Length of the run */
+  unsigned long sampleCount;    /* Samples in the file */
+  unsigned long droppedSamples; /* Samples that didn't fit in the buffer */
+  unsigned long idleSpins;      /* Idle loop iterations per second ... */
+  unsigned long sampledSpins;   /* ... and the same while sampling */
+  unsigned long regionCount;
+  unsigned long symbolCount;
+} dumpHeader;
+
+/* Kinds of region */
+enum {
+  regionROM = 0,
+  regionHeap,
+  regionDriver,
+  regionResource,
+  regionProfiler
+};
+
+/* An area of memory that code might be in */
+typedef struct dumpRegion {
+  unsigned long start;
+  unsigned long length;         /* 0 if unknown */
+  unsigned char kind;           /* regionXXX */
+  char name[31];                /* Null-terminated */
+} dumpRegion;
+
+/* A routine that samples landed in */
+typedef struct dumpSymbol {
+  unsigned long low;            /* Lowest sampled PC in the routine */
+  unsigned long end;            /* Address of its return instruction */
+  char name[64];                /* MacsBug symbol, empty if none */
+} dumpSymbol;
+
+/* Code resource types worth putting in the region table */
+static const ResType codeTypes[] = {
+  'CODE', 'DRVR', 'INIT', 'PACK', 'PTCH', 'ptch',
+  'lmgr', 'atlk', 'adev', 'cdev', 'enet', 'dcmd'
+};
+
+static dumpRegion regions[maxRegions];
+static unsigned long regionCount;
+
+/*
+Level 4 interrupt handler. Stores the PC and SR from the exception frame at
+sampleNext (or counts a dropped sample if the buffer is full), then jumps to the
+original handler with the stack as it found it. Its variables live in the code
+alongside it so that a single HoldMemory call keeps everything it touches
+resident under Virtual Memory.
+*/
+extern void profileHandler(void);
+extern char profileHandlerEnd[];
+extern sample *volatile sampleNext;
+extern sample *sampleLimit;
+extern volatile unsigned long samplesDropped;
+extern void *originalHandler;
+asm(
+  "profileHandler:                    \n"
+  "   MOVE.L    %a0, -(%sp)           \n"
+  "   MOVE.L    sampleNext, %a0       \n"
+  "   CMPA.L    sampleLimit, %a0      \n"
+  "   BHS.S     1f                    \n"
+  "   MOVE.L    6(%sp), (%a0)+        \n" /* PC */
+  "   MOVE.W    4(%sp), (%a0)+        \n" /* SR */
+  "   MOVE.L    %a0, sampleNext       \n"
+  "   BRA.S     2f                    \n"
+  "1: ADDQ.L    #1, samplesDropped    \n"
+  "2: MOVE.L    (%sp)+, %a0           \n"
+  "   MOVE.L    originalHandler, -(%sp) \n"
+  "   RTS                             \n"
+  "   .align 2                        \n"
+  "sampleNext:      .long 0           \n"
+  "sampleLimit:     .long 0           \n"
+  "samplesDropped:  .long 0           \n"
+  "originalHandler: .long 0           \n"
+  "profileHandlerEnd:                 \n"
+);
+
+/*
+Idle loop. Counts iterations until Ticks reaches endTick. Written in assembly
+so that samples landing in it can be identified (it's in the region table) and
+so that it doesn't spend its time in TickCount.
+*/
+extern unsigned long spinLoop(unsigned long endTick);
+extern char spinLoopEnd[];
+asm(
+  "spinLoop:                          \n"
+  "   MOVE.L    4(%sp), %d1           \n"
+  "   MOVEQ     #0, %d0               \n"
+  "1: ADDQ.L    #1, %d0               \n"
+  "   CMP.L     0x16a, %d1            \n" /* Ticks */
+  "   BHI.S     1b                    \n"
+  "   RTS                             \n"
+  "spinLoopEnd:                       \n"
+);
+
+/* Read the vector base register (68010 and later) */
+extern void *getVBR(void);
+asm(
+  "getVBR:                            \n"
+  "   .word     0x4e7a, 0x0801        \n" /* MOVEC VBR, D0 */
+  "   RTS                             \n"
+);
+
+static inline unsigned short maskInterrupts(void) {
+  unsigned short srSave;
+  asm volatile("MOVE.W  %%sr, %[srSave] \n\t"
+               "ORI.W   #0x700, %%sr    \n\t"
+               : [srSave] "=dm"(srSave)
+               :
+               : "memory");
+  return srSave;
+}
+
+static inline void restoreInterrupts(unsigned short srSave) {
+  asm volatile("MOVE.W  %[srSave], %%sr \n\t"
+               :
+               : [srSave] "dm"(srSave)
+               : "memory");
+}
+
+static Boolean trapAvailable(unsigned short trap, TrapType type) {
+  return NGetTrapAddress(trap, type) != GetToolboxTrapAddress(_Unimplemented);
+}
+
+/* The SCC needs a couple of microseconds to recover between accesses */
+static void sccDelay(void) {
+  volatile short i;
+  for (i = 0; i < 4; i++) {
+  }
+}
+
+/* Write to one of SCC channel A's write registers */
+static void sccWrite(unsigned char reg, unsigned char value) {
+  volatile Byte *ctl = (volatile Byte *)LMGetSCCWr() + sccACtl;
+
+  if (reg != sccWR0) {
+    *ctl = reg;
+    sccDelay();
+  }
+  *ctl = value;
+  sccDelay();
+}
+
+/* Address of the level 4 interrupt vector */
+static void **vectorAddress(void) {
+  if (LMGetCPUFlag() == 0) {
+    return (void **)level4Vector;
+  }
+  return (void **)((char *)getVBR() + level4Vector);
+}
+
+/* Start sampling rate times a second into count samples at buffer */
+static void startSampling(sample *buffer, unsigned long count,
+                          unsigned long rate) {
+  /* The counter reloads with the time constant and counts down to zero once
+  every (time constant + 2) PCLK cycles. rate is between minRate and maxRate,
+  so this fits in 16 bits. */
+  unsigned long timeConstant = sccPCLK / rate - 2;
+  unsigned short srSave;
+
+  srSave = maskInterrupts();
+  sampleNext = buffer;
+  sampleLimit = buffer + count;
+  samplesDropped = 0;
+  originalHandler = *vectorAddress();
+  *vectorAddress() = (void *)profileHandler;
+
+  /* Reading the control register resets the register pointer to WR0, in case
+  whatever we interrupted had just written to it */
+  (void)*((volatile Byte *)LMGetSCCRd() + sccACtl);
+  sccWrite(sccWR14, 0);
+  sccWrite(sccWR12, timeConstant & 0xff);
+  sccWrite(sccWR13, timeConstant >> 8);
+  sccWrite(sccWR14, sccBRGFromPCLK | sccBRGEnable);
+  sccWrite(sccWR15, sccDCDIE | sccZeroCountIE);
+  restoreInterrupts(srSave);
+}
+
+/* Stop sampling, and put the SCC and the vector back as the ROM had them */
+static void stopSampling(void) {
+  unsigned short srSave;
+
+  srSave = maskInterrupts();
+  (void)*((volatile Byte *)LMGetSCCRd() + sccACtl);
+  sccWrite(sccWR15, sccDCDIE);
+  sccWrite(sccWR14, 0);
+  sccWrite(sccWR0, sccResetExtStatus);
+  *vectorAddress() = originalHandler;
+  restoreInterrupts(srSave);
+}
+
+/* Address of a driver's code */
+static Ptr driverCode(DCtlHandle dce) {
+  if ((*dce)->dCtlFlags & dRAMBasedMask) {
+    return *(Handle)(*dce)->dCtlDriver;
+  }
+  return (*dce)->dCtlDriver;
+}
+
+/* Find an open driver by name, returning its DCE or nil */
+static DCtlHandle findOpenDriver(const unsigned char *name) {
+  short unitNum;
+  DCtlHandle dce;
+  Ptr driver;
+
+  for (unitNum = 0; unitNum < LMGetUnitTableEntryCount(); unitNum++) {
+    dce = GetDCtlEntry(~unitNum);
+    if (dce == nil || !((*dce)->dCtlFlags & dOpenedMask)) {
+      continue;
+    }
+    /* Driver name is 18 bytes from the start of the driver */
+    driver = driverCode(dce);
+    if (driver != nil &&
+        memcmp(driver + 18, name, name[0] + 1) == 0) {
+      return dce;
+    }
+  }
+  return nil;
+}
+
+static void addRegion(const void *start, unsigned long length,
+                      unsigned char kind, const char *name) {
+  dumpRegion *region;
+
+  if (regionCount == maxRegions) {
+    return;
+  }
+  region = &regions[regionCount++];
+  region->start = (unsigned long)StripAddress((Ptr)start);
+  region->length = length;
+  region->kind = kind;
+  strncpy(region->name, name, sizeof(region->name) - 1);
+  region->name[sizeof(region->name) - 1] = '\0';
+}
+
+/* Copy a Pascal string into a C string of at most size bytes */
+static void pToCStr(const unsigned char *pstr, char *cstr, size_t size) {
+  size_t len = pstr[0] < size - 1 ? pstr[0] : size - 1;
+
+  memcpy(cstr, pstr + 1, len);
+  cstr[len] = '\0';
+}
+
+/* Add every driver in the unit table */
+static void addDriverRegions(void) {
+  Ptr memTop = StripAddress(LMGetMemTop());
+  short unitNum;
+  DCtlHandle dce;
+  Ptr driver;
+  unsigned long length;
+  char name[32];
+
+  for (unitNum = 0; unitNum < LMGetUnitTableEntryCount(); unitNum++) {
+    dce = GetDCtlEntry(~unitNum);
+    if (dce == nil || (*dce)->dCtlDriver == nil) {
+      continue;
+    }
+    if ((*dce)->dCtlFlags & dRAMBasedMask) {
+      /* Purged driver resources don't need a region */
+      if (*(Handle)(*dce)->dCtlDriver == nil) {
+        continue;
+      }
+      length = GetHandleSize((Handle)(*dce)->dCtlDriver);
+    } else if (StripAddress((*dce)->dCtlDriver) < memTop) {
+      /* Only believe the block size if it looks sensible: the driver might
+      not be at the start of a block */
+      length = GetPtrSize((*dce)->dCtlDriver);
+      if (length > romSpan) {
+        length = 0;
+      }
+    } else {
+      /* In ROM */
+      length = 0;
+    }
+    driver = driverCode(dce);
+    pToCStr((unsigned char *)driver + 18, name, sizeof(name));
+    addRegion(driver, length, regionDriver, name);
+  }
+}
+
+/*
+Add the loaded code resources in every open resource file, by walking the
+resource maps (see Inside Macintosh: More Macintosh Toolbox, "Resource File
+Format"). None of this allocates memory, so the maps can't move underneath us.
+*/
+static void addResourceRegions(void) {
+  Handle map = LMGetTopMapHndl();
+  Byte *mapData, *typeList, *nameList, *typeEntry, *ref;
+  short numTypes, numRefs, t, r, id, nameOffset;
+  ResType type;
+  Handle resource;
+  char name[32];
+  char resName[32];
+  unsigned short i;
+
+  while (map != nil && *map != nil) {
+    mapData = (Byte *)StripAddress(*map);
+    typeList = mapData + *(unsigned short *)(mapData + 24);
+    nameList = mapData + *(unsigned short *)(mapData + 26);
+    numTypes = *(short *)typeList + 1;
+
+    for (t = 0; t < numTypes; t++) {
+      typeEntry = typeList + 2 + t * 8;
+      type = *(ResType *)typeEntry;
+      for (i = 0; i < sizeof(codeTypes) / sizeof(codeTypes[0]); i++) {
+        if (codeTypes[i] == type) {
+          break;
+        }
+      }
+      if (i == sizeof(codeTypes) / sizeof(codeTypes[0])) {
+        continue;
+      }
+
+      numRefs = *(short *)(typeEntry + 4) + 1;
+      for (r = 0; r < numRefs; r++) {
+        ref = typeList + *(unsigned short *)(typeEntry + 6) + r * 12;
+        resource = *(Handle *)(ref + 8);
+        if (resource == nil || *resource == nil) {
+          /* Not loaded */
+          continue;
+        }
+        id = *(short *)ref;
+        nameOffset = *(short *)(ref + 2);
+        resName[0] = '\0';
+        if (nameOffset != -1) {
+          pToCStr(nameList + nameOffset, resName, sizeof(resName));
+        }
+        snprintf(name, sizeof(name), "%c%c%c%c %d %s",
+                 (char)(type >> 24), (char)(type >> 16), (char)(type >> 8),
+                 (char)type, id, resName);
+        addRegion(*resource, GetHandleSize(resource), regionResource, name);
+      }
+    }
+    map = *(Handle *)(mapData + 16);
+  }
+}
+
+static void collectRegions(void) {
+  THz zone;
+
+  regionCount = 0;
+  addRegion(LMGetROMBase(), 0, regionROM, "ROM");
+  zone = LMGetSysZone();
+  addRegion(zone, StripAddress(zone->bkLim) - StripAddress(zone), regionHeap,
+            "System heap");
+  zone = LMGetApplZone();
+  addRegion(zone, StripAddress(zone->bkLim) - StripAddress(zone), regionHeap,
+            "Application heap");
+  addDriverRegions();
+  addResourceRegions();
+  addRegion(spinLoop, spinLoopEnd - (char *)spinLoop, regionProfiler,
+            "Profiler idle loop");
+  addRegion(profileHandler, profileHandlerEnd - (char *)profileHandler,
+            regionProfiler, "Profiler interrupt handler");
+}
+
+/* Characters that can appear in a MacsBug symbol */
+static Boolean symbolChar(unsigned char c) {
+  return isalnum(c) || c == '_' || c == '%' || c == '.';
+}
+
+/*
+Copy a MacsBug symbol at sym into name, if there is one (see the MacsBug
+Reference and Debugging Guide, Appendix D). Handles the variable-length forms
+that macsbug.inc and compilers emit, and the older fixed 8- and 16-character
+forms.
+*/
+static void readSymbol(const Byte *sym, char *name, size_t size) {
+  unsigned short length, i;
+  Boolean fixed = false;
+
+  name[0] = '\0';
+  if (sym[0] == 0x80) {
+    length = sym[1];
+    sym += 2;
+  } else if (sym[0] > 0x80 && sym[0] < 0xa0) {
+    length = sym[0] & 0x7f;
+    sym += 1;
+  } else if ((sym[0] & 0x80) && symbolChar(sym[0] & 0x7f)) {
+    length = (sym[1] & 0x80) ? 16 : 8;
+    fixed = true;
+  } else {
+    return;
+  }
+
+  if (length >= size) {
+    length = size - 1;
+  }
+  for (i = 0; i < length; i++) {
+    unsigned char c = sym[i];
+    if (fixed && i < 2) {
+      c &= 0x7f;
+    }
+    if (fixed && c == ' ') {
+      break;
+    }
+    if (!symbolChar(c)) {
+      name[0] = '\0';
+      return;
+    }
+    name[i] = c;
+  }
+  name[i] = '\0';
+}
+
+/*
+Find the end of the routine containing pc by scanning forward for a return
+instruction, the way MacsBug does, and read the symbol after it. Returns the
+address of the return instruction, or 0 if there isn't one before limit.
+*/
+static unsigned long findRoutineEnd(unsigned long pc, unsigned long limit,
+                                    char *name, size_t size) {
+  const unsigned short *p = (const unsigned short *)(pc & ~1UL);
+
+  if (pc + maxScan < limit) {
+    limit = pc + maxScan;
+  }
+  for (; (unsigned long)(p + 2) < limit; p++) {
+    switch (*p) {
+      case 0x4e75: /* RTS */
+      case 0x4e73: /* RTE */
+      case 0x4ed0: /* JMP (A0) */
+        readSymbol((const Byte *)(p + 1), name, size);
+        return (unsigned long)p;
+      case 0x4e74: /* RTD #n */
+        readSymbol((const Byte *)(p + 2), name, size);
+        return (unsigned long)p;
+    }
+  }
+  return 0;
+}
+
+static int comparePCs(const void *a, const void *b) {
+  unsigned long pcA = *(const unsigned long *)a;
+  unsigned long pcB = *(const unsigned long *)b;
+  return pcA < pcB ? -1 : pcA > pcB;
+}
+
+/*
+Find the routine each sample landed in. Visiting the PCs in order means each
+routine is only scanned for once: every PC up to the end of the last routine
+found is in that routine too. Returns the number of symbols.
+*/
+static unsigned long symbolicate(const sample *samples, unsigned long count,
+                                 dumpSymbol *symbols) {
+  unsigned long *pcs;
+  unsigned long i, pc, limit, end;
+  unsigned long symbolCount = 0;
+  unsigned long memTop = (unsigned long)StripAddress(LMGetMemTop());
+  unsigned long romBase = (unsigned long)StripAddress(LMGetROMBase());
+  dumpSymbol *current = nil;
+  char name[sizeof(symbols->name)];
+
+  pcs = (unsigned long *)NewPtr(count * sizeof(unsigned long));
+  if (pcs == nil) {
+    printf("Not enough memory to symbolicate\n");
+    return 0;
+  }
+  for (i = 0; i < count; i++) {
+    pcs[i] = samples[i].pc;
+  }
+  qsort(pcs, count, sizeof(unsigned long), comparePCs);
+
+  for (i = 0; i < count; i++) {
+    pc = pcs[i];
+    if (current != nil && pc <= current->end) {
+      continue;
+    }
+    /* Don't go scanning anywhere that might not be memory */
+    if (pc < memTop) {
+      limit = memTop;
+    } else if (pc >= romBase && pc < romBase + romSpan) {
+      limit = romBase + romSpan;
+    } else {
+      continue;
+    }
+    end = findRoutineEnd(pc, limit, name, sizeof(name));
+    if (end == 0) {
+      continue;
+    }
+    if (symbolCount == maxSymbols) {
+      printf("Symbol table full, some samples won't be symbolicated\n");
+      break;
+    }
+    current = &symbols[symbolCount++];
+    current->low = pc;
+    current->end = end;
+    memset(current->name, 0, sizeof(current->name));
+    strcpy(current->name, name);
+  }
+
+  DisposePtr((Ptr)pcs);
+  return symbolCount;
+}
+
+static OSErr writeBytes(short fileRef, const void *data, long length) {
+  return FSWrite(fileRef, &length, data);
+}
+
+static OSErr writeDump(const Str255 fileName, dumpHeader *header,
+                       const dumpSymbol *symbols, const sample *samples) {
+  short fileRef;
+  OSErr err;
+
+  err = Create(fileName, 0, 'SEpf', 'prof');
+  if (err != noErr && err != dupFNErr) {
+    return err;
+  }
+  err = FSOpen(fileName, 0, &fileRef);
+  if (err != noErr) {
+    return err;
+  }
+  SetEOF(fileRef, 0);
+
+  err = writeBytes(fileRef, header, sizeof(*header));
+  if (err == noErr) {
+    err = writeBytes(fileRef, regions, regionCount * sizeof(dumpRegion));
+  }
+  if (err == noErr) {
+    err = writeBytes(fileRef, symbols,
+                     header->symbolCount * sizeof(dumpSymbol));
+  }
+  if (err == noErr) {
+    err = writeBytes(fileRef, samples, header->sampleCount * sizeof(sample));
+  }
+  FSClose(fileRef);
+  FlushVol(nil, 0);
+  return err;
+}
+
+static unsigned long readNumber(const char *prompt, unsigned long dflt) {
+  char line[64];
+  unsigned long value;
+
+  printf("%s [%lu]: ", prompt, dflt);
+  fflush(stdout);
+  if (fgets(line, sizeof(line), stdin) == NULL ||
+      sscanf(line, "%lu", &value) != 1) {
+    return dflt;
+  }
+  return value;
+}
+
+static Boolean readYesNo(const char *prompt, Boolean dflt) {
+  char line[64];
+
+  printf("%s [%c]: ", prompt, dflt ? 'Y' : 'N');
+  fflush(stdout);
+  if (fgets(line, sizeof(line), stdin) == NULL ||
+      (toupper(line[0]) != 'Y' && toupper(line[0]) != 'N')) {
+    return dflt;
+  }
+  return toupper(line[0]) == 'Y';
+}
+
+/* Read a file name into a Pascal string */
+static Boolean readFileName(const char *prompt, Str255 name) {
+  char line[64];
+  size_t len;
+
+  printf("%s: ", prompt);
+  fflush(stdout);
+  if (fgets(line, sizeof(line), stdin) == NULL) {
+    return false;
+  }
+  len = strlen(line);
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+    len--;
+  }
+  if (len == 0 || len > 31) {
+    return false;
+  }
+  name[0] = len;
+  memcpy(&name[1], line, len);
+  return true;
+}
+
+/* Print how samples split between task time and each interrupt level */
+static void printBreakdown(const sample *samples, unsigned long count) {
+  unsigned long levels[8] = {0};
+  unsigned long i;
+  short level;
+
+  for (i = 0; i < count; i++) {
+    levels[(samples[i].sr >> 8) & 7]++;
+  }
+  for (level = 0; level < 4; level++) {
+    printf("  %s %d: %6lu (%lu%%)\n",
+           level == 0 ? "Task, IPL" : "Interrupt, IPL", level, levels[level],
+           count ? levels[level] * 100 / count : 0);
+  }
+}
+
+static void profile(void) {
+  Str255 fileName;
+  unsigned long rate, seconds, maxCount, count;
+  unsigned long idleSpins, sampledSpins, calibrationSamples, calibrationRate;
+  unsigned long start, elapsed, overhead;
+  unsigned long addressMask;
+  Boolean yield, vm;
+  long response;
+  sample *samples;
+  dumpSymbol *symbols;
+  dumpHeader header;
+  EventRecord event;
+  unsigned long i;
+  OSErr err;
+
+  if (findOpenDriver("\p.AIn") != nil) {
+    printf("The modem port is in use, close whatever is using it first\n");
+    return;
+  }
+
+  rate = readNumber("Samples per second", 1000);
+  if (rate < minRate || rate > maxRate) {
+    printf("The sample rate must be between %d and %d\n", minRate, maxRate);
+    return;
+  }
+  seconds = readNumber("Seconds (0 to stop with the mouse button)", 0);
+  yield = readYesNo("Let other applications run", true);
+  if (!readFileName("Save samples to file", fileName)) {
+    return;
+  }
+
+  /* Room for the whole run plus a bit, or a minute if it's open-ended */
+  maxCount = rate * (seconds ? seconds + 1 : 60);
+  while ((samples = (sample *)NewPtr(maxCount * sizeof(sample))) == nil) {
+    maxCount /= 2;
+    if (maxCount < minSamples) {
+      printf("Out of memory\n");
+      return;
+    }
+  }
+  symbols = (dumpSymbol *)NewPtrClear(maxSymbols * sizeof(dumpSymbol));
+  if (symbols == nil) {
+    printf("Out of memory\n");
+    goto freeSamples;
+  }
+  printf("Room for %lu samples (%lu seconds)\n", maxCount, maxCount / rate);
+
+  /* The handler and the buffer are used at interrupt time, keep them
+  resident */
+  vm = trapAvailable(_Gestalt, ToolTrap) &&
+       Gestalt(gestaltVMAttr, &response) == noErr &&
+       (response & (1 << gestaltVMPresent));
+  if (vm) {
+    HoldMemory(samples, maxCount * sizeof(sample));
+    HoldMemory(profileHandler, profileHandlerEnd - (char *)profileHandler);
+  }
+
+  /* Measure overhead by how much a sampled idle loop slows down. Line the
+  loops up with the start of a tick so both get the whole time. */
+  printf("Measuring overhead...\n");
+  spinLoop(TickCount() + 1);
+  idleSpins = spinLoop(TickCount() + calibrationTicks);
+  startSampling(samples, maxCount, rate);
+  spinLoop(TickCount() + 1);
+  start = TickCount();
+  sampledSpins = spinLoop(start + calibrationTicks);
+  calibrationSamples = (sampleNext - samples) + samplesDropped;
+  stopSampling();
+  idleSpins = idleSpins * 60 / calibrationTicks;
+  sampledSpins = sampledSpins * 60 / calibrationTicks;
+
+  printf("Sampling, %s to stop...\n",
+         seconds ? "wait or click" : "click the mouse");
+  startSampling(samples, maxCount, rate);
+  start = TickCount();
+  while (!Button() && sampleNext < sampleLimit &&
+         (seconds == 0 || TickCount() - start < seconds * 60)) {
+    if (yield) {
+      EventAvail(everyEvent, &event);
+    }
+    spinLoop(TickCount() + 1);
+  }
+  stopSampling();
+  elapsed = TickCount() - start;
+  count = sampleNext - samples;
+
+  /* Make 24-bit PCs comparable with the region table */
+  addressMask = (unsigned long)StripAddress((Ptr)0xffffffffUL);
+  for (i = 0; i < count; i++) {
+    samples[i].pc &= addressMask;
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = dumpMagic;
+  header.version = dumpVersion;
+  header.cpu = LMGetCPUFlag();
+  header.requestedRate = rate;
+  header.measuredRate =
+      elapsed ? (count + samplesDropped) * 60 / elapsed : 0;
+  header.elapsedTicks = elapsed;
+  header.sampleCount = count;
+  header.droppedSamples = samplesDropped;
+  header.idleSpins = idleSpins;
+  header.sampledSpins = sampledSpins;
+
+  printf("\n%lu samples in %lu.%02lu seconds, %lu per second (asked for "
+         "%lu)\n", count, elapsed / 60, (elapsed % 60) * 100 / 60,
+         header.measuredRate, rate);
+  if (samplesDropped) {
+    printf("%lu samples dropped, buffer full\n", samplesDropped);
+  }
+  overhead = sampledSpins < idleSpins
+                 ? (idleSpins - sampledSpins) * 1000 / idleSpins
+                 : 0;
+  printf("Sampling overhead: %lu.%lu%% of the CPU", overhead / 10,
+         overhead % 10);
+  /* Overhead is in tenths of a percent */
+  calibrationRate = calibrationSamples * 60 / calibrationTicks;
+  if (calibrationRate) {
+    printf(", about %lu us per sample", overhead * 1000 / calibrationRate);
+  }
+  printf("\n");
+  printBreakdown(samples, count);
+
+  printf("Symbolicating...\n");
+  collectRegions();
+  header.regionCount = regionCount;
+  header.symbolCount = symbolicate(samples, count, symbols);
+  printf("%lu regions, %lu routines\n", header.regionCount,
+         header.symbolCount);
+
+  err = writeDump(fileName, &header, symbols, samples);
+  if (err != noErr) {
+    printf("Couldn't write file: %d\n", err);
+  }
+
+  if (vm) {
+    UnholdMemory(samples, maxCount * sizeof(sample));
+    UnholdMemory(profileHandler, profileHandlerEnd - (char *)profileHandler);
+  }
+  DisposePtr((Ptr)symbols);
+freeSamples:
+  DisposePtr((Ptr)samples);
+}
+
+static void help(void) {
+  printf("\nP: Profile\n");
+  printf("Q: Quit\n");
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  int choice;
+
+  printf("**** SEthernet profiler ****\n\n");
+
+  help();
+  while (1) {
+    choice = toupper(getchar());
+    if (choice == '\r' || choice == '\n') {
+      continue;
+    }
+    if (choice == 'Q') {
+      return 0;
+    }
+    /* Eat the rest of the line */
+    while (getchar() != '\n') {}
+
+    if (choice == 'P') {
+      profile();
+    }
+    help();
+  }
+}
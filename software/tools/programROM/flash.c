@@ -22,7 +22,7 @@ this program.  If not, see <https://www.gnu.org/licenses/>.
 
 enum {
   cmd_chiperase = 0x10,
-  cmd_byteerase = 0x30,
+  cmd_sectorerase = 0x30,
   cmd_erase = 0x80,
   cmd_id = 0x90,
   cmd_bytewrite = 0xa0,
@@ -66,6 +66,26 @@ void flash_erase(volatile unsigned char* base_address) {
   };
 }
 
+int flash_erase_sector(volatile unsigned char* base_address,
+                       unsigned int offset) {
+  offset &= ~(FLASH_SECTOR_SIZE - 1);
+
+  /* Same as a chip erase, except the last write goes to the sector */
+  flash_3byte(base_address, cmd_erase);
+  *(base_address + 0x5555) = 0xaa;
+  *(base_address + 0x2aaa) = 0x55;
+  *(base_address + offset) = cmd_sectorerase;
+  while (*(base_address + offset) != 0xff) {
+  };
+
+  for (unsigned int i = 0; i < FLASH_SECTOR_SIZE; i++) {
+    if (*(base_address + offset + i) != 0xff) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
 static void flash_writebyte(volatile unsigned char* base_address,
                             unsigned int offset, unsigned char data) {
   flash_3byte(base_address, cmd_bytewrite);
@@ -16,6 +16,9 @@ You should have received a copy of the GNU General Public License along with
 this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+/* Erase sector size (SST39SF010A) */
+#define FLASH_SECTOR_SIZE 4096
+
 struct flash_id {
   unsigned char manufacturer;
   unsigned char device;
@@ -37,6 +40,17 @@ int flash_probe(volatile unsigned char* base_address, flash_id* id);
 /* Erase flash device at base_address */
 void flash_erase(volatile unsigned char* base_address);
 
+/*
+Erase one sector of a flash device
+    Returns 0 if the sector reads back blank, -1 if not.
+
+    Arguments:
+        base_address    - base address of flash device
+        offset          - offset of any byte within the sector
+*/
+int flash_erase_sector(volatile unsigned char* base_address,
+                       unsigned int offset);
+
 /*
 Write data to a flash device
 
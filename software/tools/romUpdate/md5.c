@@ -0,0 +1,175 @@
+/*
+MD5 message digest (RFC 1321) and HMAC-MD5 (RFC 2104), see md5.h
+*/
+
+#include <string.h>
+
+#include "md5.h"
+
+#define F(x, y, z) (((x) & (y)) | (~(x) & (z)))
+#define G(x, y, z) (((x) & (z)) | ((y) & ~(z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define I(x, y, z) ((y) ^ ((x) | ~(z)))
+
+#define ROTATE(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define STEP(f, a, b, c, d, x, s, ac)        \
+  do {                                       \
+    (a) += f((b), (c), (d)) + (x) + (ac);    \
+    (a) = ROTATE((a), (s));                  \
+    (a) += (b);                              \
+  } while (0)
+
+/* Per-round shift amounts */
+static const unsigned char shifts[4][4] = {
+  {7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21}
+};
+
+/* Sine-derived constants, 64 of them */
+static const uint32_t sines[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+  0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+  0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+  0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+  0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+  0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static void md5Transform(uint32_t state[4], const unsigned char block[64]) {
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t x[16];
+  uint32_t t;
+  int i, k;
+
+  /* MD5 is little-endian */
+  for (i = 0; i < 16; i++) {
+    x[i] = (uint32_t)block[i * 4] | ((uint32_t)block[i * 4 + 1] << 8) |
+           ((uint32_t)block[i * 4 + 2] << 16) |
+           ((uint32_t)block[i * 4 + 3] << 24);
+  }
+
+  for (i = 0; i < 64; i++) {
+    switch (i / 16) {
+      case 0:
+        k = i;
+        STEP(F, a, b, c, d, x[k], shifts[0][i % 4], sines[i]);
+        break;
+      case 1:
+        k = (5 * i + 1) % 16;
+        STEP(G, a, b, c, d, x[k], shifts[1][i % 4], sines[i]);
+        break;
+      case 2:
+        k = (3 * i + 5) % 16;
+        STEP(H, a, b, c, d, x[k], shifts[2][i % 4], sines[i]);
+        break;
+      default:
+        k = (7 * i) % 16;
+        STEP(I, a, b, c, d, x[k], shifts[3][i % 4], sines[i]);
+        break;
+    }
+    /* Rotate the working variables for the next step */
+    t = d;
+    d = c;
+    c = b;
+    b = a;
+    a = t;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+void md5Init(md5Context *ctx) {
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->count[0] = ctx->count[1] = 0;
+}
+
+void md5Update(md5Context *ctx, const unsigned char *data, size_t length) {
+  size_t used = (ctx->count[0] >> 3) & 0x3f;
+  size_t space = md5BlockLength - used;
+  uint32_t bits = (uint32_t)length << 3;
+
+  ctx->count[0] += bits;
+  if (ctx->count[0] < bits) {
+    ctx->count[1]++;
+  }
+  ctx->count[1] += (uint32_t)(length >> 29);
+
+  if (length >= space) {
+    memcpy(&ctx->buffer[used], data, space);
+    md5Transform(ctx->state, ctx->buffer);
+    data += space;
+    length -= space;
+    while (length >= md5BlockLength) {
+      md5Transform(ctx->state, data);
+      data += md5BlockLength;
+      length -= md5BlockLength;
+    }
+    used = 0;
+  }
+  memcpy(&ctx->buffer[used], data, length);
+}
+
+void md5Final(md5Context *ctx, unsigned char digest[md5DigestLength]) {
+  static const unsigned char padding[md5BlockLength] = {0x80};
+  unsigned char bits[8];
+  size_t used = (ctx->count[0] >> 3) & 0x3f;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    bits[i] = (unsigned char)(ctx->count[i / 4] >> ((i % 4) * 8));
+  }
+  md5Update(ctx, padding, used < 56 ? 56 - used : 120 - used);
+  md5Update(ctx, bits, 8);
+
+  for (i = 0; i < md5DigestLength; i++) {
+    digest[i] = (unsigned char)(ctx->state[i / 4] >> ((i % 4) * 8));
+  }
+}
+
+void hmacMD5(const unsigned char *key, size_t keyLength,
+             const unsigned char *data, size_t length,
+             unsigned char digest[md5DigestLength]) {
+  unsigned char pad[md5BlockLength];
+  unsigned char keyDigest[md5DigestLength];
+  md5Context ctx;
+  int i;
+
+  /* Keys longer than a block are hashed first */
+  if (keyLength > md5BlockLength) {
+    md5Init(&ctx);
+    md5Update(&ctx, key, keyLength);
+    md5Final(&ctx, keyDigest);
+    key = keyDigest;
+    keyLength = md5DigestLength;
+  }
+
+  memset(pad, 0, sizeof(pad));
+  memcpy(pad, key, keyLength);
+  for (i = 0; i < md5BlockLength; i++) {
+    pad[i] ^= 0x36;
+  }
+  md5Init(&ctx);
+  md5Update(&ctx, pad, md5BlockLength);
+  md5Update(&ctx, data, length);
+  md5Final(&ctx, digest);
+
+  /* 0x36 ^ 0x5c turns the inner pad into the outer pad */
+  for (i = 0; i < md5BlockLength; i++) {
+    pad[i] ^= 0x36 ^ 0x5c;
+  }
+  md5Init(&ctx);
+  md5Update(&ctx, pad, md5BlockLength);
+  md5Update(&ctx, digest, md5DigestLength);
+  md5Final(&ctx, digest);
+}
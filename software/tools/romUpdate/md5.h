@@ -0,0 +1,29 @@
+/*
+MD5 message digest (RFC 1321) and HMAC-MD5 (RFC 2104)
+
+Used to check the signature on ROM images sent to romAgent. Portable C, so that
+simAgent can be built on Linux too.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define md5DigestLength 16
+#define md5BlockLength 64
+
+typedef struct md5Context {
+  uint32_t state[4];
+  uint32_t count[2];             /* Message length in bits, low word first */
+  unsigned char buffer[md5BlockLength];
+} md5Context;
+
+void md5Init(md5Context *ctx);
+void md5Update(md5Context *ctx, const unsigned char *data, size_t length);
+void md5Final(md5Context *ctx, unsigned char digest[md5DigestLength]);
+
+/* HMAC-MD5 of data under key */
+void hmacMD5(const unsigned char *key, size_t keyLength,
+             const unsigned char *data, size_t length,
+             unsigned char digest[md5DigestLength]);
@@ -0,0 +1,359 @@
+/*
+Declaration ROM update agent
+
+Waits for romServer to push a new declaration ROM image over the network (see
+update.h for the protocol), checks its signature and CRC, and programs it into
+the flash on the SEthernet/30 that .ENET belongs to. Only the 4K sectors that
+have changed get erased and rewritten.
+
+Frames arrive through a protocol handler for the update ethertype, which copies
+them into a queue at interrupt time; everything else, including programming the
+flash, happens in the main loop.
+
+The shared key is read from a file called "ROM Update Key" next to the
+application (or typed in, and optionally saved there). Without an SEthernet/30
+to program, the agent still answers, so that dry runs work on any Mac.
+*/
+
+#include <Devices.h>
+#include <ENET.h>
+#include <Events.h>
+#include <Files.h>
+#include <Gestalt.h>
+#include <MacTypes.h>
+#include <Memory.h>
+#include <OSUtils.h>
+#include <Resources.h>
+#include <Traps.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "enc624j600.h"
+#include "flash.h"
+#include "phHandler.h"
+#include "update.h"
+
+/* Start of SEthernet/30 declaration ROM within slot space */
+#define DECLROM_OFFSET 0xff0000
+
+/* Number of received frames that can wait for the main loop */
+#define numFrames 8
+
+/* Resource ID of the machine name (set in the Sharing Setup control panel) */
+#define machineNameID -16413
+
+static const unsigned char keyFileName[] = "\pROM Update Key";
+
+typedef struct queuedFrame {
+  volatile unsigned short full;   /* Waiting for the main loop */
+  unsigned short length;
+  Byte data[updateMaxFrame];
+} queuedFrame;
+
+static short enetRefNum;
+static volatile unsigned char *flashBase;
+
+/* Receive queue, shared with queueFrame() at interrupt time */
+static queuedFrame *frames;
+static unsigned short frameIn;          /* Next slot for queueFrame() */
+static unsigned short frameOut;         /* Next slot for the main loop */
+static volatile unsigned long droppedFrames;
+
+/* Turn a slot number and an offset into slot space, into a pointer */
+static inline unsigned char *slotptr(unsigned char slot, unsigned int offset) {
+  if (GetMMUMode() == true32b) {
+    /* 32 bit mode: slot space is 16MB, addressed at 0xFSxxxxxx*/
+    return (unsigned char *)0xf0000000 + (slot << 24) + offset;
+  } else {
+    /* 24 bit mode: slot space is 1MB, addressed at 0xSxxxxx*/
+    return (unsigned char *)(slot << 20) + (offset & 0xfffff);
+  }
+}
+
+static Boolean trapAvailable(unsigned short trap, TrapType type) {
+  return NGetTrapAddress(trap, type) != GetToolboxTrapAddress(_Unimplemented);
+}
+
+/*
+Called through phHandler at interrupt time with the frame's ethernet header and
+the number of bytes following it. Returns where the rest of the frame should go,
+with *readLength set to how much of it to read, or nil if the queue is full.
+*/
+static Byte *queueFrame(const Byte *header, unsigned long length,
+                        unsigned short *readLength) {
+  queuedFrame *frame = &frames[frameIn];
+
+  *readLength = 0;
+  if (frame->full) {
+    /* The server will send it again */
+    droppedFrames++;
+    return nil;
+  }
+  if (length > updateMaxFrame - updateEthHeaderSize) {
+    length = updateMaxFrame - updateEthHeaderSize;
+  }
+  memcpy(frame->data, header, updateEthHeaderSize);
+  frame->length = updateEthHeaderSize + length;
+  frame->full = 1;
+  frameIn = (frameIn + 1) % numFrames;
+  *readLength = length;
+  return frame->data + updateEthHeaderSize;
+}
+
+static OSErr enetControl(short csCode, short protocol, Ptr param,
+                         short size) {
+  EParamBlock pb;
+
+  memset(&pb, 0, sizeof(pb));
+  pb.ioRefNum = enetRefNum;
+  pb.csCode = csCode;
+  pb.u.EParms1.eProtType = protocol;
+  pb.u.EParms1.ePointer = param;
+  pb.u.EParms1.eBuffSize = size;
+  return PBControlSync((ParmBlkPtr)&pb);
+}
+
+static int eraseSector(updateFlash *flash, unsigned long offset) {
+  (void)flash;
+  return flash_erase_sector(flashBase, offset);
+}
+
+static int writeFlash(updateFlash *flash, unsigned long offset,
+                      const unsigned char *data, unsigned int length) {
+  (void)flash;
+  return flash_write(flashBase, offset, (unsigned char *)data, length);
+}
+
+/* Find the flash on the card .ENET is driving. Returns false if there isn't
+one (an SE, or a card we don't recognise). */
+static Boolean findFlash(updateFlash *flash) {
+  AuxDCEHandle dce = (AuxDCEHandle)GetDCtlEntry(enetRefNum);
+  unsigned char slot = (*dce)->dCtlSlot;
+  enc624j600 chip;
+  flash_id id;
+
+  if (slot < 9 || slot > 0xe) {
+    printf("No slot card, nothing to program (dry runs only)\n");
+    return false;
+  }
+
+  chip.base_address = slotptr(slot, 0);
+  if (enc624j600_detect(&chip) != 0) {
+    printf("Slot %x doesn't look like an SEthernet/30, nothing to program "
+           "(dry runs only)\n", slot);
+    return false;
+  }
+
+  flashBase = slotptr(slot, DECLROM_OFFSET);
+  if (flash_probe(flashBase, &id) != 0) {
+    printf("No flash found in slot %x (dry runs only)\n", slot);
+    return false;
+  }
+  printf("SEthernet/30 in slot %x, flash ID %02x/%02x\n", slot,
+         id.manufacturer, id.device);
+
+  flash->contents = flashBase;
+  flash->size = updateImageSize;
+  flash->manufacturer = id.manufacturer;
+  flash->device = id.device;
+  flash->eraseSector = eraseSector;
+  flash->write = writeFlash;
+  flash->context = nil;
+  return true;
+}
+
+/* Read the shared key from the key file, or have it typed in */
+static unsigned int readKey(unsigned char *key) {
+  char line[updateMaxKey + 2];
+  short fileRef;
+  long count = updateMaxKey;
+  size_t len;
+
+  if (FSOpen(keyFileName, 0, &fileRef) == noErr) {
+    FSRead(fileRef, &count, key);
+    FSClose(fileRef);
+    while (count > 0 && (key[count - 1] == '\r' || key[count - 1] == '\n')) {
+      count--;
+    }
+    return count;
+  }
+
+  printf("Shared key: ");
+  fflush(stdout);
+  if (fgets(line, sizeof(line), stdin) == NULL) {
+    return 0;
+  }
+  len = strlen(line);
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+    len--;
+  }
+  memcpy(key, line, len);
+
+  printf("Save it in \"%.*s\"? [N]: ", keyFileName[0], &keyFileName[1]);
+  fflush(stdout);
+  if (fgets(line, sizeof(line), stdin) != NULL && toupper(line[0]) == 'Y') {
+    count = len;
+    Create(keyFileName, 0, 'SEru', 'TEXT');
+    if (FSOpen(keyFileName, 0, &fileRef) == noErr) {
+      SetEOF(fileRef, 0);
+      FSWrite(fileRef, &count, key);
+      FSClose(fileRef);
+    }
+  }
+  return len;
+}
+
+/* Machine name from Sharing Setup, or "Macintosh" */
+static void machineName(char *name) {
+  Handle h = GetResource('STR ', machineNameID);
+  unsigned char len;
+
+  if (h == nil || **h == 0) {
+    strcpy(name, "Macintosh");
+    return;
+  }
+  len = **h;
+  if (len > updateNameLength) {
+    len = updateNameLength;
+  }
+  memcpy(name, *h + 1, len);
+  name[len] = '\0';
+}
+
+/* Report what the last frame did to the session */
+static void showProgress(const updateAgent *agent, unsigned char state,
+                         uint32_t session) {
+  const updateResult *r = &agent->result;
+  static const char *statusNames[] = {
+    "ok", "no such session", "bad length", "bad signature", "bad header",
+    "bad CRC", "flash error", "no flash"
+  };
+
+  if (agent->session != session || (agent->state == updateStateReceiving &&
+                                    state != updateStateReceiving)) {
+    printf("Session %08lx: receiving %simage from "
+           "%02x:%02x:%02x:%02x:%02x:%02x\n",
+           (unsigned long)agent->session,
+           (agent->flags & updateFlagVerifyOnly) ? "(dry run) " : "",
+           agent->server[0], agent->server[1], agent->server[2],
+           agent->server[3], agent->server[4], agent->server[5]);
+  }
+  if (agent->state == updateStateDone && state != updateStateDone) {
+    printf("Session %08lx: %s", (unsigned long)agent->session,
+           r->status < sizeof(statusNames) / sizeof(statusNames[0])
+               ? statusNames[r->status]
+               : "failed");
+    if (r->status == updateStatusOK &&
+        !(agent->flags & updateFlagVerifyOnly)) {
+      printf(", %u sectors erased, %u written, %u unchanged, %lu bytes. "
+             "Restart to use the new ROM.",
+             r->sectorsErased, r->sectorsWritten, r->sectorsSkipped,
+             r->bytesWritten);
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  updateFlash flash;
+  updateAgent agent;
+  Byte info[18];
+  Byte reply[updateMaxFrame];
+  unsigned char key[updateMaxKey];
+  unsigned int keyLength;
+  char name[updateNameLength + 1];
+  unsigned char *image;
+  Boolean hasFlash, vm;
+  WDSElement wds[2];
+  queuedFrame *frame;
+  unsigned char state;
+  uint32_t session;
+  long response;
+  size_t replyLength;
+  OSErr err;
+
+  printf("**** SEthernet/30 ROM update agent ****\n\n");
+
+  err = OpenDriver("\p.ENET", &enetRefNum);
+  if (err != noErr) {
+    printf("Couldn't open .ENET: %d\n", err);
+    return 1;
+  }
+  err = enetControl(ENetGetInfo, 0, (Ptr)info, sizeof(info));
+  if (err != noErr) {
+    printf("Couldn't get our ethernet address: %d\n", err);
+    return 1;
+  }
+  hasFlash = findFlash(&flash);
+
+  keyLength = readKey(key);
+  if (keyLength == 0) {
+    printf("Need a key to check images with\n");
+    return 1;
+  }
+  machineName(name);
+
+  image = (unsigned char *)NewPtr(updateImageSize);
+  frames = (queuedFrame *)NewPtrClear(numFrames * sizeof(queuedFrame));
+  if (image == nil || frames == nil) {
+    printf("Out of memory\n");
+    return 1;
+  }
+  /* Filled at interrupt time, keep it resident */
+  vm = trapAvailable(_Gestalt, ToolTrap) &&
+       Gestalt(gestaltVMAttr, &response) == noErr &&
+       (response & (1 << gestaltVMPresent));
+  if (vm) {
+    HoldMemory(frames, numFrames * sizeof(queuedFrame));
+  }
+
+  updateAgentInit(&agent, hasFlash ? &flash : nil, image, key, keyLength,
+                  name);
+
+  phFrame = queueFrame;
+  err = enetControl(ENetAttachPH, updateEthertype, (Ptr)phHandler, 0);
+  if (err != noErr) {
+    printf("Couldn't attach protocol handler: %d\n", err);
+    return 1;
+  }
+
+  printf("\"%s\" (%02x:%02x:%02x:%02x:%02x:%02x) waiting for updates, click "
+         "the mouse to quit...\n", name, info[0], info[1], info[2], info[3],
+         info[4], info[5]);
+  while (!Button()) {
+    frame = &frames[frameOut];
+    if (!frame->full) {
+      continue;
+    }
+
+    state = agent.state;
+    session = agent.session;
+    replyLength = updateHandleFrame(&agent, frame->data, frame->length, info,
+                                    reply);
+    frame->full = 0;
+    frameOut = (frameOut + 1) % numFrames;
+
+    if (replyLength) {
+      wds[0].entryLength = replyLength;
+      wds[0].entryPtr = (Ptr)reply;
+      wds[1].entryLength = 0;
+      enetControl(ENetWrite, 0, (Ptr)wds, 0);
+    }
+    showProgress(&agent, state, session);
+  }
+
+  enetControl(ENetDetachPH, updateEthertype, nil, 0);
+  if (droppedFrames) {
+    printf("%lu frames dropped (queue full)\n", droppedFrames);
+  }
+  if (vm) {
+    UnholdMemory(frames, numFrames * sizeof(queuedFrame));
+  }
+  DisposePtr((Ptr)frames);
+  DisposePtr((Ptr)image);
+  return 0;
+}
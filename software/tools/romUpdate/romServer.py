@@ -0,0 +1,427 @@
+#!/usr/bin/env python3
+
+# Push a declaration ROM image to SEthernet/30 cards running romAgent, over raw
+# ethernet (see update.h for the protocol). Updates run in parallel, so a whole
+# lab can be updated at once; each agent checks the image's signature and CRC
+# before programming it, and reports back how it went.
+#
+# Raw ethernet needs root (or CAP_NET_RAW). With --udp, frames go over UDP to
+# simAgent instead, for testing without any Macs.
+
+import argparse
+import hashlib
+import hmac
+import os
+import select
+import socket
+import struct
+import sys
+import time
+
+ETHERTYPE = 0x88b6
+MAGIC = 0x53457275
+VERSION = 1
+IMAGE_SIZE = 65536
+CHUNK = 1024
+MAX_KEY = 64
+BROADCAST = b'\xff' * 6
+
+OP_DISCOVER, OP_HELLO, OP_BEGIN, OP_DATA, OP_ACK, OP_COMMIT, OP_RESULT = \
+    range(1, 8)
+FLAG_VERIFY_ONLY = 0x0001
+
+STATUS = ['ok', 'no such session', 'bad length', 'bad signature',
+          'bad header', 'bad CRC', 'flash error', 'no flash']
+STATUS_OK, STATUS_BAD_SESSION = 0, 1
+
+HEADER = struct.Struct('>LBBHLLHH')
+HELLO = struct.Struct('>BBBBLLL32s')
+RESULT = struct.Struct('>HHHxxLL')
+
+ROM_HEADER_MAGIC = 0x5a932bc7
+
+# Seconds to wait for a reply before resending, and how many times to resend
+REPLY_TIMEOUT = 0.25
+COMMIT_TIMEOUT = 2.0
+RETRIES = 20
+COMMIT_RETRIES = 30
+# Times to start over if an agent forgets its session (restarted)
+RESTARTS = 3
+
+def mac_str(mac):
+    return ':'.join('%02x' % b for b in mac)
+
+def parse_mac(s):
+    mac = bytes(int(x, 16) for x in s.replace('-', ':').split(':'))
+    if len(mac) != 6:
+        raise argparse.ArgumentTypeError('bad ethernet address %s' % s)
+    return mac
+
+def checksum(data):
+    # Same as gencrc.py
+    sum = 0
+    for byte in data:
+        sum = ((sum << 1) & 0xffffffff) | (sum >> 31)
+        sum = (sum + byte) & 0xffffffff
+    return sum
+
+def check_image(rom):
+    # The checks gencrc.py and the agent make. Returns (revision, crc).
+    if len(rom) != IMAGE_SIZE:
+        raise ValueError('image is %d bytes, should be %d (use gencrc.py '
+                         '--pad %d)' % (len(rom), IMAGE_SIZE, IMAGE_SIZE))
+    (dir_offset, crc_length, crc, revision, _, magic, reserved,
+     lanes) = struct.unpack('>LLLBBLBB', rom[-20:])
+    if magic != ROM_HEADER_MAGIC or reserved != 0 or \
+       (lanes & 0x0f) != ((~lanes >> 4) & 0x0f):
+        raise ValueError('no valid format header block')
+    dir_offset &= 0xffffff
+    if dir_offset & 0x800000:
+        dir_offset -= 0x1000000
+    if dir_offset > 0 or -dir_offset > len(rom) - 20 or \
+       len(rom) - 20 + dir_offset + crc_length != len(rom):
+        raise ValueError('CRC length doesn\'t match directory offset')
+    data = rom[len(rom) - crc_length:]
+    if checksum(data[:-12] + bytes(4) + data[-8:]) != crc:
+        raise ValueError('CRC doesn\'t match (run gencrc.py)')
+    return revision, crc
+
+def read_key(name):
+    with open(name, 'rb') as f:
+        key = f.read().rstrip(b'\r\n')
+    if len(key) > MAX_KEY:
+        sys.exit('%s: key is longer than %d bytes' % (name, MAX_KEY))
+    return key
+
+class RawTransport:
+    def __init__(self, interface):
+        self.sock = socket.socket(socket.AF_PACKET, socket.SOCK_RAW,
+                                  socket.htons(ETHERTYPE))
+        self.sock.bind((interface, ETHERTYPE))
+        self.address = self.sock.getsockname()[4]
+
+    def send(self, dest, frame):
+        self.sock.send(dest + self.address + frame[12:])
+
+    def recv(self):
+        frame = self.sock.recv(2048)
+        return frame[6:12], frame
+
+class UdpTransport:
+    # Frames (with ethernet headers) go in UDP datagrams to a list of simAgents.
+    # Broadcasts go to all of them; agents' ethernet addresses are learned from
+    # their replies.
+    def __init__(self, agents):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(('', 0))
+        self.address = b'\x02SE\xff\xff\xff'
+        self.agents = agents
+        self.known = {}
+
+    def send(self, dest, frame):
+        frame = dest + self.address + frame[12:]
+        if dest == BROADCAST:
+            for agent in self.agents:
+                self.sock.sendto(frame, agent)
+        elif dest in self.known:
+            self.sock.sendto(frame, self.known[dest])
+
+    def recv(self):
+        frame, peer = self.sock.recvfrom(2048)
+        source = frame[6:12]
+        self.known[source] = peer
+        return source, frame
+
+def build(op, session=0, offset=0, flags=0, payload=b''):
+    # The ethernet addresses are filled in by the transport
+    return (bytes(12) + struct.pack('>H', ETHERTYPE) +
+            HEADER.pack(MAGIC, VERSION, op, 0, session, offset, len(payload),
+                        flags) + payload)
+
+def parse(frame):
+    if len(frame) < 14 + HEADER.size or \
+       struct.unpack('>H', frame[12:14])[0] != ETHERTYPE:
+        return None
+    magic, version, op, status, session, offset, length, flags = \
+        HEADER.unpack(frame[14:14 + HEADER.size])
+    if magic != MAGIC or version != VERSION:
+        return None
+    payload = frame[14 + HEADER.size:14 + HEADER.size + length]
+    return op, status, session, offset, payload
+
+class Agent:
+    def __init__(self, mac, hello):
+        (self.manufacturer, self.device, self.revision, self.state, self.crc,
+         self.session, self.received, name) = HELLO.unpack(hello[:HELLO.size])
+        self.mac = mac
+        self.name = name.split(b'\0', 1)[0].decode('mac_roman')
+
+def discover(transport, targets, seconds):
+    # Broadcast, and ask named targets directly too in case broadcasts are
+    # filtered. Returns agents by address.
+    agents = {}
+    deadline = time.monotonic() + seconds
+    next_send = 0
+    while True:
+        now = time.monotonic()
+        if now >= deadline:
+            return agents
+        if now >= next_send:
+            transport.send(BROADCAST, build(OP_DISCOVER))
+            for mac in targets:
+                if mac not in agents:
+                    transport.send(mac, build(OP_DISCOVER))
+            next_send = now + 0.5
+        ready, _, _ = select.select([transport.sock], [], [],
+                                    min(deadline, next_send) - now)
+        if ready:
+            source, frame = transport.recv()
+            msg = parse(frame)
+            if msg is not None and msg[0] == OP_HELLO and \
+               len(msg[4]) >= HELLO.size:
+                agents[source] = Agent(source, msg[4])
+
+class Update:
+    # One agent's update: BEGIN, DATA until everything's acknowledged, COMMIT,
+    # then wait for the RESULT
+    def __init__(self, agent, image, signature, flags):
+        self.agent = agent
+        self.image = image
+        self.signature = signature
+        self.flags = flags
+        self.session = struct.unpack('>L', os.urandom(4))[0] or 1
+        self.op = OP_BEGIN
+        self.position = 0
+        self.retries = 0
+        self.restarts = 0
+        self.deadline = 0
+        self.started = time.monotonic()
+        self.finished = None
+        self.status = None
+        self.result = None
+        self.error = None
+
+    def frame(self):
+        if self.op == OP_BEGIN:
+            return build(OP_BEGIN, self.session, len(self.image), self.flags)
+        if self.op == OP_DATA:
+            return build(OP_DATA, self.session, self.position, 0,
+                         self.image[self.position:self.position + CHUNK])
+        return build(OP_COMMIT, self.session, 0, 0, self.signature)
+
+    def send(self, transport):
+        transport.send(self.agent.mac, self.frame())
+        timeout = COMMIT_TIMEOUT if self.op == OP_COMMIT else REPLY_TIMEOUT
+        self.deadline = time.monotonic() + timeout
+
+    def fail(self, error):
+        self.error = error
+        self.finished = time.monotonic()
+
+    def timeout(self, transport):
+        self.retries += 1
+        limit = COMMIT_RETRIES if self.op == OP_COMMIT else RETRIES
+        if self.retries > limit:
+            self.fail('no response')
+        else:
+            self.send(transport)
+
+    def receive(self, transport, msg):
+        op, status, session, offset, payload = msg
+        if session != self.session:
+            return
+        expected = OP_RESULT if self.op == OP_COMMIT else OP_ACK
+        if op != expected:
+            return
+        if status == STATUS_BAD_SESSION and self.restarts < RESTARTS:
+            # The agent restarted and forgot us, start over
+            self.restarts += 1
+            self.op = OP_BEGIN
+            self.position = 0
+        elif op == OP_ACK:
+            if status != STATUS_OK:
+                self.fail(STATUS[status] if status < len(STATUS)
+                          else 'status %d' % status)
+                return
+            self.position = offset
+            self.op = OP_COMMIT if offset >= len(self.image) else OP_DATA
+        else:
+            self.status = status
+            if len(payload) >= RESULT.size:
+                self.result = RESULT.unpack(payload[:RESULT.size])
+            self.finished = time.monotonic()
+            return
+        self.retries = 0
+        self.send(transport)
+
+def push(transport, agents, image, signature, flags, parallel):
+    waiting = list(agents)
+    active = {}
+    done = []
+    while waiting or active:
+        while waiting and len(active) < parallel:
+            update = Update(waiting.pop(0), image, signature, flags)
+            active[update.agent.mac] = update
+            update.send(transport)
+
+        now = time.monotonic()
+        timeout = max(0, min(u.deadline for u in active.values()) - now)
+        ready, _, _ = select.select([transport.sock], [], [], timeout)
+        if ready:
+            source, frame = transport.recv()
+            msg = parse(frame)
+            if msg is not None and source in active:
+                active[source].receive(transport, msg)
+        now = time.monotonic()
+        for mac, update in list(active.items()):
+            if update.finished is None and now >= update.deadline:
+                update.timeout(transport)
+            if update.finished is not None:
+                done.append(update)
+                del active[mac]
+                report(update, len(done), len(agents))
+    return done
+
+def report(update, n, total):
+    agent = update.agent
+    seconds = update.finished - update.started
+    if update.error is not None:
+        outcome = 'FAILED: %s' % update.error
+    elif update.status != STATUS_OK:
+        outcome = 'FAILED: %s' % (STATUS[update.status]
+                                  if update.status < len(STATUS)
+                                  else 'status %d' % update.status)
+    elif update.result is not None:
+        erased, written, skipped, nbytes, crc = update.result
+        outcome = ('ok, %d sectors erased, %d written, %d unchanged, %d '
+                   'bytes, CRC %08x' % (erased, written, skipped, nbytes, crc))
+    else:
+        outcome = 'ok'
+    print('[%d/%d] %s %-20s %5.1fs  %s' % (n, total, mac_str(agent.mac),
+                                           agent.name, seconds, outcome))
+    sys.stdout.flush()
+
+def make_transport(args):
+    if args.udp:
+        agents = []
+        for spec in args.udp:
+            host, _, port = spec.rpartition(':')
+            agents.append((host or '127.0.0.1', int(port)))
+        return UdpTransport(agents)
+    if not args.interface:
+        sys.exit('need an interface (-i) or --udp agents')
+    try:
+        return RawTransport(args.interface)
+    except PermissionError:
+        sys.exit('raw sockets need root (or CAP_NET_RAW)')
+
+def show_agents(agents):
+    for agent in sorted(agents.values(), key=lambda a: a.mac):
+        state = ['idle', 'receiving', 'done'][agent.state] \
+            if agent.state < 3 else '?'
+        print('%s %-20s flash %02x/%02x  ROM revision %d CRC %08x  %s' %
+              (mac_str(agent.mac), agent.name, agent.manufacturer,
+               agent.device, agent.revision, agent.crc, state))
+
+def main():
+    parser = argparse.ArgumentParser(description='Update SEthernet/30 '
+                                     'declaration ROMs over the network')
+    transport = argparse.ArgumentParser(add_help=False)
+    transport.add_argument('-i', '--interface',
+                           help='ethernet interface to use')
+    transport.add_argument('--udp', action='append', metavar='[HOST:]PORT',
+                           help='talk to a simAgent over UDP instead '
+                           '(repeat for more agents)')
+    transport.add_argument('-t', '--target', action='append', default=[],
+                           type=parse_mac, metavar='MAC',
+                           help='only these agents (default all that answer)')
+    transport.add_argument('--wait', type=float, default=2.0,
+                           help='seconds to wait for agents to answer '
+                           '(default 2)')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p = sub.add_parser('sign', help='sign an image')
+    p.add_argument('image')
+    p.add_argument('-k', '--key-file', required=True)
+    p.add_argument('-o', '--output', help='signature file (default '
+                   'IMAGE.sig)')
+
+    sub.add_parser('discover', parents=[transport],
+                   help='list agents on the network')
+
+    p = sub.add_parser('push', parents=[transport],
+                       help='update agents with an image')
+    p.add_argument('image')
+    key = p.add_mutually_exclusive_group(required=True)
+    key.add_argument('-k', '--key-file', help='sign with this key')
+    key.add_argument('-s', '--signature', help='signature from the sign '
+                     'command')
+    p.add_argument('-n', '--dry-run', action='store_true',
+                   help='have agents check the image, but not program it')
+    p.add_argument('-f', '--force', action='store_true',
+                   help='update agents that already have this image')
+    p.add_argument('-j', '--parallel', type=int, default=32,
+                   help='agents to update at once (default 32)')
+    args = parser.parse_args()
+
+    if args.command in ('sign', 'push'):
+        with open(args.image, 'rb') as f:
+            image = f.read()
+        try:
+            revision, crc = check_image(image)
+        except ValueError as e:
+            sys.exit('%s: %s' % (args.image, e))
+
+    if args.command == 'sign':
+        signature = hmac.new(read_key(args.key_file), image,
+                             hashlib.md5).digest()
+        output = args.output or args.image + '.sig'
+        with open(output, 'wb') as f:
+            f.write(signature)
+        print('%s: revision %d, CRC %08x, signature written to %s' %
+              (args.image, revision, crc, output))
+        return
+
+    transport = make_transport(args)
+    agents = discover(transport, args.target, args.wait)
+    missing = [mac for mac in args.target if mac not in agents]
+    if args.target:
+        agents = {mac: a for mac, a in agents.items() if mac in args.target}
+
+    if args.command == 'discover':
+        show_agents(agents)
+        for mac in missing:
+            print('%s did not answer' % mac_str(mac))
+        return
+
+    if args.key_file:
+        signature = hmac.new(read_key(args.key_file), image,
+                             hashlib.md5).digest()
+    else:
+        with open(args.signature, 'rb') as f:
+            signature = f.read()
+
+    todo = []
+    for agent in sorted(agents.values(), key=lambda a: a.mac):
+        if agent.crc == crc and agent.revision == revision and \
+           not args.force and not args.dry_run:
+            print('%s %-20s already up to date' % (mac_str(agent.mac),
+                                                   agent.name))
+        else:
+            todo.append(agent)
+    print('Image revision %d, CRC %08x: %s %d agent%s' %
+          (revision, crc, 'checking with' if args.dry_run else 'updating',
+           len(todo), '' if len(todo) == 1 else 's'))
+
+    done = push(transport, todo, image, signature,
+                FLAG_VERIFY_ONLY if args.dry_run else 0, args.parallel)
+    failed = [u for u in done if u.error is not None or u.status != STATUS_OK]
+    for mac in missing:
+        print('%s did not answer' % mac_str(mac))
+    print('%d succeeded, %d failed, %d missing' %
+          (len(done) - len(failed), len(failed), len(missing)))
+    if failed or missing:
+        sys.exit(1)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,266 @@
+/*
+Simulated ROM update agent, for testing romServer without a roomful of Macs
+
+Runs the same protocol code as romAgent (update.c) natively, against a
+simulated flash device in memory, with ethernet frames carried in UDP datagrams
+(see romServer.py --udp). Build it with the host compiler:
+
+  cc -O2 -o simAgent simAgent.c update.c md5.c
+
+The simulated flash behaves like the real thing as far as the protocol can
+tell: writes can only clear bits, a sector has to be erased to set them again,
+and optionally each operation takes as long as it would on an SST39SF010A.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "update.h"
+
+/* SST39SF010A JEDEC IDs */
+#define simManufacturer 0xbf
+#define simDevice 0xb5
+
+/* SST39SF010A typical timings, in microseconds */
+#define simByteProgramTime 14
+#define simSectorEraseTime 18000
+
+typedef struct simFlash {
+  unsigned char contents[updateImageSize];
+  const char *fileName;          /* Where to save contents, or NULL */
+  int realTiming;                /* Take as long as the real device */
+  long failAfter;                /* Fail writes after this many bytes, or -1 */
+  unsigned long bytesWritten;
+  unsigned long sectorErases[updateImageSize / updateSectorSize];
+} simFlash;
+
+static int simEraseSector(updateFlash *flash, unsigned long offset) {
+  simFlash *sim = flash->context;
+
+  offset &= ~(updateSectorSize - 1);
+  memset(sim->contents + offset, 0xff, updateSectorSize);
+  sim->sectorErases[offset / updateSectorSize]++;
+  if (sim->realTiming) {
+    usleep(simSectorEraseTime);
+  }
+  return 0;
+}
+
+static int simWrite(updateFlash *flash, unsigned long offset,
+                    const unsigned char *data, unsigned int length) {
+  simFlash *sim = flash->context;
+  unsigned int i;
+
+  for (i = 0; i < length; i++) {
+    if (sim->failAfter >= 0 && sim->bytesWritten >= (unsigned long)sim->failAfter) {
+      /* Stuck bits: the byte doesn't program */
+      return -1;
+    }
+    sim->contents[offset + i] &= data[i];
+    sim->bytesWritten++;
+    if (sim->contents[offset + i] != data[i]) {
+      return -1;
+    }
+  }
+  if (sim->realTiming) {
+    usleep(simByteProgramTime * length);
+  }
+  return 0;
+}
+
+static void loadFlash(simFlash *sim) {
+  FILE *f = fopen(sim->fileName, "rb");
+
+  if (f == NULL) {
+    return;
+  }
+  if (fread(sim->contents, 1, updateImageSize, f) != updateImageSize) {
+    fprintf(stderr, "%s: short file, rest of flash is blank\n",
+            sim->fileName);
+  }
+  fclose(f);
+}
+
+static void saveFlash(const simFlash *sim) {
+  FILE *f = fopen(sim->fileName, "wb");
+
+  if (f == NULL ||
+      fwrite(sim->contents, 1, updateImageSize, f) != updateImageSize) {
+    perror(sim->fileName);
+  }
+  if (f != NULL) {
+    fclose(f);
+  }
+}
+
+static size_t readKey(const char *fileName, unsigned char *key) {
+  FILE *f = fopen(fileName, "rb");
+  size_t length;
+
+  if (f == NULL) {
+    perror(fileName);
+    exit(1);
+  }
+  length = fread(key, 1, updateMaxKey, f);
+  fclose(f);
+  while (length > 0 && (key[length - 1] == '\n' || key[length - 1] == '\r')) {
+    length--;
+  }
+  return length;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: simAgent -k keyfile [-p port] [-f flashfile] [-n name] "
+          "[-t] [-F bytes] [-l percent]\n"
+          "  -p  UDP port to listen on (default 34998)\n"
+          "  -f  file holding the flash contents (default blank flash)\n"
+          "  -n  name to report (default sim-PORT)\n"
+          "  -t  take as long as a real SST39SF010A to erase and write\n"
+          "  -F  make writes fail after this many bytes\n"
+          "  -l  drop this percentage of received frames\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  static simFlash sim;
+  static unsigned char image[updateImageSize];
+  unsigned char frame[2048];
+  unsigned char reply[updateMaxFrame];
+  unsigned char key[updateMaxKey];
+  unsigned char address[6];
+  size_t keyLength = 0;
+  const char *keyFile = NULL;
+  char name[updateNameLength + 1] = "";
+  int port = 34998;
+  int lossPercent = 0;
+  updateFlash flash;
+  updateAgent agent;
+  struct sockaddr_in local, peer;
+  socklen_t peerLength;
+  unsigned char state;
+  uint32_t session;
+  ssize_t length;
+  size_t replyLength;
+  unsigned int i;
+  int opt, s;
+
+  memset(sim.contents, 0xff, sizeof(sim.contents));
+  sim.failAfter = -1;
+  while ((opt = getopt(argc, argv, "k:p:f:n:tF:l:")) != -1) {
+    switch (opt) {
+      case 'k':
+        keyFile = optarg;
+        break;
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'f':
+        sim.fileName = optarg;
+        break;
+      case 'n':
+        snprintf(name, sizeof(name), "%s", optarg);
+        break;
+      case 't':
+        sim.realTiming = 1;
+        break;
+      case 'F':
+        sim.failAfter = atol(optarg);
+        break;
+      case 'l':
+        lossPercent = atoi(optarg);
+        break;
+      default:
+        usage();
+    }
+  }
+  if (keyFile == NULL) {
+    usage();
+  }
+  keyLength = readKey(keyFile, key);
+  if (name[0] == '\0') {
+    snprintf(name, sizeof(name), "sim-%d", port);
+  }
+  if (sim.fileName != NULL) {
+    loadFlash(&sim);
+  }
+
+  /* Locally administered address made up from the port number */
+  address[0] = 0x02;
+  address[1] = 'S';
+  address[2] = 'E';
+  address[3] = 0;
+  address[4] = port >> 8;
+  address[5] = port;
+
+  flash.contents = sim.contents;
+  flash.size = updateImageSize;
+  flash.manufacturer = simManufacturer;
+  flash.device = simDevice;
+  flash.eraseSector = simEraseSector;
+  flash.write = simWrite;
+  flash.context = &sim;
+  updateAgentInit(&agent, &flash, image, key, keyLength, name);
+
+  s = socket(AF_INET, SOCK_DGRAM, 0);
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  local.sin_port = htons(port);
+  if (s < 0 || bind(s, (struct sockaddr *)&local, sizeof(local)) < 0) {
+    perror("simAgent");
+    return 1;
+  }
+  printf("%s: listening on UDP port %d\n", name, port);
+  fflush(stdout);
+
+  for (;;) {
+    peerLength = sizeof(peer);
+    length = recvfrom(s, frame, sizeof(frame), 0, (struct sockaddr *)&peer,
+                      &peerLength);
+    if (length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("recvfrom");
+      return 1;
+    }
+    if (lossPercent && rand() % 100 < lossPercent) {
+      continue;
+    }
+
+    state = agent.state;
+    session = agent.session;
+    replyLength = updateHandleFrame(&agent, frame, length, address, reply);
+    if (replyLength) {
+      sendto(s, reply, replyLength, 0, (struct sockaddr *)&peer, peerLength);
+    }
+
+    if (agent.session != session || (agent.state == updateStateReceiving &&
+                                     state != updateStateReceiving)) {
+      printf("%s: session %08x started\n", name, (unsigned)agent.session);
+    }
+    if (agent.state == updateStateDone && state != updateStateDone) {
+      printf("%s: session %08x committed, status %u: %u sectors erased, "
+             "%u written, %u skipped, %lu bytes\n",
+             name, (unsigned)agent.session, agent.result.status,
+             agent.result.sectorsErased, agent.result.sectorsWritten,
+             agent.result.sectorsSkipped, agent.result.bytesWritten);
+      printf("%s: erase counts:", name);
+      for (i = 0; i < updateImageSize / updateSectorSize; i++) {
+        printf(" %lu", sim.sectorErases[i]);
+      }
+      printf("\n");
+      if (sim.fileName != NULL) {
+        saveFlash(&sim);
+      }
+    }
+    fflush(stdout);
+  }
+}
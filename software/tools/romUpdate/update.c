@@ -0,0 +1,363 @@
+/*
+Declaration ROM update protocol, agent side (see update.h)
+*/
+
+#include <string.h>
+
+#include "update.h"
+
+/* Declaration ROM format header block, at the end of the ROM */
+#define romHeaderSize 20
+#define romHeaderMagic 0x5a932bc7UL
+
+/* Offsets of format header block fields from the end of the ROM */
+enum {
+  romDirOffset = -20,   /* 4: offset to sResource directory (24-bit signed) */
+  romCRCLength = -16,   /* 4: number of bytes covered by the CRC */
+  romCRC = -12,         /* 4: CRC */
+  romRevision = -8,     /* 1: ROM revision */
+  romFormat = -7,       /* 1: ROM format */
+  romMagic = -6,        /* 4: romHeaderMagic */
+  romReservedZero = -2, /* 1: must be zero */
+  romByteLanes = -1     /* 1: byte lanes, high nibble is inverse of low */
+};
+
+static unsigned short get16(const volatile unsigned char *p) {
+  return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const volatile unsigned char *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put16(unsigned char *p, unsigned short value) {
+  p[0] = value >> 8;
+  p[1] = value;
+}
+
+static void put32(unsigned char *p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+void updateAgentInit(updateAgent *agent, updateFlash *flash,
+                     unsigned char *image, const unsigned char *key,
+                     unsigned int keyLength, const char *name) {
+  size_t nameLength;
+
+  memset(agent, 0, sizeof(*agent));
+  agent->flash = flash;
+  agent->image = image;
+  if (keyLength > updateMaxKey) {
+    keyLength = updateMaxKey;
+  }
+  memcpy(agent->key, key, keyLength);
+  agent->keyLength = keyLength;
+  /* NUL-padded, but not necessarily NUL-terminated */
+  nameLength = strlen(name);
+  memcpy(agent->name, name,
+         nameLength < updateNameLength ? nameLength : updateNameLength);
+  agent->state = updateStateIdle;
+}
+
+unsigned long updateChecksum(const volatile unsigned char *image,
+                             unsigned long length, unsigned long crcLength) {
+  unsigned long sum = 0;
+  unsigned long i;
+  unsigned char byte;
+
+  for (i = length - crcLength; i < length; i++) {
+    byte = (i >= length + romCRC && i < length + romCRC + 4) ? 0 : image[i];
+    sum = ((sum << 1) | ((sum >> 31) & 1)) & 0xffffffffUL;
+    sum = (sum + byte) & 0xffffffffUL;
+  }
+  return sum;
+}
+
+unsigned short updateCheckImage(const unsigned char *image,
+                                unsigned long length) {
+  const unsigned char *end = image + length;
+  long dirOffset;
+  unsigned long dirLocation;
+  unsigned long crcLength;
+  unsigned char lanes;
+
+  if (length < romHeaderSize) {
+    return updateStatusBadLength;
+  }
+  lanes = end[romByteLanes];
+  if (get32(end + romMagic) != romHeaderMagic || end[romReservedZero] != 0 ||
+      (lanes & 0x0f) != ((~lanes >> 4) & 0x0f)) {
+    return updateStatusBadHeader;
+  }
+
+  /* The directory offset is relative to the header block, and the CRC has to
+  cover everything from the directory to the end of the ROM */
+  dirOffset = get32(end + romDirOffset) & 0xffffff;
+  if (dirOffset & 0x800000) {
+    dirOffset -= 0x1000000;
+  }
+  if (dirOffset > 0 || (unsigned long)-dirOffset > length - romHeaderSize) {
+    return updateStatusBadHeader;
+  }
+  dirLocation = length - romHeaderSize + dirOffset;
+  crcLength = get32(end + romCRCLength);
+  if (dirLocation + crcLength != length) {
+    return updateStatusBadHeader;
+  }
+
+  if (updateChecksum(image, length, crcLength) != get32(end + romCRC)) {
+    return updateStatusBadCRC;
+  }
+  return updateStatusOK;
+}
+
+/* CRC field of the ROM in flash */
+static unsigned long flashCRC(const updateFlash *flash) {
+  const volatile unsigned char *end = flash->contents + flash->size;
+
+  if (get32(end + romMagic) != romHeaderMagic) {
+    return 0;
+  }
+  return get32(end + romCRC);
+}
+
+void updateProgram(updateFlash *flash, const unsigned char *image,
+                   unsigned long length, updateResult *result) {
+  const volatile unsigned char *current;
+  const unsigned char *wanted;
+  unsigned long offset, count, i, start;
+  int same, needErase;
+
+  memset(result, 0, sizeof(*result));
+
+  /* Sectors go in order, so the header block at the very end is written last:
+  if we're interrupted, the old CRC won't match and the Slot Manager will
+  ignore the card rather than run half an update */
+  for (offset = 0; offset < length; offset += updateSectorSize) {
+    current = flash->contents + offset;
+    wanted = image + offset;
+    count = length - offset < updateSectorSize ? length - offset
+                                               : updateSectorSize;
+
+    same = 1;
+    needErase = 0;
+    for (i = 0; i < count; i++) {
+      if (current[i] != wanted[i]) {
+        same = 0;
+        /* Programming can only clear bits */
+        if (wanted[i] & ~current[i]) {
+          needErase = 1;
+          break;
+        }
+      }
+    }
+    if (same) {
+      result->sectorsSkipped++;
+      continue;
+    }
+
+    if (needErase) {
+      if (flash->eraseSector(flash, offset) != 0) {
+        result->status = updateStatusFlashError;
+        return;
+      }
+      result->sectorsErased++;
+    }
+
+    /* Write runs of bytes that differ from what's there now */
+    i = 0;
+    while (i < count) {
+      if (current[i] == wanted[i]) {
+        i++;
+        continue;
+      }
+      start = i;
+      while (i < count && current[i] != wanted[i]) {
+        i++;
+      }
+      if (flash->write(flash, offset + start, wanted + start, i - start) !=
+          0) {
+        result->status = updateStatusFlashError;
+        return;
+      }
+      result->bytesWritten += i - start;
+    }
+    result->sectorsWritten++;
+
+    for (i = 0; i < count; i++) {
+      if (current[i] != wanted[i]) {
+        result->status = updateStatusFlashError;
+        return;
+      }
+    }
+  }
+  result->status = updateStatusOK;
+}
+
+/* Verify and (unless this is a dry run) program the received image */
+static void commit(updateAgent *agent, const unsigned char *signature) {
+  unsigned char digest[md5DigestLength];
+  unsigned char diff = 0;
+  int i;
+
+  memset(&agent->result, 0, sizeof(agent->result));
+  hmacMD5(agent->key, agent->keyLength, agent->image, updateImageSize,
+          digest);
+  for (i = 0; i < md5DigestLength; i++) {
+    diff |= digest[i] ^ signature[i];
+  }
+  if (diff) {
+    agent->result.status = updateStatusBadSignature;
+  } else {
+    agent->result.status = updateCheckImage(agent->image, updateImageSize);
+  }
+
+  if (agent->result.status == updateStatusOK &&
+      !(agent->flags & updateFlagVerifyOnly)) {
+    if (agent->flash == NULL || agent->flash->size != updateImageSize) {
+      agent->result.status = updateStatusNoFlash;
+    } else {
+      updateProgram(agent->flash, agent->image, updateImageSize,
+                    &agent->result);
+    }
+  }
+  if (agent->flash != NULL) {
+    agent->result.crc = flashCRC(agent->flash);
+  }
+  agent->state = updateStateDone;
+}
+
+size_t updateHandleFrame(updateAgent *agent, const unsigned char *frame,
+                         size_t length, const unsigned char address[6],
+                         unsigned char *reply) {
+  const unsigned char *header = frame + updateEthHeaderSize;
+  const unsigned char *payload = header + updateHeaderSize;
+  unsigned char *replyHeader = reply + updateEthHeaderSize;
+  unsigned char *replyPayload = replyHeader + updateHeaderSize;
+  unsigned char op;
+  uint32_t session, offset;
+  unsigned short payloadLength;
+  unsigned short status = updateStatusOK;
+  unsigned short replyLength = 0;
+
+  if (length < updateEthHeaderSize + updateHeaderSize ||
+      get16(frame + 12) != updateEthertype ||
+      get32(header + updateFieldMagic) != updateMagic ||
+      header[updateFieldVersion] != updateVersion) {
+    return 0;
+  }
+  op = header[updateFieldOp];
+  session = get32(header + updateFieldSession);
+  offset = get32(header + updateFieldOffset);
+  payloadLength = get16(header + updateFieldLength);
+  if (payloadLength > length - updateEthHeaderSize - updateHeaderSize) {
+    return 0;
+  }
+
+  memset(replyHeader, 0, updateHeaderSize);
+  switch (op) {
+    case updateOpDiscover:
+      op = updateOpHello;
+      memset(replyPayload, 0, updateHelloSize);
+      if (agent->flash != NULL) {
+        const volatile unsigned char *end =
+            agent->flash->contents + agent->flash->size;
+        replyPayload[updateHelloManufacturer] = agent->flash->manufacturer;
+        replyPayload[updateHelloDevice] = agent->flash->device;
+        if (get32(end + romMagic) == romHeaderMagic) {
+          replyPayload[updateHelloRevision] = end[romRevision];
+        }
+        put32(replyPayload + updateHelloCRC, flashCRC(agent->flash));
+      }
+      replyPayload[updateHelloState] = agent->state;
+      put32(replyPayload + updateHelloSession, agent->session);
+      put32(replyPayload + updateHelloReceived, agent->received);
+      memcpy(replyPayload + updateHelloName, agent->name, updateNameLength);
+      replyLength = updateHelloSize;
+      session = agent->session;
+      break;
+
+    case updateOpBegin:
+      op = updateOpAck;
+      if (agent->state == updateStateIdle || session != agent->session) {
+        /* New session. Anything we were doing for another server is
+        abandoned: the most recent BEGIN wins. */
+        if (offset != updateImageSize) {
+          status = updateStatusBadLength;
+          break;
+        }
+        agent->session = session;
+        agent->flags = get16(header + updateFieldFlags);
+        agent->received = 0;
+        agent->state = updateStateReceiving;
+        memcpy(agent->server, frame + 6, 6);
+      }
+      offset = agent->received;
+      break;
+
+    case updateOpData:
+      op = updateOpAck;
+      if (agent->state == updateStateIdle || session != agent->session) {
+        status = updateStatusBadSession;
+        break;
+      }
+      /* Only take data that carries on from what we have. Anything else is a
+      retransmission, or follows a lost frame; either way the ACK tells the
+      server where to carry on from. */
+      if (agent->state == updateStateReceiving && offset == agent->received &&
+          payloadLength <= updateImageSize - offset) {
+        memcpy(agent->image + offset, payload, payloadLength);
+        agent->received += payloadLength;
+      }
+      offset = agent->received;
+      break;
+
+    case updateOpCommit:
+      op = updateOpResult;
+      if (agent->state == updateStateIdle || session != agent->session) {
+        status = updateStatusBadSession;
+        break;
+      }
+      if (agent->state == updateStateReceiving) {
+        if (agent->received != updateImageSize) {
+          status = updateStatusBadLength;
+          break;
+        }
+        if (payloadLength < md5DigestLength) {
+          status = updateStatusBadSignature;
+          break;
+        }
+        commit(agent, payload);
+      }
+      /* Already committed: just send the result again */
+      status = agent->result.status;
+      put16(replyPayload + updateResultErased, agent->result.sectorsErased);
+      put16(replyPayload + updateResultWritten, agent->result.sectorsWritten);
+      put16(replyPayload + updateResultSkipped, agent->result.sectorsSkipped);
+      put16(replyPayload + updateResultSkipped + 2, 0);
+      put32(replyPayload + updateResultBytes, agent->result.bytesWritten);
+      put32(replyPayload + updateResultCRC, agent->result.crc);
+      replyLength = updateResultSize;
+      offset = agent->received;
+      break;
+
+    default:
+      return 0;
+  }
+
+  memcpy(reply, frame + 6, 6);
+  memcpy(reply + 6, address, 6);
+  put16(reply + 12, updateEthertype);
+  put32(replyHeader + updateFieldMagic, updateMagic);
+  replyHeader[updateFieldVersion] = updateVersion;
+  replyHeader[updateFieldOp] = op;
+  put16(replyHeader + updateFieldStatus, status);
+  put32(replyHeader + updateFieldSession, session);
+  put32(replyHeader + updateFieldOffset, offset);
+  put16(replyHeader + updateFieldLength, replyLength);
+  return updateEthHeaderSize + updateHeaderSize + replyLength;
+}
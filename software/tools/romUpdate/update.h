@@ -0,0 +1,204 @@
+/*
+Declaration ROM update protocol
+
+romServer pushes a ROM image to romAgent over raw ethernet frames with a private
+ethertype. Every frame the server sends gets exactly one reply, so the server
+drives the whole exchange and handles loss by resending:
+
+  DISCOVER  server -> agent (broadcast or unicast)
+  HELLO     agent -> server: flash ID, current ROM revision and CRC, state
+  BEGIN     server -> agent: new session, image length in offset
+  DATA      server -> agent: offset/length of a piece of the image
+  ACK       agent -> server: reply to BEGIN and DATA, offset is the number of
+            bytes received so far; the server carries on from there
+  COMMIT    server -> agent: HMAC-MD5 of the image under the shared key
+  RESULT    agent -> server: outcome of verifying and programming
+
+Sessions are chosen by the server. A BEGIN for the current session resumes it
+rather than starting over, and a COMMIT for a session that has already been
+committed just resends the result, so retries are always safe.
+
+This file and update.c are portable C with no Mac headers, so that simAgent can
+run the same code on Linux against a simulated flash device.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "md5.h"
+
+/* IEEE 802 local experimental ethertype */
+#define updateEthertype 0x88b6
+
+#define updateMagic 0x53457275UL /* 'SEru' */
+#define updateVersion 1
+
+/* Size of the declaration ROM window in slot space, which ROM images are padded
+out to (see gencrc.py --pad) */
+#define updateImageSize 65536UL
+
+/* Flash erase sector size (the SEthernet/30's SST39SF010A has 4K sectors) */
+#define updateSectorSize 4096UL
+
+/* Ethernet header, and the update header that follows it */
+#define updateEthHeaderSize 14
+#define updateHeaderSize 20
+
+/* Largest DATA payload, and largest frame either side sends */
+#define updateMaxPayload 1024
+#define updateMaxFrame (updateEthHeaderSize + updateHeaderSize + updateMaxPayload)
+
+/* Longest shared key */
+#define updateMaxKey 64
+
+/* Length of the name an agent reports in HELLO */
+#define updateNameLength 32
+
+/* Update header fields, as offsets from the end of the ethernet header. All
+multi-byte fields are big-endian. */
+enum {
+  updateFieldMagic = 0,    /* 4: updateMagic */
+  updateFieldVersion = 4,  /* 1: updateVersion */
+  updateFieldOp = 5,       /* 1: updateOpXXX */
+  updateFieldStatus = 6,   /* 2: updateStatusXXX (replies only) */
+  updateFieldSession = 8,  /* 4: session ID */
+  updateFieldOffset = 12,  /* 4: BEGIN: image length; DATA: offset of payload;
+                                 ACK: bytes received */
+  updateFieldLength = 16,  /* 2: payload length */
+  updateFieldFlags = 18    /* 2: BEGIN: updateFlagXXX */
+};
+
+/* Operations */
+enum {
+  updateOpDiscover = 1,
+  updateOpHello = 2,
+  updateOpBegin = 3,
+  updateOpData = 4,
+  updateOpAck = 5,
+  updateOpCommit = 6,
+  updateOpResult = 7
+};
+
+/* BEGIN flags */
+enum {
+  updateFlagVerifyOnly = 0x0001 /* Check the image and signature, but don't
+                                   program it */
+};
+
+/* Status codes */
+enum {
+  updateStatusOK = 0,
+  updateStatusBadSession = 1,   /* No such session (agent restarted?) */
+  updateStatusBadLength = 2,    /* Image is the wrong size, or incomplete */
+  updateStatusBadSignature = 3, /* HMAC doesn't match */
+  updateStatusBadHeader = 4,    /* Image doesn't end with a valid format
+                                   header block */
+  updateStatusBadCRC = 5,       /* Image CRC doesn't match its header */
+  updateStatusFlashError = 6,   /* Erase or write failed to verify */
+  updateStatusNoFlash = 7       /* No flash device to program */
+};
+
+/* HELLO payload, as offsets from the start of the payload */
+enum {
+  updateHelloManufacturer = 0, /* 1: JEDEC flash manufacturer ID */
+  updateHelloDevice = 1,       /* 1: JEDEC flash device ID */
+  updateHelloRevision = 2,     /* 1: revision of the ROM in flash */
+  updateHelloState = 3,        /* 1: updateStateXXX */
+  updateHelloCRC = 4,          /* 4: CRC of the ROM in flash */
+  updateHelloSession = 8,      /* 4: current session */
+  updateHelloReceived = 12,    /* 4: bytes received in current session */
+  updateHelloName = 16,        /* updateNameLength: agent's name, NUL-padded */
+  updateHelloSize = 16 + updateNameLength
+};
+
+/* RESULT payload */
+enum {
+  updateResultErased = 0,      /* 2: sectors erased */
+  updateResultWritten = 2,     /* 2: sectors written (erased or not) */
+  updateResultSkipped = 4,     /* 2: sectors already identical */
+  updateResultBytes = 8,       /* 4: bytes programmed */
+  updateResultCRC = 12,        /* 4: CRC of the ROM in flash afterwards */
+  updateResultSize = 16
+};
+
+/* Agent states */
+enum {
+  updateStateIdle = 0,      /* No session */
+  updateStateReceiving = 1, /* Receiving an image */
+  updateStateDone = 2       /* Session committed, result stored */
+};
+
+/* Flash device the agent programs. contents is where the device can be read;
+the erase and write routines return 0 on success. */
+typedef struct updateFlash {
+  const volatile unsigned char *contents;
+  unsigned long size;                /* Normally updateImageSize */
+  unsigned char manufacturer;        /* JEDEC IDs, for HELLO */
+  unsigned char device;
+  int (*eraseSector)(struct updateFlash *flash, unsigned long offset);
+  int (*write)(struct updateFlash *flash, unsigned long offset,
+               const unsigned char *data, unsigned int length);
+  void *context;
+} updateFlash;
+
+/* Outcome of a commit */
+typedef struct updateResult {
+  unsigned short status;            /* updateStatusXXX */
+  unsigned short sectorsErased;
+  unsigned short sectorsWritten;
+  unsigned short sectorsSkipped;
+  unsigned long bytesWritten;
+  unsigned long crc;                /* CRC of the ROM in flash afterwards */
+} updateResult;
+
+typedef struct updateAgent {
+  updateFlash *flash;               /* nil if there's nothing to program */
+  unsigned char *image;             /* updateImageSize receive buffer */
+  unsigned char key[updateMaxKey];
+  unsigned int keyLength;
+  char name[updateNameLength];      /* Reported in HELLO */
+
+  unsigned char state;              /* updateStateXXX */
+  unsigned short flags;             /* BEGIN flags for current session */
+  uint32_t session;
+  uint32_t received;                /* Bytes of image received */
+  unsigned char server[6];          /* Address of current session's server */
+  updateResult result;              /* Result of current session's commit */
+} updateAgent;
+
+/* Set up an agent. image must be updateImageSize bytes. */
+void updateAgentInit(updateAgent *agent, updateFlash *flash,
+                     unsigned char *image, const unsigned char *key,
+                     unsigned int keyLength, const char *name);
+
+/*
+Handle a received frame (starting with its ethernet header). If it calls for a
+reply, builds one in reply (updateMaxFrame bytes) with our address as its source
+and returns its length, otherwise returns 0.
+
+Programming the flash on COMMIT happens here, so this can take a few seconds.
+*/
+size_t updateHandleFrame(updateAgent *agent, const unsigned char *frame,
+                         size_t length, const unsigned char address[6],
+                         unsigned char *reply);
+
+/* Check that an image ends with a valid format header block with a matching
+CRC, the same checks as gencrc.py. Returns an updateStatusXXX code. */
+unsigned short updateCheckImage(const unsigned char *image,
+                                unsigned long length);
+
+/* Declaration ROM checksum (see gencrc.py) of the last crcLength bytes of
+image, treating the CRC field as zero */
+unsigned long updateChecksum(const volatile unsigned char *image,
+                             unsigned long length, unsigned long crcLength);
+
+/*
+Program image into flash, one sector at a time. Sectors that already hold the
+right data are skipped; a sector is only erased if some bit needs to go from 0
+to 1, and then only the bytes that differ from the erased state are written.
+Every sector written is read back afterwards.
+*/
+void updateProgram(updateFlash *flash, const unsigned char *image,
+                   unsigned long length, updateResult *result);
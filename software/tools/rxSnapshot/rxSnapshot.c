@@ -0,0 +1,318 @@
+/*
+Receive overflow snapshot viewer
+
+Turns on the driver's receive overflow snapshots (see ENCSetRxSnapshot in
+sethernet.h), and decodes the snapshot once an overflow has happened: the state
+of the receive buffer, every frame that was waiting in it, and a summary of who
+sent them.
+*/
+
+#include <Devices.h>
+#include <ENET.h>
+#include <Events.h>
+#include <MacTypes.h>
+#include <Memory.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "enc624j600.h"
+#include "enc624j600_registers.h"
+#include "sethernet.h"
+
+/* Number of sources and ethertypes to list in the summary */
+#define topCount 5
+
+/* A bit in a Receive Status Vector, numbered as in the datasheet (see
+RSV_BIT() in enc624j600.h) */
+#define rsvBit(rsv, bitnum) ((rsv)[(bitnum) >> 3] & (1 << ((bitnum) & 7)))
+
+typedef struct tally {
+  Byte key[6];             /* Source address, or ethertype in the first two */
+  unsigned short frames;
+  unsigned long bytes;
+} tally;
+
+static short enetRefNum;
+
+static OSErr setSnapshot(Boolean enable) {
+  CntrlParam pb;
+
+  memset(&pb, 0, sizeof(pb));
+  pb.ioCRefNum = enetRefNum;
+  pb.csCode = ENCSetRxSnapshot;
+  pb.csParam[0] = enable;
+  return PBControlSync((ParmBlkPtr)&pb);
+}
+
+static OSErr getSnapshot(rxSnapshot *snapshot) {
+  EParamBlock pb;
+
+  memset(&pb, 0, sizeof(pb));
+  pb.ioRefNum = enetRefNum;
+  pb.csCode = ENCGetRxSnapshot;
+  pb.u.EParms1.ePointer = (Ptr)snapshot;
+  pb.u.EParms1.eBuffSize = sizeof(rxSnapshot);
+  return PBControlSync((ParmBlkPtr)&pb);
+}
+
+static void printAddress(const Byte *addr) {
+  printf("%02x:%02x:%02x:%02x:%02x:%02x", addr[0], addr[1], addr[2], addr[3],
+         addr[4], addr[5]);
+}
+
+/* Frame length from the RSV, including FCS */
+static unsigned short frameLength(const rxSnapshotFrame *frame) {
+  return frame->rsv[0] | (frame->rsv[1] << 8);
+}
+
+/* Bytes of buffer between two addresses, allowing for wraparound */
+static unsigned short distance(const rxSnapshot *snapshot, unsigned short from,
+                               unsigned short to) {
+  if (to >= from) {
+    return to - from;
+  }
+  return (snapshot->rxEnd - from) + (to - snapshot->rxStart);
+}
+
+/* Add a frame to a table of tallies (if there is room for it) */
+static void count(tally *table, unsigned short *used, unsigned short size,
+                  const Byte *key, unsigned short keyLength,
+                  unsigned short bytes) {
+  unsigned short i;
+
+  for (i = 0; i < *used; i++) {
+    if (memcmp(table[i].key, key, keyLength) == 0) {
+      break;
+    }
+  }
+  if (i == *used) {
+    if (*used == size) {
+      return;
+    }
+    memset(table[i].key, 0, sizeof(table[i].key));
+    memcpy(table[i].key, key, keyLength);
+    table[i].frames = 0;
+    table[i].bytes = 0;
+    (*used)++;
+  }
+  table[i].frames++;
+  table[i].bytes += bytes;
+}
+
+/* Sort a table of tallies by frame count, biggest first */
+static void sortTallies(tally *table, unsigned short used) {
+  unsigned short i, j;
+  tally t;
+
+  for (i = 1; i < used; i++) {
+    t = table[i];
+    for (j = i; j > 0 && table[j - 1].frames < t.frames; j--) {
+      table[j] = table[j - 1];
+    }
+    table[j] = t;
+  }
+}
+
+static void showFrames(const rxSnapshot *snapshot) {
+  const rxSnapshotFrame *frame;
+  unsigned short i;
+
+  printf("\n  #  addr   len  cast  flags  destination        source             "
+         "type\n");
+  for (i = 0; i < snapshot->frameCount; i++) {
+    frame = &snapshot->frames[i];
+    printf("%3u  %04x  %4u  %-4s  %c%c%c%c   ", i, frame->address,
+           frameLength(frame),
+           rsvBit(frame->rsv, RSV_BIT_BROADCAST)   ? "bcst"
+           : rsvBit(frame->rsv, RSV_BIT_MULTICAST) ? "mcst"
+                                                   : "ucst",
+           rsvBit(frame->rsv, RSV_BIT_OK) ? '-' : '!',
+           rsvBit(frame->rsv, RSV_BIT_CRC_ERR) ? 'C' : '-',
+           rsvBit(frame->rsv, RSV_BIT_LENGTH_CHECK_ERR) ||
+                   rsvBit(frame->rsv, RSV_BIT_LENGTH_RANGE_ERR)
+               ? 'L'
+               : '-',
+           rsvBit(frame->rsv, RSV_BIT_PAUSE_FRAME) ? 'P' : '-');
+    printAddress(frame->dest);
+    printf("  ");
+    printAddress(frame->source);
+    if (frame->protocol <= 1500) {
+      printf("  802.3 (%u)\n", frame->protocol);
+    } else {
+      printf("  %04x\n", frame->protocol);
+    }
+  }
+}
+
+/* Who filled the buffer, and a guess at what to do about it */
+static void showSummary(const rxSnapshot *snapshot) {
+  tally sources[rxSnapshotMaxFrames];
+  tally types[rxSnapshotMaxFrames];
+  unsigned short numSources = 0, numTypes = 0;
+  unsigned short broadcasts = 0, multicasts = 0;
+  unsigned long bytes = 0;
+  const rxSnapshotFrame *frame;
+  unsigned short i, length, frames = snapshot->frameCount;
+  Byte type[2];
+
+  if (frames == 0) {
+    return;
+  }
+
+  for (i = 0; i < frames; i++) {
+    frame = &snapshot->frames[i];
+    length = frameLength(frame);
+    bytes += length;
+    if (rsvBit(frame->rsv, RSV_BIT_BROADCAST)) {
+      broadcasts++;
+    } else if (rsvBit(frame->rsv, RSV_BIT_MULTICAST)) {
+      multicasts++;
+    }
+    count(sources, &numSources, rxSnapshotMaxFrames, frame->source, 6, length);
+    type[0] = frame->protocol >> 8;
+    type[1] = frame->protocol & 0xff;
+    count(types, &numTypes, rxSnapshotMaxFrames, type, 2, length);
+  }
+  sortTallies(sources, numSources);
+  sortTallies(types, numTypes);
+
+  printf("\n%u frames, %lu bytes, average %lu bytes\n", frames, bytes,
+         bytes / frames);
+  printf("Broadcast: %u (%lu%%), multicast: %u (%lu%%)\n", broadcasts,
+         broadcasts * 100UL / frames, multicasts, multicasts * 100UL / frames);
+
+  printf("\nTop sources:\n");
+  for (i = 0; i < numSources && i < topCount; i++) {
+    printf("  ");
+    printAddress(sources[i].key);
+    printf("  %3u frames (%3lu%%)  %6lu bytes\n", sources[i].frames,
+           sources[i].frames * 100UL / frames, sources[i].bytes);
+  }
+
+  printf("\nTop types:\n");
+  for (i = 0; i < numTypes && i < topCount; i++) {
+    unsigned short type = (types[i].key[0] << 8) | types[i].key[1];
+    if (type <= 1500) {
+      printf("  802.3            ");
+    } else {
+      printf("  %04x             ", type);
+    }
+    printf("  %3u frames (%3lu%%)  %6lu bytes\n", types[i].frames,
+           types[i].frames * 100UL / frames, types[i].bytes);
+  }
+
+  printf("\nLikely cause: ");
+  if (snapshot->flags & (rxSnapshotSCSIDeferred | rxSnapshotBridgeStalled)) {
+    printf("receive was held up (see above), not the traffic itself.\n");
+  } else if ((broadcasts + multicasts) * 4 >= frames * 3) {
+    printf("a broadcast/multicast storm. Check multicast subscriptions, or "
+           "find the sender.\n");
+  } else if (sources[0].frames * 2 > frames) {
+    printf("one chatty host. Find out what it's sending.\n");
+  } else if (bytes / frames < 128) {
+    printf("lots of small frames; per-frame handler cost is the limit.\n");
+  } else {
+    printf("a burst of ordinary traffic that handlers didn't keep up with. A "
+           "bigger receive buffer or faster handlers would help.\n");
+  }
+}
+
+static void show(void) {
+  rxSnapshot *snapshot;
+  unsigned short size, waiting;
+  OSErr err;
+
+  snapshot = (rxSnapshot *)NewPtrClear(sizeof(rxSnapshot));
+  if (snapshot == nil) {
+    printf("Out of memory\n");
+    return;
+  }
+
+  err = getSnapshot(snapshot);
+  if (err != noErr) {
+    printf("Couldn't read snapshot: %d (are snapshots turned on?)\n", err);
+  } else if (!snapshot->valid) {
+    printf("No overflow since snapshots were turned on.\n");
+  } else {
+    size = snapshot->rxEnd - snapshot->rxStart;
+    printf("Overflow %lu seconds ago (%s), %lu more since\n",
+           (TickCount() - snapshot->ticks) / 60,
+           (snapshot->irqStatus & IRQ_PCNT_FULL) ? "frame counter full"
+                                                  : "buffer full",
+           snapshot->abortsSince);
+    printf("Buffer %04x-%04x (%u bytes), read %04x, head %04x, tail %04x\n",
+           snapshot->rxStart, snapshot->rxEnd, size, snapshot->rxRead,
+           snapshot->rxHead, snapshot->rxTail);
+    waiting = distance(snapshot, snapshot->rxRead, snapshot->rxHead);
+    printf("Pending: %u frames, %u bytes (%lu%% full), %u bytes between read "
+           "pointer and head\n",
+           snapshot->pendingFrames, snapshot->pendingBytes,
+           snapshot->pendingBytes * 100UL / size, waiting);
+    if (snapshot->flags & rxSnapshotSCSIDeferred) {
+      printf("Receive was deferred for a SCSI transaction\n");
+    }
+    if (snapshot->flags & rxSnapshotBridgeStalled) {
+      printf("Bridged receive was waiting for the other card\n");
+    }
+    if (snapshot->frameCount < snapshot->pendingFrames) {
+      printf("Only the first %u frames were recorded%s\n",
+             snapshot->frameCount,
+             (snapshot->flags & rxSnapshotBadChain)
+                 ? " (bad next-frame pointer)"
+                 : "");
+    }
+    showFrames(snapshot);
+    showSummary(snapshot);
+  }
+
+  DisposePtr((Ptr)snapshot);
+}
+
+static void help(void) {
+  printf("\n[A]rm, [S]how, [O]ff, [Q]uit?\n");
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  int choice;
+  OSErr err;
+
+  printf("**** SEthernet receive overflow snapshot ****\n\n");
+
+  err = OpenDriver("\p.ENET", &enetRefNum);
+  if (err != noErr) {
+    printf("Couldn't open .ENET: %d\n", err);
+    return 1;
+  }
+
+  help();
+  while (1) {
+    choice = toupper(getchar());
+    if (choice == '\r' || choice == '\n') {
+      continue;
+    }
+    if (choice == 'Q') {
+      return 0;
+    }
+    /* Eat the rest of the line */
+    while (getchar() != '\n') {}
+
+    if (choice == 'A') {
+      err = setSnapshot(true);
+      if (err == noErr) {
+        printf("Waiting for the next overflow\n");
+      } else {
+        printf("Couldn't turn on snapshots: %d\n", err);
+      }
+    } else if (choice == 'S') {
+      show();
+    } else if (choice == 'O') {
+      setSnapshot(false);
+      printf("Snapshots off\n");
+    }
+    help();
+  }
+}
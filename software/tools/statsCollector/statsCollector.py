@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+
+# Collect driver statistics from SEthernet cards using the stats-query protocol
+# (see software/driver/include/sethernet.h). Linux only (uses AF_PACKET sockets),
+# needs root or CAP_NET_RAW.
+
+import argparse
+import json
+import os
+import select
+import socket
+import struct
+import sys
+import time
+
+STATS_ETHERTYPE = 0x88b5
+STATS_MAGIC = 0x53457374
+STATS_VERSION = 2
+STATS_OP_QUERY = 1
+STATS_OP_REPLY = 2
+KEY_LENGTH = 8
+
+BROADCAST = b'\xff' * 6
+
+QUERY_FORMAT = '>LBBH8s'
+REPLY_FORMAT = '>LBBHLHH'
+
+# driverInfo layout that this collector understands (driverInfoVersion in
+# sethernet.h): the ethernet address and unused bytes, then these fields in
+# order. Keep in step with the driver.
+INFO_VERSION = 1
+INFO_FIELDS = [
+    'txFrameCount', 'singleCollisionFrames', 'multiCollisionFrames',
+    'collisionFrames', 'deferredFrames', 'lateCollisions',
+    'excessiveCollisions', 'excessiveDeferrals', 'internalTxErrors',
+    'rxFrameCount', 'multicastRxFrameCount', 'broadcastRxFrameCount',
+    'fcsErrors', 'alignmentErrors', 'internalRxErrors', 'rxPendingBytesHWM',
+    'rxPendingPacketsHWM', 'rxBadLength', 'rxRunt', 'rxTooLong', 'rxUnwanted',
+    'rxUnknownProto', 'statsQueries', 'statsReplies', 'statsRejected',
+    'statsDropped', 'bridgeForwarded', 'bridgeFlooded', 'bridgeFiltered',
+    'bridgeDropped', 'bridgeStalls', 'bridgeTxFrames', 'rxSelfDropped',
+    'txLoopback', 'copyReadKernel', 'copyWriteKernel',
+    'copyReadTimeBlockMove', 'copyReadTimeBytes', 'copyReadTimeWords',
+    'copyReadTimeLongs', 'copyReadTimeMovem',
+    'copyWriteTimeBlockMove', 'copyWriteTimeBytes', 'copyWriteTimeWords',
+    'copyWriteTimeLongs', 'copyWriteTimeMovem', 'duplexMismatch',
+    'duplexMismatchEvents', 'duplexRemediations', 'pauseRxFrames',
+    'pauseTxAsserts', 'rxBufferSize', 'tapFiltered', 'tapAccepted',
+    'scsiDeferrals', 'scsiDeferTimeouts', 'housekeepingRuns',
+    'housekeepingTimerRuns', 'missedLinkChanges', 'sramBytesTested',
+    'sramErrors', 'immediateWrites', 'immediateWritesRejected',
+    'txCompletedInDrain',
+]
+INFO_LENGTH = 18 + 4 * len(INFO_FIELDS)
+
+def parse_mac(s):
+    return bytes(int(x, 16) for x in s.split(':'))
+
+def format_mac(b):
+    return ':'.join('%02x' % x for x in b)
+
+def parse_key(s):
+    key = s.encode('ascii')
+    if len(key) > KEY_LENGTH:
+        raise argparse.ArgumentTypeError('key must be at most %d characters' % KEY_LENGTH)
+    return key.ljust(KEY_LENGTH, b'\0')
+
+def decode_info(data):
+    info = {'ethernetAddress': format_mac(data[0:6])}
+    for i, name in enumerate(INFO_FIELDS):
+        info[name], = struct.unpack_from('>L', data, 18 + 4 * i)
+    return info
+
+def decode_reply(frame, seq):
+    payload = frame[14:]
+    if len(payload) < struct.calcsize(REPLY_FORMAT):
+        return None
+    magic, version, op, reply_seq, ticks, info_version, info_length = \
+        struct.unpack_from(REPLY_FORMAT, payload)
+    if magic != STATS_MAGIC or version != STATS_VERSION or \
+       op != STATS_OP_REPLY or reply_seq != seq:
+        return None
+    reply = {'source': format_mac(frame[6:12]), 'ticks': ticks}
+    info = payload[struct.calcsize(REPLY_FORMAT):][:info_length]
+    if info_version != INFO_VERSION or info_length != INFO_LENGTH or \
+       len(info) != info_length:
+        # Field names would be attached to the wrong values
+        reply['error'] = ('driverInfo version %d (%d bytes) does not match '
+                          'this collector (version %d, %d bytes)' %
+                          (info_version, len(info), INFO_VERSION, INFO_LENGTH))
+        print('%s: %s' % (reply['source'], reply['error']), file=sys.stderr)
+        return reply
+    reply['info'] = decode_info(info)
+    return reply
+
+def query(sock, dest, key, seq, timeout):
+    src = sock.getsockname()[4]
+    payload = struct.pack(QUERY_FORMAT, STATS_MAGIC, STATS_VERSION,
+                          STATS_OP_QUERY, seq, key)
+    frame = dest + src + struct.pack('>H', STATS_ETHERTYPE) + payload
+    sock.send(frame.ljust(60, b'\0'))
+
+    replies = {}
+    deadline = time.monotonic() + timeout
+    while True:
+        remaining = deadline - time.monotonic()
+        if remaining <= 0:
+            break
+        ready, _, _ = select.select([sock], [], [], remaining)
+        if not ready:
+            break
+        reply = decode_reply(sock.recv(2048), seq)
+        if reply is not None:
+            replies[reply['source']] = reply
+    return list(replies.values())
+
+def main():
+    parser = argparse.ArgumentParser(description='Collect statistics from SEthernet cards.')
+    parser.add_argument('interface', help='Network interface to send queries on')
+    parser.add_argument('--key', '-k', type=parse_key, required=True, help='Stats-query key')
+    parser.add_argument('--dest', '-d', type=parse_mac, default=BROADCAST,
+                        help='Card to query (default: broadcast to all cards on the segment)')
+    parser.add_argument('--timeout', '-t', type=float, default=1.0,
+                        help='Time to wait for replies, in seconds')
+    parser.add_argument('--interval', '-i', type=float,
+                        help='Poll repeatedly at this interval, in seconds')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_PACKET, socket.SOCK_RAW, socket.htons(STATS_ETHERTYPE))
+    sock.bind((args.interface, STATS_ETHERTYPE))
+
+    seq = int.from_bytes(os.urandom(2), 'big')
+    while True:
+        for reply in query(sock, args.dest, args.key, seq, args.timeout):
+            reply['time'] = time.time()
+            print(json.dumps(reply), flush=True)
+        if args.interval is None:
+            break
+        seq = (seq + 1) & 0xffff
+        time.sleep(max(0, args.interval - args.timeout))
+
+if __name__ == '__main__':
+    sys.exit(main())